@@ -0,0 +1,267 @@
+#include "bench_corpus.h"
+#include "nginx_hosts.h"
+#include <glib/gstdio.h>
+#include <errno.h>
+
+static const gchar *words[] = {
+    "shop", "blog", "api", "mail", "static", "cdn", "app", "portal", "docs", "status",
+    "admin", "media", "auth", "git", "wiki", "forum", "billing", "search", "files", "chat",
+};
+static const gchar *tlds[] = { "com", "net", "org", "io", "de", "example" };
+
+static gchar* make_domain(GRand *rand, guint index) {
+    return g_strdup_printf("%s-%u.%s", words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))],
+                           index, tlds[g_rand_int_range(rand, 0, G_N_ELEMENTS(tlds))]);
+}
+
+static void add_domain(GPtrArray *domains, const gchar *domain) {
+    if (domains) g_ptr_array_add(domains, g_strdup(domain));
+}
+
+static void append_logs(GString *text, const gchar *domain) {
+    g_string_append_printf(text,
+        "    access_log /var/log/nginx/%s.access.log;\n"
+        "    error_log /var/log/nginx/%s.error.log warn;\n",
+        domain, domain);
+}
+
+void bench_corpus_append_vhost(GString *text, GRand *rand, guint index, GPtrArray *domains) {
+    gchar *domain = make_domain(rand, index);
+    gint kind = g_rand_int_range(rand, 0, 10);
+    
+    if (g_rand_int_range(rand, 0, 4) == 0) {
+        g_string_append_printf(text, "# %s, vhost %u\n", domain, index);
+    }
+    
+    if (kind < 3) {
+        // Static site
+        g_string_append_printf(text,
+            "server {\n"
+            "    listen 80;\n"
+            "    listen [::]:80;\n"
+            "    server_name %s www.%s;\n"
+            "    root /var/www/%s/public;\n"
+            "    index index.html index.htm;\n",
+            domain, domain, domain);
+        append_logs(text, domain);
+        g_string_append(text,
+            "    location / {\n"
+            "        try_files $uri $uri/ =404;\n"
+            "    }\n"
+            "    location ~* \\.(css|js|png|jpg|svg|woff2)$ {\n"
+            "        expires 30d;\n"
+            "        add_header Cache-Control \"public, immutable\";\n"
+            "    }\n"
+            "}\n\n");
+        add_domain(domains, domain);
+        gchar *www = g_strconcat("www.", domain, NULL);
+        add_domain(domains, www);
+        g_free(www);
+    } else if (kind < 6) {
+        // TLS with a redirect from plain HTTP
+        g_string_append_printf(text,
+            "server {\n"
+            "    listen 80;\n"
+            "    server_name %s;\n"
+            "    return 301 https://$host$request_uri;\n"
+            "}\n\n"
+            "server {\n"
+            "    listen 443 ssl http2;\n"
+            "    server_name %s;\n"
+            "    ssl_certificate /etc/letsencrypt/live/%s/fullchain.pem;\n"
+            "    ssl_certificate_key /etc/letsencrypt/live/%s/privkey.pem;\n"
+            "    ssl_protocols TLSv1.2 TLSv1.3;\n"
+            "    root /var/www/%s;\n",
+            domain, domain, domain, domain, domain);
+        append_logs(text, domain);
+        g_string_append(text,
+            "    location / {\n"
+            "        try_files $uri $uri/ /index.php?$query_string;\n"
+            "    }\n"
+            "    location ~ \\.php$ {\n"
+            "        include snippets/fastcgi-php.conf;\n"
+            "        fastcgi_pass unix:/run/php/php8.2-fpm.sock;\n"
+            "    }\n"
+            "}\n\n");
+        add_domain(domains, domain);
+    } else if (kind < 9) {
+        // Reverse proxy to a local application
+        g_string_append_printf(text,
+            "upstream app_%u {\n"
+            "    server 127.0.0.1:%u;\n"
+            "    server 127.0.0.1:%u backup;\n"
+            "    keepalive 16;\n"
+            "}\n\n"
+            "server {\n"
+            "    listen 80;\n"
+            "    server_name %s;\n"
+            "    client_max_body_size 20m;\n",
+            index, 3000 + index % 5000, 8000 + index % 1000, domain);
+        append_logs(text, domain);
+        g_string_append_printf(text,
+            "    location / {\n"
+            "        proxy_pass http://app_%u;\n"
+            "        proxy_http_version 1.1;\n"
+            "        proxy_set_header Host $host;\n"
+            "        proxy_set_header X-Real-IP $remote_addr;\n"
+            "        proxy_set_header X-Forwarded-For $proxy_add_x_forwarded_for;\n"
+            "        proxy_set_header Connection \"\";\n"
+            "    }\n"
+            "    location /healthz { return 200 \"ok\\n\"; }\n"
+            "}\n\n",
+            index);
+        add_domain(domains, domain);
+    } else {
+        // Wildcard tenant host
+        g_string_append_printf(text,
+            "server {\n"
+            "    listen 80;\n"
+            "    server_name %s *.%s;\n"
+            "    root /srv/tenants/$host;\n"
+            "    location / {\n"
+            "        if ($http_user_agent ~* \"(bot|crawler)\") {\n"
+            "            return 403;\n"
+            "        }\n"
+            "        try_files $uri =404;\n"
+            "    }\n"
+            "}\n\n",
+            domain, domain);
+        add_domain(domains, domain);
+    }
+    g_free(domain);
+}
+
+BenchCorpus* bench_corpus_generate(const gchar *root, guint n_vhosts, guint32 seed, GError **error) {
+    BenchCorpus *corpus = g_new0(BenchCorpus, 1);
+    corpus->root = g_strdup(root);
+    corpus->main_conf = g_build_filename(root, "nginx.conf", NULL);
+    corpus->conf_dir = g_build_filename(root, "conf.d", NULL);
+    corpus->n_vhosts = n_vhosts;
+    corpus->files = g_ptr_array_new_with_free_func(g_free);
+    corpus->domains = g_ptr_array_new_with_free_func(g_free);
+    
+    if (g_mkdir_with_parents(corpus->conf_dir, 0755) != 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "%s: %s", corpus->conf_dir, g_strerror(errno));
+        bench_corpus_free(corpus);
+        return NULL;
+    }
+    
+    const gchar *main_text =
+        "user www-data;\n"
+        "worker_processes auto;\n"
+        "events {\n"
+        "    worker_connections 1024;\n"
+        "}\n"
+        "http {\n"
+        "    sendfile on;\n"
+        "    include conf.d/*.conf;\n"
+        "}\n";
+    if (!g_file_set_contents(corpus->main_conf, main_text, -1, error)) {
+        bench_corpus_free(corpus);
+        return NULL;
+    }
+    
+    GRand *rand = g_rand_new_with_seed(seed);
+    guint n_files = MAX(1, MIN(n_vhosts, BENCH_CORPUS_MAX_FILES));
+    GString *text = g_string_new(NULL);
+    guint next = 0;
+    gboolean ok = TRUE;
+    for (guint f = 0; f < n_files && ok; f++) {
+        guint end = (guint)((guint64)n_vhosts * (f + 1) / n_files);
+        g_string_truncate(text, 0);
+        for (; next < end; next++) {
+            bench_corpus_append_vhost(text, rand, next, corpus->domains);
+        }
+        gchar *name = g_strdup_printf("site-%05u.conf", f);
+        gchar *path = g_build_filename(corpus->conf_dir, name, NULL);
+        g_free(name);
+        ok = g_file_set_contents(path, text->str, text->len, error);
+        g_ptr_array_add(corpus->files, path);
+        corpus->bytes += text->len;
+    }
+    g_string_free(text, TRUE);
+    g_rand_free(rand);
+    
+    if (!ok) {
+        bench_corpus_remove(corpus);
+        bench_corpus_free(corpus);
+        return NULL;
+    }
+    return corpus;
+}
+
+void bench_corpus_remove(BenchCorpus *corpus) {
+    for (guint i = 0; i < corpus->files->len; i++) {
+        g_unlink(g_ptr_array_index(corpus->files, i));
+    }
+    g_rmdir(corpus->conf_dir);
+    g_unlink(corpus->main_conf);
+    g_rmdir(corpus->root);
+}
+
+void bench_corpus_free(BenchCorpus *corpus) {
+    if (!corpus) return;
+    g_ptr_array_unref(corpus->domains);
+    g_ptr_array_unref(corpus->files);
+    g_free(corpus->conf_dir);
+    g_free(corpus->main_conf);
+    g_free(corpus->root);
+    g_free(corpus);
+}
+
+GPtrArray* bench_hosts_generate(const gchar *path, guint n_lines, guint32 seed, GError **error) {
+    GRand *rand = g_rand_new_with_seed(seed);
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    GString *text = g_string_sized_new((gsize)n_lines * 40);
+    g_string_append(text,
+        "127.0.0.1\tlocalhost\n"
+        "127.0.1.1\tworkstation.lan workstation\n"
+        "\n"
+        "# The following lines are desirable for IPv6 capable hosts\n"
+        "::1     ip6-localhost ip6-loopback\n"
+        "ff02::1 ip6-allnodes\n"
+        "ff02::2 ip6-allrouters\n");
+    guint lines = 7;
+    
+    // The managed block takes the last tenth of the file
+    guint managed_from = n_lines - n_lines / 10;
+    gboolean in_block = FALSE;
+    for (guint i = 0; lines < n_lines; i++, lines++) {
+        if (!in_block && lines >= managed_from && lines + 2 < n_lines) {
+            g_string_append(text, HOSTS_BLOCK_BEGIN "\n");
+            in_block = TRUE;
+            continue;
+        }
+        if (in_block && lines + 1 == n_lines) {
+            g_string_append(text, HOSTS_BLOCK_END "\n");
+            break;
+        }
+        
+        gchar *name = make_domain(rand, i);
+        if (in_block) {
+            g_string_append_printf(text, HOSTS_MANAGED_ADDRESS " %s\n", name);
+        } else if (g_rand_int_range(rand, 0, 50) == 0) {
+            g_string_append_printf(text, "# %s moved to the new cluster\n", name);
+            g_free(name);
+            continue;
+        } else if (g_rand_int_range(rand, 0, 8) == 0) {
+            g_string_append_printf(text, "fd00::%x\t%s\n", i & 0xffff, name);
+        } else {
+            gchar *alias = g_strconcat("www.", name, NULL);
+            g_string_append_printf(text, "10.%u.%u.%u\t%s %s\n",
+                                   (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff, name, alias);
+            g_ptr_array_add(names, alias);
+        }
+        g_ptr_array_add(names, name);
+    }
+    g_rand_free(rand);
+    
+    gboolean ok = g_file_set_contents(path, text->str, text->len, error);
+    g_string_free(text, TRUE);
+    if (!ok) {
+        g_ptr_array_unref(names);
+        return NULL;
+    }
+    return names;
+}
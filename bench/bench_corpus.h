@@ -0,0 +1,36 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <glib.h>
+
+// Synthetic but realistic inputs for the benchmarks. Everything is derived
+// from the seed, so two runs with the same arguments see the same bytes.
+
+// Vhosts are spread over at most this many files, as on a large host
+#define BENCH_CORPUS_MAX_FILES 2000
+
+// A conf.d tree next to an nginx.conf that includes it
+typedef struct {
+    gchar *root;
+    gchar *main_conf;
+    gchar *conf_dir;
+    guint n_vhosts;
+    GPtrArray *files;       // paths of the generated .conf files
+    GPtrArray *domains;     // every server_name written, in order
+    guint64 bytes;
+} BenchCorpus;
+
+BenchCorpus* bench_corpus_generate(const gchar *root, guint n_vhosts, guint32 seed, GError **error);
+// Removes the generated files and directories
+void bench_corpus_remove(BenchCorpus *corpus);
+void bench_corpus_free(BenchCorpus *corpus);
+
+// Appends one vhost (sometimes two server blocks and an upstream) to text
+// and its server_names to domains when not NULL
+void bench_corpus_append_vhost(GString *text, GRand *rand, guint index, GPtrArray *domains);
+
+// An /etc/hosts with n_lines lines: comments, IPv4 and IPv6 entries with
+// aliases, and an nginxui managed block. Returns the hostnames written.
+GPtrArray* bench_hosts_generate(const gchar *path, guint n_lines, guint32 seed, GError **error);
+
+#endif // BENCH_CORPUS_H
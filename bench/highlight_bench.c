@@ -0,0 +1,111 @@
+// Keystroke latency benchmark for the incremental highlighter.
+//
+// Builds synthetic configs of increasing size, highlights them once, then
+// simulates typing in the middle of the file. A keystroke should only
+// re-lex the edited line, so its latency must stay flat as files grow,
+// while a full rescan grows linearly with file size.
+
+#include "nginx_highlight.h"
+#include <stdio.h>
+#include <string.h>
+
+#define KEYSTROKES 2000
+
+typedef struct {
+    GPtrArray *lines;
+    guint64 tokens;
+} Document;
+
+static void count_token(HighlightTokenKind kind, gsize start, gsize end, gpointer user_data) {
+    (void)kind; (void)start; (void)end; // Unused parameters
+    ((Document *)user_data)->tokens++;
+}
+
+static guint8 lex_document_line(guint line, guint8 state_in, gpointer user_data) {
+    Document *doc = user_data;
+    GString *text = g_ptr_array_index(doc->lines, line);
+    return highlight_lex_line(text->str, text->len, state_in, count_token, doc);
+}
+
+static void free_line(gpointer line) {
+    g_string_free(line, TRUE);
+}
+
+static Document* generate_document(guint n_lines) {
+    static const gchar *templates[] = {
+        "server {",
+        "    listen 80;",
+        "    server_name host%u.example.com www.host%u.example.com;",
+        "    # generated upstream entry %u",
+        "    location /api/v%u/ {",
+        "        proxy_pass http://10.0.%u.1:8080;",
+        "        proxy_set_header Host \"$host\";",
+        "    }",
+        "}",
+    };
+    Document *doc = g_new0(Document, 1);
+    doc->lines = g_ptr_array_new_with_free_func(free_line);
+    for (guint i = 0; i < n_lines; i++) {
+        GString *line = g_string_new(NULL);
+        const gchar *tmpl = templates[i % G_N_ELEMENTS(templates)];
+        g_string_printf(line, tmpl, i, i);
+        g_ptr_array_add(doc->lines, line);
+    }
+    return doc;
+}
+
+static void free_document(Document *doc) {
+    g_ptr_array_unref(doc->lines);
+    g_free(doc);
+}
+
+static int compare_gint64(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+int main(void) {
+    const guint sizes[] = { 1000, 5000, 20000, 100000 };
+
+    printf("%10s %14s %14s %14s %12s\n",
+           "lines", "full (us)", "key p50 (us)", "key p99 (us)", "relexed/key");
+
+    for (gsize s = 0; s < G_N_ELEMENTS(sizes); s++) {
+        Document *doc = generate_document(sizes[s]);
+        HighlightState *state = highlight_state_new();
+
+        // Initial highlight, equivalent to the old full-buffer rescan
+        highlight_state_reset(state, doc->lines->len);
+        gint64 t0 = g_get_monotonic_time();
+        highlight_state_relex(state, doc->lines->len, lex_document_line, doc);
+        gint64 full_us = g_get_monotonic_time() - t0;
+
+        gint64 *samples = g_new(gint64, KEYSTROKES);
+        guint64 relexed = 0;
+        guint target = doc->lines->len / 2 + 2; // a server_name line
+        for (guint k = 0; k < KEYSTROKES; k++) {
+            GString *line = g_ptr_array_index(doc->lines, target);
+            if (k % 2 == 0) {
+                g_string_insert(line, 4, "x");
+            } else {
+                g_string_erase(line, 4, 1);
+            }
+
+            gint64 start = g_get_monotonic_time();
+            highlight_state_insert_lines(state, target, 0);
+            relexed += highlight_state_relex(state, doc->lines->len, lex_document_line, doc);
+            samples[k] = g_get_monotonic_time() - start;
+        }
+        qsort(samples, KEYSTROKES, sizeof(gint64), compare_gint64);
+
+        printf("%10u %14" G_GINT64_FORMAT " %14" G_GINT64_FORMAT " %14" G_GINT64_FORMAT " %12.1f\n",
+               sizes[s], full_us, samples[KEYSTROKES / 2], samples[KEYSTROKES * 99 / 100],
+               (double)relexed / KEYSTROKES);
+
+        g_free(samples);
+        highlight_state_free(state);
+        free_document(doc);
+    }
+
+    return 0;
+}
@@ -0,0 +1,816 @@
+// Benchmark suite for the hot paths of nginxui.
+//
+// Generates conf.d trees of 10 to 100k vhosts and hosts files of up to 1M
+// lines, then times each routine with warmup runs, repeated samples and
+// percentile reporting. With --output the results are also written as
+// JSON, one object per routine and corpus, so releases can be compared.
+
+#include "bench_corpus.h"
+#include "nginx_core.h"
+#include "nginx_events.h"
+#include "nginx_fuzzy.h"
+#include "nginx_highlight.h"
+#include "nginx_history.h"
+#include "nginx_pool.h"
+#include "nginx_search.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef NGINXUI_VERSION
+#define NGINXUI_VERSION "unknown"
+#endif
+
+#define DEFAULT_SIZES "10,100,1000,10000,100000"
+#define DEFAULT_HOSTS_LINES "1000,100000,1000000"
+#define DEFAULT_WARMUP 2
+#define DEFAULT_REPETITIONS 15
+#define DEFAULT_SEED 20240601
+// Keystroke samples are cheap, so each repetition takes this many
+#define KEYSTROKES_PER_REPETITION 100
+#define LOOKUPS_PER_SAMPLE 1000
+// Work items pushed per pool_roundtrip sample
+#define POOL_ITEMS_PER_SAMPLE 10000
+// Bulk items queued ahead of each pool_interactive sample, and their cost
+#define POOL_BULK_BACKLOG 64
+#define POOL_BULK_ITEM_US 500
+// Threads and events per thread of each events_flood sample
+#define EVENT_PRODUCERS 4
+#define EVENTS_PER_PRODUCER 25000
+
+typedef void (*BenchFunc)(gpointer user_data);
+
+typedef struct {
+    gchar *name;
+    gchar *corpus;
+    guint64 items;          // work items per sample: vhosts, lines, lookups...
+    guint64 bytes;          // input bytes per sample, 0 when not meaningful
+    GArray *samples;        // gint64 nanoseconds, sorted
+} BenchResult;
+
+typedef struct {
+    gint warmup;
+    gint repetitions;
+    const gchar *filter;
+    GPtrArray *results;
+} Bench;
+
+static gint64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_result_free(gpointer data) {
+    BenchResult *result = data;
+    g_array_unref(result->samples);
+    g_free(result->corpus);
+    g_free(result->name);
+    g_free(result);
+}
+
+// Nearest-rank percentile of the sorted samples, in microseconds
+static double percentile_us(const BenchResult *result, guint percent) {
+    guint n = result->samples->len;
+    guint rank = (guint)(((guint64)percent * n + 99) / 100);
+    guint index = CLAMP(rank, 1, n) - 1;
+    return g_array_index(result->samples, gint64, index) / 1e3;
+}
+
+static double mean_us(const BenchResult *result) {
+    double sum = 0;
+    for (guint i = 0; i < result->samples->len; i++) {
+        sum += g_array_index(result->samples, gint64, i);
+    }
+    return sum / result->samples->len / 1e3;
+}
+
+static gboolean bench_wants(Bench *bench, const gchar *name) {
+    return !bench->filter || strstr(name, bench->filter) != NULL;
+}
+
+// Runs func warmup times untimed, then n_samples timed
+static void bench_measure(Bench *bench, const gchar *name, const gchar *corpus, guint64 items,
+                          guint64 bytes, guint n_samples, BenchFunc func, gpointer user_data) {
+    for (gint i = 0; i < bench->warmup; i++) {
+        func(user_data);
+    }
+    
+    BenchResult *result = g_new0(BenchResult, 1);
+    result->name = g_strdup(name);
+    result->corpus = g_strdup(corpus);
+    result->items = items;
+    result->bytes = bytes;
+    result->samples = g_array_sized_new(FALSE, FALSE, sizeof(gint64), n_samples);
+    for (guint i = 0; i < n_samples; i++) {
+        gint64 start = now_ns();
+        func(user_data);
+        gint64 elapsed = now_ns() - start;
+        g_array_append_val(result->samples, elapsed);
+    }
+    g_array_sort(result->samples, compare_gint64);
+    g_ptr_array_add(bench->results, result);
+    
+    double p50 = percentile_us(result, 50);
+    printf("%-20s %-16s %12.1f %12.1f %12.1f %12.1f %14.0f\n",
+           name, corpus, p50, percentile_us(result, 90), percentile_us(result, 99),
+           percentile_us(result, 100), p50 > 0 ? items / (p50 / 1e6) : 0);
+    fflush(stdout);
+}
+
+// Routines on a conf.d corpus
+
+typedef struct {
+    BenchCorpus *corpus;
+    GPtrArray *contents;        // text of each file
+    GPtrArray *lines;           // the whole corpus as one buffer, one GString per line
+    HighlightState *highlight;
+    guint keystroke;
+    GPtrArray *file_names;      // FuzzyEntry per vhost, as if each had its own file
+    gint32 *scores;
+    SearchIndex *search;        // every file of the corpus, for queries and updates
+    gchar *history_dir;
+    HistoryStore *history;      // one revision of every file, then the saves of one
+    guint history_saves;
+    RouteTable *routes;         // every server of the corpus
+    GPtrArray *route_hosts;     // hosts of the lookups, some of them unknown
+    NginxCore *core;            // rooted at the corpus's nginx.conf
+    gchar *meta_path;           // metadata cache of the corpus, all entries fresh
+} ConfData;
+
+static void run_extract_domains(gpointer user_data) {
+    ConfData *data = user_data;
+    for (guint i = 0; i < data->contents->len; i++) {
+        g_strfreev(extract_domains_from_config(g_ptr_array_index(data->contents, i)));
+    }
+}
+
+static void run_list_configs(gpointer user_data) {
+    ConfData *data = user_data;
+    GPtrArray *names = nginx_core_list_configs(data->corpus->conf_dir, NULL);
+    g_assert(names && names->len == data->corpus->files->len);
+    g_ptr_array_unref(names);
+}
+
+// One keystroke in the file filter: every name is scored
+static void run_fuzzy_filter(gpointer user_data) {
+    ConfData *data = user_data;
+    FuzzyPattern *pattern = fuzzy_pattern_new("shp1c");
+    fuzzy_score_entries(pattern, data->file_names, NULL, data->scores, NULL);
+    fuzzy_pattern_free(pattern);
+}
+
+// Indexes the corpus from scratch, as on a first start
+static void run_search_build(gpointer user_data) {
+    ConfData *data = user_data;
+    SearchIndex *index = search_index_new();
+    for (guint i = 0; i < data->corpus->files->len; i++) {
+        search_index_refresh_file(index, g_ptr_array_index(data->corpus->files, i));
+    }
+    search_index_free(index);
+}
+
+// Where is this vhost defined
+static void run_search_query(gpointer user_data) {
+    ConfData *data = user_data;
+    const gchar *domain = g_ptr_array_index(data->corpus->domains, data->corpus->domains->len / 2);
+    GPtrArray *hits = search_index_query(data->search, domain, SEARCH_MAX_HITS);
+    g_assert(hits->len > 0);
+    g_ptr_array_unref(hits);
+}
+
+// Saving a file in the middle of the tree replaces its postings in place
+static void run_search_update(gpointer user_data) {
+    ConfData *data = user_data;
+    guint middle = data->contents->len / 2;
+    const gchar *content = g_ptr_array_index(data->contents, middle);
+    search_index_update_file(data->search, g_ptr_array_index(data->corpus->files, middle),
+                             content, strlen(content));
+}
+
+// Saving an edit of a file in the middle of the tree: only the chunks
+// around the edit are new
+static void run_history_save(gpointer user_data) {
+    ConfData *data = user_data;
+    guint middle = data->contents->len / 2;
+    gchar *content = g_strdup_printf("%s# revision %u\n", (const gchar *)g_ptr_array_index(data->contents, middle),
+                                     data->history_saves++);
+    guint id = history_store_record(data->history, g_ptr_array_index(data->corpus->files, middle),
+                                    content, strlen(content), NULL);
+    g_assert(id > 0);
+    g_free(content);
+}
+
+static void run_history_list(gpointer user_data) {
+    ConfData *data = user_data;
+    GPtrArray *revisions = history_store_list(data->history,
+                                              g_ptr_array_index(data->corpus->files, data->contents->len / 2));
+    g_assert(revisions->len > 0);
+    g_ptr_array_unref(revisions);
+}
+
+// Restores the oldest revision of the file the saves went to
+static void run_history_restore(gpointer user_data) {
+    ConfData *data = user_data;
+    GPtrArray *revisions = history_store_list(data->history,
+                                              g_ptr_array_index(data->corpus->files, data->contents->len / 2));
+    const HistoryRevision *oldest = g_ptr_array_index(revisions, revisions->len - 1);
+    gchar *content = history_store_read(data->history, oldest->id, NULL, NULL);
+    g_assert(content);
+    g_free(content);
+    g_ptr_array_unref(revisions);
+}
+
+// Compiles the server and location matchers of the whole corpus
+static RouteTable* build_routes(ConfData *data) {
+    RouteTable *table = route_table_new();
+    for (guint i = 0; i < data->contents->len; i++) {
+        const gchar *content = g_ptr_array_index(data->contents, i);
+        ConfDocument *doc = conf_document_parse(content, strlen(content));
+        route_table_add_document(table, g_ptr_array_index(data->corpus->files, i), doc);
+        conf_document_free(doc);
+    }
+    return table;
+}
+
+static void run_route_build(gpointer user_data) {
+    RouteTable *table = build_routes(user_data);
+    g_assert(route_table_get_n_servers(table) > 0);
+    route_table_free(table);
+}
+
+static void run_route_lookup(gpointer user_data) {
+    ConfData *data = user_data;
+    static const gchar *uris[] = { "/", "/index.php?page=2", "/static/app.js", "/api/v1/users/42", "/.env" };
+    guint found = 0;
+    for (guint i = 0; i < data->route_hosts->len; i++) {
+        RouteResult result;
+        route_table_lookup(data->routes, g_ptr_array_index(data->route_hosts, i), ROUTE_DEFAULT_PORT,
+                           uris[i % G_N_ELEMENTS(uris)], &result);
+        found += result.location != NULL;
+    }
+    g_assert(found > 0);
+}
+
+// Conflict index built by parsing every included file, as a start
+// without the metadata cache does
+static void run_conflicts_cold(gpointer user_data) {
+    ConfData *data = user_data;
+    include_graph_free(data->core->includes);
+    data->core->includes = include_graph_new(data->corpus->main_conf);
+    nginx_core_index_conflicts(data->core);
+}
+
+// What the first frame waits for with the cache
+static void run_meta_load(gpointer user_data) {
+    ConfData *data = user_data;
+    gboolean loaded = nginx_core_load_metadata(data->core, data->meta_path);
+    g_assert(loaded);
+}
+
+// The background check when nothing changed
+static void run_meta_refresh(gpointer user_data) {
+    ConfData *data = user_data;
+    MetadataRefresh *refresh = nginx_core_refresh_metadata(data->core);
+    g_assert(!refresh->error && refresh->summaries->len == 0);
+    metadata_refresh_free(refresh);
+}
+
+static void ignore_token(HighlightTokenKind kind, gsize start, gsize end, gpointer user_data) {
+    (void)kind; (void)start; (void)end; (void)user_data; // Unused parameters
+}
+
+static guint8 lex_corpus_line(guint line, guint8 state_in, gpointer user_data) {
+    ConfData *data = user_data;
+    GString *text = g_ptr_array_index(data->lines, line);
+    return highlight_lex_line(text->str, text->len, state_in, ignore_token, NULL);
+}
+
+static void run_highlight_full(gpointer user_data) {
+    ConfData *data = user_data;
+    highlight_state_reset(data->highlight, data->lines->len);
+    highlight_state_relex(data->highlight, data->lines->len, lex_corpus_line, data);
+}
+
+// Types or deletes one character in the middle of the buffer, which
+// should only re-lex that line however large the buffer is
+static void run_highlight_keystroke(gpointer user_data) {
+    ConfData *data = user_data;
+    guint target = data->lines->len / 2;
+    GString *line = g_ptr_array_index(data->lines, target);
+    if (data->keystroke++ % 2 == 0) {
+        g_string_insert_c(line, 0, 'x');
+    } else {
+        g_string_erase(line, 0, 1);
+    }
+    highlight_state_mark_dirty(data->highlight, target, target);
+    highlight_state_relex(data->highlight, data->lines->len, lex_corpus_line, data);
+}
+
+static void free_line(gpointer line) {
+    g_string_free(line, TRUE);
+}
+
+static gboolean bench_conf_corpus(Bench *bench, const gchar *root, guint n_vhosts, guint32 seed, GError **error) {
+    gchar *dir = g_strdup_printf("%s/vhosts-%u", root, n_vhosts);
+    BenchCorpus *corpus = bench_corpus_generate(dir, n_vhosts, seed, error);
+    g_free(dir);
+    if (!corpus) return FALSE;
+    
+    ConfData data = { corpus, g_ptr_array_new_with_free_func(g_free),
+                      g_ptr_array_new_with_free_func(free_line), highlight_state_new(), 0,
+                      g_ptr_array_new_with_free_func((GDestroyNotify)fuzzy_entry_unref), NULL, NULL,
+                      NULL, NULL, 0, NULL, NULL, NULL, NULL };
+    for (guint i = 0; i < corpus->domains->len; i++) {
+        gchar *name = g_strconcat(g_ptr_array_index(corpus->domains, i), ".conf", NULL);
+        g_ptr_array_add(data.file_names, fuzzy_entry_new(name));
+        g_free(name);
+    }
+    data.scores = g_new(gint32, data.file_names->len);
+    GString *all = g_string_sized_new(corpus->bytes);
+    for (guint i = 0; i < corpus->files->len; i++) {
+        gchar *content = NULL;
+        if (!g_file_get_contents(g_ptr_array_index(corpus->files, i), &content, NULL, error)) break;
+        g_ptr_array_add(data.contents, content);
+        g_string_append(all, content);
+    }
+    gchar **lines = g_strsplit(all->str, "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+        g_ptr_array_add(data.lines, g_string_new(lines[i]));
+    }
+    g_strfreev(lines);
+    g_string_free(all, TRUE);
+    
+    gboolean ok = data.contents->len == corpus->files->len;
+    if (ok) {
+        gchar *label = g_strdup_printf("vhosts=%u", n_vhosts);
+        guint reps = bench->repetitions;
+        if (bench_wants(bench, "extract_domains")) {
+            bench_measure(bench, "extract_domains", label, n_vhosts, corpus->bytes, reps,
+                          run_extract_domains, &data);
+        }
+        if (bench_wants(bench, "list_configs")) {
+            bench_measure(bench, "list_configs", label, corpus->files->len, 0, reps,
+                          run_list_configs, &data);
+        }
+        if (bench_wants(bench, "fuzzy_filter")) {
+            bench_measure(bench, "fuzzy_filter", label, data.file_names->len, 0, reps,
+                          run_fuzzy_filter, &data);
+        }
+        if (bench_wants(bench, "search_build")) {
+            bench_measure(bench, "search_build", label, corpus->files->len, corpus->bytes, reps,
+                          run_search_build, &data);
+        }
+        if (bench_wants(bench, "search_query") || bench_wants(bench, "search_update")) {
+            data.search = search_index_new();
+            for (guint i = 0; i < corpus->files->len; i++) {
+                search_index_refresh_file(data.search, g_ptr_array_index(corpus->files, i));
+            }
+        }
+        if (bench_wants(bench, "search_query")) {
+            bench_measure(bench, "search_query", label, 1, 0, reps, run_search_query, &data);
+        }
+        if (bench_wants(bench, "search_update")) {
+            bench_measure(bench, "search_update", label, 1, 0, reps, run_search_update, &data);
+        }
+        if (bench_wants(bench, "history_save") || bench_wants(bench, "history_list") ||
+            bench_wants(bench, "history_restore")) {
+            data.history_dir = g_strdup_printf("%s/history-%u", root, n_vhosts);
+            data.history = history_store_open(data.history_dir, error);
+            for (guint i = 0; data.history && i < corpus->files->len; i++) {
+                const gchar *content = g_ptr_array_index(data.contents, i);
+                history_store_record(data.history, g_ptr_array_index(corpus->files, i),
+                                     content, strlen(content), NULL);
+            }
+            ok = data.history != NULL;
+        }
+        if (data.history && bench_wants(bench, "history_save")) {
+            bench_measure(bench, "history_save", label, 1, 0, reps, run_history_save, &data);
+        }
+        if (data.history && bench_wants(bench, "history_list")) {
+            bench_measure(bench, "history_list", label, 1, 0, reps, run_history_list, &data);
+        }
+        if (data.history && bench_wants(bench, "history_restore")) {
+            // At least one save, so the oldest revision is not the newest
+            run_history_save(&data);
+            bench_measure(bench, "history_restore", label, 1, 0, reps, run_history_restore, &data);
+        }
+        if (bench_wants(bench, "route_build")) {
+            bench_measure(bench, "route_build", label, n_vhosts, corpus->bytes, reps,
+                          run_route_build, &data);
+        }
+        if (bench_wants(bench, "route_lookup")) {
+            data.routes = build_routes(&data);
+            data.route_hosts = g_ptr_array_new_with_free_func(g_free);
+            GRand *rand = g_rand_new_with_seed(seed);
+            for (guint i = 0; i < LOOKUPS_PER_SAMPLE; i++) {
+                if (i % 4 == 3) {
+                    g_ptr_array_add(data.route_hosts, g_strdup_printf("missing-%u.invalid", i));
+                } else {
+                    const gchar *domain = g_ptr_array_index(corpus->domains,
+                                                            g_rand_int_range(rand, 0, corpus->domains->len));
+                    g_ptr_array_add(data.route_hosts, g_strdup(domain));
+                }
+            }
+            g_rand_free(rand);
+            bench_measure(bench, "route_lookup", label, LOOKUPS_PER_SAMPLE, 0, reps, run_route_lookup, &data);
+        }
+        if (bench_wants(bench, "conflicts_cold") || bench_wants(bench, "meta_load") ||
+            bench_wants(bench, "meta_refresh")) {
+            data.core = nginx_core_new(corpus->main_conf, corpus->conf_dir, HOSTS_FILE, NULL, NULL);
+            data.meta_path = g_strdup_printf("%s/metadata-%u", root, n_vhosts);
+            nginx_core_load_metadata(data.core, data.meta_path);
+            MetadataRefresh *refresh = nginx_core_refresh_metadata(data.core);
+            nginx_core_apply_metadata(data.core, refresh);
+            metadata_refresh_free(refresh);
+        }
+        if (bench_wants(bench, "conflicts_cold")) {
+            bench_measure(bench, "conflicts_cold", label, corpus->files->len, corpus->bytes, reps,
+                          run_conflicts_cold, &data);
+        }
+        if (bench_wants(bench, "meta_load")) {
+            bench_measure(bench, "meta_load", label, corpus->files->len, 0, reps, run_meta_load, &data);
+        }
+        if (bench_wants(bench, "meta_refresh")) {
+            bench_measure(bench, "meta_refresh", label, corpus->files->len, corpus->bytes, reps,
+                          run_meta_refresh, &data);
+        }
+        if (bench_wants(bench, "highlight_full")) {
+            bench_measure(bench, "highlight_full", label, data.lines->len, corpus->bytes, reps,
+                          run_highlight_full, &data);
+        }
+        if (bench_wants(bench, "highlight_keystroke")) {
+            run_highlight_full(&data);
+            bench_measure(bench, "highlight_keystroke", label, 1, 0, reps * KEYSTROKES_PER_REPETITION,
+                          run_highlight_keystroke, &data);
+        }
+        g_free(label);
+    }
+    
+    search_index_free(data.search);
+    route_table_free(data.routes);
+    if (data.route_hosts) g_ptr_array_unref(data.route_hosts);
+    history_store_free(data.history);
+    if (data.history_dir) {
+        gchar *chunks = g_build_filename(data.history_dir, "chunks", NULL);
+        gchar *revisions = g_build_filename(data.history_dir, "revisions", NULL);
+        g_remove(chunks);
+        g_remove(revisions);
+        g_rmdir(data.history_dir);
+        g_free(revisions);
+        g_free(chunks);
+        g_free(data.history_dir);
+    }
+    nginx_core_free(data.core);
+    if (data.meta_path) {
+        g_remove(data.meta_path);
+        g_free(data.meta_path);
+    }
+    g_free(data.scores);
+    g_ptr_array_unref(data.file_names);
+    highlight_state_free(data.highlight);
+    g_ptr_array_unref(data.lines);
+    g_ptr_array_unref(data.contents);
+    bench_corpus_remove(corpus);
+    bench_corpus_free(corpus);
+    return ok;
+}
+
+// Routines on a hosts file
+
+typedef struct {
+    const gchar *path;
+    HostsFile *hosts;
+    GPtrArray *lookups;     // half present, half missing
+} HostsData;
+
+static void run_hosts_load(gpointer user_data) {
+    HostsData *data = user_data;
+    HostsFile *hosts = hosts_file_load(data->path, NULL);
+    g_assert(hosts);
+    hosts_file_free(hosts);
+}
+
+static void run_hosts_lookup(gpointer user_data) {
+    HostsData *data = user_data;
+    guint found = 0;
+    for (guint i = 0; i < data->lookups->len; i++) {
+        found += hosts_file_contains(data->hosts, g_ptr_array_index(data->lookups, i));
+    }
+    g_assert(found == data->lookups->len / 2);
+}
+
+static gboolean bench_hosts_file(Bench *bench, const gchar *root, guint n_lines, guint32 seed, GError **error) {
+    gchar *path = g_strdup_printf("%s/hosts-%u", root, n_lines);
+    GPtrArray *names = bench_hosts_generate(path, n_lines, seed, error);
+    if (!names) {
+        g_free(path);
+        return FALSE;
+    }
+    
+    HostsData data = { path, hosts_file_load(path, error), g_ptr_array_new_with_free_func(g_free) };
+    if (data.hosts) {
+        GRand *rand = g_rand_new_with_seed(seed);
+        for (guint i = 0; i < LOOKUPS_PER_SAMPLE; i++) {
+            if (i % 2 == 0) {
+                const gchar *name = g_ptr_array_index(names, g_rand_int_range(rand, 0, names->len));
+                g_ptr_array_add(data.lookups, g_ascii_strup(name, -1));
+            } else {
+                g_ptr_array_add(data.lookups, g_strdup_printf("missing-%u.invalid", i));
+            }
+        }
+        g_rand_free(rand);
+        
+        gchar *label = g_strdup_printf("lines=%u", n_lines);
+        if (bench_wants(bench, "hosts_load")) {
+            bench_measure(bench, "hosts_load", label, n_lines, 0, bench->repetitions,
+                          run_hosts_load, &data);
+        }
+        if (bench_wants(bench, "hosts_lookup")) {
+            bench_measure(bench, "hosts_lookup", label, LOOKUPS_PER_SAMPLE, 0, bench->repetitions,
+                          run_hosts_lookup, &data);
+        }
+        g_free(label);
+        hosts_file_free(data.hosts);
+    }
+    
+    gboolean ok = data.hosts != NULL;
+    g_ptr_array_unref(data.lookups);
+    g_ptr_array_unref(names);
+    g_unlink(path);
+    g_free(path);
+    return ok;
+}
+
+// Routines on the worker pool
+
+typedef struct {
+    WorkPool *pool;
+    guint pending;              // pushed, done callback not run yet
+} PoolData;
+
+static void pool_nothing(gpointer data, GCancellable *cancellable) {
+    (void)data; (void)cancellable; // Unused parameters
+}
+
+static void pool_busy(gpointer data, GCancellable *cancellable) {
+    (void)data; (void)cancellable; // Unused parameters
+    gint64 until = g_get_monotonic_time() + POOL_BULK_ITEM_US;
+    while (g_get_monotonic_time() < until) {
+    }
+}
+
+static void pool_done(gpointer data, gboolean cancelled) {
+    (void)cancelled; // Unused parameter
+    PoolData *pool_data = data;
+    pool_data->pending--;
+}
+
+static void pool_wait(PoolData *data, guint pending) {
+    while (data->pending > pending) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+// Push to done callback, batched delivery included
+static void run_pool_roundtrip(gpointer user_data) {
+    PoolData *data = user_data;
+    for (guint i = 0; i < POOL_ITEMS_PER_SAMPLE; i++) {
+        data->pending++;
+        work_pool_push(data->pool, WORK_PRIORITY_BULK, pool_nothing, pool_done, data, NULL, NULL);
+    }
+    pool_wait(data, 0);
+}
+
+// One interactive item behind a backlog of bulk work on every worker; it
+// only waits for the bulk items already running
+static void run_pool_interactive(gpointer user_data) {
+    PoolData *data = user_data;
+    for (guint i = 0; i < POOL_BULK_BACKLOG; i++) {
+        data->pending++;
+        work_pool_push(data->pool, WORK_PRIORITY_BULK, pool_busy, pool_done, data, NULL, NULL);
+    }
+    PoolData interactive = { data->pool, 1 };
+    work_pool_push(data->pool, WORK_PRIORITY_INTERACTIVE, pool_nothing, pool_done, &interactive, NULL, NULL);
+    pool_wait(&interactive, 0);
+}
+
+static void bench_pool(Bench *bench) {
+    if (!bench_wants(bench, "pool_roundtrip") && !bench_wants(bench, "pool_interactive")) return;
+    PoolData data = { work_pool_new(WORK_POOL_MAX_THREADS, NULL), 0 };
+    gchar *label = g_strdup_printf("threads=%u", WORK_POOL_MAX_THREADS);
+    if (bench_wants(bench, "pool_roundtrip")) {
+        bench_measure(bench, "pool_roundtrip", label, POOL_ITEMS_PER_SAMPLE, 0, bench->repetitions,
+                      run_pool_roundtrip, &data);
+    }
+    if (bench_wants(bench, "pool_interactive")) {
+        bench_measure(bench, "pool_interactive", label, 1, 0, bench->repetitions,
+                      run_pool_interactive, &data);
+        pool_wait(&data, 0);
+    }
+    g_free(label);
+    work_pool_free(data.pool);
+}
+
+// Routines on the UI event queue
+
+typedef struct {
+    UiEventQueue *queue;
+    guint producer;
+} EventProducer;
+
+// Mostly progress, some file changes and log lines, as a busy indexer
+// would send them
+static gpointer produce_events(gpointer user_data) {
+    EventProducer *producer = user_data;
+    gchar name[32];
+    for (guint i = 0; i < EVENTS_PER_PRODUCER; i++) {
+        if (i % 100 == 0) {
+            ui_event_queue_push_log(producer->queue, LOG_SEVERITY_INFO, "bench", "Indexed a batch of files");
+        } else if (i % 10 == 0) {
+            g_snprintf(name, sizeof(name), "site-%u.conf", i % 1000);
+            ui_event_queue_push_file(producer->queue, name, TRUE);
+        } else {
+            ui_event_queue_push_progress(producer->queue, producer, (gdouble)i / EVENTS_PER_PRODUCER);
+        }
+    }
+    return NULL;
+}
+
+// Producers push flat out while the consumer drains as often as it can;
+// the time until every event was taken
+static void run_events_flood(gpointer user_data) {
+    (void)user_data; // Unused parameter
+    UiEventQueue *queue = ui_event_queue_new(NULL, NULL);
+    EventProducer producers[EVENT_PRODUCERS];
+    GThread *threads[EVENT_PRODUCERS];
+    for (guint i = 0; i < EVENT_PRODUCERS; i++) {
+        producers[i] = (EventProducer){ queue, i };
+        threads[i] = g_thread_new("bench-producer", produce_events, &producers[i]);
+    }
+    UiEventStats stats = { 0 };
+    while (stats.taken < EVENT_PRODUCERS * EVENTS_PER_PRODUCER) {
+        g_ptr_array_unref(ui_event_queue_drain(queue, 10000, NULL));
+        ui_event_queue_get_stats(queue, &stats);
+    }
+    for (guint i = 0; i < EVENT_PRODUCERS; i++) {
+        g_thread_join(threads[i]);
+    }
+    ui_event_queue_free(queue);
+}
+
+static void bench_events(Bench *bench) {
+    if (!bench_wants(bench, "events_flood")) return;
+    gchar *label = g_strdup_printf("producers=%u", EVENT_PRODUCERS);
+    bench_measure(bench, "events_flood", label, EVENT_PRODUCERS * EVENTS_PER_PRODUCER, 0, bench->repetitions,
+                  run_events_flood, NULL);
+    g_free(label);
+}
+
+// JSON report
+
+static void append_json_string(GString *json, const gchar *value) {
+    g_string_append_c(json, '"');
+    for (const gchar *p = value; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            g_string_append_printf(json, "\\%c", *p);
+        } else if ((guchar)*p < 0x20) {
+            g_string_append_printf(json, "\\u%04x", *p);
+        } else {
+            g_string_append_c(json, *p);
+        }
+    }
+    g_string_append_c(json, '"');
+}
+
+static gboolean write_json(Bench *bench, const gchar *path, guint32 seed, GError **error) {
+    GString *json = g_string_new("{\n  \"suite\": \"nginxui_bench\",\n  \"version\": ");
+    append_json_string(json, NGINXUI_VERSION);
+    GDateTime *now = g_date_time_new_now_utc();
+    gchar *timestamp = g_date_time_format_iso8601(now);
+    g_string_append(json, ",\n  \"timestamp\": ");
+    append_json_string(json, timestamp);
+    g_free(timestamp);
+    g_date_time_unref(now);
+    g_string_append_printf(json,
+        ",\n  \"glib\": \"%u.%u.%u\",\n  \"cpus\": %u,\n  \"seed\": %u,\n"
+        "  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"unit\": \"us\",\n  \"results\": [",
+        glib_major_version, glib_minor_version, glib_micro_version, g_get_num_processors(),
+        seed, bench->warmup, bench->repetitions);
+    
+    for (guint i = 0; i < bench->results->len; i++) {
+        BenchResult *result = g_ptr_array_index(bench->results, i);
+        g_string_append(json, i > 0 ? ",\n    {\"name\": " : "\n    {\"name\": ");
+        append_json_string(json, result->name);
+        g_string_append(json, ", \"corpus\": ");
+        append_json_string(json, result->corpus);
+        g_string_append_printf(json,
+            ", \"items\": %" G_GUINT64_FORMAT ", \"bytes\": %" G_GUINT64_FORMAT ", \"samples\": %u, "
+            "\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+            result->items, result->bytes, result->samples->len,
+            percentile_us(result, 0), mean_us(result), percentile_us(result, 50),
+            percentile_us(result, 90), percentile_us(result, 99), percentile_us(result, 100));
+    }
+    g_string_append(json, "\n  ]\n}\n");
+    
+    gboolean ok = g_file_set_contents(path, json->str, json->len, error);
+    g_string_free(json, TRUE);
+    return ok;
+}
+
+static GArray* parse_sizes(const gchar *list, GError **error) {
+    GArray *sizes = g_array_new(FALSE, FALSE, sizeof(guint));
+    gchar **parts = g_strsplit(list, ",", -1);
+    for (guint i = 0; parts[i]; i++) {
+        guint64 value = 0;
+        if (!g_ascii_string_to_unsigned(g_strstrip(parts[i]), 10, 1, G_MAXUINT, &value, error)) {
+            g_array_unref(sizes);
+            sizes = NULL;
+            break;
+        }
+        guint size = (guint)value;
+        g_array_append_val(sizes, size);
+    }
+    g_strfreev(parts);
+    return sizes;
+}
+
+int main(int argc, char **argv) {
+    gchar *sizes_arg = NULL;
+    gchar *hosts_arg = NULL;
+    gchar *output = NULL;
+    gchar *filter = NULL;
+    gchar *dir = NULL;
+    gint warmup = DEFAULT_WARMUP;
+    gint repetitions = DEFAULT_REPETITIONS;
+    gint seed = DEFAULT_SEED;
+    GOptionEntry options[] = {
+        { "vhosts", 0, 0, G_OPTION_ARG_STRING, &sizes_arg, "Corpus sizes in vhosts (" DEFAULT_SIZES ")", "N,..." },
+        { "hosts-lines", 0, 0, G_OPTION_ARG_STRING, &hosts_arg, "Hosts file sizes (" DEFAULT_HOSTS_LINES ")", "N,..." },
+        { "warmup", 'w', 0, G_OPTION_ARG_INT, &warmup, "Untimed runs before sampling", "N" },
+        { "repetitions", 'r', 0, G_OPTION_ARG_INT, &repetitions, "Timed samples per routine", "N" },
+        { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Corpus generator seed", "N" },
+        { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter, "Only run routines whose name contains TEXT", "TEXT" },
+        { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the results as JSON", "FILE" },
+        { "dir", 'd', 0, G_OPTION_ARG_FILENAME, &dir, "Generate corpora below DIR instead of a temporary directory", "DIR" },
+        { NULL, 0, 0, 0, NULL, NULL, NULL }
+    };
+    
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- time nginxui routines on synthetic configs");
+    g_option_context_add_main_entries(context, options, NULL);
+    gboolean parsed = g_option_context_parse(context, &argc, &argv, &error);
+    g_option_context_free(context);
+    GArray *sizes = parsed ? parse_sizes(sizes_arg ? sizes_arg : DEFAULT_SIZES, &error) : NULL;
+    GArray *hosts_lines = sizes ? parse_sizes(hosts_arg ? hosts_arg : DEFAULT_HOSTS_LINES, &error) : NULL;
+    if (!hosts_lines || warmup < 0 || repetitions < 1) {
+        fprintf(stderr, "%s\n", error ? error->message : "warmup must be >= 0 and repetitions >= 1");
+        return 2;
+    }
+    
+    gchar *root = dir ? g_strdup(dir) : g_dir_make_tmp("nginxui-bench-XXXXXX", &error);
+    if (!root) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    
+    Bench bench = { warmup, repetitions, filter, g_ptr_array_new_with_free_func(bench_result_free) };
+    printf("%-20s %-16s %12s %12s %12s %12s %14s\n",
+           "routine", "corpus", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)", "items/s");
+    
+    gboolean ok = TRUE;
+    for (guint i = 0; ok && i < sizes->len; i++) {
+        ok = bench_conf_corpus(&bench, root, g_array_index(sizes, guint, i), (guint32)seed, &error);
+    }
+    for (guint i = 0; ok && i < hosts_lines->len; i++) {
+        ok = bench_hosts_file(&bench, root, g_array_index(hosts_lines, guint, i), (guint32)seed, &error);
+    }
+    if (ok) bench_pool(&bench);
+    if (ok) bench_events(&bench);
+    if (ok && output) {
+        ok = write_json(&bench, output, (guint32)seed, &error);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+    }
+    
+    if (!dir) g_rmdir(root);
+    g_free(root);
+    g_ptr_array_unref(bench.results);
+    g_array_unref(hosts_lines);
+    g_array_unref(sizes);
+    g_free(dir);
+    g_free(filter);
+    g_free(output);
+    g_free(hosts_arg);
+    g_free(sizes_arg);
+    return ok ? 0 : 1;
+}
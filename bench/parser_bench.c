@@ -0,0 +1,99 @@
+// Throughput benchmark for the config parser.
+//
+// Parses synthetic configs of increasing size and reports MB/s and how
+// many allocations each MB of config costs. Nodes come from the document
+// arena, so allocations should stay at a handful per document no matter
+// how large it gets. Domain extraction runs on the parsed tree.
+
+#include "nginx_parser.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RUNS 5
+
+static gchar* generate_config(gsize target_bytes, gsize *length) {
+    GString *text = g_string_sized_new(target_bytes + 4096);
+    g_string_append(text, "# generated benchmark config\nhttp {\n    include mime.types;\n");
+    for (guint i = 0; text->len < target_bytes; i++) {
+        g_string_append_printf(text,
+            "    server {\n"
+            "        listen 80;\n"
+            "        server_name host%u.example.com\n"
+            "                    www.host%u.example.com \"alt-%u.example.com\";\n"
+            "        # upstream entry %u\n"
+            "        location /api/v%u/ {\n"
+            "            proxy_pass http://10.0.%u.1:8080;\n"
+            "            proxy_set_header Host \"$host\";\n"
+            "            add_header X-Request \"${request_id} \\\"quoted\\\"\";\n"
+            "        }\n"
+            "        location ~ \\.php$ { return 403; }\n"
+            "    }\n",
+            i, i, i, i, i % 10, i % 256);
+    }
+    g_string_append(text, "}\n");
+    *length = text->len;
+    return g_string_free(text, FALSE);
+}
+
+static void count_node(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    (void)doc; (void)node; // Unused parameters
+    (*(guint64 *)user_data)++;
+}
+
+static void count_server_names(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    if (conf_span_equal(doc, node->name, "server_name")) {
+        for (guint32 i = 0; i < node->n_args; i++) {
+            g_free(conf_span_dup_value(doc, node->args[i]));
+            (*(guint64 *)user_data)++;
+        }
+    }
+}
+
+int main(void) {
+    const gsize sizes_mb[] = { 1, 10, 50 };
+
+    printf("%8s %12s %10s %12s %12s %12s\n",
+           "MB", "nodes", "MB/s", "allocs/MB", "arena MB", "domains/s");
+
+    for (gsize s = 0; s < G_N_ELEMENTS(sizes_mb); s++) {
+        gsize length = 0;
+        gchar *text = generate_config(sizes_mb[s] * 1024 * 1024, &length);
+        double mb = (double)length / (1024 * 1024);
+
+        gint64 best_us = G_MAXINT64;
+        guint allocations = 0;
+        gsize arena_bytes = 0;
+        guint64 nodes = 0;
+        for (guint run = 0; run < RUNS; run++) {
+            gint64 t0 = g_get_monotonic_time();
+            ConfDocument *doc = conf_document_parse(text, length);
+            best_us = MIN(best_us, g_get_monotonic_time() - t0);
+
+            // The document itself, its arena and the arena's blocks
+            allocations = 2 + conf_arena_get_n_blocks(doc->arena);
+            arena_bytes = conf_arena_get_bytes_used(doc->arena);
+            nodes = 0;
+            conf_document_foreach(doc, count_node, &nodes);
+            if (doc->n_errors > 0) {
+                fprintf(stderr, "unexpected parse error on line %u: %s\n",
+                        doc->errors[0].line, doc->errors[0].message);
+                return 1;
+            }
+            conf_document_free(doc);
+        }
+
+        ConfDocument *doc = conf_document_parse(text, length);
+        guint64 domains = 0;
+        gint64 t0 = g_get_monotonic_time();
+        conf_document_foreach(doc, count_server_names, &domains);
+        gint64 extract_us = MAX(g_get_monotonic_time() - t0, 1);
+        conf_document_free(doc);
+
+        printf("%8.1f %12" G_GUINT64_FORMAT " %10.1f %12.2f %12.1f %12.0f\n",
+               mb, nodes, mb / (best_us / 1e6), allocations / mb,
+               arena_bytes / (1024.0 * 1024), domains / (extract_us / 1e6));
+        g_free(text);
+    }
+
+    return 0;
+}
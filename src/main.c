@@ -1,4 +1,5 @@
 #include "nginx_ui.h"
+#include "nginx_batch.h"
 
 static void activate(GtkApplication *app, gpointer user_data) {
     (void)user_data; // Unused parameter
@@ -10,11 +11,25 @@ int main(int argc, char **argv) {
     GtkApplication *app;
     int status;
     
+    // Batch mode never touches the display
+    if (nginx_batch_requested(argc, argv)) {
+        return nginx_batch_main(argc, argv);
+    }
+    
+    // The performance panel's histograms are always collected
+    trace_init(TRUE);
+    
     app = gtk_application_new("com.nginx.config.editor", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     
     status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
     
+    GError *error = NULL;
+    if (!trace_finish(&error)) {
+        g_printerr("Cannot write trace: %s\n", error->message);
+        g_error_free(error);
+    }
+    
     return status;
 }
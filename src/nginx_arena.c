@@ -0,0 +1,86 @@
+#include "nginx_arena.h"
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_MIN_BLOCK_SIZE (16 * 1024)
+
+typedef struct _ArenaBlock ArenaBlock;
+struct _ArenaBlock {
+    ArenaBlock *next;
+    gsize size;
+    gsize used;
+    gsize padding;              // keeps data aligned to ARENA_ALIGNMENT
+    guint8 data[];
+};
+
+struct _ConfArena {
+    ArenaBlock *blocks;         // current block first
+    gsize block_size;
+    guint n_blocks;
+    gsize bytes_used;
+};
+
+static ArenaBlock* arena_new_block(ConfArena *arena, gsize size) {
+    ArenaBlock *block = g_malloc(sizeof(ArenaBlock) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->n_blocks++;
+    return block;
+}
+
+ConfArena* conf_arena_new(gsize block_size) {
+    ConfArena *arena = g_new0(ConfArena, 1);
+    arena->block_size = MAX(block_size, ARENA_MIN_BLOCK_SIZE);
+    return arena;
+}
+
+void conf_arena_free(ConfArena *arena) {
+    if (!arena) return;
+    ArenaBlock *block = arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        g_free(block);
+        block = next;
+    }
+    g_free(arena);
+}
+
+gpointer conf_arena_alloc(ConfArena *arena, gsize size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(gsize)(ARENA_ALIGNMENT - 1);
+    
+    ArenaBlock *block = arena->blocks;
+    if (!block || block->size - block->used < size) {
+        if (size > arena->block_size / 4) {
+            // Large requests get a block of their own behind the current
+            // one, so the space left in the current block is not wasted
+            block = arena_new_block(arena, size);
+            if (arena->blocks) {
+                block->next = arena->blocks->next;
+                arena->blocks->next = block;
+            } else {
+                arena->blocks = block;
+            }
+        } else {
+            block = arena_new_block(arena, arena->block_size);
+            block->next = arena->blocks;
+            arena->blocks = block;
+            // Later blocks grow so that big documents need few of them
+            arena->block_size = MIN(arena->block_size * 2, 16 * 1024 * 1024);
+        }
+    }
+    
+    gpointer p = block->data + block->used;
+    block->used += size;
+    arena->bytes_used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+guint conf_arena_get_n_blocks(const ConfArena *arena) {
+    return arena->n_blocks;
+}
+
+gsize conf_arena_get_bytes_used(const ConfArena *arena) {
+    return arena->bytes_used;
+}
@@ -0,0 +1,22 @@
+#ifndef NGINX_ARENA_H
+#define NGINX_ARENA_H
+
+#include <glib.h>
+
+// Bump allocator: memory is handed out from large blocks and released all
+// at once by conf_arena_free. Individual allocations cannot be freed.
+typedef struct _ConfArena ConfArena;
+
+ConfArena* conf_arena_new(gsize block_size);
+void conf_arena_free(ConfArena *arena);
+
+// Returns zeroed memory aligned for any type, valid until the arena is freed
+gpointer conf_arena_alloc(ConfArena *arena, gsize size);
+
+#define conf_arena_new0(arena, type, n) ((type *)conf_arena_alloc((arena), sizeof(type) * (n)))
+
+// Number of blocks requested from the system allocator so far
+guint conf_arena_get_n_blocks(const ConfArena *arena);
+gsize conf_arena_get_bytes_used(const ConfArena *arena);
+
+#endif // NGINX_ARENA_H
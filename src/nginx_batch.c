@@ -0,0 +1,175 @@
+#include "nginx_batch.h"
+#include "nginx_changes.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    gboolean quiet;
+} BatchOutput;
+
+// Problems go to stderr, progress to stdout unless --quiet
+static void on_batch_log(LogSeverity severity, const gchar *source, const gchar *message, gpointer user_data) {
+    (void)source; // Unused parameter
+    BatchOutput *output = user_data;
+    if (severity >= LOG_SEVERITY_WARNING) {
+        fflush(stdout);
+        fprintf(stderr, "%s\n", message);
+    } else if (!output->quiet) {
+        fprintf(stdout, "%s\n", message);
+    }
+}
+
+gboolean nginx_batch_requested(int argc, char **argv) {
+    for (gint i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 || g_str_has_prefix(argv[i], "--batch=")) return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean get_boolean(GKeyFile *manifest, const gchar *group, const gchar *key,
+                            gboolean default_value, GError **error) {
+    if (!g_key_file_has_key(manifest, group, key, NULL)) return default_value;
+    return g_key_file_get_boolean(manifest, group, key, error);
+}
+
+static gchar* get_path(GKeyFile *manifest, const gchar *group, const gchar *key,
+                       const gchar *base_dir, const gchar *default_value) {
+    gchar *value = g_key_file_get_string(manifest, group, key, NULL);
+    if (!value) return g_strdup(default_value);
+    if (g_path_is_absolute(value) || !base_dir) return value;
+    gchar *path = g_build_filename(base_dir, value, NULL);
+    g_free(value);
+    return path;
+}
+
+// Stages the config a manifest group describes
+static gboolean stage_config(GKeyFile *manifest, const gchar *group, const gchar *filename,
+                             const gchar *base_dir, ChangeSet *changes, GError **error) {
+    gboolean delete = get_boolean(manifest, group, "delete", FALSE, error);
+    if (error && *error) return FALSE;
+    if (delete) return change_set_delete(changes, filename, error);
+    
+    gchar *source = get_path(manifest, group, "source", base_dir, NULL);
+    if (!source) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND,
+                    "[%s] needs source= or delete=true", group);
+        return FALSE;
+    }
+    gchar *content = NULL;
+    gsize length = 0;
+    gboolean staged = g_file_get_contents(source, &content, &length, error) &&
+                      change_set_write(changes, filename, content, length, error);
+    g_free(content);
+    g_free(source);
+    return staged;
+}
+
+// Stages every config of the manifest and reads the files they replace
+static gboolean load_manifest(GKeyFile *manifest, const gchar *base_dir, ChangeSet *changes, GError **error) {
+    gchar **groups = g_key_file_get_groups(manifest, NULL);
+    gboolean loaded = TRUE;
+    for (gint i = 0; groups[i] && loaded; i++) {
+        if (!g_str_has_prefix(groups[i], BATCH_GROUP_CONFIG_PREFIX)) continue;
+        
+        const gchar *filename = groups[i] + strlen(BATCH_GROUP_CONFIG_PREFIX);
+        GError *local_error = NULL;
+        if (!stage_config(manifest, groups[i], filename, base_dir, changes, &local_error)) {
+            g_propagate_prefixed_error(error, local_error, "%s: ", filename);
+            loaded = FALSE;
+        }
+    }
+    g_strfreev(groups);
+    return loaded && change_set_prepare(changes, error);
+}
+
+static BatchExitStatus run_manifest(NginxCore *core, GKeyFile *manifest, ChangeSet *changes, gboolean dry_run) {
+    GError *error = NULL;
+    gboolean test = get_boolean(manifest, BATCH_GROUP_NGINX, "test", TRUE, &error);
+    gboolean reload = !error ? get_boolean(manifest, BATCH_GROUP_NGINX, "reload", FALSE, &error) : FALSE;
+    gboolean hosts = !error ? get_boolean(manifest, BATCH_GROUP_NGINX, "hosts", TRUE, &error) : FALSE;
+    if (error) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: [%s] %s", BATCH_GROUP_NGINX, error->message);
+        g_error_free(error);
+        return BATCH_EXIT_USAGE;
+    }
+    
+    ChangeSetFlags flags = (test ? CHANGE_SET_TEST : 0) | (reload ? CHANGE_SET_RELOAD : 0) |
+                           (hosts ? CHANGE_SET_HOSTS : 0) | (dry_run ? CHANGE_SET_DRY_RUN : 0);
+    switch (change_set_apply(changes, flags)) {
+        case CHANGE_SET_APPLIED:
+        case CHANGE_SET_UNCHANGED:
+            return BATCH_EXIT_OK;
+        default:
+            return BATCH_EXIT_FAILED;
+    }
+}
+
+int nginx_batch_main(int argc, char **argv) {
+    gchar *manifest_path = NULL;
+    gboolean dry_run = FALSE;
+    BatchOutput output = { FALSE };
+    GOptionEntry options[] = {
+        { "batch", 0, 0, G_OPTION_ARG_FILENAME, &manifest_path, "Apply the configs listed in MANIFEST", "MANIFEST" },
+        { "dry-run", 'n', 0, G_OPTION_ARG_NONE, &dry_run, "Only show what would change", NULL },
+        { "quiet", 'q', 0, G_OPTION_ARG_NONE, &output.quiet, "Only print problems", NULL },
+        { NULL, 0, 0, 0, NULL, NULL, NULL }
+    };
+    
+    trace_init(FALSE);
+    
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- apply nginx configs without the GUI");
+    g_option_context_add_main_entries(context, options, NULL);
+    gboolean parsed = g_option_context_parse(context, &argc, &argv, &error);
+    g_option_context_free(context);
+    if (!parsed || !manifest_path || argc > 1) {
+        fprintf(stderr, "Usage: %s --batch MANIFEST [--dry-run] [--quiet]\n", g_get_prgname() ? g_get_prgname() : "nginxui");
+        if (error) fprintf(stderr, "%s\n", error->message);
+        g_clear_error(&error);
+        g_free(manifest_path);
+        return BATCH_EXIT_USAGE;
+    }
+    
+    GKeyFile *manifest = g_key_file_new();
+    if (!g_key_file_load_from_file(manifest, manifest_path, G_KEY_FILE_NONE, &error)) {
+        fprintf(stderr, "Error: %s: %s\n", manifest_path, error->message);
+        g_error_free(error);
+        g_key_file_free(manifest);
+        g_free(manifest_path);
+        return BATCH_EXIT_USAGE;
+    }
+    
+    // Paths in the manifest are relative to it
+    gchar *manifest_abs = g_canonicalize_filename(manifest_path, NULL);
+    gchar *base_dir = g_path_get_dirname(manifest_abs);
+    g_free(manifest_abs);
+    gchar *main_conf = get_path(manifest, BATCH_GROUP_NGINX, "main_conf", base_dir, NGINX_MAIN_CONF);
+    gchar *conf_dir = get_path(manifest, BATCH_GROUP_NGINX, "conf_dir", base_dir, NGINX_CONF_DIR);
+    gchar *hosts_file = get_path(manifest, BATCH_GROUP_NGINX, "hosts_file", base_dir, HOSTS_FILE);
+    NginxCore *core = nginx_core_new(main_conf, conf_dir, hosts_file, on_batch_log, &output);
+    core->pid_file = get_path(manifest, BATCH_GROUP_NGINX, "pid_file", base_dir, NULL);
+    
+    BatchExitStatus status;
+    ChangeSet *changes = change_set_new(core);
+    if (load_manifest(manifest, base_dir, changes, &error)) {
+        status = run_manifest(core, manifest, changes, dry_run);
+    } else {
+        fprintf(stderr, "Error: %s: %s\n", manifest_path, error->message);
+        g_error_free(error);
+        status = BATCH_EXIT_USAGE;
+    }
+    change_set_free(changes);
+    
+    nginx_core_free(core);
+    if (!trace_finish(&error)) {
+        fprintf(stderr, "Error: Cannot write trace: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_free(hosts_file);
+    g_free(conf_dir);
+    g_free(main_conf);
+    g_free(base_dir);
+    g_key_file_free(manifest);
+    g_free(manifest_path);
+    return status;
+}
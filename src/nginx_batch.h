@@ -0,0 +1,46 @@
+#ifndef NGINX_BATCH_H
+#define NGINX_BATCH_H
+
+#include <glib.h>
+
+// Headless mode: nginxui --batch MANIFEST applies a set of configs,
+// validates them with nginx -t and optionally reloads nginx, without
+// starting GTK. The manifest is a key file:
+//
+//   [nginx]
+//   test=true                 # run nginx -t after writing (default true)
+//   reload=true               # reload once the test passed (default false)
+//   hosts=true                # add server_names to /etc/hosts (default true)
+//   main_conf=nginx.conf      # the main config (default /etc/nginx/nginx.conf)
+//   conf_dir=conf.d           # where configs go (default /etc/nginx/conf.d)
+//   hosts_file=hosts          # the hosts file (default /etc/hosts)
+//   pid_file=nginx.pid        # the master's pid file (default: the main
+//                             # config's pid directive, else /run/nginx.pid)
+//
+//   [config:example.conf]     # a file in conf_dir
+//   source=sites/example.conf # relative to the manifest
+//
+//   [config:old.conf]
+//   delete=true
+//
+// Paths in the manifest are relative to it. Only files whose content
+// differs are written, so applying a manifest that is already in place
+// neither starts the helper nor runs nginx. The configs are applied as
+// one change set (see nginx_changes.h): if the test or the reload fails,
+// every file is put back the way it was.
+
+#define BATCH_GROUP_NGINX "nginx"
+#define BATCH_GROUP_CONFIG_PREFIX "config:"
+
+typedef enum {
+    BATCH_EXIT_OK = 0,
+    BATCH_EXIT_FAILED = 1,      // nothing applied, or rolled back
+    BATCH_EXIT_USAGE = 2        // bad command line or manifest
+} BatchExitStatus;
+
+// Whether the command line asks for batch mode
+gboolean nginx_batch_requested(int argc, char **argv);
+
+int nginx_batch_main(int argc, char **argv);
+
+#endif // NGINX_BATCH_H
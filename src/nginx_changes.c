@@ -0,0 +1,298 @@
+#include "nginx_changes.h"
+#include "nginx_reload.h"
+#include <string.h>
+#include <sys/stat.h>
+
+struct _ChangeSet {
+    NginxCore *core;
+    GPtrArray *changes;         // Change*, in the order first staged
+    GHashTable *by_name;        // filename -> Change*
+    gboolean prepared;          // originals read since the last change or apply
+};
+
+static void change_free(gpointer data) {
+    Change *change = data;
+    conf_document_free(change->doc);
+    g_free(change->original);
+    g_free(change->content);
+    g_free(change->path);
+    g_free(change->filename);
+    g_free(change);
+}
+
+ChangeSet* change_set_new(NginxCore *core) {
+    ChangeSet *set = g_new0(ChangeSet, 1);
+    set->core = core;
+    set->changes = g_ptr_array_new_with_free_func(change_free);
+    set->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    return set;
+}
+
+void change_set_free(ChangeSet *set) {
+    if (!set) return;
+    g_hash_table_unref(set->by_name);
+    g_ptr_array_unref(set->changes);
+    g_free(set);
+}
+
+void change_set_clear(ChangeSet *set) {
+    g_hash_table_remove_all(set->by_name);
+    g_ptr_array_set_size(set->changes, 0);
+    set->prepared = FALSE;
+}
+
+// The change staged for filename, emptied for new content
+static Change* stage(ChangeSet *set, const gchar *filename, GError **error) {
+    if (!nginx_core_check_filename(filename, error)) return NULL;
+    Change *change = g_hash_table_lookup(set->by_name, filename);
+    if (change) {
+        g_clear_pointer(&change->content, g_free);
+        g_clear_pointer(&change->doc, conf_document_free);
+        change->length = 0;
+    } else {
+        change = g_new0(Change, 1);
+        change->filename = g_strdup(filename);
+        change->path = nginx_core_get_path(set->core, filename);
+        g_ptr_array_add(set->changes, change);
+        g_hash_table_insert(set->by_name, change->filename, change);
+    }
+    set->prepared = FALSE;
+    return change;
+}
+
+gboolean change_set_write(ChangeSet *set, const gchar *filename,
+                          const gchar *content, gsize length, GError **error) {
+    Change *change = stage(set, filename, error);
+    if (!change) return FALSE;
+    change->delete = FALSE;
+    change->content = g_strndup(content, length);
+    change->length = length;
+    change->doc = conf_document_parse(change->content, change->length);
+    return TRUE;
+}
+
+gboolean change_set_delete(ChangeSet *set, const gchar *filename, GError **error) {
+    Change *change = stage(set, filename, error);
+    if (!change) return FALSE;
+    change->delete = TRUE;
+    return TRUE;
+}
+
+guint change_set_get_length(ChangeSet *set) {
+    return set->changes->len;
+}
+
+const Change* change_set_get(ChangeSet *set, guint index) {
+    return g_ptr_array_index(set->changes, index);
+}
+
+const Change* change_set_lookup(ChangeSet *set, const gchar *filename) {
+    return g_hash_table_lookup(set->by_name, filename);
+}
+
+// Reads the file a change replaces
+static gboolean read_original(Change *change, GError **error) {
+    g_clear_pointer(&change->original, g_free);
+    change->original_length = 0;
+    change->exists = FALSE;
+    change->original_mode = CHANGE_SET_DEFAULT_MODE;
+
+    GError *read_error = NULL;
+    if (g_file_get_contents(change->path, &change->original, &change->original_length, &read_error)) {
+        change->exists = TRUE;
+        struct stat st;
+        if (stat(change->path, &st) == 0) change->original_mode = st.st_mode & 07777;
+    } else if (g_error_matches(read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_clear_error(&read_error);
+    } else {
+        g_propagate_prefixed_error(error, read_error, "%s: ", change->filename);
+        return FALSE;
+    }
+
+    change->changed = change->delete ? change->exists
+                                     : !change->exists || change->length != change->original_length ||
+                                       memcmp(change->content, change->original, change->length) != 0;
+    return TRUE;
+}
+
+gboolean change_set_prepare(ChangeSet *set, GError **error) {
+    for (guint i = 0; i < set->changes->len; i++) {
+        if (!read_original(g_ptr_array_index(set->changes, i), error)) return FALSE;
+    }
+    set->prepared = TRUE;
+    return TRUE;
+}
+
+// Writes or deletes the changed files in one pipelined helper batch.
+// With restore, the original state is written back instead.
+static gboolean apply_changes(ChangeSet *set, gboolean restore) {
+    NginxCore *core = set->core;
+    HelperBatch *batch = helper_batch_new();
+    GPtrArray *applied = g_ptr_array_new();
+    for (guint i = 0; i < set->changes->len; i++) {
+        Change *change = g_ptr_array_index(set->changes, i);
+        if (!restore) change->written = FALSE;
+        // A failed write left the file as it was
+        if (!change->changed || (restore && !change->written)) continue;
+
+        gboolean remove = restore ? !change->exists : change->delete;
+        if (remove) {
+            helper_batch_unlink(batch, change->path);
+        } else if (restore) {
+            helper_batch_write_file(batch, change->path, change->original, change->original_length,
+                                    change->original_mode);
+        } else {
+            helper_batch_write_file(batch, change->path, change->content, change->length,
+                                    change->original_mode);
+        }
+        g_ptr_array_add(applied, change);
+    }
+
+    GError *error = NULL;
+    HelperClient *client = helper_client_get_default(&error);
+    gboolean ok = client && helper_batch_run(client, batch, &error);
+    guint n_failed = 0;
+    for (guint i = 0; client && i < applied->len; i++) {
+        Change *change = g_ptr_array_index(applied, i);
+        const gchar *request_error = helper_batch_get_error(batch, i);
+        if (request_error) {
+            nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s %s: %s",
+                           restore ? "Could not restore" : change->delete ? "Could not delete" : "Could not save",
+                           change->filename, request_error);
+            n_failed++;
+        } else if (!restore) {
+            change->written = TRUE;
+            nginx_core_log(core, LOG_SEVERITY_SUCCESS, "%s: %s", change->delete ? "Deleted" : "Saved",
+                           change->filename);
+        }
+    }
+    // The helper could not be started or the pipe broke
+    if (error && n_failed == 0) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s", error->message);
+    }
+    g_clear_error(&error);
+
+    g_ptr_array_unref(applied);
+    helper_batch_free(batch);
+    return ok;
+}
+
+static gboolean run_nginx(NginxCore *core, HelperOp op) {
+    GError *error = NULL;
+    gint exit_status = -1;
+    if (!nginx_core_run_nginx(core, op, &exit_status, &error)) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    return exit_status == 0;
+}
+
+ChangeSetResult change_set_apply(ChangeSet *set, ChangeSetFlags flags) {
+    NginxCore *core = set->core;
+    GError *error = NULL;
+    if (!set->prepared && !change_set_prepare(set, &error)) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s", error->message);
+        g_error_free(error);
+        return CHANGE_SET_REJECTED;
+    }
+    // What was read is only good for this attempt
+    set->prepared = FALSE;
+
+    // Nothing is written while any config fails to parse
+    guint n_parse_errors = 0;
+    guint n_changed = 0;
+    for (guint i = 0; i < set->changes->len; i++) {
+        Change *change = g_ptr_array_index(set->changes, i);
+        if (change->doc) n_parse_errors += nginx_core_report_parse_errors(core, change->filename, change->doc);
+        if (change->changed) n_changed++;
+    }
+    if (n_parse_errors > 0) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %u config error(s), nothing was changed", n_parse_errors);
+        return CHANGE_SET_REJECTED;
+    }
+    if (n_changed == 0) {
+        nginx_core_log(core, LOG_SEVERITY_INFO, "Nothing to do, %u config(s) up to date", set->changes->len);
+        return CHANGE_SET_UNCHANGED;
+    }
+    if (flags & CHANGE_SET_DRY_RUN) {
+        for (guint i = 0; i < set->changes->len; i++) {
+            Change *change = g_ptr_array_index(set->changes, i);
+            if (change->changed) {
+                nginx_core_log(core, LOG_SEVERITY_INFO, "Would %s %s",
+                               change->delete ? "delete" : change->exists ? "update" : "create", change->path);
+            }
+        }
+        return CHANGE_SET_APPLIED;
+    }
+
+    if (!apply_changes(set, FALSE)) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: Rolling back after a failed write");
+        apply_changes(set, TRUE);
+        return CHANGE_SET_ROLLED_BACK;
+    }
+
+    if (flags & CHANGE_SET_TEST) {
+        nginx_core_log(core, LOG_SEVERITY_INFO, "Testing Nginx configuration...");
+        if (!run_nginx(core, HELPER_OP_NGINX_TEST)) {
+            nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: Configuration test failed, rolling back");
+            apply_changes(set, TRUE);
+            return CHANGE_SET_ROLLED_BACK;
+        }
+        nginx_core_log(core, LOG_SEVERITY_SUCCESS, "Configuration test passed");
+    }
+
+    // A reload the master did not take leaves nginx on the old
+    // configuration, which the files must match again
+    if (flags & CHANGE_SET_RELOAD) {
+        nginx_core_log(core, LOG_SEVERITY_INFO, "Reloading Nginx...");
+        if (!nginx_reload_run(core, &error)) {
+            nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s", error->message);
+            g_clear_error(&error);
+            nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: Reload failed, rolling back");
+            apply_changes(set, TRUE);
+            return CHANGE_SET_ROLLED_BACK;
+        }
+        nginx_core_log(core, LOG_SEVERITY_SUCCESS, "Nginx reloaded successfully");
+    }
+
+    // Only names nginx now serves go into the hosts file, which a
+    // rollback would not restore
+    if (flags & CHANGE_SET_HOSTS) {
+        GPtrArray *docs = g_ptr_array_new();
+        for (guint i = 0; i < set->changes->len; i++) {
+            Change *change = g_ptr_array_index(set->changes, i);
+            if (change->changed && change->doc) g_ptr_array_add(docs, change->doc);
+        }
+        nginx_core_sync_hosts(core, (const ConfDocument * const *)docs->pdata, docs->len);
+        g_ptr_array_unref(docs);
+    }
+    return CHANGE_SET_APPLIED;
+}
+
+void change_set_index(ChangeSet *set) {
+    NginxCore *core = set->core;
+    for (guint i = 0; i < set->changes->len; i++) {
+        Change *change = g_ptr_array_index(set->changes, i);
+        if (!change->changed) continue;
+        if (change->exists) {
+            nginx_core_record_history(core, change->path, change->original, change->original_length);
+        }
+        nginx_core_record_history(core, change->path, change->content, change->length);
+        // The file may have gained or lost includes
+        include_graph_invalidate(core->includes, change->path);
+        include_graph_update_file(core->includes, change->path);
+    }
+
+    for (guint i = 0; i < set->changes->len; i++) {
+        Change *change = g_ptr_array_index(set->changes, i);
+        if (!change->changed) continue;
+        nginx_core_update_conflicts(core, change->path, change->doc);
+        if (!core->search) continue;
+        if (change->delete) {
+            search_index_remove_file(core->search, change->path);
+        } else {
+            search_index_update_file(core->search, change->path, change->content, change->length);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef NGINX_CHANGES_H
+#define NGINX_CHANGES_H
+
+#include "nginx_core.h"
+
+// A change set collects writes and deletes of many configs and applies
+// them as one: every file goes to the helper in a single pipelined batch
+// of atomic writes, nginx -t runs once and nginx reloads at most once. If
+// a write, the test or the reload fails, every file is put back the way
+// it was, so nginx never runs on half of a change.
+//
+// Staging only keeps the new content. change_set_prepare reads what the
+// files hold now and works out which of them actually change; apply
+// prepares the set itself when it was not prepared since the last apply.
+
+#define CHANGE_SET_DEFAULT_MODE 0644
+
+typedef enum {
+    CHANGE_SET_TEST = 1 << 0,       // nginx -t after writing
+    CHANGE_SET_RELOAD = 1 << 1,     // reload once the test passed
+    CHANGE_SET_HOSTS = 1 << 2,      // add server_names to the hosts file after the test and reload passed
+    CHANGE_SET_DRY_RUN = 1 << 3     // only log what would change
+} ChangeSetFlags;
+
+typedef enum {
+    CHANGE_SET_APPLIED,
+    CHANGE_SET_UNCHANGED,           // every file already had its staged content
+    CHANGE_SET_REJECTED,            // a config has errors or a file cannot be read, nothing was written
+    CHANGE_SET_ROLLED_BACK          // a write, the test or the reload failed
+} ChangeSetResult;
+
+typedef struct {
+    gchar *filename;
+    gchar *path;                // target in the config directory
+    gboolean delete;
+    gchar *content;             // new content, NULL when deleting
+    gsize length;
+    ConfDocument *doc;          // parse of content
+    // Filled in by change_set_prepare
+    gboolean exists;
+    gchar *original;            // content before the change, for rollback
+    gsize original_length;
+    guint original_mode;
+    gboolean changed;
+    gboolean written;           // by the last apply; a rollback only restores these
+} Change;
+
+typedef struct _ChangeSet ChangeSet;
+
+ChangeSet* change_set_new(NginxCore *core);
+void change_set_free(ChangeSet *set);
+
+// Stages new content for a file (copied) or its deletion, replacing what
+// was staged for it before
+gboolean change_set_write(ChangeSet *set, const gchar *filename,
+                          const gchar *content, gsize length, GError **error);
+gboolean change_set_delete(ChangeSet *set, const gchar *filename, GError **error);
+void change_set_clear(ChangeSet *set);
+
+// Staged changes in the order they were first staged
+guint change_set_get_length(ChangeSet *set);
+const Change* change_set_get(ChangeSet *set, guint index);
+const Change* change_set_lookup(ChangeSet *set, const gchar *filename);
+
+gboolean change_set_prepare(ChangeSet *set, GError **error);
+
+// Applies the set, blocking the calling thread; it may be a worker. Every
+// step is logged through the core.
+ChangeSetResult change_set_apply(ChangeSet *set, ChangeSetFlags flags);
+
+// After a set was applied, on the thread that owns the core: updates the
+// include graph, the conflict and search indexes and the history
+void change_set_index(ChangeSet *set);
+
+#endif // NGINX_CHANGES_H
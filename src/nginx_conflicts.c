@@ -0,0 +1,392 @@
+#include "nginx_conflicts.h"
+#include <string.h>
+
+// nginx listens here when a server block has no listen directive
+#define DEFAULT_LISTEN "*:80"
+
+typedef enum {
+    TABLE_NAMES,                // "endpoint name" -> entries, wildcards included
+    TABLE_SUFFIXES,             // "endpoint .suffix" -> entries of exact names below it
+    TABLE_DEFAULTS,             // "endpoint" -> entries with default_server
+    N_TABLES
+} IndexTable;
+
+typedef struct {
+    gchar *path;
+    GArray *keys;               // RecordKey, each table key this file has entries under
+} FileRecord;
+
+typedef struct {
+    IndexTable table;
+    const gchar *key;           // owned by the table
+} RecordKey;
+
+typedef struct {
+    FileRecord *file;
+    guint32 line;               // the server_name or listen directive
+    guint32 block;              // line of the server block, identifies it within the file
+    const gchar *name;          // exact name, for suffix entries (points into a names key)
+} IndexEntry;
+
+struct _ConflictIndex {
+    GHashTable *tables[N_TABLES];
+    GHashTable *files;          // path -> FileRecord*
+};
+
+static void file_record_free(gpointer data) {
+    FileRecord *record = data;
+    g_array_free(record->keys, TRUE);
+    g_free(record->path);
+    g_free(record);
+}
+
+static void entries_free(gpointer data) {
+    g_array_free(data, TRUE);
+}
+
+ConflictIndex* conflict_index_new(void) {
+    ConflictIndex *index = g_new0(ConflictIndex, 1);
+    for (gint t = 0; t < N_TABLES; t++) {
+        index->tables[t] = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, entries_free);
+    }
+    index->files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, file_record_free);
+    return index;
+}
+
+void conflict_index_free(ConflictIndex *index) {
+    if (!index) return;
+    g_hash_table_unref(index->files);
+    for (gint t = 0; t < N_TABLES; t++) {
+        g_hash_table_unref(index->tables[t]);
+    }
+    g_free(index);
+}
+
+void conflict_free(gpointer data) {
+    Conflict *conflict = data;
+    g_free(conflict->endpoint);
+    g_free(conflict->name);
+    g_free(conflict->path);
+    g_free(conflict->other_name);
+    g_free(conflict->other_path);
+    g_free(conflict);
+}
+
+gchar* conflict_describe(const Conflict *conflict) {
+    switch (conflict->kind) {
+        case CONFLICT_DUPLICATE_NAME:
+            return g_strdup_printf("conflicting server name \"%s\" on %s: %s:%u and %s:%u",
+                                   conflict->name, conflict->endpoint, conflict->path, conflict->line,
+                                   conflict->other_path, conflict->other_line);
+        case CONFLICT_DUPLICATE_DEFAULT:
+            return g_strdup_printf("duplicate default server for %s: %s:%u and %s:%u",
+                                   conflict->endpoint, conflict->path, conflict->line,
+                                   conflict->other_path, conflict->other_line);
+        case CONFLICT_WILDCARD_OVERLAP:
+        default:
+            return g_strdup_printf("\"%s\" (%s:%u) overlaps \"%s\" (%s:%u) on %s",
+                                   conflict->name, conflict->path, conflict->line,
+                                   conflict->other_name, conflict->other_path, conflict->other_line,
+                                   conflict->endpoint);
+    }
+}
+
+void conflict_index_remove_file(ConflictIndex *index, const gchar *path) {
+    FileRecord *record = g_hash_table_lookup(index->files, path);
+    if (!record) return;
+    
+    for (guint k = 0; k < record->keys->len; k++) {
+        RecordKey *rk = &g_array_index(record->keys, RecordKey, k);
+        GHashTable *table = index->tables[rk->table];
+        GArray *entries = g_hash_table_lookup(table, rk->key);
+        for (guint i = entries->len; i > 0; i--) {
+            if (g_array_index(entries, IndexEntry, i - 1).file == record) {
+                g_array_remove_index(entries, i - 1);
+            }
+        }
+        if (entries->len == 0) {
+            g_hash_table_remove(table, rk->key);
+        }
+    }
+    g_hash_table_remove(index->files, path);
+}
+
+// Adds an entry and returns the entries that were already under key
+static GArray* add_entry(ConflictIndex *index, FileRecord *record, IndexTable table_id,
+                         const gchar *key, const IndexEntry *entry, guint *n_before) {
+    GHashTable *table = index->tables[table_id];
+    gchar *stored_key = NULL;
+    GArray *entries = NULL;
+    if (!g_hash_table_lookup_extended(table, key, (gpointer *)&stored_key, (gpointer *)&entries)) {
+        stored_key = g_strdup(key);
+        entries = g_array_sized_new(FALSE, FALSE, sizeof(IndexEntry), 1);
+        g_hash_table_insert(table, stored_key, entries);
+    }
+    
+    // Each key is recorded once per file, however often the file uses it.
+    // A file is indexed in one go after its old entries were removed, so
+    // its entries are the last ones under any key.
+    gboolean known = entries->len > 0 && g_array_index(entries, IndexEntry, entries->len - 1).file == record;
+    if (!known) {
+        RecordKey rk = { table_id, stored_key };
+        g_array_append_val(record->keys, rk);
+    }
+    
+    *n_before = entries->len;
+    g_array_append_val(entries, *entry);
+    return entries;
+}
+
+static const gchar* names_key_name(ConflictIndex *index, const gchar *key) {
+    gchar *stored_key = NULL;
+    g_hash_table_lookup_extended(index->tables[TABLE_NAMES], key, (gpointer *)&stored_key, NULL);
+    return strchr(stored_key, ' ') + 1;
+}
+
+static void report(GPtrArray *conflicts, ConflictKind kind, const gchar *endpoint,
+                   const gchar *name, const IndexEntry *entry,
+                   const gchar *other_name, const IndexEntry *other) {
+    // Names repeated within one server block are not a conflict
+    if (entry->file == other->file && entry->block == other->block) return;
+    
+    Conflict *conflict = g_new0(Conflict, 1);
+    conflict->kind = kind;
+    conflict->endpoint = g_strdup(endpoint);
+    conflict->name = g_strdup(name);
+    conflict->path = g_strdup(entry->file->path);
+    conflict->line = entry->line;
+    conflict->other_name = g_strdup(other_name);
+    conflict->other_path = g_strdup(other->file->path);
+    conflict->other_line = other->line;
+    g_ptr_array_add(conflicts, conflict);
+}
+
+static void index_name(ConflictIndex *index, FileRecord *record, const gchar *endpoint,
+                       const gchar *name, guint32 line, guint32 block, GPtrArray *conflicts) {
+    IndexEntry entry = { record, line, block, NULL };
+    gchar *key = g_strdup_printf("%s %s", endpoint, name);
+    guint n_before = 0;
+    GArray *entries = add_entry(index, record, TABLE_NAMES, key, &entry, &n_before);
+    for (guint i = 0; i < n_before; i++) {
+        report(conflicts, CONFLICT_DUPLICATE_NAME, endpoint, name, &entry,
+               name, &g_array_index(entries, IndexEntry, i));
+    }
+    
+    if (g_str_has_prefix(name, "*.")) {
+        // Exact names already covered by this wildcard
+        gchar *suffix_key = g_strdup_printf("%s %s", endpoint, name + 1);
+        GArray *covered = g_hash_table_lookup(index->tables[TABLE_SUFFIXES], suffix_key);
+        for (guint i = 0; covered && i < covered->len; i++) {
+            IndexEntry *other = &g_array_index(covered, IndexEntry, i);
+            report(conflicts, CONFLICT_WILDCARD_OVERLAP, endpoint, name, &entry, other->name, other);
+        }
+        g_free(suffix_key);
+    } else if (*name != '~' && !strchr(name, '*')) {
+        // Register every suffix of an exact name and look for wildcards on them
+        entry.name = names_key_name(index, key);
+        for (const gchar *dot = strchr(name, '.'); dot; dot = strchr(dot + 1, '.')) {
+            gchar *suffix_key = g_strdup_printf("%s %s", endpoint, dot);
+            add_entry(index, record, TABLE_SUFFIXES, suffix_key, &entry, &n_before);
+            g_free(suffix_key);
+            
+            gchar *wildcard_key = g_strdup_printf("%s *%s", endpoint, dot);
+            GArray *wildcards = g_hash_table_lookup(index->tables[TABLE_NAMES], wildcard_key);
+            for (guint i = 0; wildcards && i < wildcards->len; i++) {
+                IndexEntry *other = &g_array_index(wildcards, IndexEntry, i);
+                report(conflicts, CONFLICT_WILDCARD_OVERLAP, endpoint, name, &entry,
+                       names_key_name(index, wildcard_key), other);
+            }
+            g_free(wildcard_key);
+        }
+    }
+    g_free(key);
+}
+
+static gboolean is_port(const gchar *s) {
+    if (!*s) return FALSE;
+    for (; *s; s++) {
+        if (!g_ascii_isdigit(*s)) return FALSE;
+    }
+    return TRUE;
+}
+
+// "80" -> "*:80", "0.0.0.0:80" -> "*:80", "127.0.0.1" -> "127.0.0.1:80"
+static gchar* normalize_listen(const gchar *value) {
+    if (g_str_has_prefix(value, "unix:")) {
+        return g_strdup(value);
+    }
+    if (is_port(value)) {
+        return g_strdup_printf("*:%s", value);
+    }
+    
+    const gchar *colon = NULL;
+    if (value[0] == '[') {
+        const gchar *close = strchr(value, ']');
+        if (close && close[1] == ':') colon = close + 1;
+    } else {
+        colon = strrchr(value, ':');
+    }
+    
+    gchar *address = colon ? g_strndup(value, colon - value) : g_strdup(value);
+    const gchar *port = colon && is_port(colon + 1) ? colon + 1 : "80";
+    if (strcmp(address, "0.0.0.0") == 0) {
+        g_free(address);
+        address = g_strdup("*");
+    }
+    gchar *endpoint = g_strdup_printf("%s:%s", address, port);
+    gchar *lower = g_ascii_strdown(endpoint, -1);
+    g_free(endpoint);
+    g_free(address);
+    return lower;
+}
+
+typedef struct {
+    gchar *endpoint;
+    gboolean is_default;
+    guint32 line;
+} Listen;
+
+typedef struct {
+    gchar *name;
+    guint32 line;
+} ServerName;
+
+// Indexes one server block from its listen and server_name directives,
+// gathered from a parse or a cached summary. Frees their strings.
+static void index_server(ConflictIndex *index, FileRecord *record, guint32 block,
+                         GArray *listens, GArray *names, GPtrArray *conflicts) {
+    if (listens->len == 0) {
+        Listen listen = { g_strdup(DEFAULT_LISTEN), FALSE, block };
+        g_array_append_val(listens, listen);
+    }
+    
+    for (guint l = 0; l < listens->len; l++) {
+        Listen *listen = &g_array_index(listens, Listen, l);
+        if (listen->is_default) {
+            IndexEntry entry = { record, listen->line, block, NULL };
+            guint n_before = 0;
+            GArray *defaults = add_entry(index, record, TABLE_DEFAULTS, listen->endpoint, &entry, &n_before);
+            for (guint i = 0; i < n_before; i++) {
+                report(conflicts, CONFLICT_DUPLICATE_DEFAULT, listen->endpoint, "default_server", &entry,
+                       "default_server", &g_array_index(defaults, IndexEntry, i));
+            }
+        }
+        
+        for (guint n = 0; n < names->len; n++) {
+            ServerName *name = &g_array_index(names, ServerName, n);
+            if (name->name[0] == '.') {
+                // ".example.com" is shorthand for example.com plus *.example.com
+                gchar *wildcard = g_strdup_printf("*%s", name->name);
+                index_name(index, record, listen->endpoint, name->name + 1, name->line, block, conflicts);
+                index_name(index, record, listen->endpoint, wildcard, name->line, block, conflicts);
+                g_free(wildcard);
+            } else {
+                index_name(index, record, listen->endpoint, name->name, name->line, block, conflicts);
+            }
+        }
+        g_free(listen->endpoint);
+    }
+    
+    for (guint n = 0; n < names->len; n++) {
+        g_free(g_array_index(names, ServerName, n).name);
+    }
+    g_array_set_size(names, 0);
+    g_array_set_size(listens, 0);
+}
+
+static void add_listen(GArray *listens, const gchar *value, gboolean is_default, guint32 line) {
+    Listen listen = { normalize_listen(value), is_default, line };
+    g_array_append_val(listens, listen);
+}
+
+static void add_name(GArray *names, const gchar *value, guint32 line) {
+    // Regex names are case sensitive, host names are not
+    ServerName name = { *value == '~' ? g_strdup(value) : g_ascii_strdown(value, -1), line };
+    g_array_append_val(names, name);
+}
+
+typedef struct {
+    ConflictIndex *index;
+    FileRecord *record;
+    GPtrArray *conflicts;
+    GArray *listens;
+    GArray *names;
+} IndexContext;
+
+static void index_node(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    IndexContext *ctx = user_data;
+    if (!node->is_block || !conf_span_equal(doc, node->name, "server")) return;
+    
+    for (const ConfNode *child = node->children; child; child = child->next) {
+        if (conf_span_equal(doc, child->name, "listen") && child->n_args > 0) {
+            gboolean is_default = FALSE;
+            for (guint32 i = 1; i < child->n_args; i++) {
+                if (conf_span_equal(doc, child->args[i], "default_server") ||
+                    conf_span_equal(doc, child->args[i], "default")) {
+                    is_default = TRUE;
+                }
+            }
+            gchar *value = conf_span_dup_value(doc, child->args[0]);
+            add_listen(ctx->listens, value, is_default, child->line);
+            g_free(value);
+        } else if (conf_span_equal(doc, child->name, "server_name")) {
+            for (guint32 i = 0; i < child->n_args; i++) {
+                gchar *value = conf_span_dup_value(doc, child->args[i]);
+                add_name(ctx->names, value, child->line);
+                g_free(value);
+            }
+        }
+    }
+    index_server(ctx->index, ctx->record, node->line, ctx->listens, ctx->names, ctx->conflicts);
+}
+
+static IndexContext begin_file(ConflictIndex *index, const gchar *path) {
+    conflict_index_remove_file(index, path);
+    
+    FileRecord *record = g_new0(FileRecord, 1);
+    record->path = g_strdup(path);
+    record->keys = g_array_new(FALSE, FALSE, sizeof(RecordKey));
+    g_hash_table_insert(index->files, record->path, record);
+    
+    IndexContext ctx = { index, record, g_ptr_array_new_with_free_func(conflict_free),
+                         g_array_new(FALSE, FALSE, sizeof(Listen)), g_array_new(FALSE, FALSE, sizeof(ServerName)) };
+    return ctx;
+}
+
+static GPtrArray* end_file(IndexContext *ctx) {
+    g_array_free(ctx->names, TRUE);
+    g_array_free(ctx->listens, TRUE);
+    return ctx->conflicts;
+}
+
+GPtrArray* conflict_index_update_file(ConflictIndex *index, const gchar *path, const ConfDocument *doc) {
+    IndexContext ctx = begin_file(index, path);
+    conf_document_foreach(doc, index_node, &ctx);
+    return end_file(&ctx);
+}
+
+// Items come in document order, so those of one server block are
+// consecutive (blocks nested in it have no listen or server_name)
+GPtrArray* conflict_index_update_summary(ConflictIndex *index, const MetaSummary *summary) {
+    IndexContext ctx = begin_file(index, summary->path);
+    guint32 block = 0;
+    for (guint i = 0; i < summary->items->len; i++) {
+        const MetaItem *item = &g_array_index(summary->items, MetaItem, i);
+        if (item->block == 0 || (item->kind != META_LISTEN && item->kind != META_SERVER_NAME)) continue;
+        if (item->block != block && block != 0) {
+            index_server(index, ctx.record, block, ctx.listens, ctx.names, ctx.conflicts);
+        }
+        block = item->block;
+        if (item->kind == META_LISTEN) {
+            add_listen(ctx.listens, item->value, (item->flags & META_FLAG_DEFAULT) != 0, item->line);
+        } else {
+            add_name(ctx.names, item->value, item->line);
+        }
+    }
+    if (block != 0) index_server(index, ctx.record, block, ctx.listens, ctx.names, ctx.conflicts);
+    return end_file(&ctx);
+}
+
+guint conflict_index_get_n_names(ConflictIndex *index) {
+    return g_hash_table_size(index->tables[TABLE_NAMES]);
+}
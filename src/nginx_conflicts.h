@@ -0,0 +1,47 @@
+#ifndef NGINX_CONFLICTS_H
+#define NGINX_CONFLICTS_H
+
+#include <glib.h>
+#include "nginx_meta.h"
+#include "nginx_parser.h"
+
+// Index of virtual hosts across all configs: (listen address:port,
+// server_name) -> defining file and line. Files are added and replaced
+// one at a time, so a save only touches the entries of the saved file.
+// Memory is per name; no config text is kept.
+
+typedef enum {
+    CONFLICT_DUPLICATE_NAME,    // same name on the same address in two server blocks
+    CONFLICT_DUPLICATE_DEFAULT, // default_server set twice for one address
+    CONFLICT_WILDCARD_OVERLAP   // an exact name is also covered by a wildcard
+} ConflictKind;
+
+typedef struct {
+    ConflictKind kind;
+    gchar *endpoint;            // "*:80", "127.0.0.1:8080", "[::]:443"
+    gchar *name;                // name in the file being indexed
+    gchar *path;
+    guint line;
+    gchar *other_name;          // the name it clashes with
+    gchar *other_path;
+    guint other_line;
+} Conflict;
+
+typedef struct _ConflictIndex ConflictIndex;
+
+ConflictIndex* conflict_index_new(void);
+void conflict_index_free(ConflictIndex *index);
+
+// Replaces the entries of path with the server blocks in doc and returns
+// the conflicts that involve them (Conflict*, owned by the caller)
+GPtrArray* conflict_index_update_file(ConflictIndex *index, const gchar *path, const ConfDocument *doc);
+// The same from a cached summary of the file, without reading it
+GPtrArray* conflict_index_update_summary(ConflictIndex *index, const MetaSummary *summary);
+void conflict_index_remove_file(ConflictIndex *index, const gchar *path);
+
+guint conflict_index_get_n_names(ConflictIndex *index);
+
+void conflict_free(gpointer conflict);
+gchar* conflict_describe(const Conflict *conflict);
+
+#endif // NGINX_CONFLICTS_H
@@ -0,0 +1,604 @@
+#include "nginx_core.h"
+#include <glib/gstdio.h>
+#include <string.h>
+
+NginxCore* nginx_core_new(const gchar *main_conf, const gchar *conf_dir, const gchar *hosts_file,
+                          CoreLogFunc log, gpointer log_data) {
+    NginxCore *core = g_new0(NginxCore, 1);
+    core->main_conf = g_strdup(main_conf);
+    core->conf_dir = g_strdup(conf_dir);
+    core->hosts_file = g_strdup(hosts_file);
+    core->includes = include_graph_new(main_conf);
+    core->log = log;
+    core->log_data = log_data;
+    return core;
+}
+
+void nginx_core_free(NginxCore *core) {
+    if (!core) return;
+    conflict_index_free(core->conflicts);
+    meta_cache_free(core->meta);
+    g_free(core->meta_path);
+    search_index_free(core->search);
+    history_store_free(core->history);
+    include_graph_free(core->includes);
+    g_free(core->pid_file);
+    g_free(core->hosts_file);
+    g_free(core->conf_dir);
+    g_free(core->main_conf);
+    g_free(core);
+}
+
+static void core_log_message(NginxCore *core, LogSeverity severity, const gchar *source, const gchar *message) {
+    if (core->log) {
+        core->log(severity, source, message, core->log_data);
+    }
+}
+
+void nginx_core_log(NginxCore *core, LogSeverity severity, const gchar *format, ...) {
+    va_list args;
+    va_start(args, format);
+    gchar *message = g_strdup_vprintf(format, args);
+    va_end(args);
+    core_log_message(core, severity, "nginxui", message);
+    g_free(message);
+}
+
+gchar* nginx_core_get_path(NginxCore *core, const gchar *filename) {
+    return g_strdup_printf("%s/%s", core->conf_dir, filename);
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b) {
+    return strcmp(*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+GPtrArray* nginx_core_list_configs(const gchar *dir, GError **error) {
+    GDir *handle = g_dir_open(dir, 0, error);
+    if (!handle) return NULL;
+    
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    const gchar *filename;
+    while ((filename = g_dir_read_name(handle)) != NULL) {
+        if (g_str_has_suffix(filename, ".conf")) {
+            g_ptr_array_add(names, g_strdup(filename));
+        }
+    }
+    g_dir_close(handle);
+    g_ptr_array_sort(names, compare_names);
+    return names;
+}
+
+gboolean nginx_core_check_filename(const gchar *filename, GError **error) {
+    if (!filename || !*filename || strchr(filename, '/') || filename[0] == '.') {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME, "Invalid filename");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+guint nginx_core_report_parse_errors(NginxCore *core, const gchar *filename, const ConfDocument *doc) {
+    for (guint i = 0; i < doc->n_errors; i++) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s:%u: %s", filename,
+                       doc->errors[i].line, doc->errors[i].message);
+    }
+    return doc->n_errors;
+}
+
+gboolean nginx_core_sync_hosts(NginxCore *core, const ConfDocument * const *docs, guint n_docs) {
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_HOSTS);
+    GPtrArray *domains = g_ptr_array_new_with_free_func(g_free);
+    for (guint d = 0; d < n_docs; d++) {
+        gchar **names = extract_domains_from_document(docs[d]);
+        for (gint i = 0; names[i]; i++) {
+            g_ptr_array_add(domains, names[i]);
+        }
+        g_free(names);
+    }
+    g_ptr_array_add(domains, NULL);
+    
+    GError *error = NULL;
+    GPtrArray *added = hosts_sync_domains(core->hosts_file, (const gchar * const *)domains->pdata, &error);
+    // Bytes are the hosts file that was scanned
+    GStatBuf st;
+    trace_end(&span, trace_is_recording(&span) && g_stat(core->hosts_file, &st) == 0 ? (guint64)st.st_size : 0);
+    g_ptr_array_unref(domains);
+    if (!added) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    
+    for (guint i = 0; i < added->len; i++) {
+        nginx_core_log(core, LOG_SEVERITY_INFO, "Added domain '%s' to %s",
+                       (const gchar *)g_ptr_array_index(added, i), core->hosts_file);
+    }
+    g_ptr_array_unref(added);
+    return TRUE;
+}
+
+void nginx_core_record_history(NginxCore *core, const gchar *path, const gchar *content, gsize length) {
+    if (!core->history) return;
+    GError *error = NULL;
+    guint id = content ? history_store_record(core->history, path, content, length, &error)
+                       : history_store_record_deletion(core->history, path, &error);
+    if (!id && error) {
+        nginx_core_log(core, LOG_SEVERITY_WARNING, "Warning: Cannot record history: %s", error->message);
+        g_error_free(error);
+    }
+}
+
+// Records what is on disk before it is replaced or removed. Usually that
+// is the newest revision already and nothing is written, but a file never
+// saved through nginxui, or changed outside it, gets its content kept.
+static void record_previous(NginxCore *core, const gchar *filepath) {
+    gchar *content = NULL;
+    gsize length = 0;
+    if (core->history && g_file_get_contents(filepath, &content, &length, NULL)) {
+        nginx_core_record_history(core, filepath, content, length);
+        g_free(content);
+    }
+}
+
+gchar* nginx_core_create_config(NginxCore *core, const gchar *name, GError **error) {
+    gchar *filename = g_str_has_suffix(name, ".conf") ? g_strdup(name) : g_strdup_printf("%s.conf", name);
+    if (!nginx_core_check_filename(filename, error)) {
+        g_free(filename);
+        return NULL;
+    }
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_CREATE);
+    
+    // Add default server block
+    gchar *domain_name = g_strndup(filename, strlen(filename) - strlen(".conf"));
+    gchar *default_config = g_strdup_printf(
+        "server {\n"
+        "    listen 80;\n"
+        "    server_name %s;\n"
+        "    \n"
+        "    location / {\n"
+        "        root /var/www/html;\n"
+        "        index index.html;\n"
+        "    }\n"
+        "}\n",
+        domain_name
+    );
+    
+    gchar *filepath = nginx_core_get_path(core, filename);
+    gboolean created = helper_write_file(filepath, default_config, strlen(default_config), 0644, error);
+    if (created) {
+        // Extract domain and add to the hosts file
+        ConfDocument *doc = conf_document_parse(default_config, strlen(default_config));
+        nginx_core_sync_hosts(core, (const ConfDocument * const *)&doc, 1);
+        conf_document_free(doc);
+        if (core->search) {
+            search_index_update_file(core->search, filepath, default_config, strlen(default_config));
+        }
+        nginx_core_record_history(core, filepath, default_config, strlen(default_config));
+        nginx_core_log(core, LOG_SEVERITY_SUCCESS, "Created: %s", filename);
+    }
+    trace_end(&span, strlen(default_config));
+    
+    g_free(filepath);
+    g_free(default_config);
+    g_free(domain_name);
+    if (!created) {
+        g_free(filename);
+        return NULL;
+    }
+    return filename;
+}
+
+gboolean nginx_core_save_config(NginxCore *core, const gchar *filename, const gchar *content,
+                                gsize length, const ConfDocument *doc, GError **error) {
+    if (!nginx_core_check_filename(filename, error)) return FALSE;
+    gint64 started = g_get_monotonic_time();
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_SAVE);
+    
+    // One parse serves validation, domain extraction and the conflict index
+    ConfDocument *own_doc = doc ? NULL : conf_document_parse(content, length);
+    if (own_doc) doc = own_doc;
+    nginx_core_report_parse_errors(core, filename, doc);
+    
+    gchar *filepath = nginx_core_get_path(core, filename);
+    record_previous(core, filepath);
+    gboolean saved = helper_write_file(filepath, content, length, 0644, error);
+    if (saved) {
+        nginx_core_sync_hosts(core, &doc, 1);
+        
+        // The file may have gained or lost includes
+        include_graph_invalidate(core->includes, filepath);
+        include_graph_update_file(core->includes, filepath);
+        nginx_core_update_conflicts(core, filepath, doc);
+        if (core->search) {
+            search_index_update_file(core->search, filepath, content, length);
+        }
+        nginx_core_record_history(core, filepath, content, length);
+        nginx_core_log(core, LOG_SEVERITY_SUCCESS, "Saved: %s (%.1f ms)", filename,
+                       (g_get_monotonic_time() - started) / 1000.0);
+    }
+    trace_end(&span, length);
+    
+    g_free(filepath);
+    conf_document_free(own_doc);
+    return saved;
+}
+
+gboolean nginx_core_delete_config(NginxCore *core, const gchar *filename, GError **error) {
+    if (!nginx_core_check_filename(filename, error)) return FALSE;
+    
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_DELETE);
+    gchar *filepath = nginx_core_get_path(core, filename);
+    record_previous(core, filepath);
+    gboolean deleted = helper_unlink(filepath, error);
+    if (deleted) {
+        if (core->conflicts) {
+            conflict_index_remove_file(core->conflicts, filepath);
+        }
+        if (core->search) {
+            search_index_remove_file(core->search, filepath);
+        }
+        nginx_core_record_history(core, filepath, NULL, 0);
+        nginx_core_log(core, LOG_SEVERITY_SUCCESS, "Deleted: %s", filename);
+    }
+    trace_end(&span, 0);
+    g_free(filepath);
+    return deleted;
+}
+
+// Logs each conflict as a warning; nginx itself only warns about most of
+// them, and the losing server block silently never matches
+static void report_conflicts(NginxCore *core, GPtrArray *conflicts) {
+    for (guint i = 0; i < conflicts->len; i++) {
+        gchar *description = conflict_describe(g_ptr_array_index(conflicts, i));
+        nginx_core_log(core, LOG_SEVERITY_WARNING, "Warning: %s", description);
+        g_free(description);
+    }
+}
+
+typedef struct {
+    ConflictIndex *index;
+    GPtrArray *conflicts;
+} IndexDocumentsContext;
+
+static void index_document(const gchar *path, const ConfDocument *doc, gpointer user_data) {
+    IndexDocumentsContext *ctx = user_data;
+    // Every pair is found once, by whichever file is indexed second
+    GPtrArray *conflicts = conflict_index_update_file(ctx->index, path, doc);
+    g_ptr_array_extend_and_steal(ctx->conflicts, conflicts);
+}
+
+void nginx_core_index_conflicts(NginxCore *core) {
+    conflict_index_free(core->conflicts);
+    core->conflicts = conflict_index_new();
+    GError *error = NULL;
+    if (include_graph_update(core->includes, &error) < 0) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: Cannot index server names: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    IndexDocumentsContext ctx = { core->conflicts, g_ptr_array_new_with_free_func(conflict_free) };
+    include_graph_foreach_document(core->includes, index_document, &ctx);
+    nginx_core_log(core, LOG_SEVERITY_INFO, "Indexed %u server name(s) in %u file(s), %u conflict(s)",
+                   conflict_index_get_n_names(core->conflicts),
+                   include_graph_get_n_files(core->includes), ctx.conflicts->len);
+    report_conflicts(core, ctx.conflicts);
+    g_ptr_array_unref(ctx.conflicts);
+}
+
+static void collect_document_path_array(const gchar *path, const ConfDocument *doc, gpointer user_data) {
+    (void)doc; // Unused parameter
+    g_ptr_array_add(user_data, g_strdup(path));
+}
+
+gboolean nginx_core_load_metadata(NginxCore *core, const gchar *cache_path) {
+    g_free(core->meta_path);
+    core->meta_path = g_strdup(cache_path);
+    meta_cache_free(core->meta);
+    // A missing or outdated cache only means the refresh reads everything.
+    // The index exists either way, so saves made before the refresh is
+    // applied are indexed.
+    conflict_index_free(core->conflicts);
+    core->conflicts = conflict_index_new();
+    core->meta = meta_cache_open(cache_path, NULL);
+    if (!core->meta) return FALSE;
+    
+    GPtrArray *conflicts = g_ptr_array_new_with_free_func(conflict_free);
+    guint n_files = meta_cache_get_n_files(core->meta);
+    for (guint i = 0; i < n_files; i++) {
+        MetaSummary *summary = meta_cache_get_summary(core->meta, i);
+        if (!summary) continue;
+        g_ptr_array_extend_and_steal(conflicts, conflict_index_update_summary(core->conflicts, summary));
+        meta_summary_free(summary);
+    }
+    nginx_core_log(core, LOG_SEVERITY_INFO, "Indexed %u server name(s) in %u cached file(s), %u conflict(s)",
+                   conflict_index_get_n_names(core->conflicts), n_files, conflicts->len);
+    report_conflicts(core, conflicts);
+    g_ptr_array_unref(conflicts);
+    return TRUE;
+}
+
+void metadata_refresh_free(MetadataRefresh *refresh) {
+    if (!refresh) return;
+    include_graph_free(refresh->graph);
+    g_ptr_array_unref(refresh->changed);
+    g_ptr_array_unref(refresh->summaries);
+    g_ptr_array_unref(refresh->removed);
+    g_clear_error(&refresh->error);
+    g_clear_error(&refresh->save_error);
+    g_free(refresh);
+}
+
+MetadataRefresh* nginx_core_refresh_metadata(NginxCore *core) {
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_METADATA);
+    MetadataRefresh *refresh = g_new0(MetadataRefresh, 1);
+    refresh->graph = include_graph_new(core->main_conf);
+    refresh->summaries = g_ptr_array_new_with_free_func(meta_summary_free);
+    refresh->changed = g_ptr_array_new();
+    refresh->removed = g_ptr_array_new_with_free_func(g_free);
+    if (include_graph_update(refresh->graph, &refresh->error) < 0) {
+        trace_end(&span, 0);
+        return refresh;
+    }
+    
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    include_graph_foreach_document(refresh->graph, collect_document_path_array, paths);
+    refresh->n_files = paths->len;
+    GHashTable *reached = g_hash_table_new(g_str_hash, g_str_equal);
+    GArray *fresh = g_array_new(FALSE, FALSE, sizeof(guint));
+    guint64 bytes = 0;
+    for (guint p = 0; p < paths->len; p++) {
+        const gchar *path = g_ptr_array_index(paths, p);
+        g_hash_table_add(reached, (gpointer)path);
+        IncludeFileKey key, cached_key;
+        guint8 digest[META_DIGEST_SIZE];
+        include_graph_get_key(refresh->graph, path, &key);
+        gint i = core->meta ? meta_cache_find(core->meta, path) : -1;
+        gboolean cached = i >= 0 && meta_cache_get_key(core->meta, i, &cached_key, digest);
+        if (cached && include_file_key_equal(&key, &cached_key)) {
+            guint index = (guint)i;
+            g_array_append_val(fresh, index);
+            continue;
+        }
+        
+        // Stale: the parse is there already, only the summary is new
+        const ConfDocument *doc = include_graph_get_document(refresh->graph, path);
+        MetaSummary *summary = meta_summary_new(path, &key, doc->data, doc->length, doc);
+        bytes += doc->length;
+        g_ptr_array_add(refresh->summaries, summary);
+        if (cached && memcmp(digest, summary->digest, META_DIGEST_SIZE) == 0) {
+            refresh->n_touched++;
+        } else {
+            g_ptr_array_add(refresh->changed, summary);
+        }
+    }
+    
+    guint n_cached = core->meta ? meta_cache_get_n_files(core->meta) : 0;
+    for (guint i = 0; i < n_cached; i++) {
+        const gchar *path = meta_cache_get_path(core->meta, i);
+        if (path && !g_hash_table_contains(reached, path)) g_ptr_array_add(refresh->removed, g_strdup(path));
+    }
+    
+    // Unchanged entries are only read back when the file is rewritten
+    if (core->meta_path && (refresh->summaries->len > 0 || refresh->removed->len > 0)) {
+        GPtrArray *all = g_ptr_array_new_with_free_func(meta_summary_free);
+        for (guint f = 0; f < fresh->len; f++) {
+            MetaSummary *summary = meta_cache_get_summary(core->meta, g_array_index(fresh, guint, f));
+            if (summary) g_ptr_array_add(all, summary);
+        }
+        GPtrArray *save = g_ptr_array_new();
+        g_ptr_array_extend(save, all, NULL, NULL);
+        g_ptr_array_extend(save, refresh->summaries, NULL, NULL);
+        refresh->saved = meta_cache_save(core->meta_path, save, &refresh->save_error);
+        g_ptr_array_unref(save);
+        g_ptr_array_unref(all);
+    }
+    g_array_free(fresh, TRUE);
+    g_hash_table_unref(reached);
+    g_ptr_array_unref(paths);
+    trace_end(&span, bytes);
+    return refresh;
+}
+
+void nginx_core_apply_metadata(NginxCore *core, MetadataRefresh *refresh) {
+    // A graph the core built on its own meanwhile is at least as new
+    if (include_graph_get_n_files(core->includes) == 0) {
+        include_graph_free(core->includes);
+        core->includes = g_steal_pointer(&refresh->graph);
+    }
+    if (refresh->error) {
+        nginx_core_log(core, LOG_SEVERITY_ERROR, "Error: Cannot index server names: %s", refresh->error->message);
+        return;
+    }
+    
+    if (!core->conflicts) core->conflicts = conflict_index_new();
+    for (guint i = 0; i < refresh->removed->len; i++) {
+        conflict_index_remove_file(core->conflicts, g_ptr_array_index(refresh->removed, i));
+    }
+    GPtrArray *conflicts = g_ptr_array_new_with_free_func(conflict_free);
+    for (guint i = 0; i < refresh->changed->len; i++) {
+        const MetaSummary *summary = g_ptr_array_index(refresh->changed, i);
+        // A save since the refresh read the file has indexed it already
+        IncludeFileKey key;
+        include_file_key_stat(summary->path, &key);
+        if (!include_file_key_equal(&key, &summary->key)) continue;
+        g_ptr_array_extend_and_steal(conflicts, conflict_index_update_summary(core->conflicts, summary));
+    }
+    nginx_core_log(core, LOG_SEVERITY_INFO,
+                   "Indexed %u server name(s) in %u file(s), %u changed and %u removed since the cache, %u conflict(s)",
+                   conflict_index_get_n_names(core->conflicts), refresh->n_files, refresh->changed->len,
+                   refresh->removed->len, conflicts->len);
+    report_conflicts(core, conflicts);
+    g_ptr_array_unref(conflicts);
+    
+    if (refresh->save_error) {
+        nginx_core_log(core, LOG_SEVERITY_WARNING, "Warning: Cannot save the metadata cache: %s",
+                       refresh->save_error->message);
+    } else if (refresh->saved) {
+        meta_cache_free(core->meta);
+        core->meta = meta_cache_open(core->meta_path, NULL);
+    }
+}
+
+// Files nginx does not load are dropped from the index, as they cannot
+// conflict with anything
+void nginx_core_update_conflicts(NginxCore *core, const gchar *path, const ConfDocument *doc) {
+    if (!core->conflicts) return;
+    if (!doc || !include_graph_contains(core->includes, path)) {
+        conflict_index_remove_file(core->conflicts, path);
+        return;
+    }
+    GPtrArray *conflicts = conflict_index_update_file(core->conflicts, path, doc);
+    report_conflicts(core, conflicts);
+    g_ptr_array_unref(conflicts);
+}
+
+static void collect_document_path(const gchar *path, const ConfDocument *doc, gpointer user_data) {
+    (void)doc; // Unused parameter
+    g_hash_table_add(user_data, g_strdup(path));
+}
+
+gchar** nginx_core_list_search_files(NginxCore *core) {
+    GHashTable *paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    // An unreadable main config still leaves the config directory
+    if (include_graph_update(core->includes, NULL) >= 0) {
+        include_graph_foreach_document(core->includes, collect_document_path, paths);
+    }
+    GPtrArray *names = nginx_core_list_configs(core->conf_dir, NULL);
+    for (guint i = 0; names && i < names->len; i++) {
+        g_hash_table_add(paths, nginx_core_get_path(core, g_ptr_array_index(names, i)));
+    }
+    if (names) g_ptr_array_unref(names);
+    
+    GPtrArray *files = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer path;
+    g_hash_table_iter_init(&iter, paths);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) {
+        g_hash_table_iter_steal(&iter);
+        g_ptr_array_add(files, path);
+    }
+    g_hash_table_unref(paths);
+    g_ptr_array_sort(files, compare_names);
+    g_ptr_array_add(files, NULL);
+    return (gchar **)g_ptr_array_free(files, FALSE);
+}
+
+static gint compare_paths_main_first(gconstpointer a, gconstpointer b, gpointer user_data) {
+    const gchar *path_a = *(const gchar * const *)a;
+    const gchar *path_b = *(const gchar * const *)b;
+    const gchar *main_conf = user_data;
+    if (strcmp(path_a, main_conf) == 0) return -1;
+    if (strcmp(path_b, main_conf) == 0) return 1;
+    return strcmp(path_a, path_b);
+}
+
+typedef struct {
+    gchar *path;
+    gchar *text;
+    gsize length;
+    ConfDocument *doc;          // parsed by route_snapshot_build
+} RouteSource;
+
+struct _RouteSnapshot {
+    gint ref_count;
+    guint serial;               // of the include graph the files were copied from
+    GPtrArray *sources;         // RouteSource*, in the order nginx reads them
+    RouteTable *table;          // NULL until built
+};
+
+static void route_source_free(gpointer data) {
+    RouteSource *source = data;
+    conf_document_free(source->doc);
+    g_free(source->text);
+    g_free(source->path);
+    g_free(source);
+}
+
+RouteSnapshot* nginx_core_snapshot_routes(NginxCore *core) {
+    RouteSnapshot *snapshot = g_new0(RouteSnapshot, 1);
+    snapshot->ref_count = 1;
+    snapshot->sources = g_ptr_array_new_with_free_func(route_source_free);
+    if (include_graph_get_n_files(core->includes) == 0) include_graph_update(core->includes, NULL);
+    snapshot->serial = include_graph_get_serial(core->includes);
+    
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    include_graph_foreach_document(core->includes, collect_document_path_array, paths);
+    g_ptr_array_sort_with_data(paths, compare_paths_main_first, core->main_conf);
+    for (guint i = 0; i < paths->len; i++) {
+        const ConfDocument *doc = include_graph_get_document(core->includes, g_ptr_array_index(paths, i));
+        RouteSource *source = g_new0(RouteSource, 1);
+        source->path = g_strdup(g_ptr_array_index(paths, i));
+        source->text = g_strndup(doc->data, doc->length);
+        source->length = doc->length;
+        g_ptr_array_add(snapshot->sources, source);
+    }
+    g_ptr_array_unref(paths);
+    return snapshot;
+}
+
+gboolean nginx_core_routes_current(NginxCore *core, const RouteSnapshot *snapshot) {
+    return snapshot->serial == include_graph_get_serial(core->includes);
+}
+
+RouteSnapshot* route_snapshot_ref(RouteSnapshot *snapshot) {
+    g_atomic_int_inc(&snapshot->ref_count);
+    return snapshot;
+}
+
+void route_snapshot_unref(RouteSnapshot *snapshot) {
+    if (!snapshot || !g_atomic_int_dec_and_test(&snapshot->ref_count)) return;
+    route_table_free(snapshot->table);
+    g_ptr_array_unref(snapshot->sources);
+    g_free(snapshot);
+}
+
+void route_snapshot_build(RouteSnapshot *snapshot) {
+    if (snapshot->table) return;
+    snapshot->table = route_table_new();
+    for (guint i = 0; i < snapshot->sources->len; i++) {
+        RouteSource *source = g_ptr_array_index(snapshot->sources, i);
+        source->doc = conf_document_parse(source->text, source->length);
+        route_table_add_document(snapshot->table, source->path, source->doc);
+    }
+}
+
+const RouteTable* route_snapshot_get_table(const RouteSnapshot *snapshot) {
+    return snapshot->table;
+}
+
+RouteTable* route_snapshot_build_with(const RouteSnapshot *snapshot, const gchar *path, const ConfDocument *doc) {
+    RouteTable *table = route_table_new_sharing(snapshot->table);
+    for (guint i = 0; i < snapshot->sources->len; i++) {
+        const RouteSource *source = g_ptr_array_index(snapshot->sources, i);
+        gboolean replaced = strcmp(source->path, path) == 0;
+        route_table_add_document(table, source->path, replaced ? doc : source->doc);
+    }
+    return table;
+}
+
+typedef struct {
+    NginxCore *core;
+    guint64 bytes;
+} NginxOutputContext;
+
+static void on_nginx_output(const gchar *line, gpointer user_data) {
+    NginxOutputContext *ctx = user_data;
+    ctx->bytes += strlen(line);
+    core_log_message(ctx->core, log_severity_guess(line), "nginx", line);
+}
+
+gboolean nginx_core_run_nginx(NginxCore *core, HelperOp op, gint *exit_status, GError **error) {
+    TraceSpan span;
+    trace_begin(&span, op == HELPER_OP_NGINX_RELOAD ? TRACE_OP_NGINX_RELOAD : TRACE_OP_NGINX_TEST);
+    NginxOutputContext ctx = { core, 0 };
+    HelperClient *client = helper_client_get_default(error);
+    gboolean ran = client && helper_client_run_nginx(client, op, on_nginx_output, &ctx, exit_status, error);
+    // Bytes are the command's output
+    trace_end(&span, ctx.bytes);
+    return ran;
+}
@@ -0,0 +1,144 @@
+#ifndef NGINX_CORE_H
+#define NGINX_CORE_H
+
+#include <glib.h>
+#include "nginx_helper.h"
+#include "nginx_hosts.h"
+#include "nginx_include.h"
+#include "nginx_conflicts.h"
+#include "nginx_history.h"
+#include "nginx_log.h"
+#include "nginx_meta.h"
+#include "nginx_route.h"
+#include "nginx_search.h"
+#include "nginx_trace.h"
+
+// Config, hosts and nginx operations shared by the GTK front-end and the
+// batch mode. Nothing here needs a display: results are reported through
+// the log function, which each front-end routes where it wants.
+
+#define NGINX_MAIN_CONF "/etc/nginx/nginx.conf"
+#define NGINX_CONF_DIR "/etc/nginx/conf.d"
+#define HOSTS_FILE "/etc/hosts"
+
+typedef void (*CoreLogFunc)(LogSeverity severity, const gchar *source,
+                            const gchar *message, gpointer user_data);
+
+typedef struct {
+    gchar *main_conf;
+    gchar *conf_dir;
+    gchar *hosts_file;
+    gchar *pid_file;            // nginx master's pid file, NULL for the main config's pid directive
+    IncludeGraph *includes;     // include graph rooted at the main config
+    ConflictIndex *conflicts;   // server_name/listen index of the included files
+    MetaCache *meta;            // summaries of the included files from the last session
+    gchar *meta_path;
+    SearchIndex *search;        // full-text index, kept up to date on saves when set
+    HistoryStore *history;      // revisions of every save and delete, when set
+    CoreLogFunc log;            // may be called from any thread that runs nginx
+    gpointer log_data;
+} NginxCore;
+
+NginxCore* nginx_core_new(const gchar *main_conf, const gchar *conf_dir, const gchar *hosts_file,
+                          CoreLogFunc log, gpointer log_data);
+void nginx_core_free(NginxCore *core);
+
+void nginx_core_log(NginxCore *core, LogSeverity severity, const gchar *format, ...) G_GNUC_PRINTF(3, 4);
+
+// Path of a file in the config directory
+gchar* nginx_core_get_path(NginxCore *core, const gchar *filename);
+
+// Sorted names of the .conf files in dir
+GPtrArray* nginx_core_list_configs(const gchar *dir, GError **error);
+
+// Accepts plain file names in the config directory. The helper only takes
+// canonical paths, but this rejects anything leaving the directory early.
+gboolean nginx_core_check_filename(const gchar *filename, GError **error);
+
+// Logs what the parser found wrong with a config; nginx -t has the final say
+guint nginx_core_report_parse_errors(NginxCore *core, const gchar *filename, const ConfDocument *doc);
+
+// Adds every server_name of the configs that is missing from the hosts
+// file, rewriting it at most once
+gboolean nginx_core_sync_hosts(NginxCore *core, const ConfDocument * const *docs, guint n_docs);
+
+// Writes a server block for name (".conf" is appended when missing) and
+// returns the file name that was created
+gchar* nginx_core_create_config(NginxCore *core, const gchar *name, GError **error);
+
+// Writes a config, adds its names to the hosts file and re-indexes it.
+// doc is the parse of content when the caller already has one. With a
+// history store, what was on disk and what was written both become
+// revisions, as does a delete.
+gboolean nginx_core_save_config(NginxCore *core, const gchar *filename, const gchar *content,
+                                gsize length, const ConfDocument *doc, GError **error);
+gboolean nginx_core_delete_config(NginxCore *core, const gchar *filename, GError **error);
+
+// Records content as the newest revision of path, or its deletion when
+// content is NULL. Does nothing without a history store; failures are
+// logged as warnings.
+void nginx_core_record_history(NginxCore *core, const gchar *path, const gchar *content, gsize length);
+
+// Builds the conflict index from every file reachable from the main config
+void nginx_core_index_conflicts(NginxCore *core);
+
+// Opens the metadata cache at cache_path and builds the conflict index
+// from it without reading any config. FALSE when there is no usable
+// cache; the index is then empty until the refresh is applied.
+gboolean nginx_core_load_metadata(NginxCore *core, const gchar *cache_path);
+
+typedef struct {
+    IncludeGraph *graph;        // built from the disk
+    GPtrArray *summaries;       // MetaSummary* of the stale files
+    GPtrArray *changed;         // those of them whose contents changed, or that are new
+    GPtrArray *removed;         // gchar* paths cached but no longer included
+    guint n_files;
+    guint n_touched;            // stale only by their stat key
+    gboolean saved;
+    GError *error;              // the main config is unreadable
+    GError *save_error;
+} MetadataRefresh;
+
+// Builds a new include graph and checks every file against the metadata
+// cache: only stale files are summarized, and the cache is rewritten if
+// any were. Runs on a worker; it reads only the main config path and the
+// cache, which stay put until the refresh is applied.
+MetadataRefresh* nginx_core_refresh_metadata(NginxCore *core);
+// On the thread that owns core: adopts the graph unless the core built
+// one meanwhile, re-indexes the changed files and logs their conflicts
+void nginx_core_apply_metadata(NginxCore *core, MetadataRefresh *refresh);
+void metadata_refresh_free(MetadataRefresh *refresh);
+
+// Re-indexes one file after it was written and logs its conflicts
+void nginx_core_update_conflicts(NginxCore *core, const gchar *path, const ConfDocument *doc);
+
+// Every file the full-text index covers: the files reachable from the
+// main config and the .conf files of the config directory. Sorted paths.
+gchar** nginx_core_list_search_files(NginxCore *core);
+
+// Copies of every file nginx loads, in the order it reads them: nginx.conf
+// first, then by path, as glob includes expand sorted. They are taken from
+// the include graph as the last update left it, so taking one stats
+// nothing; only an empty graph is read first. Once built, a snapshot is
+// read-only and worker threads may share it.
+typedef struct _RouteSnapshot RouteSnapshot;
+
+RouteSnapshot* nginx_core_snapshot_routes(NginxCore *core);
+// FALSE once the include graph parsed or dropped a file since the snapshot
+gboolean nginx_core_routes_current(NginxCore *core, const RouteSnapshot *snapshot);
+RouteSnapshot* route_snapshot_ref(RouteSnapshot *snapshot);
+void route_snapshot_unref(RouteSnapshot *snapshot);
+
+// Parses the copies and builds their route table, on any one thread
+void route_snapshot_build(RouteSnapshot *snapshot);
+const RouteTable* route_snapshot_get_table(const RouteSnapshot *snapshot);
+// The routes with doc standing in for path, e.g. an unsaved buffer, built
+// with the regexes of the snapshot's table; any thread, once it is built
+RouteTable* route_snapshot_build_with(const RouteSnapshot *snapshot, const gchar *path,
+                                      const ConfDocument *doc);
+
+// Runs nginx -t or the reload in the helper, blocking the calling thread.
+// Output lines are logged from that thread with source "nginx".
+gboolean nginx_core_run_nginx(NginxCore *core, HelperOp op, gint *exit_status, GError **error);
+
+#endif // NGINX_CORE_H
@@ -0,0 +1,147 @@
+#include "nginx_documents.h"
+#include <string.h>
+
+struct _DocumentCache {
+    GPtrArray *documents;       // Document*, in the order they were opened
+    gsize budget;
+    guint64 clock;              // bumped by every touch
+};
+
+static void document_free(gpointer data) {
+    Document *document = data;
+    if (document->loader) buffer_loader_cancel(document->loader);
+    // The tab is gone by now
+    document->view = NULL;
+    document_set_buffer(document, NULL);
+    g_hash_table_unref(document->lint_logged);
+    g_free(document->saved_digest);
+    g_free(document->filename);
+    g_free(document);
+}
+
+DocumentCache* document_cache_new(gsize budget) {
+    DocumentCache *cache = g_new0(DocumentCache, 1);
+    cache->documents = g_ptr_array_new_with_free_func(document_free);
+    cache->budget = budget;
+    return cache;
+}
+
+void document_cache_free(DocumentCache *cache) {
+    if (!cache) return;
+    g_ptr_array_unref(cache->documents);
+    g_free(cache);
+}
+
+guint document_cache_get_length(DocumentCache *cache) {
+    return cache->documents->len;
+}
+
+Document* document_cache_get(DocumentCache *cache, guint index) {
+    return g_ptr_array_index(cache->documents, index);
+}
+
+Document* document_cache_lookup(DocumentCache *cache, const gchar *filename) {
+    for (guint i = 0; i < cache->documents->len; i++) {
+        Document *document = g_ptr_array_index(cache->documents, i);
+        if (strcmp(document->filename, filename) == 0) return document;
+    }
+    return NULL;
+}
+
+Document* document_cache_lookup_page(DocumentCache *cache, GtkWidget *page) {
+    for (guint i = 0; i < cache->documents->len; i++) {
+        Document *document = g_ptr_array_index(cache->documents, i);
+        if (document->page == page) return document;
+    }
+    return NULL;
+}
+
+Document* document_cache_add(DocumentCache *cache, const gchar *filename) {
+    Document *document = g_new0(Document, 1);
+    document->filename = g_strdup(filename);
+    document->lint_logged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    document->last_used = ++cache->clock;
+    g_ptr_array_add(cache->documents, document);
+    return document;
+}
+
+void document_cache_remove(DocumentCache *cache, Document *document) {
+    g_ptr_array_remove(cache->documents, document);
+}
+
+void document_set_buffer(Document *document, GtkTextBuffer *buffer) {
+    if (buffer) g_object_ref(buffer);
+    // Its handlers point at the document, which may go before the buffer
+    if (document->buffer) g_signal_handlers_disconnect_by_data(document->buffer, document);
+    g_clear_object(&document->buffer);
+    document->buffer = buffer;
+    // Without a buffer of its own the view shows an empty one
+    if (document->view) gtk_text_view_set_buffer(GTK_TEXT_VIEW(document->view), buffer);
+}
+
+gboolean document_is_dirty(const Document *document) {
+    return document->buffer && gtk_text_buffer_get_modified(document->buffer);
+}
+
+void document_mark_saved(Document *document, const gchar *path) {
+    if (g_stat(path, &document->stat) != 0) memset(&document->stat, 0, sizeof(document->stat));
+}
+
+gboolean document_changed_on_disk(const Document *document, const gchar *path) {
+    GStatBuf st;
+    if (g_stat(path, &st) != 0) return TRUE;
+    return st.st_ino != document->stat.st_ino || st.st_size != document->stat.st_size ||
+           st.st_mtime != document->stat.st_mtime;
+}
+
+// The file's size when it was loaded or saved, in bytes like the budget.
+// Edits are not counted, but dirty buffers are never dropped anyway.
+static gsize document_get_size(const Document *document) {
+    return (gsize)document->stat.st_size;
+}
+
+gsize document_cache_get_size(DocumentCache *cache, guint *n_resident) {
+    gsize size = 0;
+    guint resident = 0;
+    for (guint i = 0; i < cache->documents->len; i++) {
+        Document *document = g_ptr_array_index(cache->documents, i);
+        if (!document->buffer) continue;
+        size += document_get_size(document);
+        resident++;
+    }
+    if (n_resident) *n_resident = resident;
+    return size;
+}
+
+static gint compare_least_recent(gconstpointer a, gconstpointer b) {
+    const Document *document_a = *(Document * const *)a;
+    const Document *document_b = *(Document * const *)b;
+    return document_a->last_used < document_b->last_used ? -1 : document_a->last_used > document_b->last_used;
+}
+
+guint document_cache_touch(DocumentCache *cache, Document *document) {
+    document->last_used = ++cache->clock;
+    gsize size = document_cache_get_size(cache, NULL);
+    if (size <= cache->budget) return 0;
+
+    // Only clean, loaded buffers of other documents can be read again
+    GPtrArray *candidates = g_ptr_array_new();
+    for (guint i = 0; i < cache->documents->len; i++) {
+        Document *other = g_ptr_array_index(cache->documents, i);
+        if (other != document && other->buffer && !other->loader && !document_is_dirty(other)) {
+            g_ptr_array_add(candidates, other);
+        }
+    }
+    g_ptr_array_sort(candidates, compare_least_recent);
+
+    guint n_evicted = 0;
+    for (guint i = 0; i < candidates->len && size > cache->budget; i++) {
+        Document *other = g_ptr_array_index(candidates, i);
+        size -= document_get_size(other);
+        document_set_buffer(other, NULL);
+        g_clear_pointer(&other->saved_digest, g_free);
+        n_evicted++;
+    }
+    g_ptr_array_unref(candidates);
+    return n_evicted;
+}
@@ -0,0 +1,67 @@
+#ifndef NGINX_DOCUMENTS_H
+#define NGINX_DOCUMENTS_H
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include "nginx_loader.h"
+
+// Documents open in editor tabs, each with its own text buffer, so
+// switching back to one needs no disk read and no re-highlighting.
+//
+// Buffers are kept in least recently used order under a memory budget
+// counted in bytes of the files as loaded or saved. Past the budget, the least recently
+// used buffers are dropped until it fits again; their tabs stay open and
+// load the file again when shown. The active document, documents still
+// loading and buffers with unsaved edits are never dropped.
+
+// Bytes of text kept in buffers by default
+#define DOCUMENTS_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+typedef struct {
+    gchar *filename;
+    GtkTextBuffer *buffer;      // NULL while evicted or not yet loaded
+    BufferLoader *loader;       // filling buffer, NULL once it is loaded
+    gchar *saved_digest;        // checksum of the file as last loaded or saved
+    GStatBuf stat;              // of the file then, to notice changes by others
+    guint goto_line;            // line to show once the file is loaded
+    gboolean lint_stale;        // edited since the last finished lint
+    GHashTable *lint_logged;    // diagnostics of the last lint, already in the log
+    GtkWidget *page;            // the tab, holding view
+    GtkWidget *view;
+    GtkWidget *label;
+    guint64 last_used;          // the cache's clock when it was last touched
+    gpointer user_data;
+} Document;
+
+typedef struct _DocumentCache DocumentCache;
+
+DocumentCache* document_cache_new(gsize budget);
+void document_cache_free(DocumentCache *cache);
+
+guint document_cache_get_length(DocumentCache *cache);
+Document* document_cache_get(DocumentCache *cache, guint index);
+Document* document_cache_lookup(DocumentCache *cache, const gchar *filename);
+Document* document_cache_lookup_page(DocumentCache *cache, GtkWidget *page);
+
+// A new document without a buffer, most recently used
+Document* document_cache_add(DocumentCache *cache, const gchar *filename);
+// Cancels its load and frees it
+void document_cache_remove(DocumentCache *cache, Document *document);
+
+// Marks document as the most recently used and drops the buffers of
+// others past the budget. Returns the number of buffers dropped.
+guint document_cache_touch(DocumentCache *cache, Document *document);
+// Gives document a buffer it owns, e.g. before loading into it
+void document_set_buffer(Document *document, GtkTextBuffer *buffer);
+// Modified since it was loaded or saved
+gboolean document_is_dirty(const Document *document);
+
+// Remembers the file at path as loaded or saved
+void document_mark_saved(Document *document, const gchar *path);
+// Whether the file at path was written, replaced or removed since
+gboolean document_changed_on_disk(const Document *document, const gchar *path);
+
+// Bytes held by buffers and how many documents have one
+gsize document_cache_get_size(DocumentCache *cache, guint *n_resident);
+
+#endif // NGINX_DOCUMENTS_H
@@ -0,0 +1,146 @@
+#include "nginx_events.h"
+
+struct _UiEventQueue {
+    UiEvent *head;              // newest first, only touched atomically
+    UiEventWakeFunc wake;
+    gpointer user_data;
+    UiEventStats stats;         // the consumer's
+};
+
+static void ui_event_free(gpointer data) {
+    UiEvent *event = data;
+    if (event->payload_free) event->payload_free(event->payload);
+    g_free(event->text);
+    g_free(event);
+}
+
+static void free_list(UiEvent *event) {
+    while (event) {
+        UiEvent *next = event->next;
+        ui_event_free(event);
+        event = next;
+    }
+}
+
+UiEventQueue* ui_event_queue_new(UiEventWakeFunc wake, gpointer user_data) {
+    UiEventQueue *queue = g_new0(UiEventQueue, 1);
+    queue->wake = wake;
+    queue->user_data = user_data;
+    return queue;
+}
+
+void ui_event_queue_free(UiEventQueue *queue) {
+    if (!queue) return;
+    free_list(queue->head);
+    g_free(queue);
+}
+
+void ui_event_queue_push(UiEventQueue *queue, UiEvent *event) {
+    UiEvent *head;
+    do {
+        head = g_atomic_pointer_get(&queue->head);
+        event->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&queue->head, head, event));
+    // Every later push finds it non-empty until the consumer takes it all
+    if (!head && queue->wake) queue->wake(queue->user_data);
+}
+
+void ui_event_queue_push_log(UiEventQueue *queue, LogSeverity severity, const gchar *source,
+                             const gchar *message) {
+    UiEvent *event = g_new0(UiEvent, 1);
+    event->type = UI_EVENT_LOG;
+    event->severity = severity;
+    event->source = source;
+    event->text = g_strdup(message);
+    ui_event_queue_push(queue, event);
+}
+
+void ui_event_queue_push_file(UiEventQueue *queue, const gchar *name, gboolean exists) {
+    UiEvent *event = g_new0(UiEvent, 1);
+    event->type = UI_EVENT_FILE;
+    event->text = g_strdup(name);
+    event->exists = exists;
+    ui_event_queue_push(queue, event);
+}
+
+void ui_event_queue_push_diagnostics(UiEventQueue *queue, gconstpointer key, gpointer payload,
+                                     GDestroyNotify payload_free) {
+    UiEvent *event = g_new0(UiEvent, 1);
+    event->type = UI_EVENT_DIAGNOSTICS;
+    event->key = key;
+    event->payload = payload;
+    event->payload_free = payload_free;
+    ui_event_queue_push(queue, event);
+}
+
+void ui_event_queue_push_progress(UiEventQueue *queue, gconstpointer key, gdouble fraction) {
+    UiEvent *event = g_new0(UiEvent, 1);
+    event->type = UI_EVENT_PROGRESS;
+    event->key = key;
+    event->fraction = fraction;
+    ui_event_queue_push(queue, event);
+}
+
+// The list comes newest first, so the first event seen for a name or key
+// is the one to keep
+GPtrArray* ui_event_queue_drain(UiEventQueue *queue, guint max_logs, guint *n_dropped) {
+    UiEvent *head;
+    do {
+        head = g_atomic_pointer_get(&queue->head);
+    } while (head && !g_atomic_pointer_compare_and_exchange(&queue->head, head, NULL));
+
+    GPtrArray *events = g_ptr_array_new_with_free_func(ui_event_free);
+    GHashTable *names = NULL;
+    GHashTable *keys[UI_N_EVENT_TYPES] = { NULL };
+    guint n_logs = 0;
+    guint dropped = 0;
+    queue->stats.drains++;
+
+    for (UiEvent *event = head, *next; event; event = next) {
+        next = event->next;
+        event->next = NULL;
+        queue->stats.taken++;
+        gboolean keep;
+        switch (event->type) {
+            case UI_EVENT_LOG:
+                keep = n_logs++ < max_logs;
+                if (!keep) dropped++;
+                break;
+            case UI_EVENT_FILE:
+                // Adding a name that is there would replace it with this
+                // event's copy, which is freed below
+                if (!names) names = g_hash_table_new(g_str_hash, g_str_equal);
+                keep = !g_hash_table_contains(names, event->text);
+                if (keep) g_hash_table_add(names, event->text);
+                break;
+            default:
+                if (!keys[event->type]) keys[event->type] = g_hash_table_new(NULL, NULL);
+                keep = g_hash_table_add(keys[event->type], (gpointer)event->key);
+                break;
+        }
+        if (keep) {
+            g_ptr_array_add(events, event);
+        } else {
+            if (event->type != UI_EVENT_LOG) queue->stats.merged++;
+            ui_event_free(event);
+        }
+    }
+
+    // Oldest first, as they were pushed
+    for (guint i = 0, j = events->len; i + 1 < j; i++, j--) {
+        gpointer swap = events->pdata[i];
+        events->pdata[i] = events->pdata[j - 1];
+        events->pdata[j - 1] = swap;
+    }
+    if (names) g_hash_table_unref(names);
+    for (guint type = 0; type < UI_N_EVENT_TYPES; type++) {
+        if (keys[type]) g_hash_table_unref(keys[type]);
+    }
+    queue->stats.dropped += dropped;
+    if (n_dropped) *n_dropped = dropped;
+    return events;
+}
+
+void ui_event_queue_get_stats(UiEventQueue *queue, UiEventStats *stats) {
+    *stats = queue->stats;
+}
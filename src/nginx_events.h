@@ -0,0 +1,76 @@
+#ifndef NGINX_EVENTS_H
+#define NGINX_EVENTS_H
+
+#include <glib.h>
+#include "nginx_log.h"
+
+// Updates for the front-end from any thread, applied by the thread that
+// owns the widgets. Pushing is lock-free: an event is linked onto the
+// front of a list with one compare-and-swap. The consumer takes the whole
+// list with another and merges it, so however fast workers push, it does
+// one pass per drain:
+//
+// - of the file events for a name, only the newest is kept
+// - of the diagnostics and progress events for a key, only the newest
+// - of the log lines, only as many of the newest as the log would keep
+//
+// The push that finds the queue empty calls the wake function, so a
+// drain is scheduled once per batch, never once per event.
+
+typedef enum {
+    UI_EVENT_LOG,               // a log line
+    UI_EVENT_FILE,              // a config file appeared or went away
+    UI_EVENT_DIAGNOSTICS,       // lint results for key
+    UI_EVENT_PROGRESS,          // how far the operation key got
+    UI_N_EVENT_TYPES
+} UiEventType;
+
+typedef struct _UiEvent UiEvent;
+
+struct _UiEvent {
+    UiEvent *next;              // the queue's link
+    UiEventType type;
+    LogSeverity severity;       // LOG
+    const gchar *source;        // LOG, a static string
+    gchar *text;                // LOG message, FILE name
+    gboolean exists;            // FILE
+    gconstpointer key;          // DIAGNOSTICS and PROGRESS: what they are about
+    gdouble fraction;           // PROGRESS, 1.0 when it finished
+    gpointer payload;           // DIAGNOSTICS
+    GDestroyNotify payload_free;
+};
+
+typedef struct _UiEventQueue UiEventQueue;
+
+// Called from the pushing thread whenever the queue stops being empty
+typedef void (*UiEventWakeFunc)(gpointer user_data);
+
+typedef struct {
+    guint64 taken;              // events drained
+    guint64 merged;             // dropped for a newer one of the same name or key
+    guint64 dropped;            // log lines past the limit of a drain
+    guint64 drains;
+} UiEventStats;
+
+UiEventQueue* ui_event_queue_new(UiEventWakeFunc wake, gpointer user_data);
+// Frees what was never drained; nothing may push any more
+void ui_event_queue_free(UiEventQueue *queue);
+
+// Takes ownership of event
+void ui_event_queue_push(UiEventQueue *queue, UiEvent *event);
+void ui_event_queue_push_log(UiEventQueue *queue, LogSeverity severity, const gchar *source,
+                             const gchar *message);
+void ui_event_queue_push_file(UiEventQueue *queue, const gchar *name, gboolean exists);
+void ui_event_queue_push_diagnostics(UiEventQueue *queue, gconstpointer key, gpointer payload,
+                                     GDestroyNotify payload_free);
+void ui_event_queue_push_progress(UiEventQueue *queue, gconstpointer key, gdouble fraction);
+
+// Consumer only. Everything pushed so far after merging, oldest first;
+// the array frees the events. n_dropped, when set, receives how many
+// older log lines were dropped beyond max_logs.
+GPtrArray* ui_event_queue_drain(UiEventQueue *queue, guint max_logs, guint *n_dropped);
+
+// Consumer only
+void ui_event_queue_get_stats(UiEventQueue *queue, UiEventStats *stats);
+
+#endif // NGINX_EVENTS_H
@@ -1,20 +1,52 @@
 #include "nginx_ui.h"
-#include <glib/gstdio.h>
+#include <string.h>
 
-gchar* execute_command(const gchar *command) {
-    FILE *fp = popen(command, "r");
-    if (!fp) {
-        return g_strdup("Error executing command");
+static gboolean is_staging(AppData *app_data) {
+    return gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app_data->stage_btn));
+}
+
+// The helper serves one request at a time, so a write made while nginx
+// runs would block the UI until the command finished
+static gboolean check_helper_idle(AppData *app_data, const gchar *action) {
+    if (!app_data->nginx_command_running) return TRUE;
+    gchar *msg = g_strdup_printf("Error: Cannot %s while nginx is running, try again when it finished", action);
+    append_log(app_data, msg);
+    g_free(msg);
+    return FALSE;
+}
+
+static void update_staged_buttons(AppData *app_data) {
+    guint pending = change_set_get_length(app_data->staged);
+    gchar *label = pending > 0 ? g_strdup_printf("Apply (%u)", pending) : g_strdup("Apply");
+    gtk_button_set_label(GTK_BUTTON(app_data->apply_btn), label);
+    g_free(label);
+    gtk_widget_set_sensitive(app_data->apply_btn, pending > 0 && !app_data->nginx_command_running);
+    gtk_widget_set_sensitive(app_data->discard_btn, pending > 0 && !app_data->nginx_command_running);
+}
+
+// Staged edits go to disk all at once; meanwhile the set belongs to the
+// worker applying it
+static void stage_change(AppData *app_data, gboolean delete, const gchar *content, gsize length) {
+    if (app_data->nginx_command_running) {
+        append_log(app_data, "Error: Cannot stage changes while nginx is running, try again when it finished");
+        return;
     }
-    
-    GString *output = g_string_new(NULL);
-    char buffer[1024];
-    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-        g_string_append(output, buffer);
+    GError *error = NULL;
+    gboolean staged = delete ? change_set_delete(app_data->staged, app_data->current_file, &error)
+                             : change_set_write(app_data->staged, app_data->current_file, content, length, &error);
+    gchar *msg;
+    if (staged) {
+        // The change set keeps the edit now
+        if (!delete) gtk_text_buffer_set_modified(app_data->source_buffer, FALSE);
+        msg = g_strdup_printf("Staged %s: %s (%u change(s) pending)", delete ? "deletion" : "edit",
+                              app_data->current_file, change_set_get_length(app_data->staged));
+    } else {
+        msg = g_strdup_printf("Error: Cannot stage %s: %s", app_data->current_file, error->message);
+        g_error_free(error);
     }
-    
-    pclose(fp);
-    return g_string_free(output, FALSE);
+    append_log(app_data, msg);
+    g_free(msg);
+    update_staged_buttons(app_data);
 }
 
 void on_new_file_clicked(GtkButton *button, AppData *app_data) {
@@ -24,87 +56,20 @@ void on_new_file_clicked(GtkButton *button, AppData *app_data) {
         append_log(app_data, "Error: Please enter a filename");
         return;
     }
+    if (!check_helper_idle(app_data, "create a file")) return;
     
-    gchar *full_filename;
-    if (g_str_has_suffix(filename, ".conf")) {
-        full_filename = g_strdup(filename);
+    GError *error = NULL;
+    gchar *created = nginx_core_create_config(app_data->core, filename, &error);
+    if (created) {
+        refresh_file_list(app_data);
+        gtk_editable_set_text(GTK_EDITABLE(app_data->file_entry), "");
+        g_free(created);
     } else {
-        full_filename = g_strdup_printf("%s.conf", filename);
+        gchar *msg = g_strdup_printf("Error: Failed to create config file: %s", error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+        g_error_free(error);
     }
-    
-    gchar *filepath = g_strdup_printf("%s/%s", NGINX_CONF_DIR, full_filename);
-    
-    // Create empty config file with sudo
-    gchar *command = g_strdup_printf("sudo touch %s && sudo chmod 644 %s", filepath, filepath);
-    gint result = system(command);
-    g_free(command);
-    
-    gchar *domain_name = NULL;
-    gchar *default_config = NULL;
-    
-    if (result == 0) {
-        // Add default server block
-        domain_name = g_strdup(full_filename);
-        if (g_str_has_suffix(domain_name, ".conf")) {
-            domain_name[strlen(domain_name) - 5] = '\0';
-        }
-        
-        default_config = g_strdup_printf(
-            "server {\n"
-            "    listen 80;\n"
-            "    server_name %s;\n"
-            "    \n"
-            "    location / {\n"
-            "        root /var/www/html;\n"
-            "        index index.html;\n"
-            "    }\n"
-            "}\n",
-            domain_name
-        );
-        
-        // Write config to temp file first, then copy with sudo
-        gchar *temp_config = g_strdup_printf("/tmp/nginx_new_%s", full_filename);
-        if (g_file_set_contents(temp_config, default_config, -1, NULL)) {
-            gchar *write_cmd = g_strdup_printf("sudo cp %s %s && sudo chmod 644 %s", 
-                                               temp_config, filepath, filepath);
-            result = system(write_cmd);
-            g_free(write_cmd);
-            g_unlink(temp_config);
-        } else {
-            result = -1;
-        }
-        g_free(temp_config);
-        
-        if (result == 0) {
-            // Extract domain and add to /etc/hosts
-            gchar **domains = extract_domains_from_config(default_config);
-            for (gint i = 0; domains[i] != NULL; i++) {
-                if (!domain_exists_in_hosts(domains[i])) {
-                    add_domain_to_hosts(domains[i]);
-                    gchar *msg = g_strdup_printf("Added domain '%s' to /etc/hosts", domains[i]);
-                    append_log(app_data, msg);
-                    g_free(msg);
-                }
-            }
-            g_strfreev(domains);
-            
-            refresh_file_list(app_data);
-            gtk_editable_set_text(GTK_EDITABLE(app_data->file_entry), "");
-            
-            gchar *msg = g_strdup_printf("Created: %s", full_filename);
-            append_log(app_data, msg);
-            g_free(msg);
-        } else {
-            append_log(app_data, "Error: Failed to write config file");
-        }
-    } else {
-        append_log(app_data, "Error: Failed to create config file");
-    }
-    
-    g_free(domain_name);
-    g_free(default_config);
-    g_free(filepath);
-    g_free(full_filename);
 }
 
 void on_save_clicked(GtkButton *button, AppData *app_data) {
@@ -114,81 +79,136 @@ void on_save_clicked(GtkButton *button, AppData *app_data) {
         return;
     }
     
+    gint64 started = g_get_monotonic_time();
     GtkTextBuffer *buffer = GTK_TEXT_BUFFER(app_data->source_buffer);
     GtkTextIter start, end;
     gtk_text_buffer_get_bounds(buffer, &start, &end);
     gchar *content = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    gsize length = strlen(content);
+    if (is_staging(app_data)) {
+        stage_change(app_data, FALSE, content, length);
+        g_free(content);
+        return;
+    }
+    if (!check_helper_idle(app_data, "save")) {
+        g_free(content);
+        return;
+    }
     
-    gchar *filepath = g_strdup_printf("%s/%s", NGINX_CONF_DIR, app_data->current_file);
-    gchar *temp_file = g_strdup_printf("/tmp/nginx_%s", app_data->current_file);
-    
-    // Write to temp file first
-    if (g_file_set_contents(temp_file, content, -1, NULL)) {
-        // Copy to destination with sudo
-        gchar *command = g_strdup_printf("sudo cp %s %s && sudo chmod 644 %s", temp_file, filepath, filepath);
-        gint result = system(command);
-        g_free(command);
-        
-        if (result == 0) {
-            // Extract domains and check/add to /etc/hosts
-            gchar **domains = extract_domains_from_config(content);
-            for (gint i = 0; domains[i] != NULL; i++) {
-                if (!domain_exists_in_hosts(domains[i])) {
-                    add_domain_to_hosts(domains[i]);
-                    gchar *msg = g_strdup_printf("Added domain '%s' to /etc/hosts", domains[i]);
-                    append_log(app_data, msg);
-                    g_free(msg);
-                }
-            }
-            g_strfreev(domains);
-            
-            gchar *msg = g_strdup_printf("Saved: %s", app_data->current_file);
-            append_log(app_data, msg);
-            g_free(msg);
-        } else {
-            append_log(app_data, "Error: Failed to save file");
-        }
-        
-        g_unlink(temp_file);
+    // A buffer that matches the file as loaded or last saved is not
+    // written, and hosts, includes, conflicts and search are left alone
+    Document *document = app_data->current;
+    gchar *digest = g_compute_checksum_for_data(LOADER_CHECKSUM, (const guchar *)content, length);
+    GError *error = NULL;
+    if (g_strcmp0(digest, document->saved_digest) == 0) {
+        gtk_text_buffer_set_modified(buffer, FALSE);
+        gchar *msg = g_strdup_printf("Unchanged: %s, nothing to save (%.1f ms)", app_data->current_file,
+                                     (g_get_monotonic_time() - started) / 1000.0);
+        append_log(app_data, msg);
+        g_free(msg);
+    } else if (nginx_core_save_config(app_data->core, app_data->current_file, content, length, NULL, &error)) {
+        g_free(document->saved_digest);
+        document->saved_digest = g_steal_pointer(&digest);
+        gtk_text_buffer_set_modified(buffer, FALSE);
+        gchar *filepath = nginx_core_get_path(app_data->core, app_data->current_file);
+        document_mark_saved(document, filepath);
+        g_free(filepath);
+        show_include_context(app_data);
     } else {
-        append_log(app_data, "Error: Failed to write temporary file");
+        gchar *msg = g_strdup_printf("Error: Failed to save file: %s", error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+        g_error_free(error);
     }
-    
-    g_free(temp_file);
-    g_free(filepath);
+    g_free(digest);
     g_free(content);
 }
 
 static void on_delete_response(GtkDialog *dialog, gint response_id, AppData *app_data) {
     gtk_window_destroy(GTK_WINDOW(dialog));
     
-    if (response_id == GTK_RESPONSE_YES) {
-        gchar *filepath = g_strdup_printf("%s/%s", NGINX_CONF_DIR, app_data->current_file);
-        gchar *command = g_strdup_printf("sudo rm %s", filepath);
-        gint result = system(command);
-        g_free(command);
-        g_free(filepath);
-        
-        if (result == 0) {
-            gchar *deleted_file = g_strdup(app_data->current_file);
-            gtk_text_buffer_set_text(GTK_TEXT_BUFFER(app_data->source_buffer), "", -1);
-            g_free(app_data->current_file);
-            app_data->current_file = NULL;
-            gtk_widget_set_sensitive(app_data->save_btn, FALSE);
-            gtk_widget_set_sensitive(app_data->delete_btn, FALSE);
-            
+    if (response_id == GTK_RESPONSE_YES && is_staging(app_data)) {
+        stage_change(app_data, TRUE, NULL, 0);
+    } else if (response_id == GTK_RESPONSE_YES && check_helper_idle(app_data, "delete")) {
+        GError *error = NULL;
+        if (nginx_core_delete_config(app_data->core, app_data->current_file, &error)) {
+            close_document(app_data, app_data->current);
             refresh_file_list(app_data);
-            
-            gchar *msg = g_strdup_printf("Deleted: %s", deleted_file);
+        } else {
+            gchar *msg = g_strdup_printf("Error: Failed to delete file: %s", error->message);
             append_log(app_data, msg);
             g_free(msg);
-            g_free(deleted_file);
-        } else {
-            append_log(app_data, "Error: Failed to delete file");
+            g_error_free(error);
         }
     }
 }
 
+// Lists the revisions of the current file, newest first, when the
+// history popover opens
+void on_history_shown(GtkWidget *popover, AppData *app_data) {
+    (void)popover; // Unused parameter
+    GtkListBox *box = GTK_LIST_BOX(app_data->history_list);
+    GtkWidget *child;
+    while ((child = gtk_widget_get_first_child(GTK_WIDGET(box))) != NULL) {
+        gtk_list_box_remove(box, child);
+    }
+    if (!app_data->core->history || !app_data->current_file) return;
+    
+    gchar *filepath = nginx_core_get_path(app_data->core, app_data->current_file);
+    GPtrArray *revisions = history_store_list(app_data->core->history, filepath);
+    for (guint i = 0; i < revisions->len; i++) {
+        const HistoryRevision *revision = g_ptr_array_index(revisions, i);
+        GDateTime *time = g_date_time_new_from_unix_local(revision->time / G_USEC_PER_SEC);
+        gchar *when = g_date_time_format(time, "%Y-%m-%d %H:%M:%S");
+        gchar *size = g_format_size(revision->size);
+        gchar *text = g_strdup_printf("#%u  %s  %s", revision->id, when,
+                                      revision->action == HISTORY_ACTION_DELETE ? "deleted" : size);
+        
+        GtkWidget *row = gtk_list_box_row_new();
+        GtkWidget *label = gtk_label_new(text);
+        gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+        gtk_list_box_row_set_child(GTK_LIST_BOX_ROW(row), label);
+        gtk_list_box_row_set_activatable(GTK_LIST_BOX_ROW(row), revision->action == HISTORY_ACTION_SAVE);
+        g_object_set_data(G_OBJECT(row), "revision-id", GUINT_TO_POINTER(revision->id));
+        gtk_list_box_append(box, row);
+        
+        g_free(text);
+        g_free(size);
+        g_free(when);
+        g_date_time_unref(time);
+    }
+    g_ptr_array_unref(revisions);
+    g_free(filepath);
+}
+
+// Puts a revision into the editor. Nothing is written until it is saved,
+// which makes it the newest revision.
+void on_history_row_activated(GtkListBox *box, GtkListBoxRow *row, AppData *app_data) {
+    (void)box; // Unused parameter
+    guint id = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "revision-id"));
+    gtk_menu_button_popdown(GTK_MENU_BUTTON(app_data->history_btn));
+    if (!app_data->core->history || !app_data->current_file) return;
+    
+    gint64 started = g_get_monotonic_time();
+    GError *error = NULL;
+    gsize length = 0;
+    gchar *content = history_store_read(app_data->core->history, id, &length, &error);
+    gchar *msg;
+    if (!content) {
+        msg = g_strdup_printf("Error: Cannot restore revision %u: %s", id, error->message);
+        g_error_free(error);
+    } else if (!g_utf8_validate(content, length, NULL)) {
+        msg = g_strdup_printf("Error: Revision %u of %s is not UTF-8 text", id, app_data->current_file);
+    } else {
+        gtk_text_buffer_set_text(GTK_TEXT_BUFFER(app_data->source_buffer), content, length);
+        msg = g_strdup_printf("Restored revision %u of %s into the editor (%.1f ms), save to apply it",
+                              id, app_data->current_file, (g_get_monotonic_time() - started) / 1000.0);
+    }
+    append_log(app_data, msg);
+    g_free(msg);
+    g_free(content);
+}
+
 void on_delete_clicked(GtkButton *button, AppData *app_data) {
     (void)button; // Unused parameter
     if (!app_data->current_file) {
@@ -212,27 +232,225 @@ void on_delete_clicked(GtkButton *button, AppData *app_data) {
     gtk_window_present(GTK_WINDOW(dialog));
 }
 
+typedef struct {
+    AppData *app_data;
+    HelperOp op;
+    const gchar *success_message;
+    const gchar *failure_message;
+    gint exit_status;
+} NginxCommand;
+
+static void run_nginx_command_thread(GTask *task, gpointer source_object,
+                                     gpointer task_data, GCancellable *cancellable) {
+    (void)source_object; // Unused parameter
+    (void)cancellable; // Unused parameter
+    NginxCommand *command = task_data;
+    GError *error = NULL;
+    
+    if (nginx_core_run_nginx(command->app_data->core, command->op, &command->exit_status, &error)) {
+        g_task_return_boolean(task, TRUE);
+    } else {
+        g_task_return_error(task, error);
+    }
+}
+
+static void set_nginx_command_running(AppData *app_data, gboolean running) {
+    app_data->nginx_command_running = running;
+    gtk_widget_set_sensitive(app_data->test_btn, !running);
+    gtk_widget_set_sensitive(app_data->reload_btn, !running);
+    gtk_widget_set_sensitive(app_data->cancel_btn, running);
+    update_staged_buttons(app_data);
+    update_document_actions(app_data);
+}
+
+static void on_nginx_command_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void)source_object; // Unused parameter
+    AppData *app_data = user_data;
+    NginxCommand *command = g_task_get_task_data(G_TASK(result));
+    GError *error = NULL;
+    set_nginx_command_running(app_data, FALSE);
+    
+    if (g_task_propagate_boolean(G_TASK(result), &error) && command->exit_status == 0) {
+        append_log_full(app_data, LOG_SEVERITY_SUCCESS, "nginx", command->success_message);
+    } else {
+        gchar *reason = error ? g_strdup(error->message)
+                              : g_strdup_printf("exit status %d", command->exit_status);
+        gchar *msg = g_strdup_printf("Error: %s (%s)", command->failure_message, reason);
+        append_log(app_data, msg);
+        g_free(msg);
+        g_free(reason);
+        g_clear_error(&error);
+    }
+}
+
+// nginx runs inside the helper; a worker thread waits for it so the
+// output can be streamed into the log without blocking the UI
+static void start_nginx_command(AppData *app_data, HelperOp op,
+                                const gchar *success_message, const gchar *failure_message) {
+    if (app_data->nginx_command_running) {
+        append_log(app_data, "Error: Another nginx command is still running");
+        return;
+    }
+    
+    NginxCommand *command = g_new0(NginxCommand, 1);
+    command->app_data = app_data;
+    command->op = op;
+    command->success_message = success_message;
+    command->failure_message = failure_message;
+    
+    GTask *task = g_task_new(NULL, NULL, on_nginx_command_done, app_data);
+    g_task_set_task_data(task, command, g_free);
+    g_task_run_in_thread(task, run_nginx_command_thread);
+    g_object_unref(task);
+    set_nginx_command_running(app_data, TRUE);
+}
+
 void on_test_config_clicked(GtkButton *button, AppData *app_data) {
     (void)button; // Unused parameter
     append_log(app_data, "Testing Nginx configuration...");
-    gchar *output = execute_command("sudo nginx -t");
-    append_log(app_data, output);
-    g_free(output);
+    start_nginx_command(app_data, HELPER_OP_NGINX_TEST,
+                        "Configuration test passed", "Configuration test failed");
 }
 
+// Clicks close together share one reload, see nginx_reload.h
 void on_reload_nginx_clicked(GtkButton *button, AppData *app_data) {
     (void)button; // Unused parameter
-    append_log(app_data, "Reloading Nginx...");
-    gchar *output = execute_command("sudo systemctl reload nginx");
-    if (output && strlen(output) == 0) {
-        append_log(app_data, "Nginx reloaded successfully");
+    reload_scheduler_request(app_data->reloads);
+}
+
+// The reload runs in the helper like any other nginx command
+void on_reload_started(guint n_requests, gpointer user_data) {
+    (void)n_requests; // Unused parameter
+    set_nginx_command_running(user_data, TRUE);
+}
+
+void on_reload_done(gboolean reloaded, guint n_requests, const GError *error, gpointer user_data) {
+    AppData *app_data = user_data;
+    set_nginx_command_running(app_data, FALSE);
+    gchar *msg;
+    if (reloaded && n_requests > 1) {
+        msg = g_strdup_printf("Nginx reloaded successfully (%u requests in one reload)", n_requests);
+    } else if (reloaded) {
+        msg = g_strdup("Nginx reloaded successfully");
     } else {
-        append_log(app_data, output ? output : "Reload command executed");
+        msg = g_strdup_printf("Error: Reload failed (%s)", error->message);
+    }
+    append_log_full(app_data, reloaded ? LOG_SEVERITY_SUCCESS : LOG_SEVERITY_ERROR, "nginx", msg);
+    g_free(msg);
+}
+
+void on_cancel_command_clicked(GtkButton *button, AppData *app_data) {
+    (void)button; // Unused parameter
+    if (app_data->nginx_command_running) {
+        append_log(app_data, "Cancelling...");
+        helper_cancel_command();
     }
-    g_free(output);
 }
 
 void on_refresh_clicked(GtkButton *button, AppData *app_data) {
     (void)button; // Unused parameter
     refresh_file_list(app_data);
+    update_search_index(app_data);
+}
+
+static void apply_staged_thread(GTask *task, gpointer source_object,
+                                gpointer task_data, GCancellable *cancellable) {
+    (void)source_object; // Unused parameter
+    (void)cancellable; // Unused parameter
+    AppData *app_data = task_data;
+    ChangeSetResult applied = change_set_apply(app_data->staged, CHANGE_SET_TEST | CHANGE_SET_RELOAD);
+    // The file list learns of created and deleted files without a rescan
+    for (guint i = 0; applied == CHANGE_SET_APPLIED && i < change_set_get_length(app_data->staged); i++) {
+        const Change *change = change_set_get(app_data->staged, i);
+        if (change->changed) ui_event_queue_push_file(app_data->events, change->filename, !change->delete);
+    }
+    g_task_return_int(task, applied);
+}
+
+static void on_apply_staged_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void)source_object; // Unused parameter
+    AppData *app_data = user_data;
+    ChangeSetResult applied = g_task_propagate_int(G_TASK(result), NULL);
+    set_nginx_command_running(app_data, FALSE);
+    
+    if (applied == CHANGE_SET_REJECTED || applied == CHANGE_SET_ROLLED_BACK) {
+        gchar *msg = g_strdup_printf("Warning: %u change(s) are still staged, fix them and apply again",
+                                     change_set_get_length(app_data->staged));
+        append_log(app_data, msg);
+        g_free(msg);
+        return;
+    }
+    
+    if (applied == CHANGE_SET_APPLIED) {
+        // Only once nginx runs on them, like a single save
+        GPtrArray *docs = g_ptr_array_new();
+        for (guint i = 0; i < change_set_get_length(app_data->staged); i++) {
+            const Change *change = change_set_get(app_data->staged, i);
+            if (change->changed && change->doc) g_ptr_array_add(docs, change->doc);
+        }
+        nginx_core_sync_hosts(app_data->core, (const ConfDocument * const *)docs->pdata, docs->len);
+        g_ptr_array_unref(docs);
+        change_set_index(app_data->staged);
+    }
+    
+    // Open files now hold what was staged for them
+    for (guint i = 0; i < change_set_get_length(app_data->staged); i++) {
+        const Change *change = change_set_get(app_data->staged, i);
+        Document *document = document_cache_lookup(app_data->documents, change->filename);
+        if (!document) continue;
+        if (change->delete) {
+            close_document(app_data, document);
+        } else if (document->buffer && !document->loader) {
+            g_free(document->saved_digest);
+            document->saved_digest = g_compute_checksum_for_data(LOADER_CHECKSUM, (const guchar *)change->content,
+                                                                 change->length);
+            gchar *filepath = nginx_core_get_path(app_data->core, document->filename);
+            document_mark_saved(document, filepath);
+            g_free(filepath);
+        }
+    }
+    change_set_clear(app_data->staged);
+    update_staged_buttons(app_data);
+    show_include_context(app_data);
+}
+
+// Writes every staged file, runs nginx -t once and reloads once; any
+// failure puts all of them back
+void on_apply_staged_clicked(GtkButton *button, AppData *app_data) {
+    (void)button; // Unused parameter
+    if (app_data->nginx_command_running) {
+        append_log(app_data, "Error: Another nginx command is still running");
+        return;
+    }
+    if (change_set_get_length(app_data->staged) == 0) {
+        append_log(app_data, "Error: No changes staged");
+        return;
+    }
+    
+    gchar *msg = g_strdup_printf("Applying %u staged change(s)...", change_set_get_length(app_data->staged));
+    append_log(app_data, msg);
+    g_free(msg);
+    GTask *task = g_task_new(NULL, NULL, on_apply_staged_done, app_data);
+    g_task_set_task_data(task, app_data, NULL);
+    g_task_run_in_thread(task, apply_staged_thread);
+    g_object_unref(task);
+    set_nginx_command_running(app_data, TRUE);
+}
+
+void on_discard_staged_clicked(GtkButton *button, AppData *app_data) {
+    (void)button; // Unused parameter
+    if (app_data->nginx_command_running) return;
+    
+    gchar *msg = g_strdup_printf("Discarded %u staged change(s), the editor keeps its text",
+                                 change_set_get_length(app_data->staged));
+    // What open tabs show of them is unsaved again
+    for (guint i = 0; i < change_set_get_length(app_data->staged); i++) {
+        const Change *change = change_set_get(app_data->staged, i);
+        Document *document = document_cache_lookup(app_data->documents, change->filename);
+        if (document && document->buffer && !change->delete) gtk_text_buffer_set_modified(document->buffer, TRUE);
+    }
+    change_set_clear(app_data->staged);
+    update_staged_buttons(app_data);
+    append_log(app_data, msg);
+    g_free(msg);
 }
@@ -0,0 +1,509 @@
+#include "nginx_filelist.h"
+#include "nginx_core.h"
+#include "nginx_fuzzy.h"
+#include "nginx_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct _ConfFileList {
+    gchar *dir;
+    GtkStringList *names;           // sorted file names, owned by selection
+    GPtrArray *index;               // FuzzyEntry of each name, in the same order
+    GtkCustomFilter *filter;        // hides names the filter text does not match
+    GtkSortListModel *sorted;       // best matches first while filtering
+    GtkSorter *sorter;              // score, then name
+    GtkSorter *score_sorter;
+    GtkSingleSelection *selection;
+    GtkWidget *widget;              // drives the per-frame update
+    GFileMonitor *monitor;
+    GHashTable *pending;            // name -> GINT_TO_POINTER(exists) since the last update
+    guint tick_id;
+    gulong selected_handler;
+    gchar *filter_text;             // NULL when the whole list is shown
+    gchar *applied_text;            // filter text the current scores belong to
+    GArray *matches;                // positions in names matching applied_text
+    GCancellable *scoring;          // worker scoring a large list
+};
+
+typedef struct {
+    ConfFileList *list;
+    GPtrArray *entries;             // snapshot of index
+    GArray *candidates;             // positions to score, NULL for all
+    FuzzyPattern *pattern;
+    gchar *text;
+    gint32 *scores;
+    gboolean narrowing;
+    gboolean scored;                // FALSE when cancelled midway
+} ScoringJob;
+
+static GQuark score_quark;
+
+static gboolean is_conf_name(const gchar *name) {
+    return name && g_str_has_suffix(name, ".conf");
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b) {
+    return strcmp(*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+// First position whose name is not less than name (or, with after, greater)
+static guint find_position(ConfFileList *list, const gchar *name, gboolean after) {
+    guint lo = 0, hi = g_list_model_get_n_items(G_LIST_MODEL(list->names));
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        gint cmp = strcmp(gtk_string_list_get_string(list->names, mid), name);
+        if (cmp < 0 || (after && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static gboolean contains_name(ConfFileList *list, const gchar *name, guint *position) {
+    guint pos = find_position(list, name, FALSE);
+    if (pos < g_list_model_get_n_items(G_LIST_MODEL(list->names)) &&
+        strcmp(gtk_string_list_get_string(list->names, pos), name) == 0) {
+        if (position) *position = pos;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static gchar* dup_selected_name(ConfFileList *list) {
+    guint selected = gtk_single_selection_get_selected(list->selection);
+    if (selected == GTK_INVALID_LIST_POSITION) return NULL;
+    return g_strdup(gtk_string_list_get_string(list->names, selected));
+}
+
+static gint32 get_item_score(gpointer item) {
+    return GPOINTER_TO_INT(g_object_get_qdata(G_OBJECT(item), score_quark));
+}
+
+static gboolean match_item(gpointer item, gpointer user_data) {
+    (void)user_data; // Unused parameter
+    return get_item_score(item) != FUZZY_NO_MATCH;
+}
+
+static gint item_score(GtkStringObject *item, gpointer user_data) {
+    (void)user_data; // Unused parameter
+    return get_item_score(item);
+}
+
+// Position of name among the visible items
+static guint find_visible(ConfFileList *list, const gchar *name) {
+    guint position = GTK_INVALID_LIST_POSITION;
+    if (name && !list->filter_text) {
+        if (!contains_name(list, name, &position)) position = GTK_INVALID_LIST_POSITION;
+    } else if (name) {
+        GListModel *visible = G_LIST_MODEL(list->sorted);
+        guint n = g_list_model_get_n_items(visible);
+        for (guint i = 0; i < n && position == GTK_INVALID_LIST_POSITION; i++) {
+            GtkStringObject *item = g_list_model_get_item(visible, i);
+            if (strcmp(gtk_string_object_get_string(item), name) == 0) position = i;
+            g_object_unref(item);
+        }
+    }
+    return position;
+}
+
+static void reselect(ConfFileList *list, const gchar *name) {
+    gtk_single_selection_set_selected(list->selection, find_visible(list, name));
+}
+
+// Stores the scores on the items, then lets the filter and sort models
+// redo their work once
+static void apply_scores(ConfFileList *list, const gchar *text, const gint32 *scores, gboolean narrowing) {
+    gchar *selected = dup_selected_name(list);
+    g_signal_handler_block(list->selection, list->selected_handler);
+    
+    g_array_set_size(list->matches, 0);
+    guint n = g_list_model_get_n_items(G_LIST_MODEL(list->names));
+    for (guint32 i = 0; i < n; i++) {
+        GObject *item = g_list_model_get_item(G_LIST_MODEL(list->names), i);
+        g_object_set_qdata(item, score_quark, GINT_TO_POINTER(scores[i]));
+        g_object_unref(item);
+        if (scores[i] != FUZZY_NO_MATCH) g_array_append_val(list->matches, i);
+    }
+    g_free(list->applied_text);
+    list->applied_text = g_strdup(text);
+    
+    if (!gtk_sort_list_model_get_sorter(list->sorted)) {
+        gtk_sort_list_model_set_sorter(list->sorted, list->sorter);
+        gtk_custom_filter_set_filter_func(list->filter, match_item, NULL, NULL);
+    } else {
+        gtk_sorter_changed(list->score_sorter, GTK_SORTER_CHANGE_DIFFERENT);
+        gtk_filter_changed(GTK_FILTER(list->filter),
+                           narrowing ? GTK_FILTER_CHANGE_MORE_STRICT : GTK_FILTER_CHANGE_DIFFERENT);
+    }
+    
+    reselect(list, selected);
+    g_signal_handler_unblock(list->selection, list->selected_handler);
+    g_free(selected);
+}
+
+static void scoring_job_free(gpointer data) {
+    ScoringJob *job = data;
+    g_ptr_array_unref(job->entries);
+    if (job->candidates) g_array_unref(job->candidates);
+    fuzzy_pattern_free(job->pattern);
+    g_free(job->text);
+    g_free(job->scores);
+    g_free(job);
+}
+
+static void scoring_thread(gpointer data, GCancellable *cancellable) {
+    ScoringJob *job = data;
+    job->scored = fuzzy_score_entries(job->pattern, job->entries, job->candidates, job->scores, cancellable);
+}
+
+static void on_scoring_done(gpointer data, gboolean cancelled) {
+    ScoringJob *job = data;
+    // A cancelled job may belong to a list that is gone
+    if (cancelled || !job->scored) return;
+    
+    ConfFileList *list = job->list;
+    g_clear_object(&list->scoring);
+    apply_scores(list, job->text, job->scores, job->narrowing);
+}
+
+static gpointer copy_entry(gconstpointer entry, gpointer user_data) {
+    (void)user_data; // Unused parameter
+    return fuzzy_entry_ref((FuzzyEntry *)entry);
+}
+
+// Scores the names against filter_text. A longer version of the text that
+// was last applied can only match names that matched before, so only those
+// are scored again. Lists that take longer than a frame go to a worker.
+static void refilter(ConfFileList *list, gboolean allow_narrowing) {
+    if (list->scoring) {
+        g_cancellable_cancel(list->scoring);
+        g_clear_object(&list->scoring);
+    }
+    
+    gboolean narrowing = allow_narrowing && list->applied_text &&
+                         g_str_has_prefix(list->filter_text, list->applied_text);
+    GArray *candidates = narrowing ? list->matches : NULL;
+    guint n_candidates = candidates ? candidates->len : list->index->len;
+    
+    if (n_candidates <= FILE_FILTER_SYNC_LIMIT) {
+        FuzzyPattern *pattern = fuzzy_pattern_new(list->filter_text);
+        gint32 *scores = g_new0(gint32, list->index->len);
+        fuzzy_score_entries(pattern, list->index, candidates, scores, NULL);
+        apply_scores(list, list->filter_text, scores, narrowing);
+        g_free(scores);
+        fuzzy_pattern_free(pattern);
+        return;
+    }
+    
+    ScoringJob *job = g_new0(ScoringJob, 1);
+    job->list = list;
+    job->entries = g_ptr_array_copy(list->index, copy_entry, NULL);
+    g_ptr_array_set_free_func(job->entries, (GDestroyNotify)fuzzy_entry_unref);
+    if (candidates) {
+        job->candidates = g_array_copy(candidates);
+    }
+    job->pattern = fuzzy_pattern_new(list->filter_text);
+    job->text = g_strdup(list->filter_text);
+    job->scores = g_new0(gint32, list->index->len);
+    job->narrowing = narrowing;
+    
+    list->scoring = g_cancellable_new();
+    work_pool_push(work_pool_get_default(), WORK_PRIORITY_INTERACTIVE, scoring_thread, on_scoring_done,
+                   job, scoring_job_free, list->scoring);
+}
+
+// Merges the pending changes into the model. Only the span between the
+// first and last changed name is replaced, and that span is trimmed to
+// the entries that really differ, so the view gets one items-changed.
+static void conf_file_list_flush(ConfFileList *list) {
+    guint n_changes = 0;
+    const gchar **changes = (const gchar **)g_hash_table_get_keys_as_array(list->pending, &n_changes);
+    if (n_changes == 0) {
+        g_free(changes);
+        return;
+    }
+    qsort(changes, n_changes, sizeof(gchar *), compare_names);
+    
+    guint lo = find_position(list, changes[0], FALSE);
+    guint hi = find_position(list, changes[n_changes - 1], TRUE);
+    
+    GPtrArray *merged = g_ptr_array_sized_new(hi - lo + n_changes);
+    guint i = lo, j = 0;
+    while (i < hi || j < n_changes) {
+        const gchar *old_name = i < hi ? gtk_string_list_get_string(list->names, i) : NULL;
+        gint cmp = !old_name ? 1 : j >= n_changes ? -1 : strcmp(old_name, changes[j]);
+        if (cmp < 0) {
+            g_ptr_array_add(merged, (gpointer)old_name);
+            i++;
+            continue;
+        }
+        if (GPOINTER_TO_INT(g_hash_table_lookup(list->pending, changes[j]))) {
+            g_ptr_array_add(merged, (gpointer)changes[j]);
+        }
+        if (cmp == 0) i++;
+        j++;
+    }
+    
+    // Leave the entries that did not move alone
+    guint n_old = hi - lo;
+    guint prefix = 0, suffix = 0;
+    while (prefix < n_old && prefix < merged->len &&
+           strcmp(gtk_string_list_get_string(list->names, lo + prefix),
+                  g_ptr_array_index(merged, prefix)) == 0) {
+        prefix++;
+    }
+    while (suffix < n_old - prefix && suffix < merged->len - prefix &&
+           strcmp(gtk_string_list_get_string(list->names, hi - 1 - suffix),
+                  g_ptr_array_index(merged, merged->len - 1 - suffix)) == 0) {
+        suffix++;
+    }
+    
+    guint n_removed = n_old - prefix - suffix;
+    guint n_added = merged->len - prefix - suffix;
+    if (n_removed > 0 || n_added > 0) {
+        // Copies, since the removed strings are freed by the splice
+        gchar **additions = g_new0(gchar *, n_added + 1);
+        for (guint k = 0; k < n_added; k++) {
+            additions[k] = g_strdup(g_ptr_array_index(merged, prefix + k));
+        }
+        
+        gchar *selected = dup_selected_name(list);
+        g_signal_handler_block(list->selection, list->selected_handler);
+        gtk_string_list_splice(list->names, lo + prefix, n_removed, (const gchar * const *)additions);
+        g_ptr_array_remove_range(list->index, lo + prefix, n_removed);
+        for (guint k = 0; k < n_added; k++) {
+            g_ptr_array_insert(list->index, lo + prefix + k, fuzzy_entry_new(additions[k]));
+        }
+        
+        // New names have no score yet, and the positions moved
+        if (list->filter_text) {
+            refilter(list, FALSE);
+        }
+        
+        // The selected file keeps its selection wherever it ended up
+        reselect(list, selected);
+        g_signal_handler_unblock(list->selection, list->selected_handler);
+        
+        g_free(selected);
+        g_strfreev(additions);
+    }
+    
+    g_ptr_array_unref(merged);
+    g_free(changes);
+    g_hash_table_remove_all(list->pending);
+}
+
+static gboolean on_frame_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+    (void)widget; (void)frame_clock; // Unused parameters
+    ConfFileList *list = user_data;
+    list->tick_id = 0;
+    conf_file_list_flush(list);
+    return G_SOURCE_REMOVE;
+}
+
+void conf_file_list_queue_name(ConfFileList *list, const gchar *name, gboolean exists) {
+    if (!is_conf_name(name)) return;
+    
+    // The latest event for a name wins, bursts collapse into one entry
+    g_hash_table_replace(list->pending, g_strdup(name), GINT_TO_POINTER(exists));
+    if (list->tick_id == 0) {
+        list->tick_id = gtk_widget_add_tick_callback(list->widget, on_frame_tick, list, NULL);
+    }
+}
+
+static void queue_change(ConfFileList *list, GFile *file, gboolean exists) {
+    if (!file) return;
+    gchar *name = g_file_get_basename(file);
+    conf_file_list_queue_name(list, name, exists);
+    g_free(name);
+}
+
+static void on_directory_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                 GFileMonitorEvent event_type, gpointer user_data) {
+    (void)monitor; // Unused parameter
+    ConfFileList *list = user_data;
+    
+    switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+            queue_change(list, file, TRUE);
+            break;
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+            queue_change(list, file, FALSE);
+            break;
+        case G_FILE_MONITOR_EVENT_RENAMED:
+            queue_change(list, file, FALSE);
+            queue_change(list, other_file, TRUE);
+            break;
+        default:
+            // Content changes do not affect the list
+            break;
+    }
+}
+
+ConfFileList* conf_file_list_new(const gchar *dir, GtkWidget *list_view,
+                                 GCallback on_selected, gpointer user_data) {
+    ConfFileList *list = g_new0(ConfFileList, 1);
+    list->dir = g_strdup(dir);
+    list->widget = list_view;
+    list->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    
+    list->index = g_ptr_array_new_with_free_func((GDestroyNotify)fuzzy_entry_unref);
+    list->matches = g_array_new(FALSE, FALSE, sizeof(guint32));
+    if (!score_quark) score_quark = g_quark_from_static_string("nginxui-fuzzy-score");
+    
+    // names -> filter -> sort -> selection. Until there is filter text
+    // the filter lets everything through and nothing is re-sorted.
+    list->names = gtk_string_list_new(NULL);
+    list->filter = gtk_custom_filter_new(NULL, NULL, NULL);
+    GtkFilterListModel *filtered = gtk_filter_list_model_new(G_LIST_MODEL(list->names),
+                                                             GTK_FILTER(g_object_ref(list->filter)));
+    list->sorted = gtk_sort_list_model_new(G_LIST_MODEL(filtered), NULL);
+    
+    GtkExpression *score = gtk_cclosure_expression_new(G_TYPE_INT, NULL, 0, NULL,
+                                                       G_CALLBACK(item_score), NULL, NULL);
+    GtkNumericSorter *by_score = gtk_numeric_sorter_new(score);
+    gtk_numeric_sorter_set_sort_order(by_score, GTK_SORT_DESCENDING);
+    list->score_sorter = GTK_SORTER(g_object_ref(by_score));
+    GtkMultiSorter *sorter = gtk_multi_sorter_new();
+    gtk_multi_sorter_append(sorter, GTK_SORTER(by_score));
+    gtk_multi_sorter_append(sorter, GTK_SORTER(gtk_string_sorter_new(
+        gtk_property_expression_new(GTK_TYPE_STRING_OBJECT, NULL, "string"))));
+    list->sorter = GTK_SORTER(sorter);
+    
+    list->selection = gtk_single_selection_new(G_LIST_MODEL(list->sorted));
+    // Files are opened by clicking them, never by the list changing
+    gtk_single_selection_set_autoselect(list->selection, FALSE);
+    gtk_single_selection_set_can_unselect(list->selection, TRUE);
+    list->selected_handler = g_signal_connect(list->selection, "notify::selected", on_selected, user_data);
+    
+    gtk_list_view_set_model(GTK_LIST_VIEW(list_view), GTK_SELECTION_MODEL(list->selection));
+    return list;
+}
+
+void conf_file_list_free(ConfFileList *list) {
+    if (!list) return;
+    if (list->tick_id) {
+        gtk_widget_remove_tick_callback(list->widget, list->tick_id);
+    }
+    if (list->monitor) {
+        g_file_monitor_cancel(list->monitor);
+        g_object_unref(list->monitor);
+    }
+    if (list->scoring) {
+        g_cancellable_cancel(list->scoring);
+        g_object_unref(list->scoring);
+    }
+    g_signal_handler_disconnect(list->selection, list->selected_handler);
+    g_object_unref(list->selection);
+    g_object_unref(list->sorter);
+    g_object_unref(list->score_sorter);
+    g_object_unref(list->filter);
+    g_array_unref(list->matches);
+    g_ptr_array_unref(list->index);
+    g_free(list->applied_text);
+    g_free(list->filter_text);
+    g_hash_table_unref(list->pending);
+    g_free(list->dir);
+    g_free(list);
+}
+
+gboolean conf_file_list_watch(ConfFileList *list, GError **error) {
+    if (list->monitor) return TRUE;
+    
+    GFile *dir = g_file_new_for_path(list->dir);
+    list->monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, error);
+    g_object_unref(dir);
+    if (!list->monitor) return FALSE;
+    
+    g_signal_connect(list->monitor, "changed", G_CALLBACK(on_directory_changed), list);
+    return TRUE;
+}
+
+gboolean conf_file_list_rescan(ConfFileList *list, GError **error) {
+    GPtrArray *present = nginx_core_list_configs(list->dir, error);
+    if (!present) return FALSE;
+    
+    // The directory contents supersede any events still pending; queue
+    // only the differences from what the model shows. Both sides are
+    // sorted, so one merge pass finds them.
+    g_hash_table_remove_all(list->pending);
+    guint n = g_list_model_get_n_items(G_LIST_MODEL(list->names));
+    guint i = 0, j = 0;
+    while (i < n || j < present->len) {
+        const gchar *existing = i < n ? gtk_string_list_get_string(list->names, i) : NULL;
+        const gchar *name = j < present->len ? g_ptr_array_index(present, j) : NULL;
+        gint cmp = !existing ? 1 : !name ? -1 : strcmp(existing, name);
+        if (cmp < 0) {
+            g_hash_table_replace(list->pending, g_strdup(existing), GINT_TO_POINTER(FALSE));
+            i++;
+        } else if (cmp > 0) {
+            g_hash_table_replace(list->pending, g_strdup(name), GINT_TO_POINTER(TRUE));
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+    g_ptr_array_unref(present);
+    
+    conf_file_list_flush(list);
+    return TRUE;
+}
+
+guint conf_file_list_get_count(ConfFileList *list) {
+    return g_list_model_get_n_items(G_LIST_MODEL(list->names));
+}
+
+void conf_file_list_set_filter(ConfFileList *list, const gchar *text) {
+    if (!text || !*text) {
+        if (!list->filter_text) return;
+        if (list->scoring) {
+            g_cancellable_cancel(list->scoring);
+            g_clear_object(&list->scoring);
+        }
+        g_clear_pointer(&list->filter_text, g_free);
+        g_clear_pointer(&list->applied_text, g_free);
+        g_array_set_size(list->matches, 0);
+        
+        gchar *selected = dup_selected_name(list);
+        g_signal_handler_block(list->selection, list->selected_handler);
+        gtk_custom_filter_set_filter_func(list->filter, NULL, NULL, NULL);
+        gtk_sort_list_model_set_sorter(list->sorted, NULL);
+        reselect(list, selected);
+        g_signal_handler_unblock(list->selection, list->selected_handler);
+        g_free(selected);
+        return;
+    }
+    
+    if (g_strcmp0(text, list->filter_text) == 0) return;
+    g_free(list->filter_text);
+    list->filter_text = g_strdup(text);
+    refilter(list, TRUE);
+}
+
+guint conf_file_list_get_n_visible(ConfFileList *list) {
+    return g_list_model_get_n_items(G_LIST_MODEL(list->sorted));
+}
+
+gboolean conf_file_list_select_name(ConfFileList *list, const gchar *name) {
+    guint position = find_visible(list, name);
+    if (position == GTK_INVALID_LIST_POSITION) return FALSE;
+    gtk_single_selection_set_selected(list->selection, position);
+    return TRUE;
+}
+
+void conf_file_list_show_name(ConfFileList *list, const gchar *name) {
+    g_signal_handler_block(list->selection, list->selected_handler);
+    reselect(list, name);
+    g_signal_handler_unblock(list->selection, list->selected_handler);
+}
+
+void conf_file_list_select_first(ConfFileList *list) {
+    if (conf_file_list_get_n_visible(list) > 0) {
+        gtk_single_selection_set_selected(list->selection, 0);
+    }
+}
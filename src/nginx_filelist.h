@@ -0,0 +1,43 @@
+#ifndef NGINX_FILELIST_H
+#define NGINX_FILELIST_H
+
+#include <gtk/gtk.h>
+
+// Sorted list of the .conf files in a directory, kept up to date by a
+// directory monitor. The model and selection are created once; changes
+// are batched and applied at most once per frame as a single splice.
+// With filter text, only fuzzy matches are shown, best first.
+typedef struct _ConfFileList ConfFileList;
+
+// Names scored on the main thread per keystroke; longer lists go to a worker
+#define FILE_FILTER_SYNC_LIMIT 50000
+
+// Installs the model on list_view and connects on_selected to the
+// selection's notify::selected. The handler is blocked while the list
+// rearranges itself, so it only fires for real selection changes.
+ConfFileList* conf_file_list_new(const gchar *dir, GtkWidget *list_view,
+                                 GCallback on_selected, gpointer user_data);
+void conf_file_list_free(ConfFileList *list);
+
+// Starts following changes made to the directory by other programs
+gboolean conf_file_list_watch(ConfFileList *list, GError **error);
+
+// Re-reads the directory and applies the difference immediately
+gboolean conf_file_list_rescan(ConfFileList *list, GError **error);
+// Adds or removes name with the next frame, like a change the directory
+// monitor saw; names that are not .conf files are ignored
+void conf_file_list_queue_name(ConfFileList *list, const gchar *name, gboolean exists);
+
+guint conf_file_list_get_count(ConfFileList *list);
+
+// Shows only names the text fuzzily matches, or everything for NULL or ""
+void conf_file_list_set_filter(ConfFileList *list, const gchar *text);
+guint conf_file_list_get_n_visible(ConfFileList *list);
+// Selects the best visible match, which opens it
+void conf_file_list_select_first(ConfFileList *list);
+// Selects name if it is visible, which opens it unless it already was
+gboolean conf_file_list_select_name(ConfFileList *list, const gchar *name);
+// Selects name if it is visible, or nothing, without opening anything
+void conf_file_list_show_name(ConfFileList *list, const gchar *name);
+
+#endif // NGINX_FILELIST_H
@@ -0,0 +1,135 @@
+#include "nginx_fuzzy.h"
+#include <string.h>
+
+// Entries scored between cancellation checks
+#define FUZZY_CHUNK 1024
+
+#define SCORE_MATCH 16
+#define SCORE_GAP_START 3
+#define SCORE_GAP_EXTENSION 1
+#define BONUS_START 10          // first character of the name
+#define BONUS_BOUNDARY 8        // after a separator
+#define BONUS_CONSECUTIVE 4     // minimum for a run of matches
+#define BONUS_FIRST_FACTOR 2    // the first pattern character counts double
+
+static guint64 char_bit(guchar c) {
+    if (c >= 'a' && c <= 'z') return G_GUINT64_CONSTANT(1) << (c - 'a');
+    if (c >= '0' && c <= '9') return G_GUINT64_CONSTANT(1) << (26 + c - '0');
+    return G_GUINT64_CONSTANT(1) << (36 + c % 28);
+}
+
+static void fold(const gchar *text, gchar **folded, guint32 *length, guint64 *mask) {
+    *folded = g_ascii_strdown(text, -1);
+    *length = (guint32)strlen(*folded);
+    *mask = 0;
+    for (guint32 i = 0; i < *length; i++) {
+        *mask |= char_bit((guchar)(*folded)[i]);
+    }
+}
+
+FuzzyEntry* fuzzy_entry_new(const gchar *name) {
+    FuzzyEntry *entry = g_atomic_rc_box_new0(FuzzyEntry);
+    entry->name = g_strdup(name);
+    fold(name, &entry->folded, &entry->length, &entry->mask);
+    return entry;
+}
+
+FuzzyEntry* fuzzy_entry_ref(FuzzyEntry *entry) {
+    return g_atomic_rc_box_acquire(entry);
+}
+
+static void fuzzy_entry_clear(gpointer data) {
+    FuzzyEntry *entry = data;
+    g_free(entry->folded);
+    g_free(entry->name);
+}
+
+void fuzzy_entry_unref(FuzzyEntry *entry) {
+    g_atomic_rc_box_release_full(entry, fuzzy_entry_clear);
+}
+
+FuzzyPattern* fuzzy_pattern_new(const gchar *text) {
+    FuzzyPattern *pattern = g_new0(FuzzyPattern, 1);
+    fold(text, &pattern->folded, &pattern->length, &pattern->mask);
+    return pattern;
+}
+
+void fuzzy_pattern_free(FuzzyPattern *pattern) {
+    if (!pattern) return;
+    g_free(pattern->folded);
+    g_free(pattern);
+}
+
+static gint32 boundary_bonus(const gchar *name, guint32 i) {
+    if (i == 0) return BONUS_START;
+    switch (name[i - 1]) {
+        case '-': case '_': case '.': case ' ': case '/':
+            return BONUS_BOUNDARY;
+        default:
+            return 0;
+    }
+}
+
+// Finds the first window of the name holding the pattern as a
+// subsequence, shrinks it from the left, then scores the characters
+// matched inside it. Linear in the name length.
+gint32 fuzzy_score(const FuzzyPattern *pattern, const FuzzyEntry *entry) {
+    if (pattern->length == 0) return 1;
+    if ((pattern->mask & entry->mask) != pattern->mask || pattern->length > entry->length) {
+        return FUZZY_NO_MATCH;
+    }
+    
+    const gchar *name = entry->folded;
+    const gchar *text = pattern->folded;
+    guint32 p = 0, end = 0;
+    for (guint32 i = 0; i < entry->length; i++) {
+        if (name[i] == text[p] && ++p == pattern->length) {
+            end = i + 1;
+            break;
+        }
+    }
+    if (p < pattern->length) return FUZZY_NO_MATCH;
+    
+    guint32 start = end;
+    p = pattern->length;
+    while (p > 0) {
+        start--;
+        if (name[start] == text[p - 1]) p--;
+    }
+    
+    gint32 score = 0, run_bonus = 0;
+    gboolean in_gap = FALSE;
+    p = 0;
+    for (guint32 i = start; i < end; i++) {
+        if (p < pattern->length && name[i] == text[p]) {
+            gint32 bonus = boundary_bonus(name, i);
+            if (run_bonus > 0) {
+                // A run keeps the bonus of the boundary it started at
+                bonus = MAX(bonus, MAX(run_bonus, BONUS_CONSECUTIVE));
+            }
+            score += SCORE_MATCH + (p == 0 ? bonus * BONUS_FIRST_FACTOR : bonus);
+            run_bonus = MAX(bonus, BONUS_CONSECUTIVE);
+            in_gap = FALSE;
+            p++;
+        } else {
+            score -= in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            run_bonus = 0;
+            in_gap = TRUE;
+        }
+    }
+    // Among equal matches the shorter name is the likelier target
+    score -= (gint32)(entry->length - pattern->length) / 8;
+    return MAX(score, 1);
+}
+
+gboolean fuzzy_score_entries(const FuzzyPattern *pattern, GPtrArray *entries,
+                             const GArray *positions, gint32 *scores,
+                             GCancellable *cancellable) {
+    guint n = positions ? positions->len : entries->len;
+    for (guint i = 0; i < n; i++) {
+        if (i % FUZZY_CHUNK == 0 && g_cancellable_is_cancelled(cancellable)) return FALSE;
+        guint position = positions ? g_array_index(positions, guint32, i) : i;
+        scores[position] = fuzzy_score(pattern, g_ptr_array_index(entries, position));
+    }
+    return TRUE;
+}
@@ -0,0 +1,45 @@
+#ifndef NGINX_FUZZY_H
+#define NGINX_FUZZY_H
+
+#include <gio/gio.h>
+
+// Fuzzy file name matching: a pattern matches a name when its characters
+// appear in order, ignoring ASCII case. Matches score higher the closer
+// together their characters are and the more of them start a word after
+// "-", "_" or ".", so "exa" ranks "example.conf" above "shop.examples.conf".
+
+// No match; every match scores at least 1
+#define FUZZY_NO_MATCH 0
+
+// A name folded for matching, built once when the name appears. Entries
+// never change, so a worker may score them while the list moves on.
+typedef struct {
+    gchar *name;
+    gchar *folded;          // ASCII lowercase copy of name
+    guint32 length;
+    guint64 mask;           // characters present, to reject most names early
+} FuzzyEntry;
+
+FuzzyEntry* fuzzy_entry_new(const gchar *name);
+FuzzyEntry* fuzzy_entry_ref(FuzzyEntry *entry);
+void fuzzy_entry_unref(FuzzyEntry *entry);
+
+typedef struct {
+    gchar *folded;
+    guint32 length;
+    guint64 mask;
+} FuzzyPattern;
+
+FuzzyPattern* fuzzy_pattern_new(const gchar *text);
+void fuzzy_pattern_free(FuzzyPattern *pattern);
+
+gint32 fuzzy_score(const FuzzyPattern *pattern, const FuzzyEntry *entry);
+
+// Scores entries[positions[i]] into scores[positions[i]], or every entry
+// when positions is NULL, checking for cancellation between chunks.
+// Returns FALSE when cancelled.
+gboolean fuzzy_score_entries(const FuzzyPattern *pattern, GPtrArray *entries,
+                             const GArray *positions, gint32 *scores,
+                             GCancellable *cancellable);
+
+#endif // NGINX_FUZZY_H
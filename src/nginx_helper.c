@@ -0,0 +1,387 @@
+#include "nginx_helper.h"
+#include "nginx_trace.h"
+#include <gio/gio.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NGINXUI_HELPER_PATH
+#define NGINXUI_HELPER_PATH "/usr/libexec/nginxui-helper"
+#endif
+
+// Unanswered requests allowed in flight, so that unread responses can
+// never fill the pipe while we are still writing requests
+#define HELPER_MAX_IN_FLIGHT 256
+
+struct _HelperClient {
+    GSubprocess *process;
+    GOutputStream *requests;    // helper stdin, owned by process
+    GInputStream *responses;    // helper stdout, owned by process
+    guint32 next_id;
+    GMutex lock;
+    // Held for writing requests, so that a cancel can be sent while
+    // another thread holds lock waiting on a command
+    GMutex write_lock;
+    guint32 command_id;         // nginx command in progress, 0 if none
+};
+
+typedef struct {
+    HelperOp op;
+    guint32 n_args;
+    GByteArray *payload;        // encoded arguments
+    gint status;
+    gchar *error;
+} HelperRequest;
+
+struct _HelperBatch {
+    GPtrArray *requests;
+};
+
+static HelperClient *default_client;
+static GMutex default_client_lock;
+
+static HelperRequest* helper_request_new(HelperOp op) {
+    HelperRequest *request = g_new0(HelperRequest, 1);
+    request->op = op;
+    request->payload = g_byte_array_new();
+    return request;
+}
+
+static void helper_request_free(gpointer data) {
+    HelperRequest *request = data;
+    g_byte_array_unref(request->payload);
+    g_free(request->error);
+    g_free(request);
+}
+
+static void append_arg(HelperRequest *request, gconstpointer data, gsize length) {
+    guint32 len = (guint32)length;
+    g_byte_array_append(request->payload, (const guint8 *)&len, sizeof(len));
+    g_byte_array_append(request->payload, data, len);
+    request->n_args++;
+}
+
+static void append_string_arg(HelperRequest *request, const gchar *value) {
+    append_arg(request, value, strlen(value));
+}
+
+static void append_mode_arg(HelperRequest *request, guint mode) {
+    guint32 value = mode;
+    append_arg(request, &value, sizeof(value));
+}
+
+static gboolean send_request(HelperClient *client, guint32 id, const HelperRequest *request, GError **error) {
+    HelperRequestHeader header = { HELPER_MAGIC, id, request->op, request->n_args };
+    g_mutex_lock(&client->write_lock);
+    gboolean ok = g_output_stream_write_all(client->requests, &header, sizeof(header), NULL, NULL, error) &&
+                  g_output_stream_write_all(client->requests, request->payload->data, request->payload->len,
+                                            NULL, NULL, error);
+    g_mutex_unlock(&client->write_lock);
+    return ok;
+}
+
+static gboolean read_exact(HelperClient *client, gpointer buffer, gsize length, GError **error) {
+    gsize n = 0;
+    if (!g_input_stream_read_all(client->responses, buffer, length, &n, NULL, error)) {
+        return FALSE;
+    }
+    if (n != length) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE, "Privileged helper exited");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Reads the frames answering request id, passing output lines to on_output
+static gboolean read_result(HelperClient *client, guint32 id, HelperOutputFunc on_output, gpointer user_data,
+                            gint *status, gchar **message, GError **error) {
+    for (;;) {
+        HelperFrame frame;
+        if (!read_exact(client, &frame, sizeof(frame), error)) {
+            return FALSE;
+        }
+        if (frame.magic != HELPER_MAGIC || frame.id != id || frame.length > HELPER_MAX_ARG_LENGTH) {
+            g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                "Malformed response from privileged helper");
+            return FALSE;
+        }
+        
+        gchar *payload = g_malloc(frame.length + 1);
+        if (!read_exact(client, payload, frame.length, error)) {
+            g_free(payload);
+            return FALSE;
+        }
+        payload[frame.length] = '\0';
+        
+        if (frame.type == HELPER_FRAME_RESULT) {
+            *status = frame.status;
+            *message = payload;
+            return TRUE;
+        }
+        if (on_output) {
+            on_output(payload, user_data);
+        }
+        g_free(payload);
+    }
+}
+
+static void helper_client_stop(HelperClient *client) {
+    if (!client->process) return;
+    
+    // Closing its stdin makes the helper exit on its own; it may run as
+    // root, so we cannot rely on being allowed to kill it
+    g_mutex_lock(&client->write_lock);
+    g_output_stream_close(client->requests, NULL, NULL);
+    g_clear_object(&client->process);
+    client->requests = NULL;
+    client->responses = NULL;
+    g_mutex_unlock(&client->write_lock);
+}
+
+static const gchar* default_launcher(void) {
+    const gchar *launcher = g_getenv("NGINXUI_HELPER_LAUNCHER");
+    if (launcher && *launcher) {
+        return launcher;
+    }
+    // sudo needs a terminal to ask for a password, pkexec brings its own dialog
+    return isatty(STDIN_FILENO) ? "sudo" : "pkexec";
+}
+
+static gboolean helper_client_start(HelperClient *client, GError **error) {
+    const gchar *helper_path = g_getenv("NGINXUI_HELPER_PATH");
+    if (!helper_path || !*helper_path) {
+        helper_path = NGINXUI_HELPER_PATH;
+    }
+    const gchar *launcher = default_launcher();
+    
+    const gchar *argv[3];
+    gint argc = 0;
+    if (g_strcmp0(launcher, "none") != 0) {
+        argv[argc++] = launcher;
+    }
+    argv[argc++] = helper_path;
+    argv[argc] = NULL;
+    
+    // A dead helper must show up as a write error, not kill the application
+    signal(SIGPIPE, SIG_IGN);
+    
+    client->process = g_subprocess_newv(argv, G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE,
+                                        error);
+    if (!client->process) {
+        g_prefix_error(error, "Cannot start privileged helper: ");
+        return FALSE;
+    }
+    trace_count_spawn();
+    client->requests = g_subprocess_get_stdin_pipe(client->process);
+    client->responses = g_subprocess_get_stdout_pipe(client->process);
+    
+    // The handshake also waits for sudo/pkexec authentication to finish
+    HelperRequest *hello = helper_request_new(HELPER_OP_HELLO);
+    guint32 id = client->next_id++;
+    gint version = 0;
+    gchar *message = NULL;
+    gboolean ok = send_request(client, id, hello, error) &&
+                  read_result(client, id, NULL, NULL, &version, &message, error);
+    helper_request_free(hello);
+    g_free(message);
+    
+    if (ok && version != HELPER_PROTOCOL_VERSION) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "helper speaks protocol version %d, expected %d", version, HELPER_PROTOCOL_VERSION);
+        ok = FALSE;
+    }
+    if (!ok) {
+        g_prefix_error(error, "Cannot start privileged helper: ");
+        helper_client_stop(client);
+    }
+    return ok;
+}
+
+HelperClient* helper_client_get_default(GError **error) {
+    g_mutex_lock(&default_client_lock);
+    if (!default_client) {
+        default_client = g_new0(HelperClient, 1);
+        g_mutex_init(&default_client->lock);
+        g_mutex_init(&default_client->write_lock);
+        default_client->next_id = 1;
+    }
+    HelperClient *client = default_client;
+    g_mutex_unlock(&default_client_lock);
+    
+    g_mutex_lock(&client->lock);
+    gboolean ok = client->process != NULL || helper_client_start(client, error);
+    g_mutex_unlock(&client->lock);
+    return ok ? client : NULL;
+}
+
+void helper_cancel_command(void) {
+    g_mutex_lock(&default_client_lock);
+    HelperClient *client = default_client;
+    g_mutex_unlock(&default_client_lock);
+    if (!client) return;
+    
+    // A failed write shows up in the thread waiting on the command
+    g_mutex_lock(&client->write_lock);
+    if (client->requests && client->command_id != 0) {
+        HelperRequestHeader header = { HELPER_MAGIC, client->command_id, HELPER_OP_CANCEL, 0 };
+        g_output_stream_write_all(client->requests, &header, sizeof(header), NULL, NULL, NULL);
+    }
+    g_mutex_unlock(&client->write_lock);
+}
+
+HelperBatch* helper_batch_new(void) {
+    HelperBatch *batch = g_new0(HelperBatch, 1);
+    batch->requests = g_ptr_array_new_with_free_func(helper_request_free);
+    return batch;
+}
+
+void helper_batch_free(HelperBatch *batch) {
+    if (!batch) return;
+    g_ptr_array_unref(batch->requests);
+    g_free(batch);
+}
+
+void helper_batch_write_file(HelperBatch *batch, const gchar *path,
+                             const gchar *data, gsize length, guint mode) {
+    HelperRequest *request = helper_request_new(HELPER_OP_WRITE_FILE);
+    append_string_arg(request, path);
+    append_arg(request, data, length);
+    append_mode_arg(request, mode);
+    g_ptr_array_add(batch->requests, request);
+}
+
+void helper_batch_chmod(HelperBatch *batch, const gchar *path, guint mode) {
+    HelperRequest *request = helper_request_new(HELPER_OP_CHMOD);
+    append_string_arg(request, path);
+    append_mode_arg(request, mode);
+    g_ptr_array_add(batch->requests, request);
+}
+
+void helper_batch_unlink(HelperBatch *batch, const gchar *path) {
+    HelperRequest *request = helper_request_new(HELPER_OP_UNLINK);
+    append_string_arg(request, path);
+    g_ptr_array_add(batch->requests, request);
+}
+
+guint helper_batch_get_length(const HelperBatch *batch) {
+    return batch->requests->len;
+}
+
+// Error message of a request after helper_batch_run, NULL if it succeeded
+const gchar* helper_batch_get_error(const HelperBatch *batch, guint index) {
+    HelperRequest *request = g_ptr_array_index(batch->requests, index);
+    return request->status != 0 ? request->error : NULL;
+}
+
+// Sends every request in the batch without waiting for the previous
+// answer, then collects the answers. Returns FALSE if the helper could
+// not be reached or any request failed; error describes the first failure.
+gboolean helper_batch_run(HelperClient *client, HelperBatch *batch, GError **error) {
+    GPtrArray *requests = batch->requests;
+    guint64 bytes = 0;
+    for (guint i = 0; i < requests->len; i++) {
+        bytes += ((HelperRequest *)g_ptr_array_index(requests, i))->payload->len;
+    }
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_HELPER_WRITE);
+    
+    g_mutex_lock(&client->lock);
+    gboolean ok = client->process != NULL || helper_client_start(client, error);
+    if (ok) {
+        guint32 first_id = client->next_id;
+        client->next_id += requests->len;
+        
+        guint sent = 0, received = 0;
+        while (ok && received < requests->len) {
+            if (sent < requests->len && sent - received < HELPER_MAX_IN_FLIGHT) {
+                ok = send_request(client, first_id + sent, g_ptr_array_index(requests, sent), error);
+                sent++;
+            } else {
+                HelperRequest *request = g_ptr_array_index(requests, received);
+                g_clear_pointer(&request->error, g_free);
+                ok = read_result(client, first_id + received, NULL, NULL,
+                                 &request->status, &request->error, error);
+                received++;
+            }
+        }
+        if (!ok) {
+            helper_client_stop(client);
+        }
+    }
+    g_mutex_unlock(&client->lock);
+    trace_end(&span, bytes);
+    
+    for (guint i = 0; ok && i < requests->len; i++) {
+        HelperRequest *request = g_ptr_array_index(requests, i);
+        if (request->status != 0) {
+            g_set_error_literal(error, G_IO_ERROR, g_io_error_from_errno(request->status),
+                                request->error && *request->error ? request->error : g_strerror(request->status));
+            ok = FALSE;
+        }
+    }
+    return ok;
+}
+
+static gboolean run_single(HelperBatch *batch, GError **error) {
+    HelperClient *client = helper_client_get_default(error);
+    gboolean ok = client && helper_batch_run(client, batch, error);
+    helper_batch_free(batch);
+    return ok;
+}
+
+gboolean helper_write_file(const gchar *path, const gchar *data, gsize length,
+                           guint mode, GError **error) {
+    HelperBatch *batch = helper_batch_new();
+    helper_batch_write_file(batch, path, data, length, mode);
+    return run_single(batch, error);
+}
+
+gboolean helper_unlink(const gchar *path, GError **error) {
+    HelperBatch *batch = helper_batch_new();
+    helper_batch_unlink(batch, path);
+    return run_single(batch, error);
+}
+
+gboolean helper_client_run_nginx(HelperClient *client, HelperOp op,
+                                 HelperOutputFunc on_output, gpointer user_data,
+                                 gint *exit_status, GError **error) {
+    g_return_val_if_fail(op == HELPER_OP_NGINX_TEST || op == HELPER_OP_NGINX_RELOAD, FALSE);
+    
+    HelperRequest *request = helper_request_new(op);
+    gint status = -1;
+    gchar *message = NULL;
+    
+    g_mutex_lock(&client->lock);
+    gboolean ok = client->process != NULL || helper_client_start(client, error);
+    if (ok) {
+        guint32 id = client->next_id++;
+        // The helper runs the command as its child on our behalf
+        trace_count_spawn();
+        ok = send_request(client, id, request, error);
+        if (ok) {
+            // A cancel may only follow the request it names
+            g_mutex_lock(&client->write_lock);
+            client->command_id = id;
+            g_mutex_unlock(&client->write_lock);
+            ok = read_result(client, id, on_output, user_data, &status, &message, error);
+            g_mutex_lock(&client->write_lock);
+            client->command_id = 0;
+            g_mutex_unlock(&client->write_lock);
+        }
+        if (!ok) {
+            helper_client_stop(client);
+        }
+    }
+    g_mutex_unlock(&client->lock);
+    helper_request_free(request);
+    
+    if (ok && status < 0) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            message && *message ? message : "command failed");
+        ok = FALSE;
+    } else if (ok) {
+        *exit_status = status;
+    }
+    g_free(message);
+    return ok;
+}
@@ -0,0 +1,97 @@
+#ifndef NGINX_HELPER_H
+#define NGINX_HELPER_H
+
+#include <glib.h>
+
+// Privileged helper protocol.
+//
+// The helper (nginxui-helper) is started once per session through sudo or
+// pkexec and reads requests on stdin, answering on stdout. Both ends run on
+// the same host, so frames use native byte order. A request is a
+// HelperRequestHeader followed by n_args arguments, each a guint32 length
+// and that many bytes. The helper answers requests strictly in order with
+// zero or more HELPER_FRAME_OUTPUT frames (one line of command output each)
+// and exactly one HELPER_FRAME_RESULT frame, whose payload is an error
+// message or empty. Requests may be pipelined.
+//
+// HELPER_OP_CANCEL is the exception: it is never answered. Sent while an
+// nginx command runs, with the id of that command's request, it stops the
+// command, which then answers as cancelled; otherwise it is ignored. A
+// signal would do the same, but the helper may run as root, and pkexec
+// does not pass signals on.
+
+#define HELPER_MAGIC 0x4e475848u          // "HXGN"
+#define HELPER_PROTOCOL_VERSION 2
+#define HELPER_MAX_ARG_LENGTH (256u * 1024 * 1024)
+#define HELPER_MAX_ARGS 8
+
+typedef enum {
+    HELPER_OP_HELLO = 1,        // () -> status = protocol version
+    HELPER_OP_WRITE_FILE,       // (path, data, mode) -> status = errno
+    HELPER_OP_CHMOD,            // (path, mode) -> status = errno
+    HELPER_OP_UNLINK,           // (path) -> status = errno
+    HELPER_OP_NGINX_TEST,       // () -> output frames, status = exit status or -1
+    HELPER_OP_NGINX_RELOAD,     // () -> output frames, status = exit status or -1
+    HELPER_OP_CANCEL            // () -> no answer
+} HelperOp;
+
+typedef enum {
+    HELPER_FRAME_OUTPUT = 1,
+    HELPER_FRAME_RESULT
+} HelperFrameType;
+
+typedef struct {
+    guint32 magic;
+    guint32 id;
+    guint32 op;
+    guint32 n_args;
+} HelperRequestHeader;
+
+typedef struct {
+    guint32 magic;
+    guint32 id;
+    guint32 type;
+    gint32 status;
+    guint32 length;
+} HelperFrame;
+
+// Client side
+
+typedef struct _HelperClient HelperClient;
+typedef struct _HelperBatch HelperBatch;
+
+typedef void (*HelperOutputFunc)(const gchar *line, gpointer user_data);
+
+// The session's helper, started on first use. The launcher is taken from
+// NGINXUI_HELPER_LAUNCHER ("sudo", "pkexec" or "none" to run the helper
+// unprivileged as a local stand-in), the binary from NGINXUI_HELPER_PATH.
+HelperClient* helper_client_get_default(GError **error);
+
+// Asks the default helper to stop the nginx command it is running.
+// Safe to call from any thread while another thread waits on the command.
+void helper_cancel_command(void);
+
+// Requests queued in a batch are pipelined to the helper by helper_batch_run
+HelperBatch* helper_batch_new(void);
+void helper_batch_free(HelperBatch *batch);
+void helper_batch_write_file(HelperBatch *batch, const gchar *path,
+                             const gchar *data, gsize length, guint mode);
+void helper_batch_chmod(HelperBatch *batch, const gchar *path, guint mode);
+void helper_batch_unlink(HelperBatch *batch, const gchar *path);
+guint helper_batch_get_length(const HelperBatch *batch);
+const gchar* helper_batch_get_error(const HelperBatch *batch, guint index);
+gboolean helper_batch_run(HelperClient *client, HelperBatch *batch, GError **error);
+
+// Single-request conveniences on the default helper
+gboolean helper_write_file(const gchar *path, const gchar *data, gsize length,
+                           guint mode, GError **error);
+gboolean helper_unlink(const gchar *path, GError **error);
+
+// Runs nginx -t or the reload command in the helper, blocking the calling
+// thread. Returns TRUE when the command ran to completion, with its exit
+// status in exit_status; on_output receives each line in the calling thread.
+gboolean helper_client_run_nginx(HelperClient *client, HelperOp op,
+                                 HelperOutputFunc on_output, gpointer user_data,
+                                 gint *exit_status, GError **error);
+
+#endif // NGINX_HELPER_H
@@ -0,0 +1,358 @@
+// nginxui-helper: the privileged half of nginxui. Started once per session
+// through sudo or pkexec, it serves the requests described in nginx_helper.h
+// until its stdin is closed.
+
+#include "nginx_helper.h"
+#include "nginx_process.h"
+#include <glib-unix.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HELPER_COMMAND_TIMEOUT_MS 120000
+
+// Entries ending in '/' allow everything below them, others one exact path
+static const gchar *default_allowed_paths[] = { "/etc/nginx/", "/etc/hosts", NULL };
+
+typedef struct {
+    gchar *data;
+    gsize length;
+} HelperArg;
+
+typedef struct {
+    GPtrArray *allowed_paths;
+    gchar **test_argv;
+    gchar **reload_argv;
+    GMainLoop *loop;
+    ProcessRunner *runner;      // command in progress
+    guint32 request_id;         // request the running command answers
+    guint stdin_watch;          // reads cancel requests while a command runs
+    HelperRequestHeader pending; // read by the watch, to be served next
+    gboolean has_pending;
+    gboolean stdin_closed;
+} Helper;
+
+static gboolean read_full(gint fd, gpointer buffer, gsize length) {
+    guint8 *p = buffer;
+    while (length > 0) {
+        gssize n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        p += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+static gboolean write_full(gint fd, gconstpointer buffer, gsize length) {
+    const guint8 *p = buffer;
+    while (length > 0) {
+        gssize n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return FALSE;
+        p += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+static void send_frame(guint32 id, HelperFrameType type, gint32 status, const gchar *payload) {
+    guint32 length = payload ? strlen(payload) : 0;
+    HelperFrame frame = { HELPER_MAGIC, id, type, status, length };
+    if (!write_full(STDOUT_FILENO, &frame, sizeof(frame)) ||
+        !write_full(STDOUT_FILENO, payload, length)) {
+        // Nobody is listening any more
+        _exit(1);
+    }
+}
+
+static void send_result(guint32 id, gint32 status, const gchar *message) {
+    send_frame(id, HELPER_FRAME_RESULT, status, message);
+}
+
+static void send_errno_result(guint32 id, gint saved_errno, const gchar *path) {
+    if (saved_errno == 0) {
+        send_result(id, 0, NULL);
+        return;
+    }
+    gchar *message = g_strdup_printf("%s: %s", path, g_strerror(saved_errno));
+    send_result(id, saved_errno, message);
+    g_free(message);
+}
+
+// Only canonical absolute paths are accepted, so ".." or "//" cannot be
+// used to step outside an allowed directory
+static gboolean is_path_allowed(Helper *helper, const gchar *path) {
+    if (!g_path_is_absolute(path)) return FALSE;
+    
+    gchar *canonical = g_canonicalize_filename(path, "/");
+    gboolean is_canonical = strcmp(canonical, path) == 0;
+    g_free(canonical);
+    if (!is_canonical) return FALSE;
+    
+    for (guint i = 0; i < helper->allowed_paths->len; i++) {
+        const gchar *allowed = g_ptr_array_index(helper->allowed_paths, i);
+        if (g_str_has_suffix(allowed, "/")) {
+            if (g_str_has_prefix(path, allowed) && path[strlen(allowed)] != '\0') return TRUE;
+        } else if (strcmp(path, allowed) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Writes a temporary file next to path, flushes it to disk and renames it
+// over path, so nginx never sees a half-written file and a crash leaves
+// either the old or the new contents. Returns 0 or an errno value.
+static gint write_file_atomically(const gchar *path, const gchar *data, gsize length, guint mode) {
+    gchar *dir = g_path_get_dirname(path);
+    gchar *base = g_path_get_basename(path);
+    gchar *temp_path = g_strdup_printf("%s/.%s.XXXXXX", dir, base);
+    gint saved_errno = 0;
+    
+    gint fd = g_mkstemp_full(temp_path, O_WRONLY | O_CLOEXEC, mode);
+    if (fd < 0) {
+        saved_errno = errno;
+    } else {
+        if (!write_full(fd, data, length) || fchmod(fd, mode) != 0 || fsync(fd) != 0) {
+            saved_errno = errno;
+        }
+        if (close(fd) != 0 && saved_errno == 0) {
+            saved_errno = errno;
+        }
+        if (saved_errno == 0 && rename(temp_path, path) != 0) {
+            saved_errno = errno;
+        }
+        if (saved_errno != 0) {
+            unlink(temp_path);
+        } else {
+            // Makes the rename itself durable; the file is in place either way
+            gint dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd >= 0) {
+                fsync(dir_fd);
+                close(dir_fd);
+            }
+        }
+    }
+    
+    g_free(temp_path);
+    g_free(base);
+    g_free(dir);
+    return saved_errno;
+}
+
+static void on_command_output(ProcessStream stream, const gchar *line, gpointer user_data) {
+    (void)stream; // nginx reports its results on stderr, both streams are forwarded
+    Helper *helper = user_data;
+    send_frame(helper->request_id, HELPER_FRAME_OUTPUT, 0, line);
+}
+
+static void on_command_done(const ProcessResult *result, gpointer user_data) {
+    Helper *helper = user_data;
+    helper->runner = NULL;
+    
+    if (result->exited && !result->timed_out && !result->cancelled) {
+        send_result(helper->request_id, result->exit_status, NULL);
+    } else {
+        gchar *reason = process_result_describe(result);
+        send_result(helper->request_id, -1, reason);
+        g_free(reason);
+    }
+    g_main_loop_quit(helper->loop);
+}
+
+// Only a cancel is expected while a command runs; any other request is
+// kept for the main loop, and a closed stdin stops the command as well
+static gboolean on_stdin_ready(gint fd, GIOCondition condition, gpointer user_data) {
+    (void)condition; // Unused parameter
+    Helper *helper = user_data;
+    HelperRequestHeader header;
+    
+    if (!read_full(fd, &header, sizeof(header))) {
+        helper->stdin_closed = TRUE;
+    } else if (header.magic == HELPER_MAGIC && header.op == HELPER_OP_CANCEL && header.n_args == 0) {
+        if (helper->runner && header.id == helper->request_id) {
+            process_runner_cancel(helper->runner);
+        }
+        return G_SOURCE_CONTINUE;
+    } else {
+        helper->pending = header;
+        helper->has_pending = TRUE;
+        helper->stdin_watch = 0;
+        return G_SOURCE_REMOVE;
+    }
+    
+    if (helper->runner) {
+        process_runner_cancel(helper->runner);
+    }
+    helper->stdin_watch = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void run_command(Helper *helper, guint32 id, gchar **argv) {
+    GError *error = NULL;
+    helper->request_id = id;
+    helper->runner = process_runner_start((const gchar * const *)argv, HELPER_COMMAND_TIMEOUT_MS,
+                                          on_command_output, on_command_done, helper, &error);
+    if (!helper->runner) {
+        send_result(id, -1, error->message);
+        g_error_free(error);
+        return;
+    }
+    helper->stdin_watch = g_unix_fd_add(STDIN_FILENO, G_IO_IN | G_IO_HUP | G_IO_ERR, on_stdin_ready, helper);
+    g_main_loop_run(helper->loop);
+    if (helper->stdin_watch) {
+        g_source_remove(helper->stdin_watch);
+        helper->stdin_watch = 0;
+    }
+}
+
+static guint arg_mode(const HelperArg *arg) {
+    guint32 mode = 0;
+    memcpy(&mode, arg->data, sizeof(mode));
+    return mode & 07777;
+}
+
+static void handle_request(Helper *helper, const HelperRequestHeader *header, HelperArg *args) {
+    guint32 id = header->id;
+    
+    switch (header->op) {
+        case HELPER_OP_HELLO:
+            send_result(id, HELPER_PROTOCOL_VERSION, NULL);
+            return;
+        case HELPER_OP_NGINX_TEST:
+            run_command(helper, id, helper->test_argv);
+            return;
+        case HELPER_OP_NGINX_RELOAD:
+            run_command(helper, id, helper->reload_argv);
+            return;
+        case HELPER_OP_CANCEL:
+            // The command it was meant for has already finished
+            return;
+        default:
+            break;
+    }
+    
+    // Everything else operates on the path in the first argument
+    guint n_args = header->n_args;
+    gboolean valid =
+        (header->op == HELPER_OP_WRITE_FILE && n_args == 3 && args[2].length == sizeof(guint32)) ||
+        (header->op == HELPER_OP_CHMOD && n_args == 2 && args[1].length == sizeof(guint32)) ||
+        (header->op == HELPER_OP_UNLINK && n_args == 1);
+    if (!valid || strlen(args[0].data) != args[0].length) {
+        send_result(id, EINVAL, "Malformed request");
+        return;
+    }
+    
+    const gchar *path = args[0].data;
+    if (!is_path_allowed(helper, path)) {
+        gchar *message = g_strdup_printf("%s: not a path nginxui may modify", path);
+        send_result(id, EACCES, message);
+        g_free(message);
+        return;
+    }
+    
+    gint saved_errno = 0;
+    if (header->op == HELPER_OP_WRITE_FILE) {
+        saved_errno = write_file_atomically(path, args[1].data, args[1].length, arg_mode(&args[2]));
+    } else if (header->op == HELPER_OP_CHMOD) {
+        if (chmod(path, arg_mode(&args[1])) != 0) saved_errno = errno;
+    } else {
+        if (unlink(path) != 0) saved_errno = errno;
+    }
+    send_errno_result(id, saved_errno, path);
+}
+
+static void helper_init(Helper *helper) {
+    helper->allowed_paths = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; default_allowed_paths[i]; i++) {
+        g_ptr_array_add(helper->allowed_paths, g_strdup(default_allowed_paths[i]));
+    }
+    
+    const gchar *nginx = NULL;
+    
+    // An unprivileged stand-in (NGINXUI_HELPER_LAUNCHER=none) may be pointed
+    // at a scratch tree and another nginx; as root the environment is ignored
+    if (geteuid() != 0) {
+        const gchar *extra = g_getenv("NGINXUI_HELPER_ALLOW");
+        if (extra) {
+            gchar **paths = g_strsplit(extra, ":", -1);
+            for (guint i = 0; paths[i]; i++) {
+                if (g_path_is_absolute(paths[i])) {
+                    g_ptr_array_add(helper->allowed_paths, g_strdup(paths[i]));
+                }
+            }
+            g_strfreev(paths);
+        }
+        nginx = g_getenv("NGINXUI_HELPER_NGINX");
+    }
+    
+    if (nginx) {
+        helper->test_argv = g_strdupv((gchar *[]){ (gchar *)nginx, "-t", NULL });
+        helper->reload_argv = g_strdupv((gchar *[]){ (gchar *)nginx, "-s", "reload", NULL });
+    } else {
+        helper->test_argv = g_strdupv((gchar *[]){ "nginx", "-t", NULL });
+        helper->reload_argv = g_strdupv((gchar *[]){ "systemctl", "reload", "nginx", NULL });
+    }
+    
+    helper->loop = g_main_loop_new(NULL, FALSE);
+}
+
+// The next request header, which the stdin watch may already have read
+static gboolean read_header(Helper *helper, HelperRequestHeader *header) {
+    if (helper->has_pending) {
+        *header = helper->pending;
+        helper->has_pending = FALSE;
+        return TRUE;
+    }
+    return !helper->stdin_closed && read_full(STDIN_FILENO, header, sizeof(*header));
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc; // Unused parameter
+    (void)argv; // Unused parameter
+    
+    // A closed response pipe is handled where the write fails
+    signal(SIGPIPE, SIG_IGN);
+    
+    Helper helper = { 0 };
+    helper_init(&helper);
+    
+    HelperRequestHeader header;
+    while (read_header(&helper, &header)) {
+        if (header.magic != HELPER_MAGIC || header.n_args > HELPER_MAX_ARGS) {
+            // The stream cannot be resynchronized
+            g_printerr("nginxui-helper: malformed request, exiting\n");
+            return 1;
+        }
+        
+        HelperArg args[HELPER_MAX_ARGS] = { 0 };
+        gboolean ok = TRUE;
+        for (guint i = 0; ok && i < header.n_args; i++) {
+            guint32 length = 0;
+            ok = read_full(STDIN_FILENO, &length, sizeof(length)) && length <= HELPER_MAX_ARG_LENGTH;
+            if (ok) {
+                args[i].data = g_malloc(length + 1);
+                args[i].length = length;
+                ok = read_full(STDIN_FILENO, args[i].data, length);
+                args[i].data[length] = '\0';
+            }
+        }
+        
+        if (ok) {
+            handle_request(&helper, &header, args);
+        }
+        for (guint i = 0; i < header.n_args; i++) {
+            g_free(args[i].data);
+        }
+        if (!ok) {
+            g_printerr("nginxui-helper: truncated request, exiting\n");
+            return 1;
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include "nginx_highlight.h"
+#include "nginx_parser.h"
+#include <string.h>
+
+#define KEYWORD_TABLE_SIZE 128
+
+typedef struct {
+    const gchar *word;
+    HighlightTokenKind kind;
+} Keyword;
+
+// Nginx keywords and directives
+static const Keyword keywords[] = {
+    { "server", HL_TOKEN_DIRECTIVE }, { "location", HL_TOKEN_DIRECTIVE },
+    { "upstream", HL_TOKEN_DIRECTIVE }, { "http", HL_TOKEN_DIRECTIVE },
+    { "events", HL_TOKEN_DIRECTIVE },
+    { "listen", HL_TOKEN_KEYWORD }, { "server_name", HL_TOKEN_KEYWORD },
+    { "root", HL_TOKEN_KEYWORD }, { "index", HL_TOKEN_KEYWORD },
+    { "proxy_pass", HL_TOKEN_KEYWORD }, { "proxy_set_header", HL_TOKEN_KEYWORD },
+    { "access_log", HL_TOKEN_KEYWORD }, { "error_log", HL_TOKEN_KEYWORD },
+    { "return", HL_TOKEN_KEYWORD }, { "rewrite", HL_TOKEN_KEYWORD },
+    { "try_files", HL_TOKEN_KEYWORD }, { "include", HL_TOKEN_KEYWORD },
+    { "if", HL_TOKEN_KEYWORD }, { "set", HL_TOKEN_KEYWORD },
+    { "worker_processes", HL_TOKEN_KEYWORD }, { "gzip", HL_TOKEN_KEYWORD },
+    { "ssl_certificate", HL_TOKEN_KEYWORD }, { "ssl_certificate_key", HL_TOKEN_KEYWORD },
+    { "ssl_protocols", HL_TOKEN_KEYWORD }, { "client_max_body_size", HL_TOKEN_KEYWORD },
+    { "keepalive_timeout", HL_TOKEN_KEYWORD }, { "types", HL_TOKEN_KEYWORD },
+};
+
+// Perfect hash over the keyword list: the seed is searched once so that
+// every keyword lands in its own slot, making a lookup one hash plus
+// one memcmp regardless of how many keywords there are.
+static guint32 keyword_seed;
+static const Keyword *keyword_table[KEYWORD_TABLE_SIZE];
+
+static inline guint32 keyword_hash(guint32 seed, const gchar *word, gsize len) {
+    guint32 h = 2166136261u ^ seed;
+    for (gsize i = 0; i < len; i++) {
+        h = (h ^ (guchar)word[i]) * 16777619u;
+    }
+    return (h ^ (h >> 15)) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static void build_keyword_table(void) {
+    static gsize initialized = 0;
+    if (!g_once_init_enter(&initialized)) {
+        return;
+    }
+
+    for (guint32 seed = 1; ; seed++) {
+        memset(keyword_table, 0, sizeof(keyword_table));
+        gboolean collision = FALSE;
+        for (gsize i = 0; i < G_N_ELEMENTS(keywords) && !collision; i++) {
+            guint32 slot = keyword_hash(seed, keywords[i].word, strlen(keywords[i].word));
+            if (keyword_table[slot]) {
+                collision = TRUE;
+            } else {
+                keyword_table[slot] = &keywords[i];
+            }
+        }
+        if (!collision) {
+            keyword_seed = seed;
+            break;
+        }
+    }
+
+    g_once_init_leave(&initialized, 1);
+}
+
+static const Keyword* lookup_keyword(const gchar *word, gsize len) {
+    const Keyword *kw = keyword_table[keyword_hash(keyword_seed, word, len)];
+    if (kw && strncmp(kw->word, word, len) == 0 && kw->word[len] == '\0') {
+        return kw;
+    }
+    return NULL;
+}
+
+// Tokens come from the config tokenizer, so a keyword is only
+// highlighted when it is a whole token (not the "http" in "http://")
+guint8 highlight_lex_line(const gchar *line, gsize len, guint8 state_in,
+                          HighlightTokenFunc emit, gpointer user_data) {
+    build_keyword_table();
+
+    ConfLexer lexer;
+    gchar quote = state_in == HL_STATE_DQUOTE ? '"' : state_in == HL_STATE_SQUOTE ? '\'' : 0;
+    conf_lexer_init(&lexer, line, len, quote);
+
+    ConfToken token;
+    while (conf_lexer_next(&lexer, &token)) {
+        gsize start = token.offset, end = token.offset + token.length;
+        if (token.kind == CONF_TOKEN_WORD) {
+            const Keyword *kw = lookup_keyword(line + start, token.length);
+            if (kw) {
+                emit(kw->kind, start, end, user_data);
+            }
+        } else if (token.kind == CONF_TOKEN_STRING) {
+            emit(HL_TOKEN_STRING, start, end, user_data);
+        } else if (token.kind == CONF_TOKEN_COMMENT) {
+            emit(HL_TOKEN_COMMENT, start, end, user_data);
+        }
+    }
+
+    if (lexer.quote == '"') return HL_STATE_DQUOTE;
+    if (lexer.quote == '\'') return HL_STATE_SQUOTE;
+    return HL_STATE_NORMAL;
+}
+
+HighlightState* highlight_state_new(void) {
+    HighlightState *state = g_new0(HighlightState, 1);
+    state->line_states = g_array_new(FALSE, TRUE, sizeof(guint8));
+    return state;
+}
+
+void highlight_state_free(HighlightState *state) {
+    if (!state) return;
+    g_array_free(state->line_states, TRUE);
+    g_free(state);
+}
+
+// Forget all cached line states and schedule a full re-lex
+void highlight_state_reset(HighlightState *state, guint n_lines) {
+    g_array_set_size(state->line_states, 0);
+    g_array_set_size(state->line_states, n_lines);
+    state->dirty = FALSE;
+    if (n_lines > 0) {
+        highlight_state_mark_dirty(state, 0, n_lines - 1);
+    }
+}
+
+// Text was inserted into line, splitting it into count + 1 lines
+void highlight_state_insert_lines(HighlightState *state, guint line, guint count) {
+    if (count > 0) {
+        guint at = MIN(line + 1, state->line_states->len);
+        guint8 *fill = g_new0(guint8, count);
+        g_array_insert_vals(state->line_states, at, fill, count);
+        g_free(fill);
+
+        if (state->dirty) {
+            if (state->dirty_start > line) state->dirty_start += count;
+            if (state->dirty_end > line) state->dirty_end += count;
+        }
+    }
+    highlight_state_mark_dirty(state, line, line + count);
+}
+
+static guint shift_after_removal(guint index, guint line, guint count) {
+    if (index <= line + 1) return index;
+    if (index <= line + 1 + count) return line + 1;
+    return index - count;
+}
+
+// Text was deleted starting in line, joining the count lines after it into it
+void highlight_state_remove_lines(HighlightState *state, guint line, guint count) {
+    if (count > 0) {
+        guint at = MIN(line + 1, state->line_states->len);
+        guint n = MIN(count, state->line_states->len - at);
+        g_array_remove_range(state->line_states, at, n);
+
+        if (state->dirty) {
+            state->dirty_start = shift_after_removal(state->dirty_start, line, count);
+            state->dirty_end = shift_after_removal(state->dirty_end, line, count);
+        }
+    }
+    highlight_state_mark_dirty(state, line, line);
+}
+
+void highlight_state_mark_dirty(HighlightState *state, guint first, guint last) {
+    if (!state->dirty) {
+        state->dirty_start = first;
+        state->dirty_end = last + 1;
+        state->dirty = TRUE;
+    } else {
+        state->dirty_start = MIN(state->dirty_start, first);
+        state->dirty_end = MAX(state->dirty_end, last + 1);
+    }
+}
+
+// Re-lex the dirty range, then keep going past it only while the end
+// state of a line differs from what was cached: once a line ends in the
+// same state as before, every following line is known to be unchanged.
+// Returns the number of lines that were re-lexed.
+guint highlight_state_relex(HighlightState *state, guint n_lines,
+                            HighlightLineFunc func, gpointer user_data) {
+    if (state->line_states->len != n_lines) {
+        // Line bookkeeping drifted (e.g. a separator we do not track), start over
+        highlight_state_reset(state, n_lines);
+    }
+    if (!state->dirty) {
+        return 0;
+    }
+
+    guint8 *states = (guint8 *)state->line_states->data;
+    guint count = 0;
+    for (guint line = state->dirty_start; line < n_lines; line++) {
+        guint8 state_in = line > 0 ? states[line - 1] : HL_STATE_NORMAL;
+        guint8 state_out = func(line, state_in, user_data);
+        gboolean changed = states[line] != state_out;
+        states[line] = state_out;
+        count++;
+
+        if (line + 1 >= state->dirty_end && !changed) {
+            break;
+        }
+    }
+
+    state->dirty = FALSE;
+    return count;
+}
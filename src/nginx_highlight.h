@@ -0,0 +1,47 @@
+#ifndef NGINX_HIGHLIGHT_H
+#define NGINX_HIGHLIGHT_H
+
+#include <glib.h>
+
+// Lexer state carried from the end of one line into the next.
+// Quoted strings may span lines in nginx configs, so a line cannot
+// be lexed without knowing how the previous one ended.
+typedef enum {
+    HL_STATE_NORMAL = 0,
+    HL_STATE_DQUOTE,
+    HL_STATE_SQUOTE
+} HighlightLexState;
+
+typedef enum {
+    HL_TOKEN_KEYWORD,
+    HL_TOKEN_DIRECTIVE,
+    HL_TOKEN_STRING,
+    HL_TOKEN_COMMENT
+} HighlightTokenKind;
+
+// Token callback: start/end are byte offsets within the line
+typedef void (*HighlightTokenFunc)(HighlightTokenKind kind, gsize start, gsize end, gpointer user_data);
+
+// Re-lex a single line starting in state_in, return the state at its end
+typedef guint8 (*HighlightLineFunc)(guint line, guint8 state_in, gpointer user_data);
+
+typedef struct {
+    GArray *line_states;    // guint8 lexer state at the end of each line
+    guint dirty_start;      // first line that must be re-lexed
+    guint dirty_end;        // lines before this are re-lexed unconditionally
+    gboolean dirty;
+} HighlightState;
+
+HighlightState* highlight_state_new(void);
+void highlight_state_free(HighlightState *state);
+void highlight_state_reset(HighlightState *state, guint n_lines);
+void highlight_state_insert_lines(HighlightState *state, guint line, guint count);
+void highlight_state_remove_lines(HighlightState *state, guint line, guint count);
+void highlight_state_mark_dirty(HighlightState *state, guint first, guint last);
+guint highlight_state_relex(HighlightState *state, guint n_lines,
+                            HighlightLineFunc func, gpointer user_data);
+
+guint8 highlight_lex_line(const gchar *line, gsize len, guint8 state_in,
+                          HighlightTokenFunc emit, gpointer user_data);
+
+#endif // NGINX_HIGHLIGHT_H
@@ -0,0 +1,676 @@
+#include "nginx_history.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HISTORY_CHUNKS_MAGIC 0x4b484348u     // "HCHK"
+#define HISTORY_REVISIONS_MAGIC 0x56455248u  // "HREV"
+#define HISTORY_VERSION 1
+#define DIGEST_LENGTH 32                     // SHA-256
+#define HEADER_LENGTH (2 * sizeof(guint32))
+#define CHUNK_HEADER_LENGTH (DIGEST_LENGTH + 3 * sizeof(guint32))
+#define DELTA_HEADER_LENGTH (2 * sizeof(guint32))
+#define NO_CHUNK G_MAXUINT32
+// Longest chain of deltas a restore follows to rebuild one chunk
+#define MAX_DELTA_DEPTH 16
+
+// On-disk records, native byte order (the store never leaves the machine):
+//   chunks:    digest[32], u32 raw length, u32 stored length, u32 base,
+//              stored bytes
+//   revisions: u32 record length, i64 time, u32 action, u32 path length,
+//              path, u64 size, u32 n_chunks, n_chunks u32 chunk numbers
+// Chunk numbers are the position of the chunk in its file. A chunk
+// without a base (NO_CHUNK) is stored whole: raw deflate, or the raw
+// bytes when deflating did not make it smaller. A chunk with a base is
+// the base with its middle replaced, stored as u32 prefix length, u32
+// suffix length and the new middle. The base is the chunk it replaced in
+// the previous revision, so an edit stores little more than the bytes
+// that were typed.
+
+typedef struct {
+    guint8 digest[DIGEST_LENGTH];
+    guint32 raw_length;
+    guint32 stored_length;
+    guint32 base;               // chunk this one is a delta against, or NO_CHUNK
+    guint32 depth;              // deltas applied to rebuild it
+    guint64 offset;             // of the stored bytes
+} Chunk;
+
+typedef struct {
+    HistoryRevision pub;
+    guint32 n_chunks;
+    guint32 *chunks;
+} Revision;
+
+struct _HistoryStore {
+    gint chunks_fd;
+    gint revisions_fd;
+    guint64 chunks_size;        // end of the last complete record
+    guint64 revisions_size;
+    GPtrArray *chunks;          // Chunk*, by number
+    GHashTable *digests;        // digest -> chunk number
+    GPtrArray *revisions;       // Revision*, by id - 1
+    GHashTable *files;          // path -> GArray of guint revision ids, oldest first
+    GConverter *compressor;
+    GConverter *decompressor;
+    GChecksum *checksum;
+    guint64 content_bytes;
+};
+
+static guint64 gear[256];
+
+// Random values for the rolling hash. They are derived from a fixed seed:
+// other values would cut the same content at other places, and nothing
+// stored so far would be shared with what is stored next.
+static void init_gear(void) {
+    static gsize initialized = 0;
+    if (g_once_init_enter(&initialized)) {
+        guint64 state = G_GUINT64_CONSTANT(0x6e67696e78756921);
+        for (guint i = 0; i < G_N_ELEMENTS(gear); i++) {
+            // splitmix64
+            state += G_GUINT64_CONSTANT(0x9e3779b97f4a7c15);
+            guint64 z = state;
+            z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+            z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+            gear[i] = z ^ (z >> 31);
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+// Length of the chunk starting at data. A boundary is where the top bits
+// of the gear hash are all zero; the hash only depends on the last 64
+// bytes, so equal content is cut equally wherever it is.
+static gsize next_boundary(const guint8 *data, gsize length) {
+    if (length <= HISTORY_CHUNK_MIN) return length;
+    gsize limit = MIN(length, HISTORY_CHUNK_MAX);
+    const guint64 mask = ((G_GUINT64_CONSTANT(1) << HISTORY_CHUNK_BITS) - 1) << (64 - HISTORY_CHUNK_BITS);
+    guint64 hash = 0;
+    // Bytes further back than 64 have been shifted out by the minimum
+    for (gsize i = HISTORY_CHUNK_MIN - 64; i < limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (i >= HISTORY_CHUNK_MIN && !(hash & mask)) return i + 1;
+    }
+    return limit;
+}
+
+static guint digest_hash(gconstpointer key) {
+    guint hash;
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static gboolean digest_equal(gconstpointer a, gconstpointer b) {
+    return memcmp(a, b, DIGEST_LENGTH) == 0;
+}
+
+static void revision_free(gpointer data) {
+    Revision *revision = data;
+    g_free(revision->chunks);
+    g_free(revision);
+}
+
+static void set_errno_error(GError **error, const gchar *what, const gchar *path) {
+    int saved_errno = errno;
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                "Cannot %s %s: %s", what, path, g_strerror(saved_errno));
+}
+
+gchar* history_store_get_default_dir(void) {
+    return g_build_filename(g_get_user_data_dir(), "nginxui", "history", NULL);
+}
+
+void history_store_free(HistoryStore *store) {
+    if (!store) return;
+    if (store->chunks_fd >= 0) close(store->chunks_fd);
+    if (store->revisions_fd >= 0) close(store->revisions_fd);
+    g_ptr_array_unref(store->revisions);
+    g_hash_table_unref(store->files);
+    g_hash_table_unref(store->digests);
+    g_ptr_array_unref(store->chunks);
+    g_clear_object(&store->compressor);
+    g_clear_object(&store->decompressor);
+    g_checksum_free(store->checksum);
+    g_free(store);
+}
+
+static gboolean write_all(gint fd, const guint8 *data, gsize length, guint64 offset) {
+    while (length > 0) {
+        gssize written = pwrite(fd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return TRUE;
+}
+
+static gboolean read_all(gint fd, guint8 *data, gsize length, guint64 offset) {
+    while (length > 0) {
+        gssize n = pread(fd, data, length, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+        offset += n;
+    }
+    return TRUE;
+}
+
+typedef struct {
+    const guint8 *p;
+    const guint8 *end;
+    gboolean ok;
+} Reader;
+
+static const guint8* get_bytes(Reader *reader, gsize n) {
+    if (!reader->ok || (gsize)(reader->end - reader->p) < n) {
+        reader->ok = FALSE;
+        return NULL;
+    }
+    const guint8 *bytes = reader->p;
+    reader->p += n;
+    return bytes;
+}
+
+static guint32 get_u32(Reader *reader) {
+    guint32 value = 0;
+    const guint8 *bytes = get_bytes(reader, sizeof(value));
+    if (bytes) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static guint64 get_u64(Reader *reader) {
+    guint64 value = 0;
+    const guint8 *bytes = get_bytes(reader, sizeof(value));
+    if (bytes) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static void put_u32(GByteArray *out, guint32 value) {
+    g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_u64(GByteArray *out, guint64 value) {
+    g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+typedef gboolean (*ScanFunc)(HistoryStore *store, Reader *reader, guint64 base);
+
+// Opens one of the store files, writing its header when it is new, and
+// hands its records to scan. scan returns FALSE at the first record it
+// cannot read completely; the file is cut back to the records before it.
+static gint open_store_file(HistoryStore *store, const gchar *dir, const gchar *name, guint32 magic,
+                            ScanFunc scan, guint64 *size_out, GError **error) {
+    gchar *path = g_build_filename(dir, name, NULL);
+    gint fd = g_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        set_errno_error(error, "open", path);
+        g_free(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        set_errno_error(error, "stat", path);
+        goto failed;
+    }
+    if (st.st_size == 0) {
+        guint32 header[2] = { magic, HISTORY_VERSION };
+        if (!write_all(fd, (const guint8 *)header, sizeof(header), 0) || fsync(fd) != 0) {
+            set_errno_error(error, "write", path);
+            goto failed;
+        }
+        *size_out = HEADER_LENGTH;
+        g_free(path);
+        return fd;
+    }
+
+    GMappedFile *mapped = g_mapped_file_new_from_fd(fd, FALSE, error);
+    if (!mapped) goto failed;
+    const guint8 *data = (const guint8 *)g_mapped_file_get_contents(mapped);
+    Reader reader = { data, data + g_mapped_file_get_length(mapped), TRUE };
+    if (get_u32(&reader) != magic || get_u32(&reader) != HISTORY_VERSION) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s is not a history file of this version", path);
+        g_mapped_file_unref(mapped);
+        goto failed;
+    }
+    const guint8 *valid_end = reader.p;
+    while (reader.p < reader.end && scan(store, &reader, reader.p - data)) {
+        valid_end = reader.p;
+    }
+    *size_out = valid_end - data;
+    g_mapped_file_unref(mapped);
+    if (*size_out < (guint64)st.st_size && ftruncate(fd, *size_out) != 0) {
+        set_errno_error(error, "truncate", path);
+        goto failed;
+    }
+    g_free(path);
+    return fd;
+
+failed:
+    close(fd);
+    g_free(path);
+    return -1;
+}
+
+static guint32 add_chunk(HistoryStore *store, const guint8 *digest, guint32 raw_length,
+                         guint32 stored_length, guint32 base, guint64 offset) {
+    Chunk *chunk = g_new(Chunk, 1);
+    memcpy(chunk->digest, digest, DIGEST_LENGTH);
+    chunk->raw_length = raw_length;
+    chunk->stored_length = stored_length;
+    chunk->base = base;
+    chunk->depth = base == NO_CHUNK ? 0 : ((Chunk *)g_ptr_array_index(store->chunks, base))->depth + 1;
+    chunk->offset = offset;
+    guint32 number = store->chunks->len;
+    g_ptr_array_add(store->chunks, chunk);
+    // A chunk written twice (by a record that was cut short) keeps the first copy
+    if (!g_hash_table_contains(store->digests, chunk->digest)) {
+        g_hash_table_insert(store->digests, chunk->digest, GUINT_TO_POINTER(number));
+    }
+    return number;
+}
+
+static gboolean scan_chunk(HistoryStore *store, Reader *reader, guint64 base) {
+    const guint8 *digest = get_bytes(reader, DIGEST_LENGTH);
+    guint32 raw_length = get_u32(reader);
+    guint32 stored_length = get_u32(reader);
+    guint32 base_number = get_u32(reader);
+    const guint8 *stored = get_bytes(reader, stored_length);
+    if (!stored || raw_length == 0 || raw_length > HISTORY_CHUNK_MAX) return FALSE;
+    if (base_number == NO_CHUNK) {
+        if (stored_length > raw_length) return FALSE;
+    } else {
+        // Deltas only refer back, and must rebuild exactly raw_length bytes
+        if (base_number >= store->chunks->len || stored_length < DELTA_HEADER_LENGTH) return FALSE;
+        const Chunk *base_chunk = g_ptr_array_index(store->chunks, base_number);
+        guint32 prefix, suffix;
+        memcpy(&prefix, stored, sizeof(prefix));
+        memcpy(&suffix, stored + sizeof(prefix), sizeof(suffix));
+        if ((guint64)prefix + suffix > base_chunk->raw_length ||
+            (guint64)prefix + suffix + stored_length - DELTA_HEADER_LENGTH != raw_length) {
+            return FALSE;
+        }
+    }
+    add_chunk(store, digest, raw_length, stored_length, base_number, base + CHUNK_HEADER_LENGTH);
+    return TRUE;
+}
+
+static const HistoryRevision* add_revision(HistoryStore *store, gint64 time, HistoryAction action,
+                                           const gchar *path, gsize path_length, guint64 size,
+                                           const guint32 *chunks, guint32 n_chunks) {
+    gchar *key = g_strndup(path, path_length);
+    gchar *interned;
+    GArray *ids;
+    if (!g_hash_table_lookup_extended(store->files, key, (gpointer *)&interned, (gpointer *)&ids)) {
+        ids = g_array_new(FALSE, FALSE, sizeof(guint));
+        g_hash_table_insert(store->files, key, ids);
+        interned = key;
+    } else {
+        g_free(key);
+    }
+    Revision *revision = g_new(Revision, 1);
+    revision->pub.id = store->revisions->len + 1;
+    revision->pub.time = time;
+    revision->pub.action = action;
+    revision->pub.path = interned;
+    revision->pub.size = size;
+    revision->n_chunks = n_chunks;
+    revision->chunks = g_new(guint32, n_chunks);
+    if (n_chunks > 0) memcpy(revision->chunks, chunks, n_chunks * sizeof(guint32));
+    g_ptr_array_add(store->revisions, revision);
+    g_array_append_val(ids, revision->pub.id);
+    store->content_bytes += size;
+    return &revision->pub;
+}
+
+static gboolean scan_revision(HistoryStore *store, Reader *reader, guint64 base) {
+    (void)base; // Unused parameter
+    guint32 record_length = get_u32(reader);
+    const guint8 *record = get_bytes(reader, record_length);
+    if (!record) return FALSE;
+
+    Reader fields = { record, record + record_length, TRUE };
+    gint64 time = (gint64)get_u64(&fields);
+    guint32 action = get_u32(&fields);
+    guint32 path_length = get_u32(&fields);
+    const gchar *path = (const gchar *)get_bytes(&fields, path_length);
+    guint64 size = get_u64(&fields);
+    guint32 n_chunks = get_u32(&fields);
+    const guint8 *numbers = get_bytes(&fields, (gsize)n_chunks * sizeof(guint32));
+    if (!fields.ok || fields.p != fields.end || path_length == 0 || action > HISTORY_ACTION_DELETE) {
+        return FALSE;
+    }
+    guint32 *chunks = g_new(guint32, n_chunks);
+    memcpy(chunks, numbers, (gsize)n_chunks * sizeof(guint32));
+    guint64 total = 0;
+    for (guint32 i = 0; i < n_chunks; i++) {
+        if (chunks[i] >= store->chunks->len) {
+            g_free(chunks);
+            return FALSE;
+        }
+        total += ((Chunk *)g_ptr_array_index(store->chunks, chunks[i]))->raw_length;
+    }
+    gboolean valid = total == size;
+    if (valid) add_revision(store, time, action, path, path_length, size, chunks, n_chunks);
+    g_free(chunks);
+    return valid;
+}
+
+HistoryStore* history_store_open(const gchar *dir, GError **error) {
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        set_errno_error(error, "create", dir);
+        return NULL;
+    }
+    HistoryStore *store = g_new0(HistoryStore, 1);
+    store->chunks_fd = -1;
+    store->revisions_fd = -1;
+    store->chunks = g_ptr_array_new_with_free_func(g_free);
+    store->digests = g_hash_table_new(digest_hash, digest_equal);
+    store->revisions = g_ptr_array_new_with_free_func(revision_free);
+    store->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+    store->compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, -1));
+    store->decompressor = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    store->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+    // Revisions refer to chunks, so those are read first
+    store->chunks_fd = open_store_file(store, dir, "chunks", HISTORY_CHUNKS_MAGIC,
+                                       scan_chunk, &store->chunks_size, error);
+    if (store->chunks_fd >= 0) {
+        store->revisions_fd = open_store_file(store, dir, "revisions", HISTORY_REVISIONS_MAGIC,
+                                              scan_revision, &store->revisions_size, error);
+    }
+    if (store->revisions_fd < 0) {
+        history_store_free(store);
+        return NULL;
+    }
+    return store;
+}
+
+// Rebuilds a chunk into out, which has room for its raw length
+static gboolean read_chunk(HistoryStore *store, const Chunk *chunk, guint8 *out, GError **error) {
+    gboolean whole = chunk->base == NO_CHUNK;
+    if (whole && chunk->stored_length == chunk->raw_length) {
+        if (read_all(store->chunks_fd, out, chunk->raw_length, chunk->offset)) return TRUE;
+        set_errno_error(error, "read", "the revision history");
+        return FALSE;
+    }
+    guint8 *stored = g_malloc(chunk->stored_length);
+    if (!read_all(store->chunks_fd, stored, chunk->stored_length, chunk->offset)) {
+        set_errno_error(error, "read", "the revision history");
+        g_free(stored);
+        return FALSE;
+    }
+    
+    gboolean rebuilt = FALSE;
+    if (whole) {
+        gsize bytes_read = 0;
+        gsize written = 0;
+        g_converter_reset(store->decompressor);
+        GConverterResult result = g_converter_convert(store->decompressor, stored, chunk->stored_length,
+                                                      out, chunk->raw_length, G_CONVERTER_INPUT_AT_END,
+                                                      &bytes_read, &written, NULL);
+        rebuilt = result == G_CONVERTER_FINISHED && written == chunk->raw_length;
+        if (!rebuilt) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "The revision history is damaged");
+        }
+    } else {
+        const Chunk *base = g_ptr_array_index(store->chunks, chunk->base);
+        guint8 *base_data = g_malloc(base->raw_length);
+        rebuilt = read_chunk(store, base, base_data, error);
+        if (rebuilt) {
+            guint32 prefix, suffix;
+            memcpy(&prefix, stored, sizeof(prefix));
+            memcpy(&suffix, stored + sizeof(prefix), sizeof(suffix));
+            guint32 middle = chunk->stored_length - DELTA_HEADER_LENGTH;
+            memcpy(out, base_data, prefix);
+            memcpy(out + prefix, stored + DELTA_HEADER_LENGTH, middle);
+            memcpy(out + prefix + middle, base_data + base->raw_length - suffix, suffix);
+        }
+        g_free(base_data);
+    }
+    g_free(stored);
+    return rebuilt;
+}
+
+// Appends the record of a chunk to out: a delta against base when that
+// saves more than half, else the chunk, deflated when that is smaller.
+// Returns the base that was used.
+static guint32 append_chunk_record(HistoryStore *store, GByteArray *out, const guint8 *digest,
+                                   const guint8 *data, guint32 length, guint32 base,
+                                   guint32 *stored_length_out) {
+    g_byte_array_append(out, digest, DIGEST_LENGTH);
+    put_u32(out, length);
+    guint header_end = out->len + 2 * sizeof(guint32);
+    
+    const Chunk *base_chunk = base == NO_CHUNK ? NULL : g_ptr_array_index(store->chunks, base);
+    if (base_chunk && base_chunk->depth < MAX_DELTA_DEPTH) {
+        guint8 *base_data = g_malloc(base_chunk->raw_length);
+        if (read_chunk(store, base_chunk, base_data, NULL)) {
+            guint32 limit = MIN(length, base_chunk->raw_length);
+            guint32 prefix = 0;
+            while (prefix < limit && data[prefix] == base_data[prefix]) prefix++;
+            guint32 suffix = 0;
+            while (suffix < limit - prefix &&
+                   data[length - 1 - suffix] == base_data[base_chunk->raw_length - 1 - suffix]) {
+                suffix++;
+            }
+            guint32 middle = length - prefix - suffix;
+            if (DELTA_HEADER_LENGTH + middle < length / 2) {
+                put_u32(out, DELTA_HEADER_LENGTH + middle);
+                put_u32(out, base);
+                put_u32(out, prefix);
+                put_u32(out, suffix);
+                g_byte_array_append(out, data + prefix, middle);
+                g_free(base_data);
+                *stored_length_out = DELTA_HEADER_LENGTH + middle;
+                return base;
+            }
+        }
+        g_free(base_data);
+    }
+    
+    put_u32(out, 0);
+    put_u32(out, NO_CHUNK);
+    g_byte_array_set_size(out, header_end + length);
+
+    gsize bytes_read = 0;
+    gsize written = 0;
+    g_converter_reset(store->compressor);
+    GConverterResult result = g_converter_convert(store->compressor, data, length,
+                                                  out->data + header_end, length,
+                                                  G_CONVERTER_INPUT_AT_END, &bytes_read, &written, NULL);
+    guint32 stored_length = written;
+    if (result != G_CONVERTER_FINISHED || bytes_read != length || written >= length) {
+        memcpy(out->data + header_end, data, length);
+        stored_length = length;
+    }
+    memcpy(out->data + header_end - 2 * sizeof(guint32), &stored_length, sizeof(guint32));
+    g_byte_array_set_size(out, header_end + stored_length);
+    *stored_length_out = stored_length;
+    return NO_CHUNK;
+}
+
+static const Revision* get_latest(HistoryStore *store, const gchar *path) {
+    GArray *ids = g_hash_table_lookup(store->files, path);
+    if (!ids || ids->len == 0) return NULL;
+    return g_ptr_array_index(store->revisions, g_array_index(ids, guint, ids->len - 1) - 1);
+}
+
+static guint append_revision(HistoryStore *store, HistoryAction action, const gchar *path,
+                             guint64 size, const guint32 *chunks, guint32 n_chunks, GError **error) {
+    gint64 time = g_get_real_time();
+    gsize path_length = strlen(path);
+    GByteArray *out = g_byte_array_new();
+    put_u32(out, 0);
+    put_u64(out, (guint64)time);
+    put_u32(out, action);
+    put_u32(out, path_length);
+    g_byte_array_append(out, (const guint8 *)path, path_length);
+    put_u64(out, size);
+    put_u32(out, n_chunks);
+    g_byte_array_append(out, (const guint8 *)chunks, n_chunks * sizeof(guint32));
+    guint32 record_length = out->len - sizeof(guint32);
+    memcpy(out->data, &record_length, sizeof(record_length));
+
+    gboolean written = write_all(store->revisions_fd, out->data, out->len, store->revisions_size) &&
+                       fdatasync(store->revisions_fd) == 0;
+    if (!written) {
+        set_errno_error(error, "write the history of", path);
+        // Whatever part made it is cut off on the next open
+        g_byte_array_unref(out);
+        return 0;
+    }
+    store->revisions_size += out->len;
+    g_byte_array_unref(out);
+    return add_revision(store, time, action, path, path_length, size, chunks, n_chunks)->id;
+}
+
+typedef struct {
+    gsize offset;
+    guint32 length;
+    guint32 number;             // NO_CHUNK while the chunk is not stored yet
+    guint8 digest[DIGEST_LENGTH];
+} Cut;
+
+guint history_store_record(HistoryStore *store, const gchar *path,
+                           const gchar *data, gsize length, GError **error) {
+    init_gear();
+    GArray *cuts = g_array_new(FALSE, FALSE, sizeof(Cut));
+    for (gsize pos = 0; pos < length; ) {
+        Cut cut = { pos, next_boundary((const guint8 *)data + pos, length - pos), NO_CHUNK, { 0 } };
+        gsize digest_length = sizeof(cut.digest);
+        g_checksum_reset(store->checksum);
+        g_checksum_update(store->checksum, (const guint8 *)data + pos, cut.length);
+        g_checksum_get_digest(store->checksum, cut.digest, &digest_length);
+        gpointer found;
+        if (g_hash_table_lookup_extended(store->digests, cut.digest, NULL, &found)) {
+            cut.number = GPOINTER_TO_UINT(found);
+        }
+        g_array_append_val(cuts, cut);
+        pos += cut.length;
+    }
+    
+    // New chunks between the chunks kept at the start and at the end are
+    // deltas against the chunks they replaced, paired up in order
+    const Revision *latest = get_latest(store, path);
+    const guint32 *previous = latest && latest->pub.action == HISTORY_ACTION_SAVE ? latest->chunks : NULL;
+    guint n_previous = previous ? latest->n_chunks : 0;
+    guint n = cuts->len;
+    guint head = 0;
+    while (head < n && head < n_previous && g_array_index(cuts, Cut, head).number == previous[head]) head++;
+    guint tail = 0;
+    while (tail < n - head && tail < n_previous - head &&
+           g_array_index(cuts, Cut, n - 1 - tail).number == previous[n_previous - 1 - tail]) {
+        tail++;
+    }
+    
+    GArray *numbers = g_array_sized_new(FALSE, FALSE, sizeof(guint32), n);
+    GByteArray *out = g_byte_array_new();
+    guint n_known = store->chunks->len;
+    for (guint i = 0; i < n; i++) {
+        Cut *cut = &g_array_index(cuts, Cut, i);
+        gpointer found;
+        // The same chunk may occur twice in one file
+        if (cut->number == NO_CHUNK && g_hash_table_lookup_extended(store->digests, cut->digest, NULL, &found)) {
+            cut->number = GPOINTER_TO_UINT(found);
+        }
+        if (cut->number == NO_CHUNK) {
+            guint32 base = NO_CHUNK;
+            if (n_previous > head + tail) {
+                base = previous[MIN(i, n_previous - tail - 1)];
+            }
+            guint record_start = out->len;
+            guint32 stored_length;
+            base = append_chunk_record(store, out, cut->digest, (const guint8 *)data + cut->offset,
+                                       cut->length, base, &stored_length);
+            cut->number = add_chunk(store, cut->digest, cut->length, stored_length, base,
+                                    store->chunks_size + record_start + CHUNK_HEADER_LENGTH);
+        }
+        g_array_append_val(numbers, cut->number);
+    }
+    g_array_unref(cuts);
+
+    guint id = 0;
+    if (latest && latest->pub.action == HISTORY_ACTION_SAVE && latest->n_chunks == numbers->len &&
+        memcmp(latest->chunks, numbers->data, numbers->len * sizeof(guint32)) == 0) {
+        id = latest->pub.id;
+    } else if (out->len > 0 && (!write_all(store->chunks_fd, out->data, out->len, store->chunks_size) ||
+                                fdatasync(store->chunks_fd) != 0)) {
+        set_errno_error(error, "write the history of", path);
+        // Forget the chunks that did not make it
+        for (guint i = n_known; i < store->chunks->len; i++) {
+            g_hash_table_remove(store->digests, ((Chunk *)g_ptr_array_index(store->chunks, i))->digest);
+        }
+        g_ptr_array_set_size(store->chunks, n_known);
+        // The next record overwrites what made it, or the next open cuts it off
+        if (ftruncate(store->chunks_fd, store->chunks_size) != 0) errno = 0;
+    } else {
+        store->chunks_size += out->len;
+        id = append_revision(store, HISTORY_ACTION_SAVE, path, length,
+                             (const guint32 *)numbers->data, numbers->len, error);
+    }
+    g_byte_array_unref(out);
+    g_array_unref(numbers);
+    return id;
+}
+
+guint history_store_record_deletion(HistoryStore *store, const gchar *path, GError **error) {
+    const Revision *latest = get_latest(store, path);
+    if (!latest || latest->pub.action == HISTORY_ACTION_DELETE) return 0;
+    return append_revision(store, HISTORY_ACTION_DELETE, path, 0, NULL, 0, error);
+}
+
+GPtrArray* history_store_list(HistoryStore *store, const gchar *path) {
+    GPtrArray *list = g_ptr_array_new();
+    GArray *ids = g_hash_table_lookup(store->files, path);
+    for (guint i = ids ? ids->len : 0; i > 0; i--) {
+        g_ptr_array_add(list, g_ptr_array_index(store->revisions, g_array_index(ids, guint, i - 1) - 1));
+    }
+    return list;
+}
+
+const HistoryRevision* history_store_get_latest(HistoryStore *store, const gchar *path) {
+    const Revision *latest = get_latest(store, path);
+    return latest ? &latest->pub : NULL;
+}
+
+gchar* history_store_read(HistoryStore *store, guint id, gsize *length, GError **error) {
+    if (id == 0 || id > store->revisions->len) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No revision %u in the history", id);
+        return NULL;
+    }
+    const Revision *revision = g_ptr_array_index(store->revisions, id - 1);
+    gchar *content = g_malloc(revision->pub.size + 1);
+    gsize pos = 0;
+    for (guint32 i = 0; i < revision->n_chunks; i++) {
+        const Chunk *chunk = g_ptr_array_index(store->chunks, revision->chunks[i]);
+        if (!read_chunk(store, chunk, (guint8 *)content + pos, error)) {
+            g_prefix_error(error, "Revision %u of %s: ", id, revision->pub.path);
+            g_free(content);
+            return NULL;
+        }
+        pos += chunk->raw_length;
+    }
+    content[pos] = '\0';
+    if (length) *length = pos;
+    return content;
+}
+
+void history_store_get_stats(HistoryStore *store, HistoryStats *stats) {
+    stats->n_revisions = store->revisions->len;
+    stats->n_files = g_hash_table_size(store->files);
+    stats->n_chunks = g_hash_table_size(store->digests);
+    stats->content_bytes = store->content_bytes;
+    stats->stored_bytes = store->chunks_size + store->revisions_size;
+}
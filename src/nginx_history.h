@@ -0,0 +1,74 @@
+#ifndef NGINX_HISTORY_H
+#define NGINX_HISTORY_H
+
+#include <gio/gio.h>
+
+// Revision history of every config nginxui writes or deletes.
+//
+// Contents are cut into chunks at content-defined boundaries (a gear
+// rolling hash), so an edit only changes the chunks around it and the
+// boilerplate vhosts share is cut the same way in every file. Chunks are
+// stored once, under their SHA-256; a revision is the list of its chunks.
+// Storing a revision only adds the chunks that differ from everything
+// stored before, each as a delta against the chunk it replaced in the
+// previous revision, or deflated when there is none.
+//
+// The store is two append-only files in one directory: "chunks" and
+// "revisions". Both are indexed in memory when the store is opened, so
+// listing is a lookup and a restore reads only the chunks it needs. A
+// record cut short by a crash is dropped on the next open. The store is
+// not locked; use it from one thread.
+
+#define HISTORY_CHUNK_MIN 256
+#define HISTORY_CHUNK_MAX 8192
+// Boundaries fall every 2^HISTORY_CHUNK_BITS bytes on average
+#define HISTORY_CHUNK_BITS 10
+
+typedef enum {
+    HISTORY_ACTION_SAVE,
+    HISTORY_ACTION_DELETE
+} HistoryAction;
+
+typedef struct {
+    guint id;                   // 1-based, in the order revisions were recorded
+    gint64 time;                // wall clock, microseconds since the epoch
+    HistoryAction action;
+    const gchar *path;
+    guint64 size;               // bytes of the content, 0 for a deletion
+} HistoryRevision;
+
+typedef struct {
+    guint n_revisions;
+    guint n_files;
+    guint n_chunks;
+    guint64 content_bytes;      // sum of the sizes of all revisions
+    guint64 stored_bytes;       // size of the store on disk
+} HistoryStats;
+
+typedef struct _HistoryStore HistoryStore;
+
+// The store in the user's data directory
+gchar* history_store_get_default_dir(void);
+
+HistoryStore* history_store_open(const gchar *dir, GError **error);
+void history_store_free(HistoryStore *store);
+
+// Records data as the newest revision of path and returns its id. If it
+// equals the newest revision already, nothing is written and that id is
+// returned. Returns 0 on error.
+guint history_store_record(HistoryStore *store, const gchar *path,
+                           const gchar *data, gsize length, GError **error);
+// Records that path was deleted. Returns 0 without writing anything when
+// path has no history or its newest revision already is a deletion.
+guint history_store_record_deletion(HistoryStore *store, const gchar *path, GError **error);
+
+// Revisions of path, newest first (const HistoryRevision*, owned by the store)
+GPtrArray* history_store_list(HistoryStore *store, const gchar *path);
+const HistoryRevision* history_store_get_latest(HistoryStore *store, const gchar *path);
+
+// The content of a revision, NUL-terminated
+gchar* history_store_read(HistoryStore *store, guint id, gsize *length, GError **error);
+
+void history_store_get_stats(HistoryStore *store, HistoryStats *stats);
+
+#endif // NGINX_HISTORY_H
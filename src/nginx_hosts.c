@@ -1,99 +1,292 @@
-#include "nginx_ui.h"
+#include "nginx_hosts.h"
+#include "nginx_helper.h"
 #include <string.h>
 
+typedef struct {
+    GPtrArray *domains;
+    GHashTable *seen;
+} DomainCollector;
+
+static void collect_server_names(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    DomainCollector *collector = user_data;
+    if (!conf_span_equal(doc, node->name, "server_name")) return;
+    
+    for (guint32 i = 0; i < node->n_args; i++) {
+        gchar *name = conf_span_dup_value(doc, node->args[i]);
+        // Skip catch-all, wildcard and regex names, they cannot go in hosts
+        gboolean usable = *name && *name != '_' && *name != '~' && *name != '*' && *name != '.' &&
+                          !g_str_has_suffix(name, ".*") && strcmp(name, "default_server") != 0;
+        if (usable && g_hash_table_add(collector->seen, name)) {
+            g_ptr_array_add(collector->domains, g_strdup(name));
+        } else if (!usable) {
+            g_free(name);
+        }
+    }
+}
+
+gchar** extract_domains_from_document(const ConfDocument *doc) {
+    DomainCollector collector = {
+        g_ptr_array_new(),
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL)
+    };
+    conf_document_foreach(doc, collect_server_names, &collector);
+    g_hash_table_unref(collector.seen);
+    
+    g_ptr_array_add(collector.domains, NULL);
+    return (gchar**)g_ptr_array_free(collector.domains, FALSE);
+}
+
 gchar** extract_domains_from_config(const gchar *config_content) {
-    GPtrArray *domains = g_ptr_array_new();
-    gchar **lines = g_strsplit(config_content, "\n", -1);
+    ConfDocument *doc = conf_document_parse(config_content, strlen(config_content));
+    gchar **domains = extract_domains_from_document(doc);
+    conf_document_free(doc);
+    return domains;
+}
+
+struct _HostsFile {
+    gchar *path;
+    GPtrArray *lines;           // gchar*, without line terminators
+    GHashTable *names;          // lowercased hostname -> occurrence count
+    gint block_begin;           // index of the managed block markers, -1 if absent
+    gint block_end;
+    guint duplicates;
+    gboolean modified;
+};
+
+typedef void (*HostnameFunc)(const gchar *name, gsize len, gpointer user_data);
+
+// Calls func for every hostname on a hosts line, skipping the address
+// and anything after a '#'
+static void foreach_hostname(const gchar *line, HostnameFunc func, gpointer user_data) {
+    const gchar *p = line;
+    gboolean first = TRUE;
     
-    for (gint i = 0; lines[i] != NULL; i++) {
-        gchar *line = g_strdup(lines[i]);
-        gchar *stripped = g_strstrip(line);
+    while (*p && *p != '#') {
+        while (*p == ' ' || *p == '\t') p++;
+        const gchar *start = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '#') p++;
+        if (p == start) break;
         
-        // Skip comments and empty lines
-        if (!stripped || *stripped == '#' || *stripped == '\0') {
-            g_free(line);
-            continue;
+        if (first) {
+            first = FALSE; // IP address
+        } else {
+            func(start, p - start, user_data);
         }
-        
-        // Check for server_name directive
-        if (g_str_has_prefix(stripped, "server_name")) {
-            // Extract domains from server_name line
-            gchar *start = stripped + strlen("server_name");
-            while (*start == ' ' || *start == '\t') start++;
-            
-            // Find comment or semicolon
-            gchar *comment = strchr(start, '#');
-            gchar *semicolon = strchr(start, ';');
-            gchar *end = start + strlen(start);
-            
-            if (comment && (!semicolon || comment < semicolon)) {
-                end = comment;
-            } else if (semicolon) {
-                end = semicolon;
-            }
-            
-            // Extract the domain list part
-            gchar *domain_list = g_strndup(start, end - start);
-            gchar *trimmed = g_strstrip(domain_list);
-            
-            if (*trimmed) {
-                // Split by spaces
-                gchar **tokens = g_strsplit(trimmed, " ", -1);
-                for (gint j = 0; tokens[j] != NULL; j++) {
-                    gchar *token = g_strstrip(tokens[j]);
-                    if (*token && *token != '_' && strcmp(token, "default_server") != 0) {
-                        // Skip wildcards and regex patterns for now (can be enhanced)
-                        if (*token != '~' && *token != '*') {
-                            g_ptr_array_add(domains, g_strdup(token));
-                        }
-                    }
-                }
-                g_strfreev(tokens);
-            }
-            
-            g_free(domain_list);
+    }
+}
+
+static void index_hostname(const gchar *name, gsize len, gpointer user_data) {
+    HostsFile *hosts = user_data;
+    gchar *key = g_ascii_strdown(name, len);
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(hosts->names, key));
+    if (count > 0) {
+        hosts->duplicates++;
+    }
+    g_hash_table_replace(hosts->names, key, GUINT_TO_POINTER(count + 1));
+}
+
+static void reindex(HostsFile *hosts) {
+    g_hash_table_remove_all(hosts->names);
+    hosts->duplicates = 0;
+    hosts->block_begin = hosts->block_end = -1;
+    
+    for (guint i = 0; i < hosts->lines->len; i++) {
+        const gchar *line = g_ptr_array_index(hosts->lines, i);
+        if (hosts->block_begin < 0 && strcmp(line, HOSTS_BLOCK_BEGIN) == 0) {
+            hosts->block_begin = i;
+        } else if (hosts->block_begin >= 0 && hosts->block_end < 0 && strcmp(line, HOSTS_BLOCK_END) == 0) {
+            hosts->block_end = i;
+        } else {
+            foreach_hostname(line, index_hostname, hosts);
         }
-        
-        g_free(line);
     }
     
-    g_strfreev(lines);
-    g_ptr_array_add(domains, NULL);
-    return (gchar**)g_ptr_array_free(domains, FALSE);
+    // An unterminated block runs to the end of the file
+    if (hosts->block_begin >= 0 && hosts->block_end < 0) {
+        g_ptr_array_add(hosts->lines, g_strdup(HOSTS_BLOCK_END));
+        hosts->block_end = hosts->lines->len - 1;
+    }
 }
 
-gboolean domain_exists_in_hosts(const gchar *domain) {
-    FILE *fp = fopen(HOSTS_FILE, "r");
-    if (!fp) return FALSE;
+HostsFile* hosts_file_load(const gchar *path, GError **error) {
+    gchar *content = NULL;
+    GError *local_error = NULL;
     
-    gchar line[MAX_LINE_LENGTH];
-    gboolean found = FALSE;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        // Skip comments
-        if (line[0] == '#') continue;
-        
-        // Check if domain is in this line
-        if (strstr(line, domain)) {
-            found = TRUE;
-            break;
+    if (!g_file_get_contents(path, &content, NULL, &local_error)) {
+        if (!g_error_matches(local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_propagate_error(error, local_error);
+            return NULL;
         }
+        g_error_free(local_error);
+        content = g_strdup("");
+    }
+    
+    HostsFile *hosts = g_new0(HostsFile, 1);
+    hosts->path = g_strdup(path);
+    hosts->lines = g_ptr_array_new_with_free_func(g_free);
+    hosts->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    
+    gchar *line = content;
+    while (*line) {
+        gchar *newline = strchr(line, '\n');
+        gsize len = newline ? (gsize)(newline - line) : strlen(line);
+        if (len > 0 && line[len - 1] == '\r') len--;
+        g_ptr_array_add(hosts->lines, g_strndup(line, len));
+        if (!newline) break;
+        line = newline + 1;
     }
+    g_free(content);
     
-    fclose(fp);
+    reindex(hosts);
+    return hosts;
+}
+
+void hosts_file_free(HostsFile *hosts) {
+    if (!hosts) return;
+    g_free(hosts->path);
+    g_ptr_array_unref(hosts->lines);
+    g_hash_table_unref(hosts->names);
+    g_free(hosts);
+}
+
+gboolean hosts_file_contains(const HostsFile *hosts, const gchar *hostname) {
+    gchar *key = g_ascii_strdown(hostname, -1);
+    gboolean found = g_hash_table_contains(hosts->names, key);
+    g_free(key);
     return found;
 }
 
-void add_domain_to_hosts(const gchar *domain) {
-    if (domain_exists_in_hosts(domain)) {
-        return; // Already exists
+guint hosts_file_get_duplicates(const HostsFile *hosts) {
+    return hosts->duplicates;
+}
+
+gboolean hosts_file_is_modified(const HostsFile *hosts) {
+    return hosts->modified;
+}
+
+static void ensure_block(HostsFile *hosts) {
+    if (hosts->block_begin >= 0) return;
+    
+    if (hosts->lines->len > 0) {
+        const gchar *last = g_ptr_array_index(hosts->lines, hosts->lines->len - 1);
+        if (*last) {
+            g_ptr_array_add(hosts->lines, g_strdup(""));
+        }
+    }
+    g_ptr_array_add(hosts->lines, g_strdup(HOSTS_BLOCK_BEGIN));
+    hosts->block_begin = hosts->lines->len - 1;
+    g_ptr_array_add(hosts->lines, g_strdup(HOSTS_BLOCK_END));
+    hosts->block_end = hosts->lines->len - 1;
+}
+
+gboolean hosts_file_add(HostsFile *hosts, const gchar *hostname) {
+    if (hosts_file_contains(hosts, hostname)) {
+        return FALSE;
+    }
+    
+    ensure_block(hosts);
+    gchar *line = g_strdup_printf("%s %s", HOSTS_MANAGED_ADDRESS, hostname);
+    g_ptr_array_insert(hosts->lines, hosts->block_end, line);
+    hosts->block_end++;
+    foreach_hostname(line, index_hostname, hosts);
+    hosts->modified = TRUE;
+    return TRUE;
+}
+
+static void add_to_set(const gchar *name, gsize len, gpointer user_data) {
+    g_hash_table_add((GHashTable *)user_data, g_ascii_strdown(name, len));
+}
+
+typedef struct {
+    GHashTable *seen;
+    gboolean has_new;
+} BlockLineCheck;
+
+static void check_block_name(const gchar *name, gsize len, gpointer user_data) {
+    BlockLineCheck *check = user_data;
+    if (g_hash_table_add(check->seen, g_ascii_strdown(name, len))) {
+        check->has_new = TRUE;
     }
+}
+
+// Drops managed entries whose names are already defined outside the block
+// or earlier inside it. Returns the number of lines removed.
+guint hosts_file_compact(HostsFile *hosts) {
+    if (hosts->block_begin < 0) return 0;
     
-    gchar *command = g_strdup_printf("sudo sh -c 'echo \"127.0.0.1 %s\" >> %s'", domain, HOSTS_FILE);
-    gint result = system(command);
-    g_free(command);
+    GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (guint i = 0; i < hosts->lines->len; i++) {
+        if ((gint)i >= hosts->block_begin && (gint)i <= hosts->block_end) continue;
+        foreach_hostname(g_ptr_array_index(hosts->lines, i), add_to_set, seen);
+    }
+    
+    guint removed = 0;
+    guint i = hosts->block_begin + 1;
+    while ((gint)i < hosts->block_end) {
+        BlockLineCheck check = { seen, FALSE };
+        foreach_hostname(g_ptr_array_index(hosts->lines, i), check_block_name, &check);
+        if (check.has_new) {
+            i++;
+        } else {
+            g_ptr_array_remove_index(hosts->lines, i);
+            hosts->block_end--;
+            removed++;
+        }
+    }
+    g_hash_table_unref(seen);
+    
+    if (removed > 0) {
+        hosts->modified = TRUE;
+        reindex(hosts);
+    }
+    return removed;
+}
+
+gchar* hosts_file_to_data(const HostsFile *hosts, gsize *length) {
+    GString *data = g_string_new(NULL);
+    for (guint i = 0; i < hosts->lines->len; i++) {
+        g_string_append(data, g_ptr_array_index(hosts->lines, i));
+        g_string_append_c(data, '\n');
+    }
+    if (length) *length = data->len;
+    return g_string_free(data, FALSE);
+}
+
+// The privileged helper writes the new contents next to the hosts file and
+// renames it into place, so readers never see a partial file
+gboolean hosts_file_save(HostsFile *hosts, GError **error) {
+    if (!hosts->modified) return TRUE;
+    
+    gsize length = 0;
+    gchar *data = hosts_file_to_data(hosts, &length);
+    gboolean ok = helper_write_file(hosts->path, data, length, 0644, error);
+    g_free(data);
+    
+    if (ok) {
+        hosts->modified = FALSE;
+    }
+    return ok;
+}
+
+GPtrArray* hosts_sync_domains(const gchar *path, const gchar * const *domains, GError **error) {
+    HostsFile *hosts = hosts_file_load(path, error);
+    if (!hosts) return NULL;
+    
+    GPtrArray *added = g_ptr_array_new_with_free_func(g_free);
+    for (gint i = 0; domains[i] != NULL; i++) {
+        if (hosts_file_add(hosts, domains[i])) {
+            g_ptr_array_add(added, g_strdup(domains[i]));
+        }
+    }
+    
+    if (hosts_file_get_duplicates(hosts) >= HOSTS_COMPACT_THRESHOLD) {
+        hosts_file_compact(hosts);
+    }
     
-    if (result == 0) {
-        // Success
+    if (!hosts_file_save(hosts, error)) {
+        g_ptr_array_unref(added);
+        added = NULL;
     }
+    hosts_file_free(hosts);
+    return added;
 }
@@ -0,0 +1,36 @@
+#ifndef NGINX_HOSTS_H
+#define NGINX_HOSTS_H
+
+#include <glib.h>
+#include "nginx_parser.h"
+
+#define HOSTS_BLOCK_BEGIN "# BEGIN nginxui managed block"
+#define HOSTS_BLOCK_END "# END nginxui managed block"
+#define HOSTS_MANAGED_ADDRESS "127.0.0.1"
+// Managed entries that duplicate another entry before a rewrite compacts them
+#define HOSTS_COMPACT_THRESHOLD 16
+
+// A parsed hosts file. Lines outside the managed block are kept verbatim;
+// every hostname on the file is indexed for exact, case-insensitive lookup.
+typedef struct _HostsFile HostsFile;
+
+HostsFile* hosts_file_load(const gchar *path, GError **error);
+void hosts_file_free(HostsFile *hosts);
+gboolean hosts_file_contains(const HostsFile *hosts, const gchar *hostname);
+gboolean hosts_file_add(HostsFile *hosts, const gchar *hostname);
+guint hosts_file_get_duplicates(const HostsFile *hosts);
+guint hosts_file_compact(HostsFile *hosts);
+gboolean hosts_file_is_modified(const HostsFile *hosts);
+gchar* hosts_file_to_data(const HostsFile *hosts, gsize *length);
+gboolean hosts_file_save(HostsFile *hosts, GError **error);
+
+// Adds every domain missing from the hosts file with a single rewrite.
+// Returns the names that were added, or NULL on error.
+GPtrArray* hosts_sync_domains(const gchar *path, const gchar * const *domains, GError **error);
+
+// Domain extraction from nginx configs: the literal names of every
+// server_name directive, wherever it appears, without duplicates
+gchar** extract_domains_from_document(const ConfDocument *doc);
+gchar** extract_domains_from_config(const gchar *config_content);
+
+#endif // NGINX_HOSTS_H
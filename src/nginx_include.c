@@ -0,0 +1,504 @@
+#include "nginx_include.h"
+#include <fnmatch.h>
+#include <glob.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Guards context descriptions against include cycles
+#define MAX_INCLUDE_DEPTH 32
+
+typedef struct {
+    const ConfNode *node;       // the include directive in the file's document
+    gchar *pattern;             // absolute path or glob
+    gchar *context;             // enclosing blocks, "" at the top level
+    GPtrArray *targets;         // gchar* paths matched at the last update
+} IncludeDirective;
+
+typedef struct {
+    gchar *path;
+    IncludeFileKey key;
+    gboolean exists;
+    gboolean parsed;            // text/doc/includes match key
+    gchar *text;
+    ConfDocument *doc;
+    GPtrArray *includes;        // IncludeDirective*
+    GPtrArray *sites;           // IncludeSite* pointing at this file
+    guint generation;           // last update that reached the file
+} IncludeFile;
+
+typedef struct {
+    IncludeFileKey dir_key;
+    GPtrArray *matches;
+} GlobEntry;
+
+struct _IncludeGraph {
+    gchar *main_conf;
+    gchar *prefix;              // relative includes are resolved against it
+    GHashTable *files;          // path -> IncludeFile*
+    GHashTable *globs;          // pattern -> GlobEntry*
+    guint generation;
+    guint serial;               // bumped whenever a parse is made or dropped
+};
+
+gboolean include_file_key_stat(const gchar *path, IncludeFileKey *key) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        memset(key, 0, sizeof(*key));
+        return FALSE;
+    }
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->mtime_ns = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st.st_mtim.tv_nsec;
+    key->size = st.st_size;
+    return TRUE;
+}
+
+gboolean include_file_key_equal(const IncludeFileKey *a, const IncludeFileKey *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->mtime_ns == b->mtime_ns && a->size == b->size;
+}
+
+static void include_directive_free(gpointer data) {
+    IncludeDirective *directive = data;
+    g_free(directive->pattern);
+    g_free(directive->context);
+    if (directive->targets) {
+        g_ptr_array_unref(directive->targets);
+    }
+    g_free(directive);
+}
+
+static void include_file_clear(IncludeFile *file) {
+    g_ptr_array_set_size(file->includes, 0);
+    conf_document_free(file->doc);
+    file->doc = NULL;
+    g_free(file->text);
+    file->text = NULL;
+}
+
+static void include_file_free(gpointer data) {
+    IncludeFile *file = data;
+    include_file_clear(file);
+    g_ptr_array_unref(file->includes);
+    g_ptr_array_unref(file->sites);
+    g_free(file->path);
+    g_free(file);
+}
+
+static void glob_entry_free(gpointer data) {
+    GlobEntry *entry = data;
+    g_ptr_array_unref(entry->matches);
+    g_free(entry);
+}
+
+IncludeGraph* include_graph_new(const gchar *main_conf) {
+    IncludeGraph *graph = g_new0(IncludeGraph, 1);
+    graph->main_conf = g_strdup(main_conf);
+    graph->prefix = g_path_get_dirname(main_conf);
+    graph->files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, include_file_free);
+    graph->globs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, glob_entry_free);
+    return graph;
+}
+
+void include_graph_free(IncludeGraph *graph) {
+    if (!graph) return;
+    g_hash_table_unref(graph->files);
+    g_hash_table_unref(graph->globs);
+    g_free(graph->prefix);
+    g_free(graph->main_conf);
+    g_free(graph);
+}
+
+static IncludeFile* get_or_add_file(IncludeGraph *graph, const gchar *path) {
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    if (!file) {
+        file = g_new0(IncludeFile, 1);
+        file->path = g_strdup(path);
+        file->includes = g_ptr_array_new_with_free_func(include_directive_free);
+        file->sites = g_ptr_array_new_with_free_func(g_free);
+        g_hash_table_insert(graph->files, file->path, file);
+    }
+    return file;
+}
+
+// "http > server" for a node inside server inside http
+static gchar* describe_node_context(const ConfDocument *doc, const ConfNode *node) {
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    for (const ConfNode *block = node->parent; block && block != doc->root; block = block->parent) {
+        g_ptr_array_insert(names, 0, g_strndup(conf_span_data(doc, block->name), block->name.length));
+    }
+    g_ptr_array_add(names, NULL);
+    gchar *context = g_strjoinv(" > ", (gchar **)names->pdata);
+    g_ptr_array_unref(names);
+    return context;
+}
+
+typedef struct {
+    IncludeGraph *graph;
+    IncludeFile *file;
+} CollectContext;
+
+static void collect_include(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    CollectContext *ctx = user_data;
+    if (node->is_block || node->n_args != 1 || !conf_span_equal(doc, node->name, "include")) return;
+    
+    gchar *pattern = conf_span_dup_value(doc, node->args[0]);
+    IncludeDirective *directive = g_new0(IncludeDirective, 1);
+    directive->node = node;
+    if (g_path_is_absolute(pattern)) {
+        directive->pattern = pattern;
+    } else {
+        directive->pattern = g_build_filename(ctx->graph->prefix, pattern, NULL);
+        g_free(pattern);
+    }
+    directive->context = describe_node_context(doc, node);
+    g_ptr_array_add(ctx->file->includes, directive);
+}
+
+static void parse_file(IncludeGraph *graph, IncludeFile *file) {
+    include_file_clear(file);
+    file->parsed = TRUE;
+    graph->serial++;
+    
+    gsize length = 0;
+    if (!file->exists || !g_file_get_contents(file->path, &file->text, &length, NULL)) {
+        return;
+    }
+    file->doc = conf_document_parse(file->text, length);
+    CollectContext ctx = { graph, file };
+    conf_document_foreach(file->doc, collect_include, &ctx);
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+    return strcmp(*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+// Files matching pattern, sorted like glob(3) does. Listings are cached
+// per pattern and redone only when the directory itself changed.
+static GPtrArray* expand_pattern(IncludeGraph *graph, const gchar *pattern) {
+    GPtrArray *matches = g_ptr_array_new_with_free_func(g_free);
+    if (!strpbrk(pattern, "*?[")) {
+        g_ptr_array_add(matches, g_strdup(pattern));
+        return matches;
+    }
+    
+    gchar *dir = g_path_get_dirname(pattern);
+    gchar *base = g_path_get_basename(pattern);
+    
+    if (strpbrk(dir, "*?[")) {
+        // Wildcards in directory names are rare, let glob(3) handle them
+        glob_t results;
+        if (glob(pattern, 0, NULL, &results) == 0) {
+            for (gsize i = 0; i < results.gl_pathc; i++) {
+                g_ptr_array_add(matches, g_strdup(results.gl_pathv[i]));
+            }
+        }
+        globfree(&results);
+    } else {
+        IncludeFileKey dir_key;
+        GlobEntry *entry = g_hash_table_lookup(graph->globs, pattern);
+        if (include_file_key_stat(dir, &dir_key) && !(entry && include_file_key_equal(&entry->dir_key, &dir_key))) {
+            GPtrArray *listing = g_ptr_array_new_with_free_func(g_free);
+            GDir *handle = g_dir_open(dir, 0, NULL);
+            const gchar *name;
+            while (handle && (name = g_dir_read_name(handle)) != NULL) {
+                if (fnmatch(base, name, FNM_PERIOD) == 0) {
+                    g_ptr_array_add(listing, g_build_filename(dir, name, NULL));
+                }
+            }
+            if (handle) g_dir_close(handle);
+            g_ptr_array_sort(listing, compare_paths);
+            
+            entry = g_new0(GlobEntry, 1);
+            entry->dir_key = dir_key;
+            entry->matches = listing;
+            g_hash_table_replace(graph->globs, g_strdup(pattern), entry);
+        }
+        if (entry && include_file_key_equal(&entry->dir_key, &dir_key)) {
+            for (guint i = 0; i < entry->matches->len; i++) {
+                g_ptr_array_add(matches, g_strdup(g_ptr_array_index(entry->matches, i)));
+            }
+        }
+    }
+    
+    g_free(base);
+    g_free(dir);
+    return matches;
+}
+
+static gboolean is_unreached(gpointer key, gpointer value, gpointer user_data) {
+    (void)key; // Unused parameter
+    return ((IncludeFile *)value)->generation != GPOINTER_TO_UINT(user_data);
+}
+
+static void rebuild_sites(IncludeGraph *graph) {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, graph->files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_set_size(((IncludeFile *)value)->sites, 0);
+    }
+    
+    g_hash_table_iter_init(&iter, graph->files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        IncludeFile *file = value;
+        for (guint i = 0; i < file->includes->len; i++) {
+            IncludeDirective *directive = g_ptr_array_index(file->includes, i);
+            for (guint t = 0; t < directive->targets->len; t++) {
+                IncludeFile *target = g_hash_table_lookup(graph->files,
+                                                          g_ptr_array_index(directive->targets, t));
+                if (!target) continue;
+                IncludeSite *site = g_new0(IncludeSite, 1);
+                site->path = file->path;
+                site->line = directive->node->line;
+                site->context = directive->context;
+                g_ptr_array_add(target->sites, site);
+            }
+        }
+    }
+}
+
+// Reads the queued files whose key changed and re-expands the includes of
+// the files visited, queueing the files they reach. Unless follow_all is
+// set, only the includes of files that were read again are followed.
+static gint read_queued(IncludeGraph *graph, GQueue *queue, guint generation, gboolean follow_all) {
+    gint reparsed = 0;
+    IncludeFile *file;
+    while ((file = g_queue_pop_head(queue)) != NULL) {
+        if (file->generation == generation) continue;
+        file->generation = generation;
+        
+        IncludeFileKey key;
+        gboolean exists = include_file_key_stat(file->path, &key);
+        if (!file->parsed || exists != file->exists || !include_file_key_equal(&key, &file->key)) {
+            file->key = key;
+            file->exists = exists;
+            parse_file(graph, file);
+            reparsed++;
+        } else if (!follow_all) {
+            continue;
+        }
+        
+        for (guint i = 0; i < file->includes->len; i++) {
+            IncludeDirective *directive = g_ptr_array_index(file->includes, i);
+            if (directive->targets) {
+                g_ptr_array_unref(directive->targets);
+            }
+            directive->targets = expand_pattern(graph, directive->pattern);
+            for (guint t = 0; t < directive->targets->len; t++) {
+                g_queue_push_tail(queue, get_or_add_file(graph, g_ptr_array_index(directive->targets, t)));
+            }
+        }
+    }
+    return reparsed;
+}
+
+gint include_graph_update(IncludeGraph *graph, GError **error) {
+    guint generation = ++graph->generation;
+    GQueue queue = G_QUEUE_INIT;
+    IncludeFile *main_file = get_or_add_file(graph, graph->main_conf);
+    g_queue_push_tail(&queue, main_file);
+    gint reparsed = read_queued(graph, &queue, generation, TRUE);
+    
+    // Files no longer included by anything are dropped with their parse
+    if (g_hash_table_foreach_remove(graph->files, is_unreached, GUINT_TO_POINTER(generation)) > 0) {
+        graph->serial++;
+    }
+    rebuild_sites(graph);
+    
+    if (!main_file->exists || !main_file->doc) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT, "Cannot read %s", graph->main_conf);
+        return -1;
+    }
+    return reparsed;
+}
+
+void include_graph_update_file(IncludeGraph *graph, const gchar *path) {
+    // A graph that was never read has nothing to start from
+    if (g_hash_table_size(graph->files) == 0) {
+        include_graph_update(graph, NULL);
+        return;
+    }
+    gboolean included = g_hash_table_contains(graph->files, path);
+    if (!included) {
+        // A new file joins the includes whose pattern matches it
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init(&iter, graph->files);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            IncludeFile *file = value;
+            for (guint i = 0; i < file->includes->len; i++) {
+                IncludeDirective *directive = g_ptr_array_index(file->includes, i);
+                if (fnmatch(directive->pattern, path, FNM_PATHNAME | FNM_PERIOD) != 0) continue;
+                if (directive->targets) {
+                    g_ptr_array_unref(directive->targets);
+                }
+                directive->targets = expand_pattern(graph, directive->pattern);
+                included = TRUE;
+            }
+        }
+        if (!included) return;
+    }
+    
+    GQueue queue = G_QUEUE_INIT;
+    g_queue_push_tail(&queue, get_or_add_file(graph, path));
+    read_queued(graph, &queue, ++graph->generation, FALSE);
+    rebuild_sites(graph);
+}
+
+void include_graph_invalidate(IncludeGraph *graph, const gchar *path) {
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    if (file) {
+        file->parsed = FALSE;
+    }
+}
+
+gboolean include_graph_contains(IncludeGraph *graph, const gchar *path) {
+    return g_hash_table_contains(graph->files, path);
+}
+
+guint include_graph_get_n_files(IncludeGraph *graph) {
+    return g_hash_table_size(graph->files);
+}
+
+guint include_graph_get_serial(IncludeGraph *graph) {
+    return graph->serial;
+}
+
+const ConfDocument* include_graph_get_document(IncludeGraph *graph, const gchar *path) {
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    return file ? file->doc : NULL;
+}
+
+gboolean include_graph_get_key(IncludeGraph *graph, const gchar *path, IncludeFileKey *key) {
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    if (!file || !file->parsed || !file->doc) return FALSE;
+    *key = file->key;
+    return TRUE;
+}
+
+void include_graph_foreach_document(IncludeGraph *graph, IncludeDocumentFunc func, gpointer user_data) {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, graph->files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        IncludeFile *file = value;
+        if (file->doc) {
+            func(file->path, file->doc, user_data);
+        }
+    }
+}
+
+GPtrArray* include_graph_get_include_sites(IncludeGraph *graph, const gchar *path) {
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    return file ? file->sites : NULL;
+}
+
+static gchar* describe_file_context(IncludeGraph *graph, const gchar *path, guint depth) {
+    if (strcmp(path, graph->main_conf) == 0) {
+        return g_strdup("");
+    }
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    if (!file || file->sites->len == 0 || depth > MAX_INCLUDE_DEPTH) {
+        return NULL;
+    }
+    
+    IncludeSite *site = g_ptr_array_index(file->sites, 0);
+    gchar *outer = describe_file_context(graph, site->path, depth + 1);
+    if (!outer) return NULL;
+    
+    gchar *context;
+    if (!*outer) {
+        context = g_strdup(site->context);
+    } else if (!*site->context) {
+        context = g_strdup(outer);
+    } else {
+        context = g_strdup_printf("%s > %s", outer, site->context);
+    }
+    g_free(outer);
+    return context;
+}
+
+gchar* include_graph_describe_context(IncludeGraph *graph, const gchar *path) {
+    gchar *context = describe_file_context(graph, path, 0);
+    if (context && !*context) {
+        g_free(context);
+        return g_strdup("main");
+    }
+    return context;
+}
+
+// Adds the targets of directive and everything they include to files
+static void add_targets(IncludeGraph *graph, IncludeDirective *directive, GHashTable *files) {
+    GPtrArray *stack = g_ptr_array_new();
+    g_ptr_array_add(stack, directive);
+    
+    while (stack->len > 0) {
+        IncludeDirective *current = g_ptr_array_steal_index_fast(stack, stack->len - 1);
+        if (!current->targets) continue;
+        for (guint t = 0; t < current->targets->len; t++) {
+            const gchar *target_path = g_ptr_array_index(current->targets, t);
+            IncludeFile *target = g_hash_table_lookup(graph->files, target_path);
+            if (!target || !g_hash_table_add(files, target->path)) continue;
+            for (guint i = 0; i < target->includes->len; i++) {
+                g_ptr_array_add(stack, g_ptr_array_index(target->includes, i));
+            }
+        }
+    }
+    g_ptr_array_unref(stack);
+}
+
+static gchar** sorted_paths(GHashTable *files) {
+    guint n = 0;
+    gchar **paths = (gchar **)g_hash_table_get_keys_as_array(files, &n);
+    qsort(paths, n, sizeof(gchar *), compare_paths);
+    for (guint i = 0; i < n; i++) {
+        paths[i] = g_strdup(paths[i]);
+    }
+    return paths;
+}
+
+static gboolean context_has_block(const gchar *context, const gchar *name) {
+    gchar **blocks = g_strsplit(context, " > ", -1);
+    gboolean found = g_strv_contains((const gchar * const *)blocks, name);
+    g_strfreev(blocks);
+    return found;
+}
+
+gchar** include_graph_get_files_in_context(IncludeGraph *graph, const gchar *context) {
+    GHashTable *files = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, graph->files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        IncludeFile *file = value;
+        for (guint i = 0; i < file->includes->len; i++) {
+            IncludeDirective *directive = g_ptr_array_index(file->includes, i);
+            if (context_has_block(directive->context, context)) {
+                add_targets(graph, directive, files);
+            }
+        }
+    }
+    
+    gchar **paths = sorted_paths(files);
+    g_hash_table_unref(files);
+    return paths;
+}
+
+gchar** include_graph_get_files_in_block(IncludeGraph *graph, const gchar *path, guint line) {
+    GHashTable *files = g_hash_table_new(g_str_hash, g_str_equal);
+    IncludeFile *file = g_hash_table_lookup(graph->files, path);
+    
+    for (guint i = 0; file && i < file->includes->len; i++) {
+        IncludeDirective *directive = g_ptr_array_index(file->includes, i);
+        for (const ConfNode *block = directive->node->parent; block; block = block->parent) {
+            if (block->line == line && block != file->doc->root) {
+                add_targets(graph, directive, files);
+                break;
+            }
+        }
+    }
+    
+    gchar **paths = sorted_paths(files);
+    g_hash_table_unref(files);
+    return paths;
+}
@@ -0,0 +1,83 @@
+#ifndef NGINX_INCLUDE_H
+#define NGINX_INCLUDE_H
+
+#include <glib.h>
+#include "nginx_parser.h"
+
+// Include graph of an nginx configuration, starting at nginx.conf.
+//
+// Every reachable file is parsed once and its parse is cached under the
+// file's (dev, inode, mtime, size). include_graph_update only stats the
+// files; the ones whose key changed are re-parsed and their include
+// edges recomputed, everything else is reused. Glob includes are
+// re-expanded only when the directory they list changes.
+
+typedef struct _IncludeGraph IncludeGraph;
+
+// What a parse is cached under; a file with a different key is re-read
+typedef struct {
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime_ns;
+    gint64 size;
+} IncludeFileKey;
+
+// Clears key and returns FALSE when path cannot be stat'ed
+gboolean include_file_key_stat(const gchar *path, IncludeFileKey *key);
+gboolean include_file_key_equal(const IncludeFileKey *a, const IncludeFileKey *b);
+
+// One include directive that pulls a file in
+typedef struct {
+    const gchar *path;          // the including file
+    guint line;
+    const gchar *context;       // enclosing blocks in that file, e.g. "http > server"
+} IncludeSite;
+
+IncludeGraph* include_graph_new(const gchar *main_conf);
+void include_graph_free(IncludeGraph *graph);
+
+// Brings the graph up to date with the files on disk. Returns the number
+// of files that had to be (re-)parsed, or -1 if the main file is unreadable.
+gint include_graph_update(IncludeGraph *graph, GError **error);
+
+// Drops the cached parse of path, e.g. when it was rewritten within the
+// timestamp granularity of the file system
+void include_graph_invalidate(IncludeGraph *graph, const gchar *path);
+
+// Brings one file up to date after it was written, without stat'ing the
+// rest of the tree: the file is read again when its key changed, and so
+// are the files its includes newly reach. A new file joins the includes
+// whose pattern matches it. Files nothing includes any more stay until
+// the next include_graph_update. An empty graph is read whole.
+void include_graph_update_file(IncludeGraph *graph, const gchar *path);
+
+gboolean include_graph_contains(IncludeGraph *graph, const gchar *path);
+guint include_graph_get_n_files(IncludeGraph *graph);
+// Changes whenever a file is parsed again, added or dropped, so caches of
+// the parses can tell they are stale without stat'ing anything
+guint include_graph_get_serial(IncludeGraph *graph);
+
+// The cached parse of a file, valid until the next update
+const ConfDocument* include_graph_get_document(IncludeGraph *graph, const gchar *path);
+// The key of the file when that parse was made
+gboolean include_graph_get_key(IncludeGraph *graph, const gchar *path, IncludeFileKey *key);
+
+// Calls func for every parsed file in the graph
+typedef void (*IncludeDocumentFunc)(const gchar *path, const ConfDocument *doc, gpointer user_data);
+void include_graph_foreach_document(IncludeGraph *graph, IncludeDocumentFunc func, gpointer user_data);
+
+// The include directives that pull path in (IncludeSite*, owned by the graph)
+GPtrArray* include_graph_get_include_sites(IncludeGraph *graph, const gchar *path);
+
+// Where path ends up in the effective configuration, e.g. "http" for a file
+// included from the http block of nginx.conf, or NULL if nothing includes it
+gchar* include_graph_describe_context(IncludeGraph *graph, const gchar *path);
+
+// Every file whose contents end up inside a block named context (such as
+// "http" or "server"), directly or through nested includes. Sorted paths.
+gchar** include_graph_get_files_in_context(IncludeGraph *graph, const gchar *context);
+
+// Files pulled into the block of path that starts on line, transitively
+gchar** include_graph_get_files_in_block(IncludeGraph *graph, const gchar *path, guint line);
+
+#endif // NGINX_INCLUDE_H
@@ -0,0 +1,479 @@
+#include "nginx_lint.h"
+#include <string.h>
+
+// Nodes linted between checks of the cancellable
+#define LINT_CANCEL_CHECK_INTERVAL 1024
+#define ANY_ARGS G_MAXUINT8
+
+#define C(context) (1u << LINT_CONTEXT_##context)
+#define MAIN C(MAIN)
+#define EVENTS C(EVENTS)
+#define HTTP C(HTTP)
+#define SRV C(SERVER)
+#define LOC C(LOCATION)
+#define UPS C(UPSTREAM)
+#define IF C(IF)
+#define LMT C(LIMIT_EXCEPT)
+#define STREAM C(STREAM)
+#define SSRV C(STREAM_SERVER)
+#define SUPS C(STREAM_UPSTREAM)
+#define MAIL C(MAIL)
+#define MSRV C(MAIL_SERVER)
+#define HSL (HTTP | SRV | LOC)
+#define HSLI (HSL | IF)
+#define STREAM_ANY (STREAM | SSRV)
+#define MAIL_ANY (MAIL | MSRV)
+#define ALL_CONTEXTS G_MAXUINT32
+
+typedef enum {
+    DIRECTIVE_SIMPLE,
+    DIRECTIVE_BLOCK,
+    DIRECTIVE_FLAG              // simple, takes "on" or "off"
+} DirectiveKind;
+
+typedef struct {
+    const gchar *name;
+    guint32 contexts;           // where the directive is allowed
+    guint8 min_args;
+    guint8 max_args;
+    DirectiveKind kind;
+} DirectiveSpec;
+
+// The directives of the stock nginx modules. A name may appear more than
+// once (server is a block in http but a simple directive in upstream);
+// such entries must be adjacent.
+static const DirectiveSpec directive_specs[] = {
+    // Core and events
+    { "user", MAIN, 1, 2, DIRECTIVE_SIMPLE },
+    { "worker_processes", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "worker_rlimit_nofile", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "worker_cpu_affinity", MAIN, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "worker_priority", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "worker_shutdown_timeout", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "working_directory", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "pid", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "lock_file", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "load_module", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "env", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "daemon", MAIN, 1, 1, DIRECTIVE_FLAG },
+    { "master_process", MAIN, 1, 1, DIRECTIVE_FLAG },
+    { "pcre_jit", MAIN, 1, 1, DIRECTIVE_FLAG },
+    { "thread_pool", MAIN, 2, 3, DIRECTIVE_SIMPLE },
+    { "timer_resolution", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_engine", MAIN, 1, 1, DIRECTIVE_SIMPLE },
+    { "include", ALL_CONTEXTS, 1, 1, DIRECTIVE_SIMPLE },
+    { "error_log", MAIN | HSL | STREAM_ANY | MAIL_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "events", MAIN, 0, 0, DIRECTIVE_BLOCK },
+    { "worker_connections", EVENTS, 1, 1, DIRECTIVE_SIMPLE },
+    { "use", EVENTS, 1, 1, DIRECTIVE_SIMPLE },
+    { "multi_accept", EVENTS, 1, 1, DIRECTIVE_FLAG },
+    { "accept_mutex", EVENTS, 1, 1, DIRECTIVE_FLAG },
+    { "accept_mutex_delay", EVENTS, 1, 1, DIRECTIVE_SIMPLE },
+    
+    // Blocks
+    { "http", MAIN, 0, 0, DIRECTIVE_BLOCK },
+    { "stream", MAIN, 0, 0, DIRECTIVE_BLOCK },
+    { "mail", MAIN, 0, 0, DIRECTIVE_BLOCK },
+    { "server", HTTP | STREAM | MAIL, 0, 0, DIRECTIVE_BLOCK },
+    { "server", UPS | SUPS, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "location", SRV | LOC, 1, 2, DIRECTIVE_BLOCK },
+    { "upstream", HTTP | STREAM, 1, 1, DIRECTIVE_BLOCK },
+    { "if", SRV | LOC, 1, ANY_ARGS, DIRECTIVE_BLOCK },
+    { "limit_except", LOC, 1, ANY_ARGS, DIRECTIVE_BLOCK },
+    { "types", HSL, 0, 0, DIRECTIVE_BLOCK },
+    { "map", HTTP | STREAM, 2, 2, DIRECTIVE_BLOCK },
+    { "geo", HTTP | STREAM, 1, 2, DIRECTIVE_BLOCK },
+    { "split_clients", HTTP | STREAM, 2, 2, DIRECTIVE_BLOCK },
+    
+    // http core
+    { "listen", SRV | SSRV | MSRV, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "server_name", SRV | MSRV, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "root", HSLI, 1, 1, DIRECTIVE_SIMPLE },
+    { "alias", LOC, 1, 1, DIRECTIVE_SIMPLE },
+    { "index", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "try_files", SRV | LOC, 2, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "internal", LOC, 0, 0, DIRECTIVE_SIMPLE },
+    { "default_type", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "error_page", HSLI, 2, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "sendfile", HSLI, 1, 1, DIRECTIVE_FLAG },
+    { "sendfile_max_chunk", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "tcp_nopush", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "tcp_nodelay", HSL | STREAM_ANY, 1, 1, DIRECTIVE_FLAG },
+    { "aio", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "directio", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "keepalive_timeout", HSL | UPS, 1, 2, DIRECTIVE_SIMPLE },
+    { "keepalive_requests", HSL | UPS, 1, 1, DIRECTIVE_SIMPLE },
+    { "send_timeout", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "client_max_body_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "client_body_buffer_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "client_body_timeout", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "client_body_temp_path", HSL, 1, 4, DIRECTIVE_SIMPLE },
+    { "client_header_buffer_size", HTTP | SRV, 1, 1, DIRECTIVE_SIMPLE },
+    { "client_header_timeout", HTTP | SRV, 1, 1, DIRECTIVE_SIMPLE },
+    { "large_client_header_buffers", HTTP | SRV, 2, 2, DIRECTIVE_SIMPLE },
+    { "ignore_invalid_headers", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "underscores_in_headers", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "merge_slashes", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "server_tokens", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "server_names_hash_bucket_size", HTTP, 1, 1, DIRECTIVE_SIMPLE },
+    { "server_names_hash_max_size", HTTP, 1, 1, DIRECTIVE_SIMPLE },
+    { "types_hash_bucket_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "types_hash_max_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "variables_hash_bucket_size", HTTP | STREAM, 1, 1, DIRECTIVE_SIMPLE },
+    { "variables_hash_max_size", HTTP | STREAM, 1, 1, DIRECTIVE_SIMPLE },
+    { "map_hash_bucket_size", HTTP | STREAM, 1, 1, DIRECTIVE_SIMPLE },
+    { "map_hash_max_size", HTTP | STREAM, 1, 1, DIRECTIVE_SIMPLE },
+    { "absolute_redirect", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "port_in_redirect", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "server_name_in_redirect", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "chunked_transfer_encoding", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "reset_timedout_connection", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "log_not_found", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "open_file_cache", HSL, 1, 2, DIRECTIVE_SIMPLE },
+    { "open_file_cache_valid", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "open_file_cache_min_uses", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "open_file_cache_errors", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "output_buffers", HSL, 2, 2, DIRECTIVE_SIMPLE },
+    { "postpone_output", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "resolver", HSL | STREAM_ANY | MAIL_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "resolver_timeout", HSL | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "satisfy", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "charset", HSLI, 1, 1, DIRECTIVE_SIMPLE },
+    { "stub_status", SRV | LOC, 0, 1, DIRECTIVE_SIMPLE },
+    
+    // Rewrite, headers, logging, access
+    { "return", SRV | LOC | IF, 1, 2, DIRECTIVE_SIMPLE },
+    { "rewrite", SRV | LOC | IF, 2, 3, DIRECTIVE_SIMPLE },
+    { "set", SRV | LOC | IF | STREAM_ANY, 2, 2, DIRECTIVE_SIMPLE },
+    { "break", SRV | LOC | IF, 0, 0, DIRECTIVE_SIMPLE },
+    { "rewrite_log", HTTP | SRV | LOC | IF, 1, 1, DIRECTIVE_FLAG },
+    { "add_header", HSLI, 2, 3, DIRECTIVE_SIMPLE },
+    { "expires", HSLI, 1, 2, DIRECTIVE_SIMPLE },
+    { "etag", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "access_log", HSLI | LMT | STREAM_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "log_format", HTTP | STREAM, 2, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "allow", HSL | LMT | STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "deny", HSL | LMT | STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "auth_basic", HSL | LMT, 1, 1, DIRECTIVE_SIMPLE },
+    { "auth_basic_user_file", HSL | LMT, 1, 1, DIRECTIVE_SIMPLE },
+    { "autoindex", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "real_ip_header", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "set_real_ip_from", HSL | STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "real_ip_recursive", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "sub_filter", HSL, 2, 2, DIRECTIVE_SIMPLE },
+    { "sub_filter_once", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "sub_filter_types", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "limit_rate", HSLI, 1, 1, DIRECTIVE_SIMPLE },
+    { "limit_req_zone", HTTP, 3, 4, DIRECTIVE_SIMPLE },
+    { "limit_req", HSL, 1, 3, DIRECTIVE_SIMPLE },
+    { "limit_req_status", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "limit_conn_zone", HTTP | STREAM, 2, 2, DIRECTIVE_SIMPLE },
+    { "limit_conn", HSL | STREAM_ANY, 2, 2, DIRECTIVE_SIMPLE },
+    { "limit_conn_status", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    
+    // gzip
+    { "gzip", HSLI, 1, 1, DIRECTIVE_FLAG },
+    { "gzip_types", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "gzip_comp_level", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "gzip_min_length", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "gzip_buffers", HSL, 2, 2, DIRECTIVE_SIMPLE },
+    { "gzip_http_version", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "gzip_proxied", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "gzip_disable", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "gzip_vary", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "gzip_static", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    
+    // Proxying
+    { "proxy_pass", LOC | IF | LMT | SSRV, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_set_header", HSL, 2, 2, DIRECTIVE_SIMPLE },
+    { "proxy_hide_header", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_pass_header", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_ignore_headers", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_redirect", HSL, 1, 2, DIRECTIVE_SIMPLE },
+    { "proxy_http_version", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_buffering", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_request_buffering", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_buffers", HSL, 2, 2, DIRECTIVE_SIMPLE },
+    { "proxy_buffer_size", HSL | STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_busy_buffers_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_max_temp_file_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_connect_timeout", HSL | STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_read_timeout", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_send_timeout", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_timeout", STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_responses", STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_protocol", STREAM_ANY | MSRV, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_next_upstream", HSL | STREAM_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_intercept_errors", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_cookie_domain", HSL, 1, 2, DIRECTIVE_SIMPLE },
+    { "proxy_cookie_path", HSL, 1, 2, DIRECTIVE_SIMPLE },
+    { "proxy_cache", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_cache_path", HTTP, 2, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_cache_key", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "proxy_cache_valid", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_cache_bypass", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_cache_use_stale", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_cache_lock", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_no_cache", HSL, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "proxy_ssl_server_name", HSL | STREAM_ANY, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_ssl_verify", HSL | STREAM_ANY, 1, 1, DIRECTIVE_FLAG },
+    { "proxy_ssl_trusted_certificate", HSL | STREAM_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "fastcgi_pass", LOC | IF, 1, 1, DIRECTIVE_SIMPLE },
+    { "fastcgi_param", HSL, 2, 3, DIRECTIVE_SIMPLE },
+    { "fastcgi_index", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "fastcgi_split_path_info", LOC, 1, 1, DIRECTIVE_SIMPLE },
+    { "fastcgi_buffers", HSL, 2, 2, DIRECTIVE_SIMPLE },
+    { "fastcgi_buffer_size", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "fastcgi_read_timeout", HSL, 1, 1, DIRECTIVE_SIMPLE },
+    { "fastcgi_intercept_errors", HSL, 1, 1, DIRECTIVE_FLAG },
+    { "uwsgi_pass", LOC | IF, 1, 1, DIRECTIVE_SIMPLE },
+    { "uwsgi_param", HSL, 2, 3, DIRECTIVE_SIMPLE },
+    { "scgi_pass", LOC | IF, 1, 1, DIRECTIVE_SIMPLE },
+    { "scgi_param", HSL, 2, 3, DIRECTIVE_SIMPLE },
+    { "grpc_pass", LOC | IF, 1, 1, DIRECTIVE_SIMPLE },
+    
+    // Upstream
+    { "keepalive", UPS, 1, 1, DIRECTIVE_SIMPLE },
+    { "least_conn", UPS | SUPS, 0, 0, DIRECTIVE_SIMPLE },
+    { "ip_hash", UPS, 0, 0, DIRECTIVE_SIMPLE },
+    { "hash", UPS | SUPS, 1, 2, DIRECTIVE_SIMPLE },
+    { "random", UPS | SUPS, 0, 2, DIRECTIVE_SIMPLE },
+    { "zone", UPS | SUPS, 1, 2, DIRECTIVE_SIMPLE },
+    
+    // SSL
+    { "ssl", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "http2", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "ssl_certificate", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_certificate_key", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_protocols", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "ssl_ciphers", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_prefer_server_ciphers", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_FLAG },
+    { "ssl_session_cache", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 2, DIRECTIVE_SIMPLE },
+    { "ssl_session_timeout", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_session_tickets", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_FLAG },
+    { "ssl_dhparam", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_ecdh_curve", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_client_certificate", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_trusted_certificate", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_verify_client", HTTP | SRV | STREAM_ANY | MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "ssl_stapling", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "ssl_stapling_verify", HTTP | SRV, 1, 1, DIRECTIVE_FLAG },
+    { "ssl_preread", STREAM_ANY, 1, 1, DIRECTIVE_FLAG },
+    
+    // Mail
+    { "protocol", MSRV, 1, 1, DIRECTIVE_SIMPLE },
+    { "auth_http", MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "starttls", MAIL_ANY, 1, 1, DIRECTIVE_SIMPLE },
+    { "smtp_auth", MAIL_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "pop3_auth", MAIL_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+    { "imap_auth", MAIL_ANY, 1, ANY_ARGS, DIRECTIVE_SIMPLE },
+};
+
+static const gchar *context_names[] = {
+    "main", "events", "http", "server", "location", "upstream", "if", "limit_except",
+    "stream", "server", "upstream", "mail", "server", NULL
+};
+
+// name -> first DirectiveSpec with that name, built once
+static GHashTable* get_spec_table(void) {
+    static gsize initialized = 0;
+    static GHashTable *table = NULL;
+    if (g_once_init_enter(&initialized)) {
+        table = g_hash_table_new(g_str_hash, g_str_equal);
+        for (gsize i = G_N_ELEMENTS(directive_specs); i > 0; i--) {
+            g_hash_table_insert(table, (gpointer)directive_specs[i - 1].name,
+                                (gpointer)&directive_specs[i - 1]);
+        }
+        g_once_init_leave(&initialized, 1);
+    }
+    return table;
+}
+
+// The context a block named name opens inside parent
+static LintContext child_context(const gchar *name, LintContext parent) {
+    if (strcmp(name, "events") == 0) return LINT_CONTEXT_EVENTS;
+    if (strcmp(name, "http") == 0) return LINT_CONTEXT_HTTP;
+    if (strcmp(name, "stream") == 0) return LINT_CONTEXT_STREAM;
+    if (strcmp(name, "mail") == 0) return LINT_CONTEXT_MAIL;
+    if (strcmp(name, "location") == 0) return LINT_CONTEXT_LOCATION;
+    if (strcmp(name, "if") == 0) return LINT_CONTEXT_IF;
+    if (strcmp(name, "limit_except") == 0) return LINT_CONTEXT_LIMIT_EXCEPT;
+    if (strcmp(name, "server") == 0) {
+        if (parent == LINT_CONTEXT_STREAM) return LINT_CONTEXT_STREAM_SERVER;
+        if (parent == LINT_CONTEXT_MAIL) return LINT_CONTEXT_MAIL_SERVER;
+        return LINT_CONTEXT_SERVER;
+    }
+    if (strcmp(name, "upstream") == 0) {
+        return parent == LINT_CONTEXT_STREAM ? LINT_CONTEXT_STREAM_UPSTREAM : LINT_CONTEXT_UPSTREAM;
+    }
+    return LINT_CONTEXT_OPAQUE;
+}
+
+LintContext conf_lint_context_from_description(const gchar *description) {
+    if (!description) return LINT_CONTEXT_HTTP;
+    
+    LintContext context = LINT_CONTEXT_MAIN;
+    gchar **names = g_strsplit(description, " > ", -1);
+    for (gint i = 0; names[i] && context != LINT_CONTEXT_OPAQUE; i++) {
+        if (*names[i]) context = child_context(names[i], context);
+    }
+    g_strfreev(names);
+    return context;
+}
+
+void lint_diagnostic_free(gpointer data) {
+    LintDiagnostic *diagnostic = data;
+    g_free(diagnostic->message);
+    g_free(diagnostic);
+}
+
+typedef struct {
+    const ConfDocument *doc;
+    GPtrArray *diagnostics;
+    GCancellable *cancellable;
+    guint n_linted;
+} Linter;
+
+static void add_diagnostic(Linter *linter, LintSeverity severity, guint32 offset, guint32 length,
+                           guint32 line, gchar *message) {
+    const gchar *data = linter->doc->data;
+    guint32 line_start = offset;
+    while (line_start > 0 && data[line_start - 1] != '\n') line_start--;
+    
+    LintDiagnostic *diagnostic = g_new0(LintDiagnostic, 1);
+    diagnostic->severity = severity;
+    diagnostic->line = line;
+    diagnostic->column = offset - line_start;
+    diagnostic->length = length;
+    diagnostic->message = message;
+    g_ptr_array_add(linter->diagnostics, diagnostic);
+}
+
+static const DirectiveSpec* find_spec(const DirectiveSpec *first, const gchar *name,
+                                      LintContext context, gboolean is_block) {
+    const DirectiveSpec *end = directive_specs + G_N_ELEMENTS(directive_specs);
+    const DirectiveSpec *allowed = NULL;
+    for (const DirectiveSpec *spec = first; spec < end && strcmp(spec->name, name) == 0; spec++) {
+        if (!(spec->contexts & (1u << context))) continue;
+        // Prefer the variant matching the shape that was written
+        if ((spec->kind == DIRECTIVE_BLOCK) == is_block) return spec;
+        if (!allowed) allowed = spec;
+    }
+    return allowed;
+}
+
+static guint32 count_lines(const gchar *data, guint32 from, guint32 to) {
+    guint32 n = 0;
+    for (guint32 i = from; i < to; i++) {
+        if (data[i] == '\n') n++;
+    }
+    return n;
+}
+
+// A directive missing its ";" swallows the next line: "root /srv\nindex a;"
+// parses as root with three arguments. Reports the first argument on a
+// later line that is itself a directive name.
+static gboolean check_missing_semicolon(Linter *linter, const ConfNode *node, GHashTable *specs) {
+    const ConfDocument *doc = linter->doc;
+    guint32 previous_end = node->name.offset + node->name.length;
+    for (guint32 i = 0; i < node->n_args; i++) {
+        ConfSpan arg = node->args[i];
+        if (count_lines(doc->data, previous_end, arg.offset) > 0) {
+            gchar *name = g_strndup(conf_span_data(doc, arg), arg.length);
+            gboolean is_directive = g_hash_table_contains(specs, name);
+            g_free(name);
+            if (is_directive) {
+                add_diagnostic(linter, LINT_SEVERITY_ERROR, previous_end, 0,
+                               node->line + count_lines(doc->data, node->offset, previous_end),
+                               g_strdup_printf("missing \";\" after \"%.*s\" directive",
+                                               (int)node->name.length, conf_span_data(doc, node->name)));
+                return TRUE;
+            }
+        }
+        previous_end = arg.offset + arg.length;
+    }
+    return FALSE;
+}
+
+static gboolean lint_block(Linter *linter, const ConfNode *block, LintContext context) {
+    const ConfDocument *doc = linter->doc;
+    GHashTable *specs = get_spec_table();
+    
+    for (const ConfNode *node = block->children; node; node = node->next) {
+        if (++linter->n_linted % LINT_CANCEL_CHECK_INTERVAL == 0 &&
+            g_cancellable_is_cancelled(linter->cancellable)) {
+            return FALSE;
+        }
+        
+        gchar *name = g_strndup(conf_span_data(doc, node->name), node->name.length);
+        guint32 offset = node->name.offset;
+        guint32 length = node->name.length;
+        const DirectiveSpec *first = g_hash_table_lookup(specs, name);
+        const DirectiveSpec *spec = first ? find_spec(first, name, context, node->is_block) : NULL;
+        
+        if (!first) {
+            // Directives of third-party modules land here as well
+            add_diagnostic(linter, LINT_SEVERITY_WARNING, offset, length, node->line,
+                           g_strdup_printf("unknown directive \"%s\"", name));
+        } else if (!spec) {
+            add_diagnostic(linter, LINT_SEVERITY_ERROR, offset, length, node->line,
+                           g_strdup_printf("\"%s\" directive is not allowed in %s", name,
+                                           context_names[context]));
+        } else if (spec->kind == DIRECTIVE_BLOCK && !node->is_block) {
+            add_diagnostic(linter, LINT_SEVERITY_ERROR, offset, length, node->line,
+                           g_strdup_printf("directive \"%s\" has no opening \"{\"", name));
+        } else if (spec->kind != DIRECTIVE_BLOCK && node->is_block) {
+            add_diagnostic(linter, LINT_SEVERITY_ERROR, offset, length, node->line,
+                           g_strdup_printf("directive \"%s\" does not take a block", name));
+        } else if (!check_missing_semicolon(linter, node, specs)) {
+            if (node->n_args < spec->min_args || (spec->max_args != ANY_ARGS && node->n_args > spec->max_args)) {
+                add_diagnostic(linter, LINT_SEVERITY_ERROR, offset, length, node->line,
+                               g_strdup_printf("invalid number of arguments in \"%s\" directive", name));
+            } else if (spec->kind == DIRECTIVE_FLAG &&
+                       !conf_span_equal(doc, node->args[0], "on") && !conf_span_equal(doc, node->args[0], "off")) {
+                add_diagnostic(linter, LINT_SEVERITY_ERROR, node->args[0].offset, node->args[0].length, node->line,
+                               g_strdup_printf("invalid value \"%.*s\" in \"%s\" directive, it must be \"on\" or \"off\"",
+                                               (int)node->args[0].length, conf_span_data(doc, node->args[0]), name));
+            }
+        }
+        
+        if (node->is_block) {
+            // Blocks of unknown modules may hold anything; misplaced ones are still checked inside
+            LintContext inner = first ? child_context(name, context) : LINT_CONTEXT_OPAQUE;
+            if (inner != LINT_CONTEXT_OPAQUE && !lint_block(linter, node, inner)) {
+                g_free(name);
+                return FALSE;
+            }
+        }
+        g_free(name);
+    }
+    return TRUE;
+}
+
+static gint compare_diagnostics(gconstpointer a, gconstpointer b) {
+    const LintDiagnostic *da = *(const LintDiagnostic **)a;
+    const LintDiagnostic *db = *(const LintDiagnostic **)b;
+    if (da->line != db->line) return da->line < db->line ? -1 : 1;
+    return da->column < db->column ? -1 : da->column > db->column;
+}
+
+GPtrArray* conf_lint_document(const ConfDocument *doc, LintContext root, GCancellable *cancellable) {
+    Linter linter = { doc, g_ptr_array_new_with_free_func(lint_diagnostic_free), cancellable, 0 };
+    
+    for (guint i = 0; i < doc->n_errors; i++) {
+        const ConfError *error = &doc->errors[i];
+        guint32 length = error->offset < doc->length ? 1 : 0;
+        add_diagnostic(&linter, LINT_SEVERITY_ERROR, error->offset, length, error->line,
+                       g_strdup(error->message));
+    }
+    
+    if (root == LINT_CONTEXT_OPAQUE || !lint_block(&linter, doc->root, root)) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            g_ptr_array_unref(linter.diagnostics);
+            return NULL;
+        }
+    }
+    
+    g_ptr_array_sort(linter.diagnostics, compare_diagnostics);
+    return linter.diagnostics;
+}
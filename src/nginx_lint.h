@@ -0,0 +1,55 @@
+#ifndef NGINX_LINT_H
+#define NGINX_LINT_H
+
+#include <gio/gio.h>
+#include "nginx_parser.h"
+
+// Structural and semantic checks of a config without running nginx:
+// parse errors (unbalanced braces, missing semicolons), unknown
+// directives, directives outside the blocks they belong to, wrong
+// argument counts and bad on/off flags. Only GLib is used, so linting
+// can run on a worker thread.
+
+typedef enum {
+    LINT_CONTEXT_MAIN,
+    LINT_CONTEXT_EVENTS,
+    LINT_CONTEXT_HTTP,
+    LINT_CONTEXT_SERVER,
+    LINT_CONTEXT_LOCATION,
+    LINT_CONTEXT_UPSTREAM,
+    LINT_CONTEXT_IF,
+    LINT_CONTEXT_LIMIT_EXCEPT,
+    LINT_CONTEXT_STREAM,
+    LINT_CONTEXT_STREAM_SERVER,
+    LINT_CONTEXT_STREAM_UPSTREAM,
+    LINT_CONTEXT_MAIL,
+    LINT_CONTEXT_MAIL_SERVER,
+    LINT_CONTEXT_OPAQUE         // map, types, geo...: contents are not directives
+} LintContext;
+
+typedef enum {
+    LINT_SEVERITY_ERROR,        // nginx -t would fail
+    LINT_SEVERITY_WARNING       // probably wrong, e.g. a directive from an unknown module
+} LintSeverity;
+
+typedef struct {
+    LintSeverity severity;
+    guint32 line;               // 1-based
+    guint32 column;             // byte index within the line
+    guint32 length;             // bytes to mark, 0 at the end of the text
+    gchar *message;
+} LintDiagnostic;
+
+// The context a file's top level is in, from an include context
+// description such as "http > server". NULL gives LINT_CONTEXT_HTTP, where
+// files in conf.d normally end up.
+LintContext conf_lint_context_from_description(const gchar *description);
+
+// Lints a parsed document whose top level is in root. Returns the
+// diagnostics sorted by position (LintDiagnostic*, owned by the caller),
+// or NULL if cancellable was cancelled.
+GPtrArray* conf_lint_document(const ConfDocument *doc, LintContext root, GCancellable *cancellable);
+
+void lint_diagnostic_free(gpointer diagnostic);
+
+#endif // NGINX_LINT_H
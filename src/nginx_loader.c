@@ -0,0 +1,204 @@
+#include "nginx_loader.h"
+#include "nginx_pool.h"
+#include "nginx_trace.h"
+#include <string.h>
+
+// Bytes validated between checks for cancellation
+#define LOADER_VALIDATE_BLOCK (4 * 1024 * 1024)
+
+struct _BufferLoader {
+    GtkTextBuffer *buffer;
+    gchar *path;
+    GCancellable *cancellable;
+    GMappedFile *file;
+    gchar *digest;
+    const gchar *data;
+    gsize length;
+    gsize inserted;
+    guint idle_id;
+    gboolean mapping;           // the worker still owns the loader
+    BufferLoaderProgressFunc on_progress;
+    BufferLoaderDoneFunc on_done;
+    gpointer user_data;
+    TraceSpan span;             // only loads that finish are recorded
+};
+
+static void buffer_loader_free(BufferLoader *loader) {
+    if (loader->idle_id) {
+        g_source_remove(loader->idle_id);
+    }
+    if (loader->file) {
+        g_mapped_file_unref(loader->file);
+    }
+    g_object_unref(loader->cancellable);
+    g_object_unref(loader->buffer);
+    g_free(loader->digest);
+    g_free(loader->path);
+    g_free(loader);
+}
+
+static void finish(BufferLoader *loader, const GError *error) {
+    trace_end(&loader->span, loader->inserted);
+    loader->on_done(error, error ? NULL : loader->digest, loader->user_data);
+    buffer_loader_free(loader);
+}
+
+// What the worker found, for on_file_mapped
+typedef struct {
+    BufferLoader *loader;
+    gchar *path;
+    GMappedFile *file;
+    gchar *digest;
+    GError *error;
+} MappedText;
+
+static void mapped_text_free(gpointer data) {
+    MappedText *text = data;
+    if (text->file) g_mapped_file_unref(text->file);
+    g_clear_error(&text->error);
+    g_free(text->digest);
+    g_free(text->path);
+    g_free(text);
+}
+
+static void map_file_thread(gpointer user_data, GCancellable *cancellable) {
+    MappedText *text = user_data;
+    const gchar *path = text->path;
+    GError *error = NULL;
+    GMappedFile *file = g_mapped_file_new(path, FALSE, &error);
+    if (!file) {
+        text->error = error;
+        return;
+    }
+    
+    // Reading every page once here also leaves the file in the page cache
+    // for the inserts on the main thread
+    const gchar *data = g_mapped_file_get_contents(file);
+    gsize length = g_mapped_file_get_length(file);
+    gsize offset = 0;
+    GChecksum *checksum = g_checksum_new(LOADER_CHECKSUM);
+    while (offset < length) {
+        if (g_cancellable_is_cancelled(cancellable)) {
+            g_checksum_free(checksum);
+            g_mapped_file_unref(file);
+            return;
+        }
+        gsize block = MIN(LOADER_VALIDATE_BLOCK, length - offset);
+        const gchar *end = NULL;
+        if (!g_utf8_validate_len(data + offset, block, &end)) {
+            gsize valid = end - (data + offset);
+            // A block may end inside a character, the next one starts there
+            if (offset + block == length || block - valid >= 4 || valid == 0) {
+                g_checksum_free(checksum);
+                g_mapped_file_unref(file);
+                g_set_error(&text->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "%s is not valid UTF-8 text (byte %" G_GSIZE_FORMAT ")", path, offset + valid);
+                return;
+            }
+            block = valid;
+        }
+        g_checksum_update(checksum, (const guchar *)data + offset, block);
+        offset += block;
+    }
+    text->file = file;
+    text->digest = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+}
+
+// Piece boundaries fall after a newline where possible, never inside a
+// UTF-8 sequence or between "\r" and "\n"
+static gsize next_piece_length(const gchar *data, gsize remaining) {
+    if (remaining <= LOADER_PIECE_SIZE) return remaining;
+    
+    const gchar *newline = g_strrstr_len(data, LOADER_PIECE_SIZE, "\n");
+    if (newline) return newline - data + 1;
+    
+    const gchar *start = g_utf8_find_prev_char(data, data + LOADER_PIECE_SIZE);
+    gsize length = start && start > data ? (gsize)(start - data) : LOADER_PIECE_SIZE;
+    if (length > 1 && data[length - 1] == '\r') length--;
+    return length;
+}
+
+static gboolean insert_pieces(gpointer user_data) {
+    BufferLoader *loader = user_data;
+    gint64 deadline = g_get_monotonic_time() + LOADER_FRAME_BUDGET_US;
+    
+    do {
+        gsize length = next_piece_length(loader->data + loader->inserted, loader->length - loader->inserted);
+        GtkTextIter end;
+        gtk_text_buffer_get_end_iter(loader->buffer, &end);
+        // Loading is not something to undo
+        gtk_text_buffer_begin_irreversible_action(loader->buffer);
+        gtk_text_buffer_insert(loader->buffer, &end, loader->data + loader->inserted, length);
+        gtk_text_buffer_end_irreversible_action(loader->buffer);
+        loader->inserted += length;
+    } while (loader->inserted < loader->length && g_get_monotonic_time() < deadline);
+    
+    if (loader->inserted < loader->length) {
+        loader->on_progress((gdouble)loader->inserted / loader->length, loader->user_data);
+        return G_SOURCE_CONTINUE;
+    }
+    
+    loader->idle_id = 0;
+    finish(loader, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_file_mapped(gpointer user_data, gboolean cancelled) {
+    MappedText *text = user_data;
+    BufferLoader *loader = text->loader;
+    loader->mapping = FALSE;
+    
+    if (cancelled) {
+        // buffer_loader_cancel left the loader to us
+        buffer_loader_free(loader);
+        return;
+    }
+    if (text->error) {
+        finish(loader, text->error);
+        return;
+    }
+    
+    loader->file = g_steal_pointer(&text->file);
+    loader->digest = g_steal_pointer(&text->digest);
+    loader->data = g_mapped_file_get_contents(loader->file);
+    loader->length = g_mapped_file_get_length(loader->file);
+    if (loader->length == 0) {
+        finish(loader, NULL);
+        return;
+    }
+    // Progress is only reported once a pass leaves text to insert
+    loader->idle_id = g_idle_add(insert_pieces, loader);
+}
+
+BufferLoader* buffer_loader_start(GtkTextBuffer *buffer, const gchar *path,
+                                  BufferLoaderProgressFunc on_progress,
+                                  BufferLoaderDoneFunc on_done, gpointer user_data) {
+    BufferLoader *loader = g_new0(BufferLoader, 1);
+    loader->buffer = g_object_ref(buffer);
+    loader->path = g_strdup(path);
+    loader->cancellable = g_cancellable_new();
+    loader->on_progress = on_progress;
+    loader->on_done = on_done;
+    loader->user_data = user_data;
+    loader->mapping = TRUE;
+    trace_begin(&loader->span, TRACE_OP_LOAD);
+    
+    gtk_text_buffer_begin_irreversible_action(buffer);
+    gtk_text_buffer_set_text(buffer, "", -1);
+    gtk_text_buffer_end_irreversible_action(buffer);
+    
+    MappedText *text = g_new0(MappedText, 1);
+    text->loader = loader;
+    text->path = g_strdup(path);
+    work_pool_push(work_pool_get_default(), WORK_PRIORITY_INTERACTIVE, map_file_thread, on_file_mapped,
+                   text, mapped_text_free, loader->cancellable);
+    return loader;
+}
+
+void buffer_loader_cancel(BufferLoader *loader) {
+    g_cancellable_cancel(loader->cancellable);
+    if (!loader->mapping) {
+        buffer_loader_free(loader);
+    }
+}
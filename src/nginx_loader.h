@@ -0,0 +1,36 @@
+#ifndef NGINX_LOADER_H
+#define NGINX_LOADER_H
+
+#include <gtk/gtk.h>
+
+// Loads a file into a text buffer without blocking the main loop. A worker
+// thread maps the file and validates it as UTF-8; the text is then copied
+// from the mapping into the buffer in small pieces from an idle handler,
+// a few milliseconds per main loop iteration. The mapping is shared with
+// the page cache, so the only private copy is the buffer's own.
+
+// Bytes inserted per gtk_text_buffer_insert call
+#define LOADER_PIECE_SIZE (64 * 1024)
+// Time spent inserting per idle callback, in microseconds
+#define LOADER_FRAME_BUDGET_US 8000
+// Checksum of the file handed to on_done; hashing the buffer text the same
+// way tells whether it still matches the file
+#define LOADER_CHECKSUM G_CHECKSUM_SHA256
+
+typedef struct _BufferLoader BufferLoader;
+
+typedef void (*BufferLoaderProgressFunc)(gdouble fraction, gpointer user_data);
+// error is NULL when the whole file is in the buffer, digest is then the
+// hex checksum of the file. The loader frees itself after this returns.
+typedef void (*BufferLoaderDoneFunc)(const GError *error, const gchar *digest, gpointer user_data);
+
+// Clears buffer and starts loading path into it
+BufferLoader* buffer_loader_start(GtkTextBuffer *buffer, const gchar *path,
+                                  BufferLoaderProgressFunc on_progress,
+                                  BufferLoaderDoneFunc on_done, gpointer user_data);
+
+// Stops loading and frees the loader; on_done is not called. The buffer
+// keeps whatever was inserted so far.
+void buffer_loader_cancel(BufferLoader *loader);
+
+#endif // NGINX_LOADER_H
@@ -0,0 +1,252 @@
+#include "nginx_log.h"
+#include <string.h>
+
+struct _LogRing {
+    LogRecord *records;
+    guint capacity;
+    guint64 first_seq;
+    guint64 end_seq;
+};
+
+LogRing* log_ring_new(guint capacity) {
+    LogRing *ring = g_new0(LogRing, 1);
+    ring->capacity = MAX(capacity, 1);
+    ring->records = g_new0(LogRecord, ring->capacity);
+    return ring;
+}
+
+void log_ring_free(LogRing *ring) {
+    if (!ring) return;
+    for (guint64 seq = ring->first_seq; seq < ring->end_seq; seq++) {
+        g_free(ring->records[seq % ring->capacity].message);
+    }
+    g_free(ring->records);
+    g_free(ring);
+}
+
+guint64 log_ring_append(LogRing *ring, gint64 timestamp, LogSeverity severity,
+                        const gchar *source, const gchar *message) {
+    LogRecord *record = &ring->records[ring->end_seq % ring->capacity];
+    if (ring->end_seq - ring->first_seq == ring->capacity) {
+        g_free(record->message);
+        ring->first_seq++;
+    }
+    record->seq = ring->end_seq++;
+    record->timestamp = timestamp;
+    record->severity = severity;
+    record->source = source;
+    record->message = g_strdup(message);
+    return record->seq;
+}
+
+guint64 log_ring_get_first_seq(const LogRing *ring) {
+    return ring->first_seq;
+}
+
+guint64 log_ring_get_end_seq(const LogRing *ring) {
+    return ring->end_seq;
+}
+
+const LogRecord* log_ring_get(const LogRing *ring, guint64 seq) {
+    if (seq < ring->first_seq || seq >= ring->end_seq) return NULL;
+    return &ring->records[seq % ring->capacity];
+}
+
+LogSeverity log_severity_guess(const gchar *message) {
+    if (g_str_has_prefix(message, "Error")) return LOG_SEVERITY_ERROR;
+    if (g_str_has_prefix(message, "Warning")) return LOG_SEVERITY_WARNING;
+    if (strstr(message, "[emerg]") || strstr(message, "[alert]") ||
+        strstr(message, "[crit]") || strstr(message, "[error]")) {
+        return LOG_SEVERITY_ERROR;
+    }
+    if (strstr(message, "[warn]")) return LOG_SEVERITY_WARNING;
+    return LOG_SEVERITY_INFO;
+}
+
+static gboolean contains_ascii_nocase(const gchar *haystack, const gchar *needle) {
+    gsize needle_length = strlen(needle);
+    for (; *haystack; haystack++) {
+        if (g_ascii_strncasecmp(haystack, needle, needle_length) == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+gboolean log_record_matches(const LogRecord *record, LogSeverity min_severity, const gchar *search) {
+    if (record->severity < min_severity) return FALSE;
+    if (!search || !*search) return TRUE;
+    return contains_ascii_nocase(record->message, search) || contains_ascii_nocase(record->source, search);
+}
+
+// LogItem: a copy of one record, created only for rows the view asks for
+
+struct _LogItem {
+    GObject parent_instance;
+    gint64 timestamp;
+    LogSeverity severity;
+    const gchar *source;
+    gchar *message;
+};
+
+G_DEFINE_TYPE(LogItem, log_item, G_TYPE_OBJECT)
+
+static void log_item_finalize(GObject *object) {
+    g_free(LOG_ITEM(object)->message);
+    G_OBJECT_CLASS(log_item_parent_class)->finalize(object);
+}
+
+static void log_item_class_init(LogItemClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = log_item_finalize;
+}
+
+static void log_item_init(LogItem *item) {
+    (void)item; // Unused parameter
+}
+
+gint64 log_item_get_timestamp(LogItem *item) {
+    return item->timestamp;
+}
+
+LogSeverity log_item_get_severity(LogItem *item) {
+    return item->severity;
+}
+
+const gchar* log_item_get_source(LogItem *item) {
+    return item->source;
+}
+
+const gchar* log_item_get_message(LogItem *item) {
+    return item->message;
+}
+
+// LogModel
+
+struct _LogModel {
+    GObject parent_instance;
+    LogRing *ring;
+    GArray *visible;            // guint64 seqs passing the filter, in order
+    guint64 flushed_seq;        // appends below this were considered for visible
+    LogSeverity min_severity;
+    gchar *search;
+};
+
+static void log_model_list_model_init(GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(LogModel, log_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, log_model_list_model_init))
+
+static GType log_model_get_item_type(GListModel *list) {
+    (void)list; // Unused parameter
+    return LOG_TYPE_ITEM;
+}
+
+static guint log_model_get_n_items(GListModel *list) {
+    return LOG_MODEL(list)->visible->len;
+}
+
+static gpointer log_model_get_item(GListModel *list, guint position) {
+    LogModel *model = LOG_MODEL(list);
+    if (position >= model->visible->len) return NULL;
+    
+    const LogRecord *record = log_ring_get(model->ring, g_array_index(model->visible, guint64, position));
+    LogItem *item = g_object_new(LOG_TYPE_ITEM, NULL);
+    // Evicted since the last flush, which removes the row; until then the
+    // view still counts it and must get an item
+    if (!record) {
+        item->timestamp = g_get_real_time();
+        item->severity = LOG_SEVERITY_INFO;
+        item->message = g_strdup("(dropped, the log is full)");
+        return item;
+    }
+    item->timestamp = record->timestamp;
+    item->severity = record->severity;
+    item->source = record->source;
+    item->message = g_strdup(record->message);
+    return item;
+}
+
+static void log_model_list_model_init(GListModelInterface *iface) {
+    iface->get_item_type = log_model_get_item_type;
+    iface->get_n_items = log_model_get_n_items;
+    iface->get_item = log_model_get_item;
+}
+
+static void log_model_finalize(GObject *object) {
+    LogModel *model = LOG_MODEL(object);
+    log_ring_free(model->ring);
+    g_array_free(model->visible, TRUE);
+    g_free(model->search);
+    G_OBJECT_CLASS(log_model_parent_class)->finalize(object);
+}
+
+static void log_model_class_init(LogModelClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = log_model_finalize;
+}
+
+static void log_model_init(LogModel *model) {
+    model->visible = g_array_new(FALSE, FALSE, sizeof(guint64));
+}
+
+LogModel* log_model_new(guint capacity) {
+    LogModel *model = g_object_new(LOG_TYPE_MODEL, NULL);
+    model->ring = log_ring_new(capacity);
+    return model;
+}
+
+void log_model_append(LogModel *model, LogSeverity severity, const gchar *source, const gchar *message) {
+    log_ring_append(model->ring, g_get_real_time(), severity, source, message);
+}
+
+// Brings visible up to date with the ring without notifying the view.
+// Returns the number of rows removed from the front; appended rows start at
+// position *position.
+static guint update_visible(LogModel *model, guint *position) {
+    guint64 first_seq = log_ring_get_first_seq(model->ring);
+    guint64 end_seq = log_ring_get_end_seq(model->ring);
+    
+    // Visible records that were evicted are all at the front
+    guint removed = 0;
+    while (removed < model->visible->len && g_array_index(model->visible, guint64, removed) < first_seq) {
+        removed++;
+    }
+    if (removed > 0) {
+        g_array_remove_range(model->visible, 0, removed);
+    }
+    
+    // Records appended and evicted within one burst are never shown
+    *position = model->visible->len;
+    for (guint64 seq = MAX(model->flushed_seq, first_seq); seq < end_seq; seq++) {
+        if (log_record_matches(log_ring_get(model->ring, seq), model->min_severity, model->search)) {
+            g_array_append_val(model->visible, seq);
+        }
+    }
+    model->flushed_seq = end_seq;
+    return removed;
+}
+
+gboolean log_model_flush(LogModel *model) {
+    guint position = 0;
+    guint removed = update_visible(model, &position);
+    guint added = model->visible->len - position;
+    
+    if (removed > 0) {
+        g_list_model_items_changed(G_LIST_MODEL(model), 0, removed, 0);
+    }
+    if (added > 0) {
+        g_list_model_items_changed(G_LIST_MODEL(model), position, 0, added);
+    }
+    return removed > 0 || added > 0;
+}
+
+// Re-filters the whole ring, which pending appends are part of
+void log_model_set_filter(LogModel *model, LogSeverity min_severity, const gchar *search) {
+    model->min_severity = min_severity;
+    g_free(model->search);
+    model->search = search && *search ? g_strdup(search) : NULL;
+    
+    guint old_length = model->visible->len;
+    guint position = 0;
+    g_array_set_size(model->visible, 0);
+    model->flushed_seq = log_ring_get_first_seq(model->ring);
+    update_visible(model, &position);
+    g_list_model_items_changed(G_LIST_MODEL(model), 0, old_length, model->visible->len);
+}
@@ -0,0 +1,67 @@
+#ifndef NGINX_LOG_H
+#define NGINX_LOG_H
+
+#include <gio/gio.h>
+
+// Structured log records in a fixed-capacity ring. Once it is full, each
+// append evicts the oldest record, so memory stays bounded however much
+// output is streamed into the log.
+
+typedef enum {
+    LOG_SEVERITY_INFO,
+    LOG_SEVERITY_SUCCESS,
+    LOG_SEVERITY_WARNING,
+    LOG_SEVERITY_ERROR
+} LogSeverity;
+
+typedef struct {
+    guint64 seq;                // position in the stream of all appends
+    gint64 timestamp;           // wall-clock microseconds
+    LogSeverity severity;
+    const gchar *source;        // static string, e.g. "nginx"
+    gchar *message;
+} LogRecord;
+
+typedef struct _LogRing LogRing;
+
+LogRing* log_ring_new(guint capacity);
+void log_ring_free(LogRing *ring);
+guint64 log_ring_append(LogRing *ring, gint64 timestamp, LogSeverity severity,
+                        const gchar *source, const gchar *message);
+// Records seq first_seq .. end_seq - 1 are held
+guint64 log_ring_get_first_seq(const LogRing *ring);
+guint64 log_ring_get_end_seq(const LogRing *ring);
+// The record with seq, or NULL once it was evicted
+const LogRecord* log_ring_get(const LogRing *ring, guint64 seq);
+
+// Severity of a message without one: "Error: ..." and nginx's "[emerg]"
+// are errors, "Warning: ..." and "[warn]" are warnings
+LogSeverity log_severity_guess(const gchar *message);
+
+// Whether record is at least min_severity and contains search, ignoring
+// ASCII case. An empty or NULL search matches everything.
+gboolean log_record_matches(const LogRecord *record, LogSeverity min_severity, const gchar *search);
+
+// A GListModel of LogItems over a ring, showing the records that pass a
+// severity and text filter. Appends are held back until log_model_flush,
+// so a burst costs one items-changed per flush instead of one per record.
+
+#define LOG_TYPE_ITEM (log_item_get_type())
+G_DECLARE_FINAL_TYPE(LogItem, log_item, LOG, ITEM, GObject)
+
+gint64 log_item_get_timestamp(LogItem *item);
+LogSeverity log_item_get_severity(LogItem *item);
+const gchar* log_item_get_source(LogItem *item);
+const gchar* log_item_get_message(LogItem *item);
+
+#define LOG_TYPE_MODEL (log_model_get_type())
+G_DECLARE_FINAL_TYPE(LogModel, log_model, LOG, MODEL, GObject)
+
+LogModel* log_model_new(guint capacity);
+void log_model_append(LogModel *model, LogSeverity severity, const gchar *source, const gchar *message);
+// Publishes the records appended since the last flush and drops evicted
+// ones. Returns FALSE if the visible list did not change.
+gboolean log_model_flush(LogModel *model);
+void log_model_set_filter(LogModel *model, LogSeverity min_severity, const gchar *search);
+
+#endif // NGINX_LOG_H
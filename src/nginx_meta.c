@@ -0,0 +1,297 @@
+#include "nginx_meta.h"
+#include <gio/gio.h>
+#include <string.h>
+
+#define META_CACHE_MAGIC 0x4154454du     // "META"
+#define META_CACHE_VERSION 1
+
+// Saved format, native byte order (the cache never leaves the machine).
+// Every part is a multiple of 8 bytes, so the records of a mapped file
+// are read in place:
+//   header
+//   files:   MetaFileRecord[n_files], sorted by path
+//   items:   MetaItemRecord[n_items], each file's in one run
+//   strings: NUL-terminated, referenced by offset; the last byte is NUL
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 n_files;
+    guint32 n_items;
+    guint64 strings_size;
+    guint64 reserved;
+} MetaHeader;
+
+typedef struct {
+    guint32 path;
+    guint32 first_item;
+    guint32 n_items;
+    guint32 reserved;
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime_ns;
+    gint64 size;
+    guint8 digest[META_DIGEST_SIZE];
+} MetaFileRecord;
+
+typedef struct {
+    guint8 kind;
+    guint8 flags;
+    guint16 reserved;
+    guint32 line;
+    guint32 block;
+    guint32 value;
+} MetaItemRecord;
+
+G_STATIC_ASSERT(sizeof(MetaHeader) == 32);
+G_STATIC_ASSERT(sizeof(MetaFileRecord) == 80);
+G_STATIC_ASSERT(sizeof(MetaItemRecord) == 16);
+
+struct _MetaCache {
+    GMappedFile *file;
+    const MetaHeader *header;
+    const MetaFileRecord *files;
+    const MetaItemRecord *items;
+    const gchar *strings;
+};
+
+static void add_item(MetaSummary *summary, MetaKind kind, guint flags, const ConfNode *node,
+                     const ConfDocument *doc, ConfSpan span) {
+    const ConfNode *parent = node->parent;
+    gboolean in_server = parent && parent->is_block && parent != doc->root &&
+                         conf_span_equal(doc, parent->name, "server");
+    gchar *value = conf_span_dup_value(doc, span);
+    MetaItem item = { kind, flags, node->line, in_server ? parent->line : 0,
+                      g_string_chunk_insert_const(summary->strings, value) };
+    g_array_append_val(summary->items, item);
+    g_free(value);
+}
+
+static void extract_node(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    MetaSummary *summary = user_data;
+    if (node->is_block) {
+        if (conf_span_equal(doc, node->name, "upstream") && node->n_args > 0) {
+            add_item(summary, META_UPSTREAM, 0, node, doc, node->args[0]);
+        }
+    } else if (conf_span_equal(doc, node->name, "server_name")) {
+        for (guint32 i = 0; i < node->n_args; i++) {
+            add_item(summary, META_SERVER_NAME, 0, node, doc, node->args[i]);
+        }
+    } else if (conf_span_equal(doc, node->name, "listen") && node->n_args > 0) {
+        guint flags = 0;
+        for (guint32 i = 1; i < node->n_args; i++) {
+            if (conf_span_equal(doc, node->args[i], "default_server") ||
+                conf_span_equal(doc, node->args[i], "default")) {
+                flags |= META_FLAG_DEFAULT;
+            }
+        }
+        add_item(summary, META_LISTEN, flags, node, doc, node->args[0]);
+    } else if (conf_span_equal(doc, node->name, "include") && node->n_args == 1) {
+        add_item(summary, META_INCLUDE, 0, node, doc, node->args[0]);
+    }
+}
+
+static MetaSummary* summary_new(const gchar *path) {
+    MetaSummary *summary = g_new0(MetaSummary, 1);
+    summary->path = g_strdup(path);
+    summary->items = g_array_new(FALSE, FALSE, sizeof(MetaItem));
+    summary->strings = g_string_chunk_new(256);
+    return summary;
+}
+
+MetaSummary* meta_summary_new(const gchar *path, const IncludeFileKey *key,
+                              const gchar *text, gsize length, const ConfDocument *doc) {
+    MetaSummary *summary = summary_new(path);
+    summary->key = *key;
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(checksum, (const guchar *)text, length);
+    gsize digest_length = META_DIGEST_SIZE;
+    g_checksum_get_digest(checksum, summary->digest, &digest_length);
+    g_checksum_free(checksum);
+
+    ConfDocument *parsed = doc ? NULL : conf_document_parse(text, length);
+    conf_document_foreach(doc ? doc : parsed, extract_node, summary);
+    conf_document_free(parsed);
+    return summary;
+}
+
+void meta_summary_free(gpointer data) {
+    MetaSummary *summary = data;
+    if (!summary) return;
+    g_string_chunk_free(summary->strings);
+    g_array_free(summary->items, TRUE);
+    g_free(summary->path);
+    g_free(summary);
+}
+
+gchar* meta_cache_get_default_path(void) {
+    return g_build_filename(g_get_user_cache_dir(), "nginxui", "metadata", NULL);
+}
+
+MetaCache* meta_cache_open(const gchar *path, GError **error) {
+    GMappedFile *file = g_mapped_file_new(path, FALSE, error);
+    if (!file) return NULL;
+
+    // Only the sizes are checked here, the records when they are read
+    const gchar *data = g_mapped_file_get_contents(file);
+    gsize length = g_mapped_file_get_length(file);
+    const MetaHeader *header = (const MetaHeader *)data;
+    gboolean valid = length >= sizeof(MetaHeader) && header->magic == META_CACHE_MAGIC &&
+                     header->version == META_CACHE_VERSION && header->strings_size <= length;
+    if (valid) {
+        guint64 expected = sizeof(MetaHeader) + (guint64)header->n_files * sizeof(MetaFileRecord) +
+                           (guint64)header->n_items * sizeof(MetaItemRecord) + header->strings_size;
+        valid = expected == length &&
+                (header->strings_size > 0 ? data[length - 1] == '\0' : header->n_files == 0);
+    }
+    if (!valid) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is not a metadata cache of this version", path);
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+
+    MetaCache *cache = g_new0(MetaCache, 1);
+    cache->file = file;
+    cache->header = header;
+    cache->files = (const MetaFileRecord *)(data + sizeof(MetaHeader));
+    cache->items = (const MetaItemRecord *)(cache->files + header->n_files);
+    cache->strings = (const gchar *)(cache->items + header->n_items);
+    return cache;
+}
+
+void meta_cache_free(MetaCache *cache) {
+    if (!cache) return;
+    g_mapped_file_unref(cache->file);
+    g_free(cache);
+}
+
+guint meta_cache_get_n_files(MetaCache *cache) {
+    return cache->header->n_files;
+}
+
+// The pool ends with a NUL, so any offset inside it starts a string
+static const gchar* get_string(MetaCache *cache, guint32 offset) {
+    return offset < cache->header->strings_size ? cache->strings + offset : NULL;
+}
+
+const gchar* meta_cache_get_path(MetaCache *cache, guint i) {
+    return i < cache->header->n_files ? get_string(cache, cache->files[i].path) : NULL;
+}
+
+gint meta_cache_find(MetaCache *cache, const gchar *path) {
+    guint lo = 0, hi = cache->header->n_files;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        const gchar *entry = get_string(cache, cache->files[mid].path);
+        if (!entry) return -1;
+        gint cmp = strcmp(path, entry);
+        if (cmp == 0) return (gint)mid;
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
+
+gboolean meta_cache_get_key(MetaCache *cache, guint i, IncludeFileKey *key, guint8 digest[META_DIGEST_SIZE]) {
+    if (i >= cache->header->n_files) return FALSE;
+    const MetaFileRecord *record = &cache->files[i];
+    key->dev = record->dev;
+    key->ino = record->ino;
+    key->mtime_ns = record->mtime_ns;
+    key->size = record->size;
+    if (digest) memcpy(digest, record->digest, META_DIGEST_SIZE);
+    return TRUE;
+}
+
+MetaSummary* meta_cache_get_summary(MetaCache *cache, guint i) {
+    if (i >= cache->header->n_files) return NULL;
+    const MetaFileRecord *record = &cache->files[i];
+    const gchar *path = get_string(cache, record->path);
+    if (!path || (guint64)record->first_item + record->n_items > cache->header->n_items) return NULL;
+
+    MetaSummary *summary = summary_new(path);
+    meta_cache_get_key(cache, i, &summary->key, summary->digest);
+    for (guint32 j = 0; j < record->n_items; j++) {
+        const MetaItemRecord *stored = &cache->items[record->first_item + j];
+        const gchar *value = get_string(cache, stored->value);
+        if (!value || stored->kind >= META_N_KINDS) {
+            meta_summary_free(summary);
+            return NULL;
+        }
+        MetaItem item = { stored->kind, stored->flags, stored->line, stored->block,
+                          g_string_chunk_insert_const(summary->strings, value) };
+        g_array_append_val(summary->items, item);
+    }
+    return summary;
+}
+
+static gint compare_summaries(gconstpointer a, gconstpointer b) {
+    return strcmp((*(MetaSummary * const *)a)->path, (*(MetaSummary * const *)b)->path);
+}
+
+// Offset of s in the pool, adding it the first time; values such as
+// listen addresses repeat across most files
+static guint32 intern(GString *strings, GHashTable *offsets, const gchar *s) {
+    gpointer offset;
+    if (g_hash_table_lookup_extended(offsets, s, NULL, &offset)) return GPOINTER_TO_UINT(offset);
+    guint32 start = (guint32)strings->len;
+    g_string_append_len(strings, s, strlen(s) + 1);
+    g_hash_table_insert(offsets, (gpointer)s, GUINT_TO_POINTER(start));
+    return start;
+}
+
+gboolean meta_cache_save(const gchar *path, GPtrArray *summaries, GError **error) {
+    GPtrArray *sorted = g_ptr_array_new();
+    for (guint i = 0; i < summaries->len; i++) g_ptr_array_add(sorted, g_ptr_array_index(summaries, i));
+    g_ptr_array_sort(sorted, compare_summaries);
+
+    GArray *files = g_array_sized_new(FALSE, TRUE, sizeof(MetaFileRecord), sorted->len);
+    GArray *items = g_array_new(FALSE, TRUE, sizeof(MetaItemRecord));
+    GString *strings = g_string_new(NULL);
+    GHashTable *offsets = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < sorted->len; i++) {
+        const MetaSummary *summary = g_ptr_array_index(sorted, i);
+        MetaFileRecord record = { 0 };
+        record.path = intern(strings, offsets, summary->path);
+        record.first_item = items->len;
+        record.n_items = summary->items->len;
+        record.dev = summary->key.dev;
+        record.ino = summary->key.ino;
+        record.mtime_ns = summary->key.mtime_ns;
+        record.size = summary->key.size;
+        memcpy(record.digest, summary->digest, META_DIGEST_SIZE);
+        g_array_append_val(files, record);
+        for (guint j = 0; j < summary->items->len; j++) {
+            const MetaItem *item = &g_array_index(summary->items, MetaItem, j);
+            MetaItemRecord stored = { item->kind, item->flags, 0, item->line, item->block,
+                                      intern(strings, offsets, item->value) };
+            g_array_append_val(items, stored);
+        }
+    }
+    g_hash_table_unref(offsets);
+    g_ptr_array_unref(sorted);
+    // Keeps the size a multiple of 8 and the last byte a NUL
+    while (strings->len % 8) g_string_append_c(strings, '\0');
+
+    MetaHeader header = { META_CACHE_MAGIC, META_CACHE_VERSION, files->len, items->len, strings->len, 0 };
+    GByteArray *out = g_byte_array_sized_new(sizeof(header) + files->len * sizeof(MetaFileRecord) +
+                                             items->len * sizeof(MetaItemRecord) + strings->len);
+    g_byte_array_append(out, (const guint8 *)&header, sizeof(header));
+    g_byte_array_append(out, (const guint8 *)files->data, files->len * sizeof(MetaFileRecord));
+    g_byte_array_append(out, (const guint8 *)items->data, items->len * sizeof(MetaItemRecord));
+    g_byte_array_append(out, (const guint8 *)strings->str, strings->len);
+    g_string_free(strings, TRUE);
+    g_array_free(items, TRUE);
+    g_array_free(files, TRUE);
+
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    // Written to a temporary file and renamed over the old cache, so a
+    // session that still maps the old one keeps reading it
+    gboolean saved = g_file_set_contents(path, (const gchar *)out->data, out->len, error);
+    g_byte_array_unref(out);
+    return saved;
+}
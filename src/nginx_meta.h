@@ -0,0 +1,77 @@
+#ifndef NGINX_META_H
+#define NGINX_META_H
+
+#include <glib.h>
+#include "nginx_include.h"
+#include "nginx_parser.h"
+
+// Per-file summaries of the configs, kept on disk between sessions so a
+// start does not have to read and parse every file before it can show
+// anything. A summary holds the stat key and SHA-256 of the file it was
+// made from and the directives other files care about: server_name,
+// listen, include and upstream.
+//
+// The cache file is opened with mmap and only its header is checked up
+// front; records are bounds-checked when they are read. Nothing stats the
+// files on open: whoever uses an entry decides whether its key is still
+// good, so the first frame can be drawn from the cache and stale entries
+// refreshed later.
+
+#define META_DIGEST_SIZE 32
+
+typedef enum {
+    META_SERVER_NAME,           // one name of a server_name directive
+    META_LISTEN,                // the address of a listen directive
+    META_INCLUDE,               // the pattern of an include, as written
+    META_UPSTREAM,              // the name of an upstream block
+    META_N_KINDS
+} MetaKind;
+
+// listen ... default_server
+#define META_FLAG_DEFAULT 0x1
+
+typedef struct {
+    MetaKind kind;
+    guint flags;
+    guint32 line;
+    guint32 block;              // line of the enclosing server block, 0 outside one
+    const gchar *value;         // unquoted, owned by the summary
+} MetaItem;
+
+typedef struct {
+    gchar *path;
+    IncludeFileKey key;
+    guint8 digest[META_DIGEST_SIZE];
+    GArray *items;              // MetaItem, in document order
+    GStringChunk *strings;      // their values
+} MetaSummary;
+
+// Summarizes text, the contents of path when it had key; doc is its
+// parse when the caller has one
+MetaSummary* meta_summary_new(const gchar *path, const IncludeFileKey *key,
+                              const gchar *text, gsize length, const ConfDocument *doc);
+void meta_summary_free(gpointer summary);
+
+typedef struct _MetaCache MetaCache;
+
+gchar* meta_cache_get_default_path(void);
+
+// Maps a cache file; fails when it is missing or of another version
+MetaCache* meta_cache_open(const gchar *path, GError **error);
+void meta_cache_free(MetaCache *cache);
+
+// Entries are sorted by path
+guint meta_cache_get_n_files(MetaCache *cache);
+// Path of entry i, valid while the cache is open; NULL when damaged
+const gchar* meta_cache_get_path(MetaCache *cache, guint i);
+// Index of path's entry, or -1
+gint meta_cache_find(MetaCache *cache, const gchar *path);
+// The key and digest of entry i, without reading its items
+gboolean meta_cache_get_key(MetaCache *cache, guint i, IncludeFileKey *key, guint8 digest[META_DIGEST_SIZE]);
+// A copy of entry i, or NULL when it is damaged
+MetaSummary* meta_cache_get_summary(MetaCache *cache, guint i);
+
+// Writes summaries (MetaSummary*) as a new cache, replacing path atomically
+gboolean meta_cache_save(const gchar *path, GPtrArray *summaries, GError **error);
+
+#endif // NGINX_META_H
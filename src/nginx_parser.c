@@ -0,0 +1,343 @@
+#include "nginx_parser.h"
+#include <string.h>
+
+// Directive arguments of the directive being parsed, before they are
+// copied into the arena. Most directives have only a handful.
+#define MAX_INLINE_ARGS 32
+
+static inline gboolean is_space(gchar c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline gboolean is_special(gchar c) {
+    return c == ';' || c == '{' || c == '}';
+}
+
+void conf_lexer_init(ConfLexer *lexer, const gchar *data, gsize length, gchar quote) {
+    lexer->data = data;
+    lexer->length = length;
+    lexer->pos = 0;
+    lexer->line = 1;
+    lexer->quote = quote;
+}
+
+// Scans the body of a quoted string from p, stopping after the closing
+// quote or at the end of the text with lexer->quote still set
+static const gchar* scan_quoted(ConfLexer *lexer, const gchar *p, const gchar *end) {
+    gchar quote = lexer->quote;
+    while (p < end && *p != quote) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        }
+        if (*p == '\n') {
+            lexer->line++;
+        }
+        p++;
+    }
+    if (p < end) {
+        p++;
+        lexer->quote = 0;
+    }
+    return p;
+}
+
+gboolean conf_lexer_next(ConfLexer *lexer, ConfToken *token) {
+    const gchar *data = lexer->data;
+    const gchar *end = data + lexer->length;
+    const gchar *p = data + lexer->pos;
+    
+    if (lexer->quote) {
+        // Continuing a string from an earlier chunk of text
+        if (p >= end) return FALSE;
+        token->kind = CONF_TOKEN_STRING;
+        token->offset = p - data;
+        token->line = lexer->line;
+        p = scan_quoted(lexer, p, end);
+        token->length = (p - data) - token->offset;
+        lexer->pos = p - data;
+        return TRUE;
+    }
+    
+    while (p < end && is_space(*p)) {
+        if (*p == '\n') {
+            lexer->line++;
+        }
+        p++;
+    }
+    if (p >= end) {
+        lexer->pos = lexer->length;
+        return FALSE;
+    }
+    
+    token->offset = p - data;
+    token->line = lexer->line;
+    
+    switch (*p) {
+        case ';':
+            token->kind = CONF_TOKEN_SEMICOLON;
+            p++;
+            break;
+        case '{':
+            token->kind = CONF_TOKEN_BLOCK_START;
+            p++;
+            break;
+        case '}':
+            token->kind = CONF_TOKEN_BLOCK_END;
+            p++;
+            break;
+        case '#': {
+            token->kind = CONF_TOKEN_COMMENT;
+            const gchar *newline = memchr(p, '\n', end - p);
+            p = newline ? newline : end;
+            break;
+        }
+        case '"':
+        case '\'':
+            token->kind = CONF_TOKEN_STRING;
+            lexer->quote = *p;
+            p = scan_quoted(lexer, p + 1, end);
+            break;
+        default:
+            token->kind = CONF_TOKEN_WORD;
+            while (p < end && !is_space(*p) && !is_special(*p)) {
+                if (*p == '\\' && p + 1 < end) {
+                    p += 2;
+                } else if (*p == '$' && p + 1 < end && p[1] == '{') {
+                    // ${name} keeps its braces inside the word
+                    const gchar *close = memchr(p, '}', end - p);
+                    p = close ? close + 1 : end;
+                } else {
+                    p++;
+                }
+            }
+            break;
+    }
+    
+    token->length = (p - data) - token->offset;
+    lexer->pos = p - data;
+    return TRUE;
+}
+
+typedef struct {
+    ConfDocument *doc;
+    GArray *errors;
+    ConfNode *block;            // block receiving new directives
+    gboolean in_directive;
+    ConfSpan name;
+    guint32 line;
+    ConfSpan inline_args[MAX_INLINE_ARGS];
+    GArray *extra_args;         // only for directives with many arguments
+    guint32 n_args;
+} Parser;
+
+static void parser_error(Parser *parser, guint32 offset, guint32 line, const gchar *message) {
+    if (!parser->errors) {
+        parser->errors = g_array_new(FALSE, FALSE, sizeof(ConfError));
+    }
+    ConfError error = { offset, line, message };
+    g_array_append_val(parser->errors, error);
+}
+
+static void parser_add_arg(Parser *parser, ConfSpan span) {
+    if (parser->n_args < MAX_INLINE_ARGS) {
+        parser->inline_args[parser->n_args] = span;
+    } else {
+        if (!parser->extra_args) {
+            parser->extra_args = g_array_new(FALSE, FALSE, sizeof(ConfSpan));
+        }
+        g_array_append_val(parser->extra_args, span);
+    }
+    parser->n_args++;
+}
+
+// Turns the collected name and arguments into a node of the current block
+static ConfNode* parser_finish_directive(Parser *parser, gboolean is_block) {
+    ConfArena *arena = parser->doc->arena;
+    ConfNode *node = conf_arena_new0(arena, ConfNode, 1);
+    node->name = parser->name;
+    node->line = parser->line;
+    node->offset = parser->name.offset;
+    node->is_block = is_block;
+    node->parent = parser->block;
+    
+    if (parser->n_args > 0) {
+        node->n_args = parser->n_args;
+        node->args = conf_arena_new0(arena, ConfSpan, parser->n_args);
+        guint32 n_inline = MIN(parser->n_args, MAX_INLINE_ARGS);
+        memcpy(node->args, parser->inline_args, n_inline * sizeof(ConfSpan));
+        if (parser->n_args > MAX_INLINE_ARGS) {
+            memcpy(node->args + n_inline, parser->extra_args->data,
+                   (parser->n_args - n_inline) * sizeof(ConfSpan));
+            g_array_set_size(parser->extra_args, 0);
+        }
+    }
+    
+    ConfNode *block = parser->block;
+    if (block->last_child) {
+        block->last_child->next = node;
+    } else {
+        block->children = node;
+    }
+    block->last_child = node;
+    
+    parser->in_directive = FALSE;
+    parser->n_args = 0;
+    return node;
+}
+
+ConfDocument* conf_document_parse(const gchar *data, gsize length) {
+    ConfDocument *doc = g_new0(ConfDocument, 1);
+    doc->data = data;
+    doc->length = length;
+    // Nodes take roughly as much memory as the text they describe, so one
+    // or two blocks are enough for most documents
+    doc->arena = conf_arena_new(length + 1024);
+    doc->root = conf_arena_new0(doc->arena, ConfNode, 1);
+    doc->root->is_block = TRUE;
+    
+    Parser parser = { 0 };
+    parser.doc = doc;
+    parser.block = doc->root;
+    
+    ConfLexer lexer;
+    conf_lexer_init(&lexer, data, length, 0);
+    ConfToken token;
+    
+    while (conf_lexer_next(&lexer, &token)) {
+        ConfSpan span = { token.offset, token.length };
+        
+        switch (token.kind) {
+            case CONF_TOKEN_COMMENT:
+                break;
+            case CONF_TOKEN_WORD:
+            case CONF_TOKEN_STRING:
+                if (parser.in_directive) {
+                    parser_add_arg(&parser, span);
+                } else {
+                    parser.in_directive = TRUE;
+                    parser.name = span;
+                    parser.line = token.line;
+                }
+                break;
+            case CONF_TOKEN_SEMICOLON:
+                if (parser.in_directive) {
+                    parser_finish_directive(&parser, FALSE);
+                } else {
+                    parser_error(&parser, token.offset, token.line, "unexpected \";\"");
+                }
+                break;
+            case CONF_TOKEN_BLOCK_START:
+                if (!parser.in_directive) {
+                    // Keep the block's contents under a nameless node
+                    parser_error(&parser, token.offset, token.line, "unexpected \"{\"");
+                    parser.name = (ConfSpan){ token.offset, 0 };
+                    parser.line = token.line;
+                }
+                parser.block = parser_finish_directive(&parser, TRUE);
+                break;
+            case CONF_TOKEN_BLOCK_END:
+                if (parser.in_directive) {
+                    parser_error(&parser, token.offset, token.line, "unexpected \"}\", expecting \";\"");
+                    parser_finish_directive(&parser, FALSE);
+                }
+                if (parser.block == doc->root) {
+                    parser_error(&parser, token.offset, token.line, "unexpected \"}\"");
+                } else {
+                    parser.block = parser.block->parent;
+                }
+                break;
+        }
+    }
+    
+    if (lexer.quote) {
+        parser_error(&parser, length, lexer.line, "unexpected end of file, unterminated string");
+    }
+    if (parser.in_directive) {
+        parser_error(&parser, length, lexer.line, "unexpected end of file, expecting \";\" or \"}\"");
+        parser_finish_directive(&parser, FALSE);
+    }
+    if (parser.block != doc->root) {
+        parser_error(&parser, length, lexer.line, "unexpected end of file, expecting \"}\"");
+    }
+    
+    if (parser.errors) {
+        doc->n_errors = parser.errors->len;
+        doc->errors = conf_arena_new0(doc->arena, ConfError, doc->n_errors);
+        memcpy(doc->errors, parser.errors->data, doc->n_errors * sizeof(ConfError));
+        g_array_free(parser.errors, TRUE);
+    }
+    if (parser.extra_args) {
+        g_array_free(parser.extra_args, TRUE);
+    }
+    return doc;
+}
+
+void conf_document_free(ConfDocument *doc) {
+    if (!doc) return;
+    conf_arena_free(doc->arena);
+    g_free(doc);
+}
+
+void conf_document_foreach(const ConfDocument *doc, ConfNodeFunc func, gpointer user_data) {
+    // Depth-first without recursion, following parent links back up
+    const ConfNode *node = doc->root->children;
+    while (node) {
+        func(doc, node, user_data);
+        if (node->children) {
+            node = node->children;
+            continue;
+        }
+        while (node && !node->next) {
+            node = node->parent;
+            if (node == doc->root) node = NULL;
+        }
+        if (node) node = node->next;
+    }
+}
+
+gboolean conf_span_equal(const ConfDocument *doc, ConfSpan span, const gchar *str) {
+    gsize len = strlen(str);
+    return span.length == len && memcmp(doc->data + span.offset, str, len) == 0;
+}
+
+gchar* conf_span_dup_value(const ConfDocument *doc, ConfSpan span) {
+    const gchar *p = doc->data + span.offset;
+    const gchar *end = p + span.length;
+    
+    if (p < end && (*p == '"' || *p == '\'')) {
+        gchar quote = *p++;
+        if (end > p && end[-1] == quote) {
+            end--;
+        }
+    }
+    
+    // The same escapes nginx resolves when it reads a token
+    gchar *value = g_malloc(end - p + 1);
+    gchar *out = value;
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end) {
+            switch (p[1]) {
+                case '"': case '\'': case '\\':
+                    p++;
+                    break;
+                case 't':
+                    *out++ = '\t';
+                    p += 2;
+                    continue;
+                case 'r':
+                    *out++ = '\r';
+                    p += 2;
+                    continue;
+                case 'n':
+                    *out++ = '\n';
+                    p += 2;
+                    continue;
+                default:
+                    break;
+            }
+        }
+        *out++ = *p++;
+    }
+    *out = '\0';
+    return value;
+}
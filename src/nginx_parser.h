@@ -0,0 +1,96 @@
+#ifndef NGINX_PARSER_H
+#define NGINX_PARSER_H
+
+#include <glib.h>
+#include "nginx_arena.h"
+
+// Tokenizer and parser for nginx configuration files.
+//
+// Nothing is copied out of the source text: tokens and AST nodes refer to
+// it by byte offset and length, so the text must outlive the document.
+// All nodes of a document live in one arena and are freed together.
+
+typedef enum {
+    CONF_TOKEN_WORD,            // bare word, may contain escapes and ${var}
+    CONF_TOKEN_STRING,          // quoted string, quotes included
+    CONF_TOKEN_SEMICOLON,
+    CONF_TOKEN_BLOCK_START,
+    CONF_TOKEN_BLOCK_END,
+    CONF_TOKEN_COMMENT          // from '#' to the end of the line
+} ConfTokenKind;
+
+typedef struct {
+    ConfTokenKind kind;
+    guint32 offset;
+    guint32 length;
+    guint32 line;               // 1-based line the token starts on
+} ConfToken;
+
+typedef struct {
+    const gchar *data;
+    gsize length;
+    gsize pos;
+    guint32 line;
+    gchar quote;                // open quote while inside a string, else 0
+} ConfLexer;
+
+// A lexer can be started inside a string (quote != 0), which lets text be
+// tokenized one line at a time; after the last token, lexer->quote tells
+// whether the text ended inside a string.
+void conf_lexer_init(ConfLexer *lexer, const gchar *data, gsize length, gchar quote);
+gboolean conf_lexer_next(ConfLexer *lexer, ConfToken *token);
+
+typedef struct {
+    guint32 offset;
+    guint32 length;
+} ConfSpan;
+
+typedef struct _ConfNode ConfNode;
+struct _ConfNode {
+    ConfSpan name;
+    ConfSpan *args;
+    guint32 n_args;
+    guint32 line;
+    guint32 offset;             // start of the directive name
+    gboolean is_block;
+    ConfNode *parent;
+    ConfNode *children;         // first child of a block
+    ConfNode *last_child;
+    ConfNode *next;             // next sibling
+};
+
+typedef struct {
+    guint32 offset;
+    guint32 line;
+    const gchar *message;       // static string
+} ConfError;
+
+typedef struct {
+    const gchar *data;
+    gsize length;
+    ConfArena *arena;
+    ConfNode *root;             // block holding the top-level directives
+    ConfError *errors;
+    guint n_errors;
+} ConfDocument;
+
+// Parsing never fails: problems are recorded in doc->errors and the
+// parser recovers the way an editor needs, keeping everything it can
+ConfDocument* conf_document_parse(const gchar *data, gsize length);
+void conf_document_free(ConfDocument *doc);
+
+typedef void (*ConfNodeFunc)(const ConfDocument *doc, const ConfNode *node, gpointer user_data);
+
+// Calls func for every directive in document order
+void conf_document_foreach(const ConfDocument *doc, ConfNodeFunc func, gpointer user_data);
+
+static inline const gchar* conf_span_data(const ConfDocument *doc, ConfSpan span) {
+    return doc->data + span.offset;
+}
+
+gboolean conf_span_equal(const ConfDocument *doc, ConfSpan span, const gchar *str);
+
+// The value a span stands for, with quotes removed and escapes resolved
+gchar* conf_span_dup_value(const ConfDocument *doc, ConfSpan span);
+
+#endif // NGINX_PARSER_H
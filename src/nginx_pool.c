@@ -0,0 +1,254 @@
+#include "nginx_pool.h"
+#include "nginx_trace.h"
+
+typedef struct {
+    WorkFunc func;
+    WorkDoneFunc done;
+    gpointer data;
+    GDestroyNotify destroy;
+    GCancellable *cancellable;
+    gboolean skipped;
+    gboolean stolen;
+    TraceSpan wait;             // from the push until a worker takes it
+} WorkItem;
+
+typedef struct {
+    WorkPool *pool;
+    GMutex lock;
+    GQueue queues[WORK_N_PRIORITIES];   // WorkItem*, oldest first
+    GThread *thread;
+} WorkWorker;
+
+struct _WorkPool {
+    WorkWorker *workers;
+    guint n_threads;
+    gint next_worker;           // where the next push from outside goes
+    gint queued[WORK_N_PRIORITIES];
+    gint n_queued;
+    gint running;
+
+    GMutex lock;                // idle workers sleep on cond
+    GCond cond;
+    gboolean stopping;
+
+    GMainContext *context;
+    GMutex done_lock;
+    GPtrArray *done;            // WorkItem*, finished and not delivered
+    GSource *done_source;       // delivers done, set while it is pending
+    guint64 n_finished;
+    guint64 n_skipped;
+    guint64 n_stolen;
+    guint64 n_batches;
+};
+
+static _Thread_local WorkWorker *current_worker;
+
+static const TraceOp wait_ops[WORK_N_PRIORITIES] = {
+    TRACE_OP_WAIT_INTERACTIVE, TRACE_OP_WAIT_BULK
+};
+
+static void work_item_free(gpointer data) {
+    WorkItem *item = data;
+    if (item->destroy) item->destroy(item->data);
+    if (item->cancellable) g_object_unref(item->cancellable);
+    g_free(item);
+}
+
+static gboolean deliver_done(gpointer user_data) {
+    WorkPool *pool = user_data;
+    g_mutex_lock(&pool->done_lock);
+    GPtrArray *batch = pool->done;
+    pool->done = g_ptr_array_new();
+    g_clear_pointer(&pool->done_source, g_source_unref);
+    pool->n_batches++;
+    g_mutex_unlock(&pool->done_lock);
+
+    for (guint i = 0; i < batch->len; i++) {
+        WorkItem *item = g_ptr_array_index(batch, i);
+        if (item->done) item->done(item->data, item->skipped || g_cancellable_is_cancelled(item->cancellable));
+        work_item_free(item);
+    }
+    g_ptr_array_unref(batch);
+    return G_SOURCE_REMOVE;
+}
+
+static void finish_item(WorkPool *pool, WorkItem *item) {
+    g_mutex_lock(&pool->done_lock);
+    g_ptr_array_add(pool->done, item);
+    pool->n_finished++;
+    if (item->skipped) pool->n_skipped++;
+    if (item->stolen) pool->n_stolen++;
+    if (!pool->done_source) {
+        pool->done_source = g_idle_source_new();
+        g_source_set_priority(pool->done_source, G_PRIORITY_DEFAULT);
+        g_source_set_callback(pool->done_source, deliver_done, pool, NULL);
+        g_source_attach(pool->done_source, pool->context);
+    }
+    g_mutex_unlock(&pool->done_lock);
+}
+
+// Highest priority first; within one, the own deque from the front, then
+// the others from the back
+static WorkItem* take_item(WorkPool *pool, WorkWorker *self) {
+    guint own = self - pool->workers;
+    for (guint priority = 0; priority < WORK_N_PRIORITIES; priority++) {
+        if (g_atomic_int_get(&pool->queued[priority]) == 0) continue;
+        for (guint i = 0; i < pool->n_threads; i++) {
+            WorkWorker *worker = &pool->workers[(own + i) % pool->n_threads];
+            g_mutex_lock(&worker->lock);
+            WorkItem *item = i == 0 ? g_queue_pop_head(&worker->queues[priority])
+                                    : g_queue_pop_tail(&worker->queues[priority]);
+            g_mutex_unlock(&worker->lock);
+            if (!item) continue;
+
+            g_atomic_int_add(&pool->queued[priority], -1);
+            g_atomic_int_add(&pool->n_queued, -1);
+            item->stolen = i != 0;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static gpointer worker_thread(gpointer data) {
+    WorkWorker *self = data;
+    WorkPool *pool = self->pool;
+    current_worker = self;
+
+    for (;;) {
+        WorkItem *item = take_item(pool, self);
+        if (!item) {
+            // Pushes count the item after queueing it, then signal under
+            // the lock, so none is missed between the check and the wait
+            g_mutex_lock(&pool->lock);
+            while (g_atomic_int_get(&pool->n_queued) == 0 && !pool->stopping) {
+                g_cond_wait(&pool->cond, &pool->lock);
+            }
+            gboolean stopping = pool->stopping;
+            g_mutex_unlock(&pool->lock);
+            if (stopping) break;
+            continue;
+        }
+
+        trace_end_handed_over(&item->wait);
+        if (g_cancellable_is_cancelled(item->cancellable)) {
+            item->skipped = TRUE;
+        } else {
+            g_atomic_int_inc(&pool->running);
+            item->func(item->data, item->cancellable);
+            g_atomic_int_add(&pool->running, -1);
+        }
+        finish_item(pool, item);
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+WorkPool* work_pool_new(guint n_threads, GMainContext *context) {
+    WorkPool *pool = g_new0(WorkPool, 1);
+    pool->n_threads = MAX(n_threads, 1);
+    pool->context = context ? g_main_context_ref(context) : g_main_context_ref_thread_default();
+    pool->done = g_ptr_array_new();
+    g_mutex_init(&pool->lock);
+    g_cond_init(&pool->cond);
+    g_mutex_init(&pool->done_lock);
+
+    pool->workers = g_new0(WorkWorker, pool->n_threads);
+    for (guint i = 0; i < pool->n_threads; i++) {
+        WorkWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        g_mutex_init(&worker->lock);
+        for (guint priority = 0; priority < WORK_N_PRIORITIES; priority++) {
+            g_queue_init(&worker->queues[priority]);
+        }
+    }
+    // Only once every deque exists, as workers steal from all of them
+    for (guint i = 0; i < pool->n_threads; i++) {
+        pool->workers[i].thread = g_thread_new("nginxui-worker", worker_thread, &pool->workers[i]);
+    }
+    return pool;
+}
+
+void work_pool_free(WorkPool *pool) {
+    if (!pool) return;
+    g_mutex_lock(&pool->lock);
+    pool->stopping = TRUE;
+    g_cond_broadcast(&pool->cond);
+    g_mutex_unlock(&pool->lock);
+    for (guint i = 0; i < pool->n_threads; i++) {
+        g_thread_join(pool->workers[i].thread);
+    }
+
+    for (guint i = 0; i < pool->n_threads; i++) {
+        WorkWorker *worker = &pool->workers[i];
+        for (guint priority = 0; priority < WORK_N_PRIORITIES; priority++) {
+            g_queue_clear_full(&worker->queues[priority], work_item_free);
+        }
+        g_mutex_clear(&worker->lock);
+    }
+    if (pool->done_source) {
+        g_source_destroy(pool->done_source);
+        g_source_unref(pool->done_source);
+    }
+    g_ptr_array_set_free_func(pool->done, work_item_free);
+    g_ptr_array_unref(pool->done);
+    g_main_context_unref(pool->context);
+    g_mutex_clear(&pool->done_lock);
+    g_cond_clear(&pool->cond);
+    g_mutex_clear(&pool->lock);
+    g_free(pool->workers);
+    g_free(pool);
+}
+
+WorkPool* work_pool_get_default(void) {
+    static gsize initialized = 0;
+    static WorkPool *pool;
+    if (g_once_init_enter(&initialized)) {
+        guint64 n_threads = CLAMP(g_get_num_processors(), 2, WORK_POOL_MAX_THREADS);
+        const gchar *value = g_getenv("NGINXUI_WORKERS");
+        // Anything but 1 to 64 keeps the default
+        if (value) g_ascii_string_to_unsigned(value, 10, 1, 64, &n_threads, NULL);
+        pool = work_pool_new((guint)n_threads, g_main_context_default());
+        g_once_init_leave(&initialized, 1);
+    }
+    return pool;
+}
+
+void work_pool_push(WorkPool *pool, WorkPriority priority, WorkFunc func, WorkDoneFunc done,
+                    gpointer data, GDestroyNotify destroy, GCancellable *cancellable) {
+    WorkItem *item = g_new0(WorkItem, 1);
+    item->func = func;
+    item->done = done;
+    item->data = data;
+    item->destroy = destroy;
+    item->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+    trace_begin(&item->wait, wait_ops[priority]);
+
+    WorkWorker *worker = current_worker && current_worker->pool == pool
+                             ? current_worker
+                             : &pool->workers[(guint)g_atomic_int_add(&pool->next_worker, 1) % pool->n_threads];
+    g_mutex_lock(&worker->lock);
+    g_queue_push_tail(&worker->queues[priority], item);
+    g_mutex_unlock(&worker->lock);
+    g_atomic_int_inc(&pool->queued[priority]);
+    g_atomic_int_inc(&pool->n_queued);
+
+    g_mutex_lock(&pool->lock);
+    g_cond_signal(&pool->cond);
+    g_mutex_unlock(&pool->lock);
+}
+
+void work_pool_get_stats(WorkPool *pool, WorkPoolStats *stats) {
+    stats->n_threads = pool->n_threads;
+    for (guint priority = 0; priority < WORK_N_PRIORITIES; priority++) {
+        stats->queued[priority] = MAX(g_atomic_int_get(&pool->queued[priority]), 0);
+    }
+    stats->running = MAX(g_atomic_int_get(&pool->running), 0);
+    g_mutex_lock(&pool->done_lock);
+    stats->undelivered = pool->done->len;
+    stats->finished = pool->n_finished;
+    stats->skipped = pool->n_skipped;
+    stats->stolen = pool->n_stolen;
+    stats->batches = pool->n_batches;
+    g_mutex_unlock(&pool->done_lock);
+}
@@ -0,0 +1,65 @@
+#ifndef NGINX_POOL_H
+#define NGINX_POOL_H
+
+#include <gio/gio.h>
+
+// One small pool of worker threads for the background work of the whole
+// app, so features do not each start threads of their own.
+//
+// Every worker has a deque per priority class. Work pushed from the main
+// thread goes to the workers in turn, work pushed from a worker to its
+// own deque. A worker takes the oldest item of its own deque and, when
+// that is empty, the newest of another worker's (stealing). Interactive
+// work that is queued anywhere goes before any bulk work.
+//
+// Finished work comes back to the pool's main context in batches: the
+// first item to finish schedules one idle callback, which runs the done
+// callbacks of everything that finished until it ran.
+
+// Workers of the default pool unless NGINXUI_WORKERS says otherwise
+#define WORK_POOL_MAX_THREADS 4
+
+typedef enum {
+    WORK_PRIORITY_INTERACTIVE,  // someone waits for it: loading, linting, filtering
+    WORK_PRIORITY_BULK,         // indexing, replays
+    WORK_N_PRIORITIES
+} WorkPriority;
+
+typedef struct _WorkPool WorkPool;
+
+// Runs on a worker; long work checks cancellable between steps
+typedef void (*WorkFunc)(gpointer data, GCancellable *cancellable);
+// Runs on the main context after func, or instead of it when the work was
+// cancelled before it started. cancelled is set when cancellable was
+// cancelled by then, whether or not func ran.
+typedef void (*WorkDoneFunc)(gpointer data, gboolean cancelled);
+
+typedef struct {
+    guint n_threads;
+    guint queued[WORK_N_PRIORITIES];
+    guint running;
+    guint undelivered;          // finished, done callback not run yet
+    guint64 finished;
+    guint64 skipped;            // cancelled before they started
+    guint64 stolen;             // taken from another worker's deque
+    guint64 batches;            // idle callbacks that delivered them
+} WorkPoolStats;
+
+// Done callbacks run on context, the thread-default one for NULL
+WorkPool* work_pool_new(guint n_threads, GMainContext *context);
+// Waits for running work; queued and undelivered work is dropped, only
+// its destroy notify is called
+void work_pool_free(WorkPool *pool);
+
+// The app's pool, delivering to the global default main context
+WorkPool* work_pool_get_default(void);
+
+// Queues func. cancellable, when set, is the work's cancellation token.
+// destroy frees data after done ran.
+void work_pool_push(WorkPool *pool, WorkPriority priority, WorkFunc func, WorkDoneFunc done,
+                    gpointer data, GDestroyNotify destroy, GCancellable *cancellable);
+
+// Queue depths and counters; how long work waited is in the trace stats
+void work_pool_get_stats(WorkPool *pool, WorkPoolStats *stats);
+
+#endif // NGINX_POOL_H
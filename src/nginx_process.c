@@ -0,0 +1,165 @@
+#include "nginx_process.h"
+#include <signal.h>
+
+// Time between SIGTERM and SIGKILL when stopping a process
+#define PROCESS_KILL_GRACE_MS 2000
+
+struct _ProcessRunner {
+    GSubprocess *process;
+    GDataInputStream *stdout_stream;
+    GDataInputStream *stderr_stream;
+    ProcessLineFunc on_line;
+    ProcessDoneFunc on_done;
+    gpointer user_data;
+    guint pending;          // outstanding reads and the wait
+    guint timeout_id;
+    guint kill_id;
+    gboolean terminating;
+    ProcessResult result;
+};
+
+static void read_next_line(ProcessRunner *runner, GDataInputStream *stream);
+
+static void process_runner_free(ProcessRunner *runner) {
+    g_clear_handle_id(&runner->timeout_id, g_source_remove);
+    g_clear_handle_id(&runner->kill_id, g_source_remove);
+    g_clear_object(&runner->stdout_stream);
+    g_clear_object(&runner->stderr_stream);
+    g_clear_object(&runner->process);
+    g_clear_error(&runner->result.error);
+    g_free(runner);
+}
+
+static void finish_if_done(ProcessRunner *runner) {
+    if (--runner->pending > 0) {
+        return;
+    }
+    runner->on_done(&runner->result, runner->user_data);
+    process_runner_free(runner);
+}
+
+static void on_line_read(GObject *source, GAsyncResult *res, gpointer user_data) {
+    ProcessRunner *runner = user_data;
+    GDataInputStream *stream = G_DATA_INPUT_STREAM(source);
+    gsize length = 0;
+    gchar *line = g_data_input_stream_read_line_finish(stream, res, &length, NULL);
+
+    if (!line) {
+        // EOF (or a read error, which ends the stream the same way)
+        finish_if_done(runner);
+        return;
+    }
+
+    if (length > 0 && line[length - 1] == '\r') {
+        line[length - 1] = '\0';
+    }
+    gchar *valid = g_utf8_make_valid(line, -1);
+    runner->on_line(stream == runner->stdout_stream ? PROCESS_STREAM_STDOUT : PROCESS_STREAM_STDERR,
+                    valid, runner->user_data);
+    g_free(valid);
+    g_free(line);
+
+    read_next_line(runner, stream);
+}
+
+static void read_next_line(ProcessRunner *runner, GDataInputStream *stream) {
+    g_data_input_stream_read_line_async(stream, G_PRIORITY_DEFAULT, NULL, on_line_read, runner);
+}
+
+static void on_process_exited(GObject *source, GAsyncResult *res, gpointer user_data) {
+    ProcessRunner *runner = user_data;
+    GSubprocess *process = G_SUBPROCESS(source);
+
+    if (g_subprocess_wait_finish(process, res, &runner->result.error)) {
+        if (g_subprocess_get_if_exited(process)) {
+            runner->result.exited = TRUE;
+            runner->result.exit_status = g_subprocess_get_exit_status(process);
+        } else if (g_subprocess_get_if_signaled(process)) {
+            runner->result.term_signal = g_subprocess_get_term_sig(process);
+        }
+    }
+
+    g_clear_handle_id(&runner->timeout_id, g_source_remove);
+    g_clear_handle_id(&runner->kill_id, g_source_remove);
+    finish_if_done(runner);
+}
+
+static gboolean on_kill_grace_expired(gpointer user_data) {
+    ProcessRunner *runner = user_data;
+    runner->kill_id = 0;
+    g_subprocess_force_exit(runner->process);
+    return G_SOURCE_REMOVE;
+}
+
+// SIGTERM first so that sudo can forward it to the command it runs
+static void terminate(ProcessRunner *runner) {
+    if (runner->terminating) {
+        return;
+    }
+    runner->terminating = TRUE;
+    g_subprocess_send_signal(runner->process, SIGTERM);
+    runner->kill_id = g_timeout_add(PROCESS_KILL_GRACE_MS, on_kill_grace_expired, runner);
+}
+
+static gboolean on_timeout(gpointer user_data) {
+    ProcessRunner *runner = user_data;
+    runner->timeout_id = 0;
+    runner->result.timed_out = TRUE;
+    terminate(runner);
+    return G_SOURCE_REMOVE;
+}
+
+ProcessRunner* process_runner_start(const gchar * const *argv, guint timeout_ms,
+                                    ProcessLineFunc on_line, ProcessDoneFunc on_done,
+                                    gpointer user_data, GError **error) {
+    GSubprocess *process = g_subprocess_newv(argv,
+                                             G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_PIPE,
+                                             error);
+    if (!process) {
+        return NULL;
+    }
+
+    ProcessRunner *runner = g_new0(ProcessRunner, 1);
+    runner->process = process;
+    runner->on_line = on_line;
+    runner->on_done = on_done;
+    runner->user_data = user_data;
+    runner->stdout_stream = g_data_input_stream_new(g_subprocess_get_stdout_pipe(process));
+    runner->stderr_stream = g_data_input_stream_new(g_subprocess_get_stderr_pipe(process));
+    runner->pending = 3;
+
+    read_next_line(runner, runner->stdout_stream);
+    read_next_line(runner, runner->stderr_stream);
+    g_subprocess_wait_async(process, NULL, on_process_exited, runner);
+
+    if (timeout_ms > 0) {
+        runner->timeout_id = g_timeout_add(timeout_ms, on_timeout, runner);
+    }
+    return runner;
+}
+
+void process_runner_cancel(ProcessRunner *runner) {
+    g_return_if_fail(runner != NULL);
+    runner->result.cancelled = TRUE;
+    terminate(runner);
+}
+
+gboolean process_result_succeeded(const ProcessResult *result) {
+    return result->exited && result->exit_status == 0 && !result->timed_out && !result->cancelled;
+}
+
+gchar* process_result_describe(const ProcessResult *result) {
+    if (result->error) {
+        return g_strdup(result->error->message);
+    }
+    if (result->cancelled) {
+        return g_strdup("cancelled");
+    }
+    if (result->timed_out) {
+        return g_strdup("timed out");
+    }
+    if (result->exited) {
+        return g_strdup_printf("exit status %d", result->exit_status);
+    }
+    return g_strdup_printf("killed by signal %d", result->term_signal);
+}
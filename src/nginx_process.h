@@ -0,0 +1,40 @@
+#ifndef NGINX_PROCESS_H
+#define NGINX_PROCESS_H
+
+#include <gio/gio.h>
+
+typedef enum {
+    PROCESS_STREAM_STDOUT,
+    PROCESS_STREAM_STDERR
+} ProcessStream;
+
+// How a process ended. Output is delivered separately, line by line.
+typedef struct {
+    gboolean exited;        // exited normally, exit_status is valid
+    gint exit_status;
+    gint term_signal;       // set when killed by a signal
+    gboolean timed_out;
+    gboolean cancelled;
+    GError *error;          // set when waiting for the process failed
+} ProcessResult;
+
+typedef struct _ProcessRunner ProcessRunner;
+
+typedef void (*ProcessLineFunc)(ProcessStream stream, const gchar *line, gpointer user_data);
+typedef void (*ProcessDoneFunc)(const ProcessResult *result, gpointer user_data);
+
+// Spawns argv without blocking. on_line is called from the main loop for
+// every line of stdout/stderr as it arrives; on_done is called once after
+// the process has exited and all output has been delivered, after which
+// the runner is freed. A timeout_ms of 0 disables the timeout.
+ProcessRunner* process_runner_start(const gchar * const *argv, guint timeout_ms,
+                                    ProcessLineFunc on_line, ProcessDoneFunc on_done,
+                                    gpointer user_data, GError **error);
+
+// Terminates the process; on_done still runs with result->cancelled set
+void process_runner_cancel(ProcessRunner *runner);
+
+gboolean process_result_succeeded(const ProcessResult *result);
+gchar* process_result_describe(const ProcessResult *result);
+
+#endif // NGINX_PROCESS_H
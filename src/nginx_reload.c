@@ -0,0 +1,276 @@
+#include "nginx_reload.h"
+#include <gio/gio.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+gchar* nginx_reload_find_pid_file(const gchar *main_conf) {
+    gchar *content = NULL;
+    gsize length = 0;
+    gchar *pid_file = NULL;
+    if (g_file_get_contents(main_conf, &content, &length, NULL)) {
+        ConfDocument *doc = conf_document_parse(content, length);
+        for (const ConfNode *node = doc->root->children; node && !pid_file; node = node->next) {
+            if (!node->is_block && node->n_args == 1 && conf_span_equal(doc, node->name, "pid")) {
+                pid_file = conf_span_dup_value(doc, node->args[0]);
+            }
+        }
+        conf_document_free(doc);
+        g_free(content);
+    }
+    if (!pid_file) return g_strdup(NGINX_PID_FILE);
+    if (g_path_is_absolute(pid_file)) return pid_file;
+
+    gchar *prefix = g_path_get_dirname(main_conf);
+    gchar *path = g_build_filename(prefix, pid_file, NULL);
+    g_free(prefix);
+    g_free(pid_file);
+    return path;
+}
+
+static gint read_master(const gchar *pid_file) {
+    gchar *content = NULL;
+    if (!g_file_get_contents(pid_file, &content, NULL, NULL)) return 0;
+    gint pid = atoi(content);
+    g_free(content);
+    // The pid file outlives a master that crashed
+    if (pid <= 0 || (kill(pid, 0) != 0 && errno != EPERM)) return 0;
+    return pid;
+}
+
+// The parent pid in /proc/PID/stat follows the state after the command
+// name, which may itself contain spaces and parentheses
+static gint read_parent(const gchar *pid) {
+    gchar *path = g_build_filename("/proc", pid, "stat", NULL);
+    gchar *stat = NULL;
+    gint parent = 0;
+    if (g_file_get_contents(path, &stat, NULL, NULL)) {
+        const gchar *end = strrchr(stat, ')');
+        if (end) sscanf(end + 1, " %*c %d", &parent);
+        g_free(stat);
+    }
+    g_free(path);
+    return parent;
+}
+
+static void collect_children(gint master, GArray *workers) {
+    // One read when the kernel lists children, a scan of /proc otherwise
+    gchar *path = g_strdup_printf("/proc/%d/task/%d/children", master, master);
+    gchar *children = NULL;
+    if (g_file_get_contents(path, &children, NULL, NULL)) {
+        gchar **pids = g_strsplit(g_strstrip(children), " ", -1);
+        for (guint i = 0; pids[i]; i++) {
+            gint pid = atoi(pids[i]);
+            if (pid > 0) g_array_append_val(workers, pid);
+        }
+        g_strfreev(pids);
+        g_free(children);
+    } else {
+        GDir *dir = g_dir_open("/proc", 0, NULL);
+        const gchar *name;
+        while (dir && (name = g_dir_read_name(dir)) != NULL) {
+            if (!g_ascii_isdigit(name[0]) || read_parent(name) != master) continue;
+            gint pid = atoi(name);
+            g_array_append_val(workers, pid);
+        }
+        if (dir) g_dir_close(dir);
+    }
+    g_free(path);
+}
+
+static gint compare_pids(gconstpointer a, gconstpointer b) {
+    gint pid_a = *(const gint *)a;
+    gint pid_b = *(const gint *)b;
+    return pid_a < pid_b ? -1 : pid_a > pid_b;
+}
+
+void nginx_processes_read(const gchar *pid_file, NginxProcesses *processes) {
+    processes->master = read_master(pid_file);
+    processes->workers = g_array_new(FALSE, FALSE, sizeof(gint));
+    if (processes->master) {
+        collect_children(processes->master, processes->workers);
+        g_array_sort(processes->workers, compare_pids);
+    }
+}
+
+void nginx_processes_clear(NginxProcesses *processes) {
+    g_clear_pointer(&processes->workers, g_array_unref);
+    processes->master = 0;
+}
+
+// Workers of after that were not there before
+static guint count_new_workers(const NginxProcesses *before, const NginxProcesses *after) {
+    guint n_new = 0;
+    for (guint i = 0; i < after->workers->len; i++) {
+        gint pid = g_array_index(after->workers, gint, i);
+        if (!bsearch(&pid, before->workers->data, before->workers->len, sizeof(gint), compare_pids)) n_new++;
+    }
+    return n_new;
+}
+
+// Polls the master until it shows a new generation of workers
+static gboolean confirm_reload(NginxCore *core, const gchar *pid_file, const NginxProcesses *before,
+                               gint64 started, GError **error) {
+    gint64 deadline = started + RELOAD_CONFIRM_TIMEOUT_MS * (gint64)1000;
+    while (TRUE) {
+        NginxProcesses after;
+        nginx_processes_read(pid_file, &after);
+        gint master = after.master;
+        guint n_new = master == before->master ? count_new_workers(before, &after) : 0;
+        guint n_workers = after.workers->len;
+        nginx_processes_clear(&after);
+
+        if (master != before->master) {
+            if (master) {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "The nginx master %d was replaced by %d during the reload", before->master, master);
+            } else {
+                g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                            "The nginx master %d exited during the reload", before->master);
+            }
+            return FALSE;
+        }
+        if (n_new > 0) {
+            nginx_core_log(core, LOG_SEVERITY_INFO, "Master %d started %u new of %u worker(s) (%.0f ms)",
+                           master, n_new, n_workers, (g_get_monotonic_time() - started) / 1000.0);
+            return TRUE;
+        }
+        if (g_get_monotonic_time() >= deadline) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                        "The nginx master %d started no new workers within %u s, "
+                        "it probably rejected the configuration (see its error log)",
+                        master, RELOAD_CONFIRM_TIMEOUT_MS / 1000);
+            return FALSE;
+        }
+        g_usleep(RELOAD_POLL_MS * 1000);
+    }
+}
+
+gboolean nginx_reload_run(NginxCore *core, GError **error) {
+    gchar *pid_file = core->pid_file ? g_strdup(core->pid_file) : nginx_reload_find_pid_file(core->main_conf);
+    NginxProcesses before;
+    nginx_processes_read(pid_file, &before);
+
+    gint64 started = g_get_monotonic_time();
+    gint exit_status = -1;
+    gboolean reloaded = nginx_core_run_nginx(core, HELPER_OP_NGINX_RELOAD, &exit_status, error);
+    if (reloaded && exit_status != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "The reload command exited with status %d", exit_status);
+        reloaded = FALSE;
+    }
+    if (reloaded && before.master) {
+        reloaded = confirm_reload(core, pid_file, &before, started, error);
+    } else if (reloaded) {
+        nginx_core_log(core, LOG_SEVERITY_WARNING, "Warning: No nginx master in %s, the reload is not confirmed",
+                       pid_file);
+    }
+
+    nginx_processes_clear(&before);
+    g_free(pid_file);
+    return reloaded;
+}
+
+struct _ReloadScheduler {
+    NginxCore *core;
+    guint window_ms;
+    guint min_interval_ms;
+    ReloadStartedFunc started;
+    ReloadDoneFunc done;
+    gpointer user_data;
+    guint timeout_id;           // the window or interval being waited out
+    gboolean running;
+    gboolean freed;             // freed while running, the worker's callback frees it
+    guint n_pending;            // requests the next reload serves
+    guint n_running;            // requests the running reload serves
+    gint64 last_started;        // monotonic time the last reload started
+};
+
+ReloadScheduler* reload_scheduler_new(NginxCore *core, guint window_ms, guint min_interval_ms,
+                                      ReloadStartedFunc started, ReloadDoneFunc done, gpointer user_data) {
+    ReloadScheduler *scheduler = g_new0(ReloadScheduler, 1);
+    scheduler->core = core;
+    scheduler->window_ms = window_ms;
+    scheduler->min_interval_ms = min_interval_ms;
+    scheduler->started = started;
+    scheduler->done = done;
+    scheduler->user_data = user_data;
+    return scheduler;
+}
+
+void reload_scheduler_free(ReloadScheduler *scheduler) {
+    if (!scheduler) return;
+    if (scheduler->timeout_id) g_source_remove(scheduler->timeout_id);
+    scheduler->timeout_id = 0;
+    if (scheduler->running) {
+        scheduler->freed = TRUE;
+        return;
+    }
+    g_free(scheduler);
+}
+
+static void reload_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    (void)source_object; // Unused parameter
+    (void)cancellable; // Unused parameter
+    ReloadScheduler *scheduler = task_data;
+    GError *error = NULL;
+    if (nginx_reload_run(scheduler->core, &error)) {
+        g_task_return_boolean(task, TRUE);
+    } else {
+        g_task_return_error(task, error);
+    }
+}
+
+static void schedule(ReloadScheduler *scheduler);
+
+static void on_reload_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void)source_object; // Unused parameter
+    ReloadScheduler *scheduler = user_data;
+    GError *error = NULL;
+    gboolean reloaded = g_task_propagate_boolean(G_TASK(result), &error);
+    scheduler->running = FALSE;
+
+    if (scheduler->freed) {
+        g_clear_error(&error);
+        g_free(scheduler);
+        return;
+    }
+    if (scheduler->done) {
+        scheduler->done(reloaded, scheduler->n_running, error, scheduler->user_data);
+    }
+    g_clear_error(&error);
+    // done may have asked for the next reload itself
+    if (scheduler->n_pending > 0 && !scheduler->timeout_id) schedule(scheduler);
+}
+
+static gboolean on_reload_due(gpointer user_data) {
+    ReloadScheduler *scheduler = user_data;
+    scheduler->timeout_id = 0;
+    scheduler->running = TRUE;
+    scheduler->n_running = scheduler->n_pending;
+    scheduler->n_pending = 0;
+    scheduler->last_started = g_get_monotonic_time();
+    nginx_core_log(scheduler->core, LOG_SEVERITY_INFO, "Reloading Nginx (%u request(s))...", scheduler->n_running);
+    if (scheduler->started) scheduler->started(scheduler->n_running, scheduler->user_data);
+
+    GTask *task = g_task_new(NULL, NULL, on_reload_done, scheduler);
+    g_task_set_task_data(task, scheduler, NULL);
+    g_task_run_in_thread(task, reload_thread);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule(ReloadScheduler *scheduler) {
+    gint64 now = g_get_monotonic_time();
+    gint64 due = now + scheduler->window_ms * (gint64)1000;
+    if (scheduler->last_started) {
+        due = MAX(due, scheduler->last_started + scheduler->min_interval_ms * (gint64)1000);
+    }
+    scheduler->timeout_id = g_timeout_add((guint)((due - now + 999) / 1000), on_reload_due, scheduler);
+}
+
+void reload_scheduler_request(ReloadScheduler *scheduler) {
+    scheduler->n_pending++;
+    if (scheduler->running || scheduler->timeout_id) return;
+    schedule(scheduler);
+}
@@ -0,0 +1,63 @@
+#ifndef NGINX_RELOAD_H
+#define NGINX_RELOAD_H
+
+#include "nginx_core.h"
+
+// Confirmed and coalesced reloads.
+//
+// `nginx -s reload` and `systemctl reload nginx` only signal the master
+// and exit 0 whether or not it accepted the new configuration. A reload
+// is confirmed by watching the master instead: the pid in its pid file
+// must be the same process before and after, and it must have started at
+// least one worker it did not have before. A master that rejects the
+// configuration keeps its old workers and the reload counts as failed.
+//
+// The scheduler merges reload requests that arrive within a window into
+// one reload and keeps a minimum interval between reloads, so clicks and
+// scripts in quick succession do not pile up generations of old workers
+// that are still draining their connections.
+
+#define NGINX_PID_FILE "/run/nginx.pid"
+// How long a master has to start its new workers
+#define RELOAD_CONFIRM_TIMEOUT_MS 10000
+#define RELOAD_POLL_MS 50
+#define RELOAD_DEFAULT_WINDOW_MS 500
+#define RELOAD_DEFAULT_INTERVAL_MS 2000
+
+typedef struct {
+    gint master;                // 0 when nginx does not run
+    GArray *workers;            // gint pids of the master's children, sorted
+} NginxProcesses;
+
+// The pid directive of the main config, relative to its directory, or
+// NGINX_PID_FILE when there is none
+gchar* nginx_reload_find_pid_file(const gchar *main_conf);
+
+void nginx_processes_read(const gchar *pid_file, NginxProcesses *processes);
+void nginx_processes_clear(NginxProcesses *processes);
+
+// Reloads nginx through the helper and waits until the master confirms it,
+// blocking the calling thread; it may be a worker. If nginx did not run,
+// only the exit status of the reload command counts.
+gboolean nginx_reload_run(NginxCore *core, GError **error);
+
+// Called on the main thread when a scheduled reload starts and once it
+// finished; n_requests is the number of requests it serves
+typedef void (*ReloadStartedFunc)(guint n_requests, gpointer user_data);
+typedef void (*ReloadDoneFunc)(gboolean reloaded, guint n_requests, const GError *error, gpointer user_data);
+
+typedef struct _ReloadScheduler ReloadScheduler;
+
+// Must be used from the main thread; reloads run on worker threads.
+// started may be NULL.
+ReloadScheduler* reload_scheduler_new(NginxCore *core, guint window_ms, guint min_interval_ms,
+                                      ReloadStartedFunc started, ReloadDoneFunc done, gpointer user_data);
+// A reload in progress still finishes, without calling done
+void reload_scheduler_free(ReloadScheduler *scheduler);
+
+// Asks for a reload. The first request opens the window; the reload runs
+// when it closes, or once the minimum interval since the last one passed.
+// Requests made while a reload runs are served by the next one.
+void reload_scheduler_request(ReloadScheduler *scheduler);
+
+#endif // NGINX_RELOAD_H
@@ -0,0 +1,941 @@
+#include "nginx_route.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Longest host names and URIs a replayed line may hold
+#define ROUTE_MAX_LINE 8192
+// Smallest part of a log worth a work item of its own
+#define ROUTE_MIN_SLICE (4 * 1024 * 1024)
+
+static const gchar *no_server_key = "(no server listens on the port)";
+
+// Prefix locations of one level, keyed by their bytes. Edges are
+// compressed, so a lookup touches one node per diverging prefix.
+typedef struct _RadixNode RadixNode;
+struct _RadixNode {
+    gchar *edge;                // bytes from the parent, not NUL-terminated
+    gsize edge_length;
+    const RouteLocation *location; // prefix location ending here
+    GPtrArray *children;        // RadixNode*, sorted by first byte, NULL when none
+};
+
+// Most locations have no nested ones, so each part is created with its
+// first location and NULL until then
+typedef struct {
+    GHashTable *exact;          // URI -> LocationNode*
+    RadixNode *prefixes;
+    GPtrArray *regexes;         // LocationNode*, in config order
+} LocationLevel;
+
+typedef struct {
+    RouteLocation location;     // first, so the public part casts to the node
+    GRegex *regex;
+    LocationLevel nested;
+} LocationNode;
+
+typedef struct {
+    RouteServer server;
+    LocationLevel locations;
+    gchar *no_location_key;
+} ServerNode;
+
+typedef struct {
+    GRegex *regex;
+    const ServerNode *server;
+} RegexName;
+
+// The servers listening on one port
+typedef struct {
+    GHashTable *exact;          // name -> ServerNode*
+    GHashTable *leading;        // "example.com" of "*.example.com"
+    GHashTable *leading_dot;    // "example.com" of ".example.com", matches it too
+    GHashTable *trailing;       // "www.example" of "www.example.*"
+    GArray *regexes;            // RegexName, in config order
+    const ServerNode *default_server;
+    gboolean explicit_default;  // default_server was given, not the first server
+} PortTable;
+
+struct _RouteTable {
+    GHashTable *ports;          // port -> PortTable*
+    GPtrArray *servers;         // ServerNode*, in config order
+    GPtrArray *locations;       // LocationNode*, owned here
+    GHashTable *keys;           // server keys in use, to number duplicates
+    GStringChunk *names;        // server names the port tables are keyed by
+    GHashTable *regexes;        // flags and pattern -> GRegex*, vhosts repeat theirs
+    guint n_invalid;
+};
+
+static RadixNode* radix_node_new(const gchar *edge, gsize length) {
+    RadixNode *node = g_new0(RadixNode, 1);
+    node->edge = g_strndup(edge, length);
+    node->edge_length = length;
+    return node;
+}
+
+static void radix_node_free(gpointer data) {
+    RadixNode *node = data;
+    if (!node) return;
+    if (node->children) g_ptr_array_unref(node->children);
+    g_free(node->edge);
+    g_free(node);
+}
+
+// Index of the child whose edge starts with byte, or where it would go
+static guint radix_find_child(const RadixNode *node, guchar byte, gboolean *found) {
+    guint low = 0;
+    guint high = node->children ? node->children->len : 0;
+    while (low < high) {
+        guint mid = (low + high) / 2;
+        const RadixNode *child = g_ptr_array_index(node->children, mid);
+        guchar first = (guchar)child->edge[0];
+        if (first == byte) {
+            *found = TRUE;
+            return mid;
+        }
+        if (first < byte) low = mid + 1;
+        else high = mid;
+    }
+    *found = FALSE;
+    return low;
+}
+
+static void radix_insert(RadixNode *node, const gchar *key, gsize length, const RouteLocation *location) {
+    while (length > 0) {
+        gboolean found;
+        guint index = radix_find_child(node, (guchar)key[0], &found);
+        if (!found) {
+            if (!node->children) node->children = g_ptr_array_new_with_free_func(radix_node_free);
+            RadixNode *leaf = radix_node_new(key, length);
+            leaf->location = location;
+            g_ptr_array_insert(node->children, index, leaf);
+            return;
+        }
+
+        RadixNode *child = g_ptr_array_index(node->children, index);
+        gsize common = 0;
+        while (common < child->edge_length && common < length && child->edge[common] == key[common]) common++;
+        if (common < child->edge_length) {
+            // Split the edge where the key leaves it
+            RadixNode *middle = radix_node_new(child->edge, common);
+            gchar *rest = g_strndup(child->edge + common, child->edge_length - common);
+            g_free(child->edge);
+            child->edge = rest;
+            child->edge_length -= common;
+            middle->children = g_ptr_array_new_with_free_func(radix_node_free);
+            g_ptr_array_add(middle->children, child);
+            node->children->pdata[index] = middle;
+            child = middle;
+        }
+        node = child;
+        key += common;
+        length -= common;
+    }
+    // nginx refuses duplicate locations; the first one is kept
+    if (!node->location) node->location = location;
+}
+
+static const RouteLocation* radix_longest_prefix(const RadixNode *node, const gchar *uri, gsize length) {
+    const RouteLocation *best = node->location;
+    gsize pos = 0;
+    while (pos < length && node->children) {
+        gboolean found;
+        guint index = radix_find_child(node, (guchar)uri[pos], &found);
+        if (!found) break;
+        const RadixNode *child = g_ptr_array_index(node->children, index);
+        if (child->edge_length > length - pos || memcmp(child->edge, uri + pos, child->edge_length) != 0) break;
+        pos += child->edge_length;
+        node = child;
+        if (node->location) best = node->location;
+    }
+    return best;
+}
+
+static void location_level_clear(LocationLevel *level) {
+    if (level->exact) g_hash_table_unref(level->exact);
+    if (level->prefixes) radix_node_free(level->prefixes);
+    if (level->regexes) g_ptr_array_unref(level->regexes);
+}
+
+static void location_node_free(gpointer data) {
+    LocationNode *node = data;
+    location_level_clear(&node->nested);
+    if (node->regex) g_regex_unref(node->regex);
+    g_free(node->location.pattern);
+    g_free(node->location.key);
+    g_free(node);
+}
+
+static void server_node_free(gpointer data) {
+    ServerNode *node = data;
+    location_level_clear(&node->locations);
+    g_free(node->server.name);
+    g_free(node->server.path);
+    g_free(node->server.key);
+    g_free(node->no_location_key);
+    g_free(node);
+}
+
+static void port_table_free(gpointer data) {
+    PortTable *port = data;
+    g_hash_table_unref(port->exact);
+    g_hash_table_unref(port->leading);
+    g_hash_table_unref(port->leading_dot);
+    g_hash_table_unref(port->trailing);
+    for (guint i = 0; i < port->regexes->len; i++) {
+        g_regex_unref(g_array_index(port->regexes, RegexName, i).regex);
+    }
+    g_array_free(port->regexes, TRUE);
+    g_free(port);
+}
+
+RouteTable* route_table_new(void) {
+    RouteTable *table = g_new0(RouteTable, 1);
+    table->ports = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, port_table_free);
+    table->servers = g_ptr_array_new_with_free_func(server_node_free);
+    table->locations = g_ptr_array_new_with_free_func(location_node_free);
+    table->keys = g_hash_table_new(g_str_hash, g_str_equal);
+    table->names = g_string_chunk_new(4096);
+    table->regexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_regex_unref);
+    return table;
+}
+
+RouteTable* route_table_new_sharing(const RouteTable *base) {
+    RouteTable *table = route_table_new();
+    GHashTableIter iter;
+    gpointer key, regex;
+    g_hash_table_iter_init(&iter, base->regexes);
+    while (g_hash_table_iter_next(&iter, &key, &regex)) {
+        g_hash_table_insert(table->regexes, g_strdup(key), g_regex_ref(regex));
+    }
+    return table;
+}
+
+void route_table_free(RouteTable *table) {
+    if (!table) return;
+    g_hash_table_unref(table->keys);
+    g_hash_table_unref(table->regexes);
+    g_hash_table_unref(table->ports);
+    g_string_chunk_free(table->names);
+    g_ptr_array_unref(table->locations);
+    g_ptr_array_unref(table->servers);
+    g_free(table);
+}
+
+guint route_table_get_n_servers(const RouteTable *table) {
+    return table->servers->len;
+}
+
+guint route_table_get_n_locations(const RouteTable *table) {
+    return table->locations->len;
+}
+
+guint route_table_get_n_invalid(const RouteTable *table) {
+    return table->n_invalid;
+}
+
+// JIT compiling is the bulk of building a table, so every distinct
+// pattern is compiled once and shared
+static GRegex* compile_regex(RouteTable *table, const gchar *pattern, GRegexCompileFlags flags) {
+    gchar *key = g_strdup_printf("%x %s", flags, pattern);
+    GRegex *regex = g_hash_table_lookup(table->regexes, key);
+    if (regex) {
+        g_free(key);
+        return g_regex_ref(regex);
+    }
+    regex = g_regex_new(pattern, flags | G_REGEX_OPTIMIZE, 0, NULL);
+    if (!regex) {
+        table->n_invalid++;
+        g_free(key);
+        return NULL;
+    }
+    g_hash_table_insert(table->regexes, key, regex);
+    return g_regex_ref(regex);
+}
+
+static const gchar* location_modifier(RouteLocationKind kind) {
+    switch (kind) {
+        case ROUTE_LOCATION_EXACT: return "= ";
+        case ROUTE_LOCATION_PREFIX_NOREGEX: return "^~ ";
+        case ROUTE_LOCATION_REGEX: return "~ ";
+        case ROUTE_LOCATION_REGEX_CASELESS: return "~* ";
+        case ROUTE_LOCATION_PREFIX:
+        default: return "";
+    }
+}
+
+static void add_locations(RouteTable *table, ServerNode *server, LocationLevel *level,
+                          const ConfDocument *doc, const ConfNode *block) {
+    for (const ConfNode *node = block->children; node; node = node->next) {
+        if (!node->is_block || !conf_span_equal(doc, node->name, "location") || node->n_args == 0) continue;
+
+        RouteLocationKind kind = ROUTE_LOCATION_PREFIX;
+        guint32 pattern_arg = 0;
+        if (node->n_args >= 2) {
+            pattern_arg = 1;
+            if (conf_span_equal(doc, node->args[0], "=")) kind = ROUTE_LOCATION_EXACT;
+            else if (conf_span_equal(doc, node->args[0], "^~")) kind = ROUTE_LOCATION_PREFIX_NOREGEX;
+            else if (conf_span_equal(doc, node->args[0], "~")) kind = ROUTE_LOCATION_REGEX;
+            else if (conf_span_equal(doc, node->args[0], "~*")) kind = ROUTE_LOCATION_REGEX_CASELESS;
+            else continue;
+        }
+        gchar *pattern = conf_span_dup_value(doc, node->args[pattern_arg]);
+        // Named locations are only reached by internal redirects
+        if (pattern[0] == '@') {
+            g_free(pattern);
+            continue;
+        }
+
+        LocationNode *location = g_new0(LocationNode, 1);
+        location->location.kind = kind;
+        location->location.pattern = pattern;
+        location->location.server = &server->server;
+        location->location.line = node->line;
+        location->location.key = g_strdup_printf("%s, location %s%s", server->server.key,
+                                                 location_modifier(kind), pattern);
+        g_ptr_array_add(table->locations, location);
+
+        if (kind == ROUTE_LOCATION_EXACT) {
+            if (!level->exact) level->exact = g_hash_table_new(g_str_hash, g_str_equal);
+            if (!g_hash_table_contains(level->exact, pattern)) g_hash_table_insert(level->exact, pattern, location);
+        } else if (kind == ROUTE_LOCATION_PREFIX || kind == ROUTE_LOCATION_PREFIX_NOREGEX) {
+            if (!level->prefixes) level->prefixes = radix_node_new("", 0);
+            radix_insert(level->prefixes, pattern, strlen(pattern), &location->location);
+        } else {
+            location->regex = compile_regex(table, pattern, kind == ROUTE_LOCATION_REGEX_CASELESS ? G_REGEX_CASELESS : 0);
+            if (location->regex) {
+                if (!level->regexes) level->regexes = g_ptr_array_new();
+                g_ptr_array_add(level->regexes, location);
+            }
+        }
+        add_locations(table, server, &location->nested, doc, node);
+    }
+}
+
+static PortTable* get_port(RouteTable *table, guint port_number) {
+    PortTable *port = g_hash_table_lookup(table->ports, GUINT_TO_POINTER(port_number));
+    if (!port) {
+        port = g_new0(PortTable, 1);
+        port->exact = g_hash_table_new(g_str_hash, g_str_equal);
+        port->leading = g_hash_table_new(g_str_hash, g_str_equal);
+        port->leading_dot = g_hash_table_new(g_str_hash, g_str_equal);
+        port->trailing = g_hash_table_new(g_str_hash, g_str_equal);
+        port->regexes = g_array_new(FALSE, FALSE, sizeof(RegexName));
+        g_hash_table_insert(table->ports, GUINT_TO_POINTER(port_number), port);
+    }
+    return port;
+}
+
+// "80", "127.0.0.1:8080", "[::]:443", "localhost" -> the port; 0 for unix sockets
+static guint listen_port(const gchar *value) {
+    if (g_str_has_prefix(value, "unix:")) return 0;
+    const gchar *port = value;
+    if (value[0] == '[') {
+        const gchar *close = strchr(value, ']');
+        port = close && close[1] == ':' ? close + 2 : "";
+    } else if (strchr(value, ':')) {
+        port = strrchr(value, ':') + 1;
+    }
+    guint64 number;
+    if (!g_ascii_string_to_unsigned(port, 10, 1, 65535, &number, NULL)) {
+        // An address without a port, or a bare host name
+        return ROUTE_DEFAULT_PORT;
+    }
+    return (guint)number;
+}
+
+// Names are keyed without their wildcard; the first server to claim a
+// name keeps it, as nginx warns and ignores the later ones
+static void add_name(PortTable *port, const ServerNode *server, gchar *name) {
+    GHashTable *names;
+    const gchar *key = name;
+    gsize length = strlen(name);
+    if (g_str_has_prefix(name, "*.")) {
+        names = port->leading;
+        key = name + 2;
+    } else if (name[0] == '.') {
+        names = port->leading_dot;
+        key = name + 1;
+    } else if (length > 2 && g_str_has_suffix(name, ".*")) {
+        names = port->trailing;
+        name[length - 2] = '\0';
+    } else {
+        names = port->exact;
+    }
+    if (!g_hash_table_contains(names, key)) g_hash_table_insert(names, (gpointer)key, (gpointer)server);
+}
+
+static void add_server(RouteTable *table, const gchar *path, const ConfDocument *doc, const ConfNode *block) {
+    ServerNode *server = g_new0(ServerNode, 1);
+    server->server.path = g_strdup(path);
+    server->server.line = block->line;
+
+    GArray *ports = g_array_new(FALSE, FALSE, sizeof(guint));
+    GArray *defaults = g_array_new(FALSE, FALSE, sizeof(gboolean));
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    for (const ConfNode *node = block->children; node; node = node->next) {
+        if (conf_span_equal(doc, node->name, "listen") && node->n_args > 0) {
+            gchar *value = conf_span_dup_value(doc, node->args[0]);
+            guint port = listen_port(value);
+            g_free(value);
+            if (port == 0) continue;
+            gboolean is_default = FALSE;
+            for (guint32 i = 1; i < node->n_args; i++) {
+                if (conf_span_equal(doc, node->args[i], "default_server") ||
+                    conf_span_equal(doc, node->args[i], "default")) {
+                    is_default = TRUE;
+                }
+            }
+            g_array_append_val(ports, port);
+            g_array_append_val(defaults, is_default);
+        } else if (conf_span_equal(doc, node->name, "server_name")) {
+            for (guint32 i = 0; i < node->n_args; i++) {
+                gchar *value = conf_span_dup_value(doc, node->args[i]);
+                // Regex names are case sensitive, host names are not
+                if (value[0] != '~') {
+                    gchar *lower = g_ascii_strdown(value, -1);
+                    g_free(value);
+                    value = lower;
+                }
+                g_ptr_array_add(names, value);
+            }
+        }
+    }
+    if (ports->len == 0) {
+        guint port = ROUTE_DEFAULT_PORT;
+        gboolean is_default = FALSE;
+        g_array_append_val(ports, port);
+        g_array_append_val(defaults, is_default);
+    }
+
+    server->server.name = g_strdup(names->len > 0 ? g_ptr_array_index(names, 0) : "_");
+    gchar *key = g_strdup_printf("%s server %s", path, server->server.name);
+    // Another server of the same name in the same file gets a number
+    for (guint n = 2; g_hash_table_contains(table->keys, key); n++) {
+        g_free(key);
+        key = g_strdup_printf("%s server %s #%u", path, server->server.name, n);
+    }
+    server->server.key = key;
+    server->no_location_key = g_strdup_printf("%s, no location", key);
+    g_hash_table_add(table->keys, key);
+    g_ptr_array_add(table->servers, server);
+
+    for (guint p = 0; p < ports->len; p++) {
+        PortTable *port = get_port(table, g_array_index(ports, guint, p));
+        gboolean is_default = g_array_index(defaults, gboolean, p);
+        if (!port->default_server || (is_default && !port->explicit_default)) {
+            port->default_server = server;
+            port->explicit_default = is_default;
+        }
+        for (guint n = 0; n < names->len; n++) {
+            const gchar *name = g_ptr_array_index(names, n);
+            if (name[0] == '~') {
+                GRegex *regex = compile_regex(table, name + 1, 0);
+                if (!regex) continue;
+                RegexName entry = { regex, server };
+                g_array_append_val(port->regexes, entry);
+            } else {
+                add_name(port, server, g_string_chunk_insert(table->names, name));
+            }
+        }
+    }
+    add_locations(table, server, &server->locations, doc, block);
+
+    g_ptr_array_unref(names);
+    g_array_free(defaults, TRUE);
+    g_array_free(ports, TRUE);
+}
+
+// Server blocks of the stream and mail modules never see HTTP requests
+static gboolean in_http(const ConfDocument *doc, const ConfNode *node) {
+    for (const ConfNode *parent = node->parent; parent; parent = parent->parent) {
+        if (conf_span_equal(doc, parent->name, "stream") || conf_span_equal(doc, parent->name, "mail")) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+typedef struct {
+    RouteTable *table;
+    const gchar *path;
+} AddContext;
+
+static void add_node(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    AddContext *ctx = user_data;
+    if (node->is_block && conf_span_equal(doc, node->name, "server") && in_http(doc, node)) {
+        add_server(ctx->table, ctx->path, doc, node);
+    }
+}
+
+void route_table_add_document(RouteTable *table, const gchar *path, const ConfDocument *doc) {
+    AddContext ctx = { table, path };
+    conf_document_foreach(doc, add_node, &ctx);
+}
+
+// Tries leading wildcards from the longest suffix of host to the shortest
+static const ServerNode* match_leading(const PortTable *port, const gchar *host) {
+    const ServerNode *server = g_hash_table_lookup(port->leading_dot, host);
+    if (server) return server;
+    for (const gchar *dot = strchr(host, '.'); dot; dot = strchr(dot + 1, '.')) {
+        const gchar *suffix = dot + 1;
+        if ((server = g_hash_table_lookup(port->leading, suffix)) != NULL) return server;
+        if ((server = g_hash_table_lookup(port->leading_dot, suffix)) != NULL) return server;
+    }
+    return NULL;
+}
+
+// Tries trailing wildcards from the longest prefix of host to the shortest
+static const ServerNode* match_trailing(const PortTable *port, const gchar *host) {
+    if (g_hash_table_size(port->trailing) == 0) return NULL;
+    gchar *prefix = g_alloca(strlen(host) + 1);
+    strcpy(prefix, host);
+    gchar *dot;
+    while ((dot = strrchr(prefix, '.')) != NULL) {
+        *dot = '\0';
+        const ServerNode *server = g_hash_table_lookup(port->trailing, prefix);
+        if (server) return server;
+    }
+    return NULL;
+}
+
+static const ServerNode* find_server(const PortTable *port, const gchar *host, RouteServerMatch *match) {
+    const ServerNode *server;
+    if ((server = g_hash_table_lookup(port->exact, host)) != NULL) {
+        *match = ROUTE_SERVER_EXACT;
+        return server;
+    }
+    if ((server = match_leading(port, host)) != NULL) {
+        *match = ROUTE_SERVER_LEADING_WILDCARD;
+        return server;
+    }
+    if ((server = match_trailing(port, host)) != NULL) {
+        *match = ROUTE_SERVER_TRAILING_WILDCARD;
+        return server;
+    }
+    for (guint i = 0; i < port->regexes->len; i++) {
+        const RegexName *name = &g_array_index(port->regexes, RegexName, i);
+        if (g_regex_match(name->regex, host, 0, NULL)) {
+            *match = ROUTE_SERVER_REGEX;
+            return name->server;
+        }
+    }
+    *match = ROUTE_SERVER_DEFAULT;
+    return port->default_server;
+}
+
+typedef enum {
+    FIND_DECLINED,              // nothing at this level
+    FIND_PREFIX,                // a prefix location, regexes may still win
+    FIND_DONE                   // an exact or regex location, final
+} FindStatus;
+
+// ngx_http_core_find_location: the static match first, then its nested
+// locations, then this level's regexes unless the prefix was "^~"
+static FindStatus find_location(const LocationLevel *level, const gchar *uri, gsize length,
+                                const RouteLocation **found) {
+    const LocationNode *exact = level->exact ? g_hash_table_lookup(level->exact, uri) : NULL;
+    if (exact) {
+        *found = &exact->location;
+        return FIND_DONE;
+    }
+
+    FindStatus status = FIND_DECLINED;
+    gboolean noregex = FALSE;
+    const RouteLocation *prefix = level->prefixes ? radix_longest_prefix(level->prefixes, uri, length) : NULL;
+    if (prefix) {
+        *found = prefix;
+        noregex = prefix->kind == ROUTE_LOCATION_PREFIX_NOREGEX;
+        status = find_location(&((const LocationNode *)prefix)->nested, uri, length, found);
+        if (status == FIND_DONE) return FIND_DONE;
+        status = FIND_PREFIX;
+    }
+
+    if (!noregex && level->regexes) {
+        for (guint i = 0; i < level->regexes->len; i++) {
+            const LocationNode *location = g_ptr_array_index(level->regexes, i);
+            if (g_regex_match(location->regex, uri, 0, NULL)) {
+                *found = &location->location;
+                find_location(&location->nested, uri, length, found);
+                return FIND_DONE;
+            }
+        }
+    }
+    return status;
+}
+
+static gint hex_value(gchar c) {
+    return g_ascii_isxdigit(c) ? g_ascii_xdigit_value(c) : -1;
+}
+
+// Drops the query string, decodes %XX and merges slashes, into out of
+// at least strlen(uri) + 2 bytes
+static gsize normalize_uri(const gchar *uri, gchar *out) {
+    gsize length = 0;
+    if (uri[0] != '/') out[length++] = '/';
+    for (const gchar *p = uri; *p && *p != '?' && *p != '#'; p++) {
+        gchar c = *p;
+        if (c == '%' && hex_value(p[1]) >= 0 && hex_value(p[2]) >= 0) {
+            c = (gchar)(hex_value(p[1]) * 16 + hex_value(p[2]));
+            p += 2;
+            // A decoded NUL would end the string early
+            if (c == '\0') c = '%';
+        }
+        if (c == '/' && length > 0 && out[length - 1] == '/') continue;
+        out[length++] = c;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+// Lowercases host into out, takes a ":port" off into port and drops a
+// trailing dot
+static void normalize_host(const gchar *host, gchar *out, guint *port) {
+    gsize length = 0;
+    const gchar *colon = host[0] == '[' ? strstr(host, "]:") : strrchr(host, ':');
+    if (colon && colon[0] == ']') colon++;
+    const gchar *end = colon ? colon : host + strlen(host);
+    guint64 number;
+    if (colon && g_ascii_string_to_unsigned(colon + 1, 10, 1, 65535, &number, NULL)) {
+        *port = (guint)number;
+    }
+    for (const gchar *p = host; p < end; p++) out[length++] = g_ascii_tolower(*p);
+    if (length > 0 && out[length - 1] == '.') length--;
+    out[length] = '\0';
+}
+
+void route_table_lookup(const RouteTable *table, const gchar *host, guint port, const gchar *uri,
+                        RouteResult *result) {
+    memset(result, 0, sizeof(*result));
+    gsize host_size = strlen(host) + 1;
+    gsize uri_size = strlen(uri) + 2;
+    gchar *scratch = g_alloca(host_size + uri_size);
+    gchar *normal_host = scratch;
+    gchar *normal_uri = scratch + host_size;
+    normalize_host(host, normal_host, &port);
+    gsize uri_length = normalize_uri(uri, normal_uri);
+
+    const PortTable *table_port = g_hash_table_lookup(table->ports, GUINT_TO_POINTER(port));
+    if (!table_port) return;
+    const ServerNode *server = find_server(table_port, normal_host, &result->server_match);
+    result->server = &server->server;
+    find_location(&server->locations, normal_uri, uri_length, &result->location);
+}
+
+const gchar* route_result_get_key(const RouteResult *result) {
+    if (!result->server) return no_server_key;
+    if (!result->location) return ((const ServerNode *)result->server)->no_location_key;
+    return result->location->key;
+}
+
+gchar* route_result_describe(const RouteResult *result) {
+    static const gchar *matches[] = {
+        [ROUTE_SERVER_EXACT] = "exact name",
+        [ROUTE_SERVER_LEADING_WILDCARD] = "leading wildcard",
+        [ROUTE_SERVER_TRAILING_WILDCARD] = "trailing wildcard",
+        [ROUTE_SERVER_REGEX] = "regex",
+        [ROUTE_SERVER_DEFAULT] = "default server"
+    };
+    if (!result->server) return g_strdup(no_server_key);
+
+    GString *text = g_string_new(NULL);
+    g_string_append_printf(text, "server %s (%s:%u) by %s", result->server->name, result->server->path,
+                           result->server->line, matches[result->server_match]);
+    if (result->location) {
+        g_string_append_printf(text, ", location %s%s (line %u)", location_modifier(result->location->kind),
+                               result->location->pattern, result->location->line);
+    } else {
+        g_string_append(text, ", no location");
+    }
+    return g_string_free(text, FALSE);
+}
+
+// Keys of both tables are interned, so a change is a pair of pointers
+typedef struct {
+    const gchar *from;
+    const gchar *to;
+} RouteChange;
+
+static guint route_change_hash(gconstpointer key) {
+    const RouteChange *change = key;
+    return g_direct_hash(change->from) * 31 + g_direct_hash(change->to);
+}
+
+static gboolean route_change_equal(gconstpointer a, gconstpointer b) {
+    const RouteChange *change_a = a;
+    const RouteChange *change_b = b;
+    return change_a->from == change_b->from && change_a->to == change_b->to;
+}
+
+void route_replay_init(RouteReplay *replay) {
+    memset(replay, 0, sizeof(*replay));
+    // Route keys belong to the tables, counts to the replay
+    replay->routes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    replay->changes = g_hash_table_new_full(route_change_hash, route_change_equal, g_free, g_free);
+}
+
+void route_replay_clear(RouteReplay *replay) {
+    g_clear_pointer(&replay->routes, g_hash_table_unref);
+    g_clear_pointer(&replay->changes, g_hash_table_unref);
+}
+
+static void count(GHashTable *counts, gconstpointer key, gsize key_size) {
+    guint64 *requests = g_hash_table_lookup(counts, key);
+    if (!requests) {
+        requests = g_new0(guint64, 1);
+        gpointer owned_key = (gpointer)key;
+        if (key_size) {
+            owned_key = g_malloc(key_size);
+            memcpy(owned_key, key, key_size);
+        }
+        g_hash_table_insert(counts, owned_key, requests);
+    }
+    (*requests)++;
+}
+
+// Splits a "host uri ..." line in place; FALSE when it has no URI
+static gboolean split_line(gchar *line, gchar **host, gchar **uri) {
+    gchar *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    *host = p;
+    while (*p && *p != ' ' && *p != '\t') p++;
+    if (!*p) return FALSE;
+    *p++ = '\0';
+    while (*p == ' ' || *p == '\t') p++;
+    *uri = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    *p = '\0';
+    return **host && **uri;
+}
+
+typedef struct _ReplayRun ReplayRun;
+
+typedef struct {
+    ReplayRun *run;
+    const gchar *data;
+    gsize length;
+    RouteReplay replay;
+} ReplaySlice;
+
+// One replay in flight. The mapping item and every slice item count as
+// pending; the done callback of whichever finishes last reports.
+struct _ReplayRun {
+    WorkPool *pool;
+    const RouteTable *table;
+    const RouteTable *other;
+    gchar *path;
+    RouteReplay *replay;
+    RouteReplayDoneFunc done;
+    gpointer user_data;
+    GMappedFile *file;
+    ReplaySlice *slices;
+    guint n_slices;
+    guint n_pending;            // main context only
+    GError *error;
+    gint64 started;
+};
+
+static void replay_lines(ReplaySlice *slice) {
+    const RouteTable *table = slice->run->table;
+    const RouteTable *other = slice->run->other;
+    RouteReplay *replay = &slice->replay;
+    const gchar *data = slice->data;
+    gsize length = slice->length;
+    gchar line[ROUTE_MAX_LINE];
+
+    for (gsize pos = 0; pos < length;) {
+        const gchar *end = memchr(data + pos, '\n', length - pos);
+        gsize line_length = (end ? (gsize)(end - data) : length) - pos;
+        const gchar *start = data + pos;
+        pos += line_length + 1;
+        if (line_length == 0) continue;
+
+        if (line_length >= sizeof(line)) {
+            replay->n_skipped++;
+            continue;
+        }
+        memcpy(line, start, line_length);
+        line[line_length] = '\0';
+        gchar *host;
+        gchar *uri;
+        if (!split_line(line, &host, &uri)) {
+            replay->n_skipped++;
+            continue;
+        }
+
+        RouteResult result;
+        route_table_lookup(table, host, ROUTE_DEFAULT_PORT, uri, &result);
+        const gchar *key = route_result_get_key(&result);
+        count(replay->routes, key, 0);
+        replay->n_requests++;
+        if (other) {
+            RouteResult other_result;
+            route_table_lookup(other, host, ROUTE_DEFAULT_PORT, uri, &other_result);
+            const gchar *other_key = route_result_get_key(&other_result);
+            if (strcmp(key, other_key) != 0) {
+                RouteChange change = { key, other_key };
+                count(replay->changes, &change, sizeof(change));
+                replay->n_changed++;
+            }
+        }
+    }
+}
+
+// Moves the counts of from into into
+static void merge_counts(GHashTable *into, GHashTable *from) {
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    g_hash_table_iter_init(&iter, from);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        guint64 *requests = g_hash_table_lookup(into, key);
+        if (requests) {
+            *requests += *(guint64 *)value;
+        } else {
+            g_hash_table_iter_steal(&iter);
+            g_hash_table_insert(into, key, value);
+        }
+    }
+}
+
+static void finish_part(ReplayRun *run) {
+    if (--run->n_pending > 0) return;
+
+    run->replay->seconds += (g_get_monotonic_time() - run->started) / (gdouble)G_USEC_PER_SEC;
+    run->done(run->replay, run->error, run->user_data);
+    g_clear_error(&run->error);
+    if (run->file) g_mapped_file_unref(run->file);
+    g_free(run->slices);
+    g_free(run->path);
+    g_free(run);
+}
+
+static void replay_slice_func(gpointer data, GCancellable *cancellable) {
+    (void)cancellable; // Unused parameter
+    replay_lines(data);
+}
+
+// Counts are summed on the main context as slices finish
+static void on_slice_done(gpointer data, gboolean cancelled) {
+    (void)cancelled; // Unused parameter
+    ReplaySlice *slice = data;
+    RouteReplay *replay = slice->run->replay;
+    replay->n_requests += slice->replay.n_requests;
+    replay->n_skipped += slice->replay.n_skipped;
+    replay->n_changed += slice->replay.n_changed;
+    merge_counts(replay->routes, slice->replay.routes);
+    merge_counts(replay->changes, slice->replay.changes);
+    route_replay_clear(&slice->replay);
+    finish_part(slice->run);
+}
+
+// Tables are read-only, so the file is cut at line ends into one slice
+// per worker and the slices are counted as separate items. Pushed from
+// a worker, they queue on its own deque for the others to steal.
+static void map_log_func(gpointer data, GCancellable *cancellable) {
+    (void)cancellable; // Unused parameter
+    ReplayRun *run = data;
+    run->file = g_mapped_file_new(run->path, FALSE, &run->error);
+    if (!run->file) return;
+    const gchar *log = g_mapped_file_get_contents(run->file);
+    gsize length = g_mapped_file_get_length(run->file);
+
+    WorkPoolStats stats;
+    work_pool_get_stats(run->pool, &stats);
+    run->n_slices = CLAMP(length / ROUTE_MIN_SLICE, 1, (gsize)stats.n_threads);
+    run->slices = g_new0(ReplaySlice, run->n_slices);
+    gsize pos = 0;
+    for (guint i = 0; i < run->n_slices; i++) {
+        gsize end = i + 1 == run->n_slices ? length : MAX(pos, length / run->n_slices * (i + 1));
+        while (end < length && log[end - 1] != '\n') end++;
+        ReplaySlice *slice = &run->slices[i];
+        slice->run = run;
+        slice->data = log + pos;
+        slice->length = end - pos;
+        route_replay_init(&slice->replay);
+        pos = end;
+    }
+}
+
+static void on_log_mapped(gpointer data, gboolean cancelled) {
+    (void)cancelled; // Unused parameter
+    ReplayRun *run = data;
+    // Pushed from here, so n_pending only ever changes on this context
+    run->n_pending += run->n_slices;
+    for (guint i = 0; i < run->n_slices; i++) {
+        work_pool_push(run->pool, WORK_PRIORITY_BULK, replay_slice_func, on_slice_done,
+                       &run->slices[i], NULL, NULL);
+    }
+    finish_part(run);
+}
+
+void route_replay_file_async(WorkPool *pool, const RouteTable *table, const RouteTable *other,
+                             const gchar *path, RouteReplay *replay, RouteReplayDoneFunc done,
+                             gpointer user_data) {
+    ReplayRun *run = g_new0(ReplayRun, 1);
+    run->pool = pool;
+    run->table = table;
+    run->other = other;
+    run->path = g_strdup(path);
+    run->replay = replay;
+    run->done = done;
+    run->user_data = user_data;
+    run->n_pending = 1;
+    run->started = g_get_monotonic_time();
+    work_pool_push(pool, WORK_PRIORITY_BULK, map_log_func, on_log_mapped, run, NULL, NULL);
+}
+
+typedef struct {
+    const gchar *key;
+    guint64 requests;
+} CountRow;
+
+static gint compare_rows(gconstpointer a, gconstpointer b) {
+    const CountRow *row_a = a;
+    const CountRow *row_b = b;
+    if (row_a->requests != row_b->requests) return row_a->requests > row_b->requests ? -1 : 1;
+    return strcmp(row_a->key, row_b->key);
+}
+
+static void describe_counts(GString *text, GHashTable *counts, guint64 total, guint max_rows) {
+    GArray *rows = g_array_sized_new(FALSE, FALSE, sizeof(CountRow), g_hash_table_size(counts));
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    g_hash_table_iter_init(&iter, counts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        CountRow row = { key, *(guint64 *)value };
+        g_array_append_val(rows, row);
+    }
+    g_array_sort(rows, compare_rows);
+    for (guint i = 0; i < rows->len && i < max_rows; i++) {
+        const CountRow *row = &g_array_index(rows, CountRow, i);
+        g_string_append_printf(text, "%12" G_GUINT64_FORMAT " %5.1f%%  %s\n", row->requests,
+                               total ? 100.0 * row->requests / total : 0.0, row->key);
+    }
+    if (rows->len > max_rows) g_string_append_printf(text, "%12s  and %u more\n", "", rows->len - max_rows);
+    g_array_free(rows, TRUE);
+}
+
+gchar* route_replay_describe(const RouteReplay *replay, guint max_rows) {
+    GString *text = g_string_new(NULL);
+    g_string_append_printf(text, "%" G_GUINT64_FORMAT " request(s) routed in %.2f s (%.0f/s), %"
+                           G_GUINT64_FORMAT " line(s) skipped\n",
+                           replay->n_requests, replay->seconds,
+                           replay->seconds > 0 ? replay->n_requests / replay->seconds : 0.0, replay->n_skipped);
+    describe_counts(text, replay->routes, replay->n_requests, max_rows);
+    if (replay->n_changed > 0) {
+        GHashTable *changes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        GHashTableIter iter;
+        gpointer key;
+        gpointer value;
+        g_hash_table_iter_init(&iter, replay->changes);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            const RouteChange *change = key;
+            g_hash_table_insert(changes, g_strdup_printf("%s -> %s", change->from, change->to), value);
+        }
+        g_string_append_printf(text, "%" G_GUINT64_FORMAT " request(s) routed differently:\n", replay->n_changed);
+        describe_counts(text, changes, replay->n_requests, max_rows);
+        g_hash_table_unref(changes);
+    }
+    return g_string_free(text, FALSE);
+}
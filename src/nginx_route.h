@@ -0,0 +1,114 @@
+#ifndef NGINX_ROUTE_H
+#define NGINX_ROUTE_H
+
+#include <glib.h>
+#include "nginx_parser.h"
+#include "nginx_pool.h"
+
+// Offline request routing: which server and location block nginx picks
+// for a Host header and URI, computed from parsed configs.
+//
+// Servers are grouped by the port they listen on (addresses are not told
+// apart) and chosen by nginx's server_name rules: exact names from a
+// hash, then the longest leading wildcard ("*.example.com" and
+// ".example.com"), then the longest trailing wildcard ("www.example.*"),
+// then the first matching regex, then the port's default server.
+//
+// Within a server, an "=" location wins outright; otherwise the longest
+// prefix location is found in a radix trie, its nested locations are
+// searched the same way, and unless it is "^~" the regex locations are
+// tried in config order. Regexes are compiled once with G_REGEX_OPTIMIZE,
+// which JIT-compiles them. A table is read-only once built, so lookups
+// may run on any number of threads.
+
+#define ROUTE_DEFAULT_PORT 80
+
+typedef enum {
+    ROUTE_SERVER_EXACT,
+    ROUTE_SERVER_LEADING_WILDCARD,
+    ROUTE_SERVER_TRAILING_WILDCARD,
+    ROUTE_SERVER_REGEX,
+    ROUTE_SERVER_DEFAULT
+} RouteServerMatch;
+
+typedef enum {
+    ROUTE_LOCATION_EXACT,           // location = /uri
+    ROUTE_LOCATION_PREFIX_NOREGEX,  // location ^~ /prefix
+    ROUTE_LOCATION_PREFIX,          // location /prefix
+    ROUTE_LOCATION_REGEX,           // location ~ regex
+    ROUTE_LOCATION_REGEX_CASELESS   // location ~* regex
+} RouteLocationKind;
+
+typedef struct {
+    gchar *name;                // first server_name, "_" when there is none
+    gchar *path;
+    guint line;
+    gchar *key;                 // file and name, stable across edits that move lines
+} RouteServer;
+
+typedef struct {
+    RouteLocationKind kind;
+    gchar *pattern;
+    const RouteServer *server;
+    guint line;
+    gchar *key;                 // server key plus the location, as above
+} RouteLocation;
+
+typedef struct {
+    const RouteServer *server;  // NULL when nothing listens on the port
+    RouteServerMatch server_match;
+    const RouteLocation *location; // NULL when no location matches
+} RouteResult;
+
+typedef struct _RouteTable RouteTable;
+
+RouteTable* route_table_new(void);
+// An empty table that reuses the regexes base compiled, for building a
+// variant of base; base is only read, so other threads may use it meanwhile
+RouteTable* route_table_new_sharing(const RouteTable *base);
+void route_table_free(RouteTable *table);
+
+// Adds the server blocks of a file; files must be added in the order
+// nginx reads them, which decides default servers and regex precedence
+void route_table_add_document(RouteTable *table, const gchar *path, const ConfDocument *doc);
+
+guint route_table_get_n_servers(const RouteTable *table);
+guint route_table_get_n_locations(const RouteTable *table);
+// Regexes that did not compile and are left out
+guint route_table_get_n_invalid(const RouteTable *table);
+
+// host may carry a ":port", which then overrides port; uri may carry a
+// query string. The URI is decoded and its slashes merged as nginx does.
+void route_table_lookup(const RouteTable *table, const gchar *host, guint port, const gchar *uri,
+                        RouteResult *result);
+// "server example.com (conf.d/a.conf:1) by exact name, location ^~ /api/ (line 7)"
+gchar* route_result_describe(const RouteResult *result);
+// Identifies the route for comparing tables built from different files
+const gchar* route_result_get_key(const RouteResult *result);
+
+// Replays "host uri" lines, e.g. an access log written with
+// log_format routes '$host $request_uri';
+typedef struct {
+    guint64 n_requests;
+    guint64 n_skipped;          // lines without a host and a URI
+    guint64 n_changed;          // routed differently by the other table
+    GHashTable *routes;         // route key -> guint64* requests
+    GHashTable *changes;        // (old key, new key) -> guint64* requests
+    gdouble seconds;
+} RouteReplay;
+
+void route_replay_init(RouteReplay *replay);
+void route_replay_clear(RouteReplay *replay);
+// Called on the pool's context once every slice is counted; error is set
+// when the file could not be mapped
+typedef void (*RouteReplayDoneFunc)(RouteReplay *replay, const GError *error, gpointer user_data);
+// Routes every request of the file through table and, when other is set,
+// counts the requests other routes elsewhere. The file is split into
+// bulk items on pool; the tables must live until done is called.
+void route_replay_file_async(WorkPool *pool, const RouteTable *table, const RouteTable *other,
+                             const gchar *path, RouteReplay *replay, RouteReplayDoneFunc done,
+                             gpointer user_data);
+// The busiest routes and changes, one per line, most requests first
+gchar* route_replay_describe(const RouteReplay *replay, guint max_rows);
+
+#endif // NGINX_ROUTE_H
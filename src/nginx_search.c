@@ -0,0 +1,791 @@
+#include "nginx_search.h"
+#include "nginx_trace.h"
+#include <string.h>
+#include <sys/stat.h>
+
+#define SEARCH_INDEX_MAGIC 0x58444953u    // "SIDX"
+#define SEARCH_INDEX_VERSION 1
+
+// A posting is a file id in the high and a line number in the low 32 bits,
+// so sorting postings sorts them by file, then line
+#define POSTING(id, line) (((guint64)(id) << 32) | (guint32)(line))
+#define POSTING_FILE(posting) ((guint32)((posting) >> 32))
+#define POSTING_LINE(posting) ((guint32)(posting))
+
+typedef struct {
+    gchar *path;
+    guint32 id;
+    gint64 mtime_ns;
+    gint64 size;
+    GArray *trigrams;           // guint32 keys of the posting lists the file is in
+} SearchFile;
+
+struct _SearchIndex {
+    GMutex lock;
+    GHashTable *files;          // path -> SearchFile*
+    GHashTable *ids;            // id -> SearchFile*
+    GHashTable *postings;       // trigram -> GArray of guint64 postings, ascending
+    guint32 next_id;
+    gboolean dirty;             // changed since the last load or save
+};
+
+static void search_file_free(gpointer data) {
+    SearchFile *file = data;
+    g_free(file->path);
+    g_array_unref(file->trigrams);
+    g_free(file);
+}
+
+static GHashTable* new_postings_table(void) {
+    return g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_array_unref);
+}
+
+static GHashTable* new_files_table(void) {
+    return g_hash_table_new_full(g_str_hash, g_str_equal, NULL, search_file_free);
+}
+
+SearchIndex* search_index_new(void) {
+    SearchIndex *index = g_new0(SearchIndex, 1);
+    g_mutex_init(&index->lock);
+    index->files = new_files_table();
+    index->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+    index->postings = new_postings_table();
+    return index;
+}
+
+void search_index_free(SearchIndex *index) {
+    if (!index) return;
+    g_hash_table_unref(index->postings);
+    g_hash_table_unref(index->ids);
+    g_hash_table_unref(index->files);
+    g_mutex_clear(&index->lock);
+    g_free(index);
+}
+
+static gboolean stat_stamp(const gchar *path, gint64 *mtime_ns, gint64 *size) {
+    struct stat st;
+    if (stat(path, &st) != 0) return FALSE;
+    *mtime_ns = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st.st_mtim.tv_nsec;
+    *size = st.st_size;
+    return TRUE;
+}
+
+static inline guint32 trigram_key(const gchar *p) {
+    return (guint32)(guchar)g_ascii_tolower(p[0]) << 16 |
+           (guint32)(guchar)g_ascii_tolower(p[1]) << 8 |
+           (guint32)(guchar)g_ascii_tolower(p[2]);
+}
+
+// The lines of one file grouped by trigram: the lines of trigrams[i] are
+// lines[starts[i]] up to lines[starts[i + 1]], ascending and each once
+typedef struct {
+    guint n_trigrams;
+    guint32 *trigrams;
+    guint32 *starts;
+    guint32 *lines;
+} FileTrigrams;
+
+static void file_trigrams_free(FileTrigrams *grams) {
+    g_free(grams->trigrams);
+    g_free(grams->starts);
+    g_free(grams->lines);
+    g_free(grams);
+}
+
+// Open-addressed trigram -> slot map; a file has a few thousand distinct
+// trigrams at most, against millions of occurrences
+typedef struct {
+    guint32 *keys;              // EMPTY_SLOT or a trigram
+    guint32 *slots;
+    guint32 mask;
+    guint32 n;
+} SlotMap;
+
+#define EMPTY_SLOT G_MAXUINT32
+
+static void slot_map_init(SlotMap *map, guint32 capacity) {
+    map->keys = g_new(guint32, capacity);
+    memset(map->keys, 0xff, capacity * sizeof(guint32));
+    map->slots = g_new(guint32, capacity);
+    map->mask = capacity - 1;
+    map->n = 0;
+}
+
+static guint32 slot_map_get(SlotMap *map, guint32 key) {
+    guint32 i = (key * 2654435761u) & map->mask;
+    while (map->keys[i] != key) {
+        if (map->keys[i] == EMPTY_SLOT) {
+            // Kept at most half full
+            if (2 * (map->n + 1) > map->mask + 1) {
+                SlotMap grown;
+                slot_map_init(&grown, 2 * (map->mask + 1));
+                for (guint32 j = 0; j <= map->mask; j++) {
+                    if (map->keys[j] == EMPTY_SLOT) continue;
+                    guint32 k = (map->keys[j] * 2654435761u) & grown.mask;
+                    while (grown.keys[k] != EMPTY_SLOT) k = (k + 1) & grown.mask;
+                    grown.keys[k] = map->keys[j];
+                    grown.slots[k] = map->slots[j];
+                }
+                grown.n = map->n;
+                g_free(map->keys);
+                g_free(map->slots);
+                *map = grown;
+                return slot_map_get(map, key);
+            }
+            map->keys[i] = key;
+            map->slots[i] = map->n++;
+            return map->slots[i];
+        }
+        i = (i + 1) & map->mask;
+    }
+    return map->slots[i];
+}
+
+// Runs body for every trigram occurrence in text, with line and key set
+#define FOREACH_TRIGRAM(text, length, line, key, body)                      \
+    do {                                                                    \
+        guint32 line = 1;                                                   \
+        const gchar *p_ = (text);                                           \
+        const gchar *end_ = (text) + (length);                              \
+        while (p_ < end_) {                                                 \
+            const gchar *newline_ = memchr(p_, '\n', end_ - p_);            \
+            const gchar *line_end_ = newline_ ? newline_ : end_;            \
+            for (const gchar *t_ = p_; t_ + 2 < line_end_; t_++) {          \
+                guint32 key = trigram_key(t_);                              \
+                body                                                        \
+            }                                                               \
+            p_ = line_end_ + 1;                                             \
+            line++;                                                         \
+        }                                                                   \
+    } while (0)
+
+// Groups the lines of text by trigram in two passes: count, then fill.
+// This is the expensive part of indexing and needs no lock.
+static FileTrigrams* collect_trigrams(const gchar *text, gsize length) {
+    SlotMap map;
+    slot_map_init(&map, 4096);
+    GArray *last = g_array_new(FALSE, TRUE, sizeof(guint32));
+    GArray *counts = g_array_new(FALSE, TRUE, sizeof(guint32));
+    FOREACH_TRIGRAM(text, length, line, key, {
+        guint32 slot = slot_map_get(&map, key);
+        if (slot >= last->len) {
+            g_array_set_size(last, slot + 1);
+            g_array_set_size(counts, slot + 1);
+        }
+        if (g_array_index(last, guint32, slot) != line) {
+            g_array_index(last, guint32, slot) = line;
+            g_array_index(counts, guint32, slot)++;
+        }
+    });
+
+    FileTrigrams *grams = g_new0(FileTrigrams, 1);
+    grams->n_trigrams = map.n;
+    grams->trigrams = g_new(guint32, map.n);
+    grams->starts = g_new(guint32, map.n + 1);
+    for (guint32 i = 0; i <= map.mask; i++) {
+        if (map.keys[i] != EMPTY_SLOT) grams->trigrams[map.slots[i]] = map.keys[i];
+    }
+    guint32 total = 0;
+    for (guint32 slot = 0; slot < map.n; slot++) {
+        grams->starts[slot] = total;
+        total += g_array_index(counts, guint32, slot);
+        // Reused as the fill position
+        g_array_index(counts, guint32, slot) = grams->starts[slot];
+        g_array_index(last, guint32, slot) = 0;
+    }
+    grams->starts[map.n] = total;
+    grams->lines = g_new(guint32, MAX(total, 1));
+
+    FOREACH_TRIGRAM(text, length, line, key, {
+        guint32 slot = slot_map_get(&map, key);
+        if (g_array_index(last, guint32, slot) != line) {
+            g_array_index(last, guint32, slot) = line;
+            grams->lines[g_array_index(counts, guint32, slot)++] = line;
+        }
+    });
+
+    g_array_unref(counts);
+    g_array_unref(last);
+    g_free(map.keys);
+    g_free(map.slots);
+    return grams;
+}
+
+// First posting >= value
+static guint lower_bound(GArray *postings, guint64 value) {
+    guint lo = 0, hi = postings->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(postings, guint64, mid) < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void remove_postings(SearchIndex *index, SearchFile *file) {
+    guint64 first = POSTING(file->id, 0);
+    guint64 last = POSTING(file->id, G_MAXUINT32);
+    for (guint i = 0; i < file->trigrams->len; i++) {
+        gpointer key = GUINT_TO_POINTER(g_array_index(file->trigrams, guint32, i));
+        GArray *postings = g_hash_table_lookup(index->postings, key);
+        if (!postings) continue;
+        guint start = lower_bound(postings, first);
+        guint end = start;
+        while (end < postings->len && g_array_index(postings, guint64, end) <= last) end++;
+        g_array_remove_range(postings, start, end - start);
+        if (postings->len == 0) {
+            g_hash_table_remove(index->postings, key);
+        }
+    }
+    g_array_set_size(file->trigrams, 0);
+}
+
+static void add_postings(SearchIndex *index, SearchFile *file, const FileTrigrams *grams) {
+    for (guint i = 0; i < grams->n_trigrams; i++) {
+        guint32 trigram = grams->trigrams[i];
+        GArray *postings = g_hash_table_lookup(index->postings, GUINT_TO_POINTER(trigram));
+        if (!postings) {
+            postings = g_array_new(FALSE, FALSE, sizeof(guint64));
+            g_hash_table_insert(index->postings, GUINT_TO_POINTER(trigram), postings);
+        }
+        // Files indexed for the first time have the highest id and append
+        guint at = lower_bound(postings, POSTING(file->id, 0));
+        guint tail = postings->len - at;
+        guint n = grams->starts[i + 1] - grams->starts[i];
+        g_array_set_size(postings, postings->len + n);
+        guint64 *values = &g_array_index(postings, guint64, at);
+        memmove(values + n, values, tail * sizeof(guint64));
+        for (guint j = 0; j < n; j++) {
+            values[j] = POSTING(file->id, grams->lines[grams->starts[i] + j]);
+        }
+        g_array_append_val(file->trigrams, trigram);
+    }
+}
+
+static SearchFile* lookup_or_add_file(SearchIndex *index, const gchar *path) {
+    SearchFile *file = g_hash_table_lookup(index->files, path);
+    if (!file) {
+        file = g_new0(SearchFile, 1);
+        file->path = g_strdup(path);
+        file->id = index->next_id++;
+        file->trigrams = g_array_new(FALSE, FALSE, sizeof(guint32));
+        g_hash_table_insert(index->files, file->path, file);
+        g_hash_table_insert(index->ids, GUINT_TO_POINTER(file->id), file);
+    }
+    return file;
+}
+
+// Called with the lock held
+static void replace_file(SearchIndex *index, const gchar *path, const FileTrigrams *grams,
+                         gint64 mtime_ns, gint64 size) {
+    SearchFile *file = lookup_or_add_file(index, path);
+    remove_postings(index, file);
+    add_postings(index, file, grams);
+    file->mtime_ns = mtime_ns;
+    file->size = size;
+    index->dirty = TRUE;
+}
+
+// Called with the lock held
+static void drop_file(SearchIndex *index, SearchFile *file) {
+    remove_postings(index, file);
+    g_hash_table_remove(index->ids, GUINT_TO_POINTER(file->id));
+    g_hash_table_remove(index->files, file->path);
+    index->dirty = TRUE;
+}
+
+void search_index_update_file(SearchIndex *index, const gchar *path,
+                              const gchar *text, gsize length) {
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_INDEX);
+    // An unknown stamp makes the next refresh read the file again
+    gint64 mtime_ns = 0, size = -1;
+    stat_stamp(path, &mtime_ns, &size);
+    FileTrigrams *grams = collect_trigrams(text, length);
+    g_mutex_lock(&index->lock);
+    replace_file(index, path, grams, mtime_ns, size);
+    g_mutex_unlock(&index->lock);
+    file_trigrams_free(grams);
+    trace_end(&span, length);
+}
+
+void search_index_remove_file(SearchIndex *index, const gchar *path) {
+    g_mutex_lock(&index->lock);
+    SearchFile *file = g_hash_table_lookup(index->files, path);
+    if (file) drop_file(index, file);
+    g_mutex_unlock(&index->lock);
+}
+
+gboolean search_index_refresh_file(SearchIndex *index, const gchar *path) {
+    gint64 mtime_ns, size;
+    gboolean exists = stat_stamp(path, &mtime_ns, &size);
+
+    g_mutex_lock(&index->lock);
+    SearchFile *file = g_hash_table_lookup(index->files, path);
+    gboolean current = file && exists && file->mtime_ns == mtime_ns && file->size == size;
+    g_mutex_unlock(&index->lock);
+    if (current) return FALSE;
+
+    // Files that vanished are only dropped, which is not timed
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_INDEX);
+    gchar *text = NULL;
+    gsize length = 0;
+    if (!exists || !g_file_get_contents(path, &text, &length, NULL)) {
+        g_mutex_lock(&index->lock);
+        file = g_hash_table_lookup(index->files, path);
+        gboolean dropped = file != NULL;
+        if (dropped) drop_file(index, file);
+        g_mutex_unlock(&index->lock);
+        return dropped;
+    }
+
+    FileTrigrams *grams = collect_trigrams(text, length);
+    g_free(text);
+    g_mutex_lock(&index->lock);
+    replace_file(index, path, grams, mtime_ns, size);
+    g_mutex_unlock(&index->lock);
+    file_trigrams_free(grams);
+    trace_end(&span, length);
+    return TRUE;
+}
+
+guint search_index_retain(SearchIndex *index, const gchar * const *paths) {
+    GHashTable *keep = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; paths && paths[i]; i++) {
+        g_hash_table_add(keep, (gpointer)paths[i]);
+    }
+
+    g_mutex_lock(&index->lock);
+    GPtrArray *gone = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, index->files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        SearchFile *file = value;
+        if (!g_hash_table_contains(keep, file->path)) g_ptr_array_add(gone, file);
+    }
+    for (guint i = 0; i < gone->len; i++) {
+        drop_file(index, g_ptr_array_index(gone, i));
+    }
+    g_mutex_unlock(&index->lock);
+
+    guint dropped = gone->len;
+    g_ptr_array_unref(gone);
+    g_hash_table_unref(keep);
+    return dropped;
+}
+
+guint search_index_get_n_files(SearchIndex *index) {
+    g_mutex_lock(&index->lock);
+    guint n = g_hash_table_size(index->files);
+    g_mutex_unlock(&index->lock);
+    return n;
+}
+
+guint search_index_get_n_trigrams(SearchIndex *index) {
+    g_mutex_lock(&index->lock);
+    guint n = g_hash_table_size(index->postings);
+    g_mutex_unlock(&index->lock);
+    return n;
+}
+
+gboolean search_index_is_dirty(SearchIndex *index) {
+    g_mutex_lock(&index->lock);
+    gboolean dirty = index->dirty;
+    g_mutex_unlock(&index->lock);
+    return dirty;
+}
+
+void search_hit_free(gpointer data) {
+    SearchHit *hit = data;
+    g_free(hit->path);
+    g_free(hit->text);
+    g_free(hit);
+}
+
+static gboolean contains_posting(GArray *postings, guint64 value) {
+    guint i = lower_bound(postings, value);
+    return i < postings->len && g_array_index(postings, guint64, i) == value;
+}
+
+typedef struct {
+    const gchar *path;
+    guint32 id;
+    guint start;                // first candidate of the file
+    guint n;
+} CandidateRun;
+
+static gint compare_runs(gconstpointer a, gconstpointer b) {
+    return strcmp(((const CandidateRun *)a)->path, ((const CandidateRun *)b)->path);
+}
+
+static gint compare_lengths(gconstpointer a, gconstpointer b) {
+    guint la = (*(GArray * const *)a)->len;
+    guint lb = (*(GArray * const *)b)->len;
+    return (la > lb) - (la < lb);
+}
+
+// Byte offset of query (already lowercase) in line ignoring ASCII case, or -1
+static gssize find_folded(const gchar *line, gsize length, const gchar *query, gsize query_length) {
+    for (gsize i = 0; i + query_length <= length; i++) {
+        gsize j = 0;
+        while (j < query_length && g_ascii_tolower(line[i + j]) == query[j]) j++;
+        if (j == query_length) return i;
+    }
+    return -1;
+}
+
+// Checks the candidate lines of one file, in ascending order, against its
+// current contents. Returns the bytes read.
+static gsize verify_file(const gchar *path, const guint64 *candidates, guint n,
+                        const gchar *query, gsize query_length, GPtrArray *hits, guint max_hits) {
+    gchar *text = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(path, &text, &length, NULL)) return 0;
+
+    const gchar *p = text;
+    const gchar *end = text + length;
+    guint32 line = 1;
+    for (guint i = 0; i < n && hits->len < max_hits && p < end; i++) {
+        guint32 wanted = POSTING_LINE(candidates[i]);
+        while (line < wanted && p < end) {
+            const gchar *newline = memchr(p, '\n', end - p);
+            p = newline ? newline + 1 : end;
+            line++;
+        }
+        if (line != wanted) break;
+        const gchar *newline = memchr(p, '\n', end - p);
+        gsize line_length = (newline ? newline : end) - p;
+        gssize column = find_folded(p, line_length, query, query_length);
+        if (column >= 0) {
+            SearchHit *hit = g_new0(SearchHit, 1);
+            hit->path = g_strdup(path);
+            hit->line = line;
+            hit->column = column;
+            gchar *copy = g_strndup(p, line_length);
+            hit->text = g_strdup(g_strstrip(copy));
+            g_free(copy);
+            g_ptr_array_add(hits, hit);
+        }
+    }
+    g_free(text);
+    return length;
+}
+
+GPtrArray* search_index_query(SearchIndex *index, const gchar *query, guint max_hits) {
+    GPtrArray *hits = g_ptr_array_new_with_free_func(search_hit_free);
+    gsize query_length = strlen(query);
+    if (query_length < SEARCH_MIN_QUERY || max_hits == 0) return hits;
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_SEARCH);
+    gchar *folded = g_ascii_strdown(query, query_length);
+
+    // Candidates and the paths they are in are copied out under the lock;
+    // the files are read without it
+    GArray *candidates = g_array_new(FALSE, FALSE, sizeof(guint64));
+    GHashTable *paths = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    GPtrArray *lists = g_ptr_array_new();
+    g_mutex_lock(&index->lock);
+    gboolean complete = TRUE;
+    for (gsize i = 0; i + 2 < query_length && complete; i++) {
+        GArray *postings = g_hash_table_lookup(index->postings, GUINT_TO_POINTER(trigram_key(folded + i)));
+        if (!postings) {
+            complete = FALSE;
+        } else if (!g_ptr_array_find(lists, postings, NULL)) {
+            g_ptr_array_add(lists, postings);
+        }
+    }
+    if (complete) {
+        // Walk the shortest list and probe the others
+        g_ptr_array_sort(lists, compare_lengths);
+        GArray *shortest = g_ptr_array_index(lists, 0);
+        for (guint i = 0; i < shortest->len; i++) {
+            guint64 posting = g_array_index(shortest, guint64, i);
+            gboolean everywhere = TRUE;
+            for (guint j = 1; j < lists->len && everywhere; j++) {
+                everywhere = contains_posting(g_ptr_array_index(lists, j), posting);
+            }
+            if (!everywhere) continue;
+            g_array_append_val(candidates, posting);
+            gpointer id = GUINT_TO_POINTER(POSTING_FILE(posting));
+            if (!g_hash_table_contains(paths, id)) {
+                SearchFile *file = g_hash_table_lookup(index->ids, id);
+                g_hash_table_insert(paths, id, g_strdup(file->path));
+            }
+        }
+    }
+    g_mutex_unlock(&index->lock);
+    g_ptr_array_unref(lists);
+
+    // Candidates come in runs per file, in indexing order; hits are listed by path
+    GArray *runs = g_array_new(FALSE, FALSE, sizeof(CandidateRun));
+    for (guint i = 0; i < candidates->len; i++) {
+        guint32 id = POSTING_FILE(g_array_index(candidates, guint64, i));
+        CandidateRun *last = runs->len ? &g_array_index(runs, CandidateRun, runs->len - 1) : NULL;
+        if (last && last->id == id) {
+            last->n++;
+        } else {
+            CandidateRun run = { g_hash_table_lookup(paths, GUINT_TO_POINTER(id)), id, i, 1 };
+            g_array_append_val(runs, run);
+        }
+    }
+    g_array_sort(runs, compare_runs);
+    gsize bytes = 0;
+    for (guint i = 0; i < runs->len && hits->len < max_hits; i++) {
+        const CandidateRun *run = &g_array_index(runs, CandidateRun, i);
+        bytes += verify_file(run->path, &g_array_index(candidates, guint64, run->start), run->n,
+                             folded, query_length, hits, max_hits);
+    }
+
+    g_array_unref(runs);
+    g_hash_table_unref(paths);
+    g_array_unref(candidates);
+    g_free(folded);
+    trace_end(&span, bytes);
+    return hits;
+}
+
+gchar* search_index_get_cache_path(void) {
+    return g_build_filename(g_get_user_cache_dir(), "nginxui", "search-index", NULL);
+}
+
+// Saved format, native byte order (the cache never leaves the machine):
+//   u32 magic, u32 version, u32 n_files
+//   per file:    u32 path length, path bytes, i64 mtime_ns, i64 size
+//   u32 n_trigrams
+//   per trigram: u32 key, u32 n_postings, then one run per file:
+//                varint file id delta, varint n_lines, n_lines varint line deltas
+// File ids are renumbered to the file's position, so they ascend within a
+// posting list and most deltas fit in a byte.
+
+static void put_u32(GByteArray *out, guint32 value) {
+    g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_i64(GByteArray *out, gint64 value) {
+    g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_varint(GByteArray *out, guint64 value) {
+    guint8 bytes[10];
+    guint n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (guint8)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (guint8)value;
+    g_byte_array_append(out, bytes, n);
+}
+
+static gint compare_file_ids(gconstpointer a, gconstpointer b) {
+    guint32 ia = (*(SearchFile * const *)a)->id;
+    guint32 ib = (*(SearchFile * const *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+static gint compare_keys(gconstpointer a, gconstpointer b) {
+    guint32 ka = GPOINTER_TO_UINT(*(gconstpointer const *)a);
+    guint32 kb = GPOINTER_TO_UINT(*(gconstpointer const *)b);
+    return (ka > kb) - (ka < kb);
+}
+
+gboolean search_index_save(SearchIndex *index, const gchar *path, GError **error) {
+    GByteArray *out = g_byte_array_new();
+    g_mutex_lock(&index->lock);
+    GPtrArray *files = g_ptr_array_new();
+    GPtrArray *keys = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, index->files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) g_ptr_array_add(files, value);
+    g_hash_table_iter_init(&iter, index->postings);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) g_ptr_array_add(keys, key);
+    g_ptr_array_sort(files, compare_file_ids);
+    GHashTable *renumber = g_hash_table_new(g_direct_hash, g_direct_equal);
+    put_u32(out, SEARCH_INDEX_MAGIC);
+    put_u32(out, SEARCH_INDEX_VERSION);
+    put_u32(out, files->len);
+    for (guint i = 0; i < files->len; i++) {
+        SearchFile *file = g_ptr_array_index(files, i);
+        gsize length = strlen(file->path);
+        put_u32(out, length);
+        g_byte_array_append(out, (const guint8 *)file->path, length);
+        put_i64(out, file->mtime_ns);
+        put_i64(out, file->size);
+        g_hash_table_insert(renumber, GUINT_TO_POINTER(file->id), GUINT_TO_POINTER(i));
+    }
+
+    g_ptr_array_sort(keys, compare_keys);
+    put_u32(out, keys->len);
+    for (guint i = 0; i < keys->len; i++) {
+        GArray *postings = g_hash_table_lookup(index->postings, g_ptr_array_index(keys, i));
+        put_u32(out, GPOINTER_TO_UINT(g_ptr_array_index(keys, i)));
+        put_u32(out, postings->len);
+        guint32 previous_id = 0;
+        for (guint j = 0; j < postings->len; ) {
+            guint32 old_id = POSTING_FILE(g_array_index(postings, guint64, j));
+            guint run = j;
+            while (run < postings->len && POSTING_FILE(g_array_index(postings, guint64, run)) == old_id) run++;
+            guint32 id = GPOINTER_TO_UINT(g_hash_table_lookup(renumber, GUINT_TO_POINTER(old_id)));
+            put_varint(out, id - previous_id);
+            put_varint(out, run - j);
+            guint32 previous_line = 0;
+            for (; j < run; j++) {
+                guint32 line = POSTING_LINE(g_array_index(postings, guint64, j));
+                put_varint(out, line - previous_line);
+                previous_line = line;
+            }
+            previous_id = id;
+        }
+    }
+    g_ptr_array_unref(keys);
+    g_hash_table_unref(renumber);
+    g_ptr_array_unref(files);
+    g_mutex_unlock(&index->lock);
+
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    // Written to a temporary file and renamed over the old cache
+    gboolean saved = g_file_set_contents(path, (const gchar *)out->data, out->len, error);
+    g_byte_array_unref(out);
+    if (saved) {
+        g_mutex_lock(&index->lock);
+        index->dirty = FALSE;
+        g_mutex_unlock(&index->lock);
+    }
+    return saved;
+}
+
+typedef struct {
+    const guint8 *p;
+    const guint8 *end;
+    gboolean ok;
+} Reader;
+
+static const guint8* get_bytes(Reader *reader, gsize n) {
+    if (!reader->ok || (gsize)(reader->end - reader->p) < n) {
+        reader->ok = FALSE;
+        return NULL;
+    }
+    const guint8 *bytes = reader->p;
+    reader->p += n;
+    return bytes;
+}
+
+static guint32 get_u32(Reader *reader) {
+    guint32 value = 0;
+    const guint8 *bytes = get_bytes(reader, sizeof(value));
+    if (bytes) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static gint64 get_i64(Reader *reader) {
+    gint64 value = 0;
+    const guint8 *bytes = get_bytes(reader, sizeof(value));
+    if (bytes) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static guint64 get_varint(Reader *reader) {
+    guint64 value = 0;
+    for (guint shift = 0; shift < 64; shift += 7) {
+        const guint8 *byte = get_bytes(reader, 1);
+        if (!byte) return 0;
+        value |= (guint64)(*byte & 0x7f) << shift;
+        if (!(*byte & 0x80)) return value;
+    }
+    reader->ok = FALSE;
+    return 0;
+}
+
+gboolean search_index_load(SearchIndex *index, const gchar *path, GError **error) {
+    gchar *data = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents(path, &data, &length, error)) return FALSE;
+
+    Reader reader = { (const guint8 *)data, (const guint8 *)data + length, TRUE };
+    GHashTable *files = new_files_table();
+    GHashTable *ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTable *postings_table = new_postings_table();
+    gboolean valid = get_u32(&reader) == SEARCH_INDEX_MAGIC && get_u32(&reader) == SEARCH_INDEX_VERSION;
+    guint32 n_files = valid ? get_u32(&reader) : 0;
+    for (guint32 i = 0; i < n_files && reader.ok; i++) {
+        guint32 path_length = get_u32(&reader);
+        const guint8 *bytes = get_bytes(&reader, path_length);
+        if (!bytes) break;
+        SearchFile *file = g_new0(SearchFile, 1);
+        file->path = g_strndup((const gchar *)bytes, path_length);
+        file->id = i;
+        file->mtime_ns = get_i64(&reader);
+        file->size = get_i64(&reader);
+        file->trigrams = g_array_new(FALSE, FALSE, sizeof(guint32));
+        g_hash_table_insert(ids, GUINT_TO_POINTER(i), file);
+        if (!g_hash_table_insert(files, file->path, file)) valid = FALSE;
+    }
+
+    guint32 n_trigrams = valid ? get_u32(&reader) : 0;
+    for (guint32 i = 0; i < n_trigrams && reader.ok && valid; i++) {
+        guint32 key = get_u32(&reader);
+        guint32 n = get_u32(&reader);
+        // Every posting takes at least a byte
+        if (n == 0 || n > (gsize)(reader.end - reader.p) ||
+            g_hash_table_contains(postings_table, GUINT_TO_POINTER(key))) {
+            valid = FALSE;
+            break;
+        }
+        GArray *postings = g_array_sized_new(FALSE, FALSE, sizeof(guint64), n);
+        g_hash_table_insert(postings_table, GUINT_TO_POINTER(key), postings);
+        guint64 id = 0;
+        while (postings->len < n && reader.ok && valid) {
+            guint64 id_delta = get_varint(&reader);
+            guint64 n_lines = get_varint(&reader);
+            id += id_delta;
+            // Ids and lines strictly ascend
+            if ((postings->len > 0 && id_delta == 0) || id >= n_files ||
+                n_lines == 0 || n_lines > n - postings->len) {
+                valid = FALSE;
+                break;
+            }
+            guint64 line = 0;
+            for (guint64 j = 0; j < n_lines; j++) {
+                guint64 line_delta = get_varint(&reader);
+                line += line_delta;
+                if (line_delta == 0 || line > G_MAXUINT32) {
+                    valid = FALSE;
+                    break;
+                }
+                guint64 posting = POSTING(id, line);
+                g_array_append_val(postings, posting);
+            }
+            SearchFile *file = g_hash_table_lookup(ids, GUINT_TO_POINTER((guint32)id));
+            g_array_append_val(file->trigrams, key);
+        }
+    }
+    valid = valid && reader.ok && reader.p == reader.end;
+    g_free(data);
+
+    if (!valid) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is not a search index of this version", path);
+        g_hash_table_unref(postings_table);
+        g_hash_table_unref(ids);
+        g_hash_table_unref(files);
+        return FALSE;
+    }
+
+    g_mutex_lock(&index->lock);
+    g_hash_table_unref(index->postings);
+    g_hash_table_unref(index->ids);
+    g_hash_table_unref(index->files);
+    index->files = files;
+    index->ids = ids;
+    index->postings = postings_table;
+    index->next_id = n_files;
+    index->dirty = FALSE;
+    g_mutex_unlock(&index->lock);
+    return TRUE;
+}
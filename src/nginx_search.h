@@ -0,0 +1,65 @@
+#ifndef NGINX_SEARCH_H
+#define NGINX_SEARCH_H
+
+#include <gio/gio.h>
+
+// Full-text index over config files. Every line is split into
+// overlapping three-byte sequences (trigrams, ASCII case-folded); each
+// trigram maps to the sorted (file, line) pairs it occurs on. A query
+// intersects the posting lists of its trigrams and checks only the
+// candidate lines against the files on disk, so hits are never stale.
+//
+// Files are indexed one at a time: re-indexing a file replaces its
+// entries in the posting lists it touches and nothing else. The index
+// records each file's mtime and size and can be saved to and loaded from
+// a compact cache file, so a restart only re-reads files that changed.
+// All functions lock the index and may be called from any thread.
+
+// Queries shorter than a trigram cannot use the index
+#define SEARCH_MIN_QUERY 3
+#define SEARCH_MAX_HITS 500
+
+typedef struct _SearchIndex SearchIndex;
+
+typedef struct {
+    gchar *path;
+    guint line;                 // 1-based
+    guint column;               // byte index of the match within the line
+    gchar *text;                // the line, without surrounding whitespace
+} SearchHit;
+
+SearchIndex* search_index_new(void);
+void search_index_free(SearchIndex *index);
+
+// Replaces the entries of path with those of text, e.g. after a save
+void search_index_update_file(SearchIndex *index, const gchar *path,
+                              const gchar *text, gsize length);
+void search_index_remove_file(SearchIndex *index, const gchar *path);
+
+// Re-indexes path if its mtime or size changed since it was indexed, or
+// drops it when it can no longer be read. Returns TRUE if the index changed.
+gboolean search_index_refresh_file(SearchIndex *index, const gchar *path);
+
+// Drops every file that is not in paths and returns how many were dropped
+guint search_index_retain(SearchIndex *index, const gchar * const *paths);
+
+guint search_index_get_n_files(SearchIndex *index);
+guint search_index_get_n_trigrams(SearchIndex *index);
+
+// Lines containing query, ignoring ASCII case, in path and line order
+// (SearchHit*, owned by the caller). At most max_hits are returned.
+GPtrArray* search_index_query(SearchIndex *index, const gchar *query, guint max_hits);
+void search_hit_free(gpointer hit);
+
+// The cache file in the user's cache directory
+gchar* search_index_get_cache_path(void);
+
+// Replaces the contents of index with a saved index. On error the index
+// is left as it was.
+gboolean search_index_load(SearchIndex *index, const gchar *path, GError **error);
+// Writes the index atomically; only needed when it changed since the
+// last load or save
+gboolean search_index_save(SearchIndex *index, const gchar *path, GError **error);
+gboolean search_index_is_dirty(SearchIndex *index);
+
+#endif // NGINX_SEARCH_H
@@ -0,0 +1,209 @@
+#include "nginx_trace.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    gint64 start;
+    gint64 duration;
+    guint64 bytes;
+    guint spawns;
+    guint thread;
+    TraceOp op;
+} TraceEvent;
+
+gint trace_flags = 0;
+
+static const gchar *op_names[TRACE_N_OPS] = {
+    "load", "save", "create", "delete", "helper-write", "hosts",
+    "nginx-test", "nginx-reload", "highlight", "lint", "index", "search",
+    "wait-interact", "wait-bulk", "metadata",
+};
+
+static GMutex trace_lock;
+static TraceStats trace_stats[TRACE_N_OPS];
+static GArray *trace_events;        // TraceEvent, only with TRACE_FLAG_EVENTS
+static guint64 trace_dropped;
+static gchar *trace_path;
+static gint64 trace_epoch;
+static gint trace_next_thread = 1;
+
+static _Thread_local guint thread_spawns;
+static _Thread_local guint thread_id;
+
+// Monotonic time in nanoseconds; g_get_monotonic_time only has microseconds
+static gint64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+void trace_init(gboolean stats) {
+    trace_epoch = now_ns();
+    const gchar *path = g_getenv("NGINXUI_TRACE");
+    gint flags = stats ? TRACE_FLAG_STATS : 0;
+    if (path && *path) {
+        trace_path = g_strdup(path);
+        trace_events = g_array_new(FALSE, FALSE, sizeof(TraceEvent));
+        flags |= TRACE_FLAG_STATS | TRACE_FLAG_EVENTS;
+    }
+    g_atomic_int_set(&trace_flags, flags);
+}
+
+void trace_count_spawn(void) {
+    thread_spawns++;
+}
+
+void trace_begin_recorded(TraceSpan *span, TraceOp op) {
+    span->op = op;
+    span->spawns = thread_spawns;
+    span->start = now_ns();
+}
+
+static guint bucket_for(guint64 duration_ns) {
+    guint64 us = duration_ns / 1000;
+    guint bucket = us == 0 ? 0 : g_bit_storage(us);
+    return MIN(bucket, TRACE_N_BUCKETS - 1);
+}
+
+void trace_end_recorded(TraceSpan *span, guint64 bytes) {
+    gint64 end = now_ns();
+    guint64 duration = end - span->start;
+    guint spawns = thread_spawns - span->spawns;
+    if (thread_id == 0) {
+        thread_id = g_atomic_int_add(&trace_next_thread, 1);
+    }
+    
+    g_mutex_lock(&trace_lock);
+    TraceStats *stats = &trace_stats[span->op];
+    stats->count++;
+    stats->total_ns += duration;
+    stats->max_ns = MAX(stats->max_ns, duration);
+    stats->bytes += bytes;
+    stats->spawns += spawns;
+    stats->buckets[bucket_for(duration)]++;
+    
+    if (trace_events) {
+        if (trace_events->len < TRACE_MAX_EVENTS) {
+            TraceEvent event = { span->start, duration, bytes, spawns, thread_id, span->op };
+            g_array_append_val(trace_events, event);
+        } else {
+            trace_dropped++;
+        }
+    }
+    g_mutex_unlock(&trace_lock);
+    span->start = 0;
+}
+
+void trace_end_handed_over(TraceSpan *span) {
+    if (span->start == 0) return;
+    span->spawns = thread_spawns;
+    trace_end_recorded(span, 0);
+}
+
+const gchar* trace_op_name(TraceOp op) {
+    return op < TRACE_N_OPS ? op_names[op] : "unknown";
+}
+
+void trace_get_stats(TraceOp op, TraceStats *stats) {
+    g_mutex_lock(&trace_lock);
+    *stats = trace_stats[op];
+    g_mutex_unlock(&trace_lock);
+}
+
+void trace_reset_stats(void) {
+    g_mutex_lock(&trace_lock);
+    memset(trace_stats, 0, sizeof(trace_stats));
+    g_mutex_unlock(&trace_lock);
+}
+
+guint64 trace_stats_percentile_us(const TraceStats *stats, guint percent) {
+    if (stats->count == 0) return 0;
+    guint64 rank = MAX(1, (stats->count * percent + 99) / 100);
+    guint64 seen = 0;
+    for (guint i = 0; i < TRACE_N_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen >= rank) {
+            // The maximum bounds the last, open ended bucket and any other
+            return MIN(G_GUINT64_CONSTANT(1) << i, stats->max_ns / 1000);
+        }
+    }
+    return stats->max_ns / 1000;
+}
+
+gboolean trace_finish(GError **error) {
+    if (!trace_path) return TRUE;
+    
+    g_mutex_lock(&trace_lock);
+    GString *json = g_string_sized_new(64 + (gsize)trace_events->len * 160);
+    g_string_append(json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    gint pid = getpid();
+    g_string_append_printf(json,
+        "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"nginxui\"}}", pid);
+    for (guint i = 0; i < trace_events->len; i++) {
+        const TraceEvent *event = &g_array_index(trace_events, TraceEvent, i);
+        g_string_append_printf(json,
+            ",\n{\"name\":\"%s\",\"cat\":\"nginxui\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%" G_GUINT64_FORMAT ",\"spawns\":%u}}",
+            op_names[event->op], pid, event->thread,
+            (event->start - trace_epoch) / 1e3, event->duration / 1e3, event->bytes, event->spawns);
+    }
+    g_string_append_printf(json, "\n],\"otherData\":{\"dropped\":%" G_GUINT64_FORMAT "}}\n", trace_dropped);
+    g_array_set_size(trace_events, 0);
+    g_mutex_unlock(&trace_lock);
+    
+    gboolean ok = g_file_set_contents(trace_path, json->str, json->len, error);
+    g_string_free(json, TRUE);
+    return ok;
+}
+
+static void append_duration(GString *text, guint64 us) {
+    if (us < 1000) {
+        g_string_append_printf(text, " %7" G_GUINT64_FORMAT "us", us);
+    } else if (us < 1000000) {
+        g_string_append_printf(text, " %7.1fms", us / 1e3);
+    } else {
+        g_string_append_printf(text, " %8.2fs", us / 1e6);
+    }
+}
+
+gchar* trace_format_stats(void) {
+    static const gchar *bars[] = { " ", "\u2581", "\u2582", "\u2583", "\u2584",
+                                   "\u2585", "\u2586", "\u2587", "\u2588" };
+    GString *text = g_string_new(NULL);
+    guint n_shown = 0;
+    g_string_append_printf(text, "%-13s %7s %9s %9s %9s %9s %10s %6s  %s\n",
+                           "operation", "count", "mean", "p50", "p99", "max", "bytes", "spawns",
+                           " 1us       1ms       1s"); // bucket 1, 11 and 21
+    for (guint op = 0; op < TRACE_N_OPS; op++) {
+        TraceStats stats;
+        trace_get_stats(op, &stats);
+        if (stats.count == 0) continue;
+        n_shown++;
+        
+        g_string_append_printf(text, "%-13s %7" G_GUINT64_FORMAT, op_names[op], stats.count);
+        append_duration(text, stats.total_ns / stats.count / 1000);
+        append_duration(text, trace_stats_percentile_us(&stats, 50));
+        append_duration(text, trace_stats_percentile_us(&stats, 99));
+        append_duration(text, stats.max_ns / 1000);
+        gchar *bytes = g_format_size(stats.bytes);
+        g_string_append_printf(text, " %10s %6" G_GUINT64_FORMAT "  ", bytes, stats.spawns);
+        g_free(bytes);
+        
+        guint64 tallest = 0;
+        for (guint i = 0; i < TRACE_N_BUCKETS; i++) {
+            tallest = MAX(tallest, stats.buckets[i]);
+        }
+        for (guint i = 0; i < TRACE_N_BUCKETS; i++) {
+            guint64 height = stats.buckets[i];
+            // Any non-empty bucket shows at least the lowest bar
+            guint level = height == 0 ? 0 : 1 + (guint)(height * (G_N_ELEMENTS(bars) - 2) / tallest);
+            g_string_append(text, bars[level]);
+        }
+        g_string_append_c(text, '\n');
+    }
+    if (n_shown == 0) {
+        g_string_append(text, "Nothing measured yet\n");
+    }
+    return g_string_free(text, FALSE);
+}
@@ -0,0 +1,100 @@
+#ifndef NGINX_TRACE_H
+#define NGINX_TRACE_H
+
+#include <glib.h>
+
+// Timing spans around the slow operations. Each finished span adds its
+// duration, bytes and spawned processes to a per-operation histogram;
+// with NGINXUI_TRACE=FILE every span is also kept and written to FILE as
+// Chrome trace-event JSON (chrome://tracing, Perfetto) by trace_finish.
+// While neither is on, a span costs one load and a branch.
+
+typedef enum {
+    TRACE_OP_LOAD,
+    TRACE_OP_SAVE,
+    TRACE_OP_CREATE,
+    TRACE_OP_DELETE,
+    TRACE_OP_HELPER_WRITE,      // writes and unlinks through the privileged helper
+    TRACE_OP_HOSTS,
+    TRACE_OP_NGINX_TEST,
+    TRACE_OP_NGINX_RELOAD,
+    TRACE_OP_HIGHLIGHT,
+    TRACE_OP_LINT,
+    TRACE_OP_INDEX,             // a file added to the full-text index
+    TRACE_OP_SEARCH,            // a full-text query, bytes are the file bytes checked
+    TRACE_OP_WAIT_INTERACTIVE,  // interactive work queued in the worker pool
+    TRACE_OP_WAIT_BULK,         // bulk work queued in the worker pool
+    TRACE_OP_METADATA,          // checking the include tree against the metadata cache
+    TRACE_N_OPS
+} TraceOp;
+
+typedef enum {
+    TRACE_FLAG_STATS = 1 << 0,
+    TRACE_FLAG_EVENTS = 1 << 1
+} TraceFlags;
+
+// Bucket i counts spans of [2^(i-1), 2^i) microseconds, bucket 0 those
+// under 1us; the last one also takes everything longer
+#define TRACE_N_BUCKETS 26
+// Spans kept for the Chrome trace, later ones are only counted
+#define TRACE_MAX_EVENTS (1u << 20)
+
+typedef struct {
+    gint64 start;               // 0 when the span is not recorded
+    guint spawns;
+    TraceOp op;
+} TraceSpan;
+
+typedef struct {
+    guint64 count;
+    guint64 total_ns;
+    guint64 max_ns;
+    guint64 bytes;
+    guint64 spawns;
+    guint64 buckets[TRACE_N_BUCKETS];
+} TraceStats;
+
+extern gint trace_flags;
+
+// Turns on the histograms when stats is set, and everything when
+// NGINXUI_TRACE names a file. Call once before the first span.
+void trace_init(gboolean stats);
+// Writes the Chrome trace when NGINXUI_TRACE asked for one
+gboolean trace_finish(GError **error);
+
+void trace_begin_recorded(TraceSpan *span, TraceOp op);
+void trace_end_recorded(TraceSpan *span, guint64 bytes);
+
+static inline void trace_begin(TraceSpan *span, TraceOp op) {
+    span->start = 0;
+    if (G_LIKELY(!g_atomic_int_get(&trace_flags))) return;
+    trace_begin_recorded(span, op);
+}
+
+static inline void trace_end(TraceSpan *span, guint64 bytes) {
+    if (span->start != 0) trace_end_recorded(span, bytes);
+}
+
+// Ends a span that began on another thread, e.g. time spent in a queue.
+// Processes started meanwhile are not counted.
+void trace_end_handed_over(TraceSpan *span);
+
+// Whether the span will be recorded, for measurements that cost something
+static inline gboolean trace_is_recording(const TraceSpan *span) {
+    return span->start != 0;
+}
+
+// Called wherever a process is started on behalf of the current thread
+void trace_count_spawn(void);
+
+const gchar* trace_op_name(TraceOp op);
+void trace_get_stats(TraceOp op, TraceStats *stats);
+// Upper bound of the bucket holding the given percentile, in microseconds
+guint64 trace_stats_percentile_us(const TraceStats *stats, guint percent);
+void trace_reset_stats(void);
+
+// One line per operation that ran: count, mean, p50, p99, max, bytes,
+// spawned processes and the histogram drawn with block characters
+gchar* trace_format_stats(void);
+
+#endif // NGINX_TRACE_H
@@ -1,25 +1,47 @@
 #include "nginx_ui.h"
+#include "nginx_highlight.h"
 #include <glib/gstdio.h>
 
+// Publishes the records appended since the last frame in one update and
+// follows the end of the log unless the user scrolled away from it
+static gboolean flush_log(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+    (void)frame_clock; // Unused parameter
+    AppData *app_data = user_data;
+    app_data->log_tick_id = 0;
+    
+    GtkAdjustment *vadjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(widget));
+    gboolean at_end = gtk_adjustment_get_value(vadjustment) + gtk_adjustment_get_page_size(vadjustment) >=
+                      gtk_adjustment_get_upper(vadjustment) - 1.0;
+    
+    if (log_model_flush(app_data->log_model) && at_end) {
+        guint n_items = g_list_model_get_n_items(G_LIST_MODEL(app_data->log_model));
+        if (n_items > 0) {
+            gtk_list_view_scroll_to(GTK_LIST_VIEW(widget), n_items - 1, GTK_LIST_SCROLL_NONE, NULL);
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void append_log_full(AppData *app_data, LogSeverity severity, const gchar *source, const gchar *message) {
+    log_model_append(app_data->log_model, severity, source, message);
+    if (!app_data->log_tick_id) {
+        app_data->log_tick_id = gtk_widget_add_tick_callback(app_data->logs_view, flush_log, app_data, NULL);
+    }
+}
+
+// Log function of the core. nginx commands run on worker threads, and
+// the log is only touched from the main loop.
+static void on_core_log(LogSeverity severity, const gchar *source, const gchar *message, gpointer user_data) {
+    AppData *app_data = user_data;
+    if (g_main_context_is_owner(g_main_context_default())) {
+        append_log_full(app_data, severity, source, message);
+        return;
+    }
+    ui_event_queue_push_log(app_data->events, severity, source, message);
+}
+
 void append_log(AppData *app_data, const gchar *message) {
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app_data->logs_text));
-    GtkTextIter iter;
-    GDateTime *now = g_date_time_new_now_local();
-    gchar *timestamp = g_date_time_format(now, "[%H:%M:%S]");
-    
-    gtk_text_buffer_get_end_iter(buffer, &iter);
-    gtk_text_buffer_insert(buffer, &iter, timestamp, -1);
-    gtk_text_buffer_insert(buffer, &iter, " ", -1);
-    gtk_text_buffer_insert(buffer, &iter, message, -1);
-    gtk_text_buffer_insert(buffer, &iter, "\n", -1);
-    
-    g_free(timestamp);
-    g_date_time_unref(now);
-    
-    // Auto-scroll to bottom
-    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(app_data->logs_text),
-                                 gtk_text_buffer_get_insert(buffer),
-                                 0.0, FALSE, 0.0, 0.0);
+    append_log_full(app_data, log_severity_guess(message), "nginxui", message);
 }
 
 static void setup_list_item(GtkListItemFactory *factory, GtkListItem *item, gpointer user_data) {
@@ -28,6 +50,16 @@ static void setup_list_item(GtkListItemFactory *factory, GtkListItem *item, gpoi
     gtk_list_item_set_child(item, label);
 }
 
+// Hits are long lines in a narrow panel
+static void setup_search_item(GtkListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+    (void)factory; (void)user_data; // Unused parameters
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+    gtk_widget_add_css_class(label, "search-hit");
+    gtk_list_item_set_child(item, label);
+}
+
 static void bind_list_item(GtkListItemFactory *factory, GtkListItem *item, gpointer user_data) {
     (void)factory; (void)user_data; // Unused parameters
     GtkWidget *label = gtk_list_item_get_child(item);
@@ -38,6 +70,335 @@ static void bind_list_item(GtkListItemFactory *factory, GtkListItem *item, gpoin
     }
 }
 
+static void show_line(AppData *app_data, guint line) {
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(app_data->source_buffer, &iter, line - 1);
+    gtk_text_buffer_place_cursor(app_data->source_buffer, &iter);
+    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(app_data->editor),
+                                 gtk_text_buffer_get_insert(app_data->source_buffer), 0.1, TRUE, 0.0, 0.3);
+    gtk_widget_grab_focus(app_data->editor);
+}
+
+static void schedule_lint(AppData *app_data);
+static void cancel_lint(AppData *app_data);
+static void on_text_changed(GtkTextBuffer *buffer, Document *document);
+
+static void add_tag(GtkTextBuffer *buffer, const gchar *name, const gchar *first_property, ...) {
+    GtkTextTag *tag = gtk_text_tag_new(name);
+    va_list args;
+    va_start(args, first_property);
+    g_object_set_valist(G_OBJECT(tag), first_property, args);
+    va_end(args);
+    gtk_text_tag_table_add(gtk_text_buffer_get_tag_table(buffer), tag);
+    g_object_unref(tag);
+}
+
+// A buffer for one document: highlighting, lint underlines and the
+// handlers that follow its edits
+static GtkTextBuffer* new_document_buffer(Document *document) {
+#ifdef HAVE_GTKSOURCEVIEW
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(gtk_source_buffer_new(NULL));
+    GtkSourceLanguageManager *lm = gtk_source_language_manager_get_default();
+    
+    // Try to find nginx language definition
+    GtkSourceLanguage *lang = gtk_source_language_manager_get_language(lm, "nginx");
+    if (!lang) {
+        // Try alternative names
+        lang = gtk_source_language_manager_get_language(lm, "conf");
+        if (!lang) {
+            lang = gtk_source_language_manager_get_language(lm, "apache");
+        }
+    }
+    
+    if (lang) {
+        gtk_source_buffer_set_language(GTK_SOURCE_BUFFER(buffer), lang);
+    } else {
+        // Create a simple style scheme for basic highlighting
+        GtkSourceStyleSchemeManager *scheme_mgr = gtk_source_style_scheme_manager_get_default();
+        GtkSourceStyleScheme *scheme = gtk_source_style_scheme_manager_get_scheme(scheme_mgr, "classic");
+        if (scheme) {
+            gtk_source_buffer_set_style_scheme(GTK_SOURCE_BUFFER(buffer), scheme);
+        }
+    }
+    gtk_source_buffer_set_highlight_syntax(GTK_SOURCE_BUFFER(buffer), TRUE);
+#else
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    add_tag(buffer, "keyword", "foreground", "#0000FF", NULL);
+    add_tag(buffer, "directive", "foreground", "#0066CC", "weight", PANGO_WEIGHT_BOLD, NULL);
+    add_tag(buffer, "string", "foreground", "#008000", NULL);
+    add_tag(buffer, "comment", "foreground", "#808080", "style", PANGO_STYLE_ITALIC, NULL);
+    
+    // Start tracking per-line lexer state before the first edit
+    apply_syntax_highlighting(buffer);
+#endif
+    
+    // Lint diagnostics are underlined in place
+    GdkRGBA warning_color;
+    gdk_rgba_parse(&warning_color, "#E5A50A");
+    add_tag(buffer, "lint-error", "underline", PANGO_UNDERLINE_ERROR, NULL);
+    add_tag(buffer, "lint-warning", "underline", PANGO_UNDERLINE_ERROR, "underline-rgba", &warning_color, NULL);
+    
+    g_signal_connect(buffer, "changed", G_CALLBACK(on_text_changed), document);
+    return buffer;
+}
+
+static GtkWidget* new_document_view(void) {
+#ifdef HAVE_GTKSOURCEVIEW
+    GtkWidget *view = gtk_source_view_new();
+    gtk_source_view_set_show_line_numbers(GTK_SOURCE_VIEW(view), TRUE);
+    gtk_source_view_set_auto_indent(GTK_SOURCE_VIEW(view), TRUE);
+    gtk_source_view_set_tab_width(GTK_SOURCE_VIEW(view), 4);
+    gtk_source_view_set_insert_spaces_instead_of_tabs(GTK_SOURCE_VIEW(view), TRUE);
+#else
+    GtkWidget *view = gtk_text_view_new();
+    gtk_text_view_set_monospace(GTK_TEXT_VIEW(view), TRUE);
+#endif
+    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(view), GTK_WRAP_WORD);
+    // Nothing may be edited until the whole file is in the buffer
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(view), FALSE);
+    return view;
+}
+
+// Save, History and editing follow the load state of the active tab.
+// Writes wait on the helper, which is busy while nginx runs, so New, Save
+// and Delete are off until it finished.
+void update_document_actions(AppData *app_data) {
+    Document *document = app_data->current;
+    gboolean loaded = document && document->buffer && !document->loader;
+    gboolean idle = !app_data->nginx_command_running;
+    if (document) gtk_text_view_set_editable(GTK_TEXT_VIEW(document->view), loaded);
+    gtk_widget_set_sensitive(app_data->save_btn, loaded && idle);
+    gtk_widget_set_sensitive(app_data->history_btn, loaded && app_data->core->history != NULL);
+    // The file can be deleted while it loads
+    gtk_widget_set_sensitive(app_data->delete_btn, document != NULL && idle);
+    gtk_widget_set_sensitive(app_data->new_btn, idle);
+}
+
+// Unsaved edits are marked in the tab
+static void on_document_modified(GtkTextBuffer *buffer, Document *document) {
+    gchar *text = gtk_text_buffer_get_modified(buffer) ? g_strconcat("*", document->filename, NULL)
+                                                       : g_strdup(document->filename);
+    gtk_label_set_text(GTK_LABEL(document->label), text);
+    g_free(text);
+}
+
+// Large files take several frames to load; small ones never show the bar
+static void on_load_progress(gdouble fraction, gpointer user_data) {
+    Document *document = user_data;
+    AppData *app_data = document->user_data;
+    if (document != app_data->current) return;
+    gtk_widget_set_visible(app_data->load_progress, TRUE);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app_data->load_progress), fraction);
+}
+
+static void on_load_done(const GError *error, const gchar *digest, gpointer user_data) {
+    Document *document = user_data;
+    AppData *app_data = document->user_data;
+    gboolean is_current = document == app_data->current;
+    document->loader = NULL;
+    if (is_current) gtk_widget_set_visible(app_data->load_progress, FALSE);
+    
+    if (error) {
+        gchar *msg = g_strdup_printf("Error: Failed to load %s: %s", document->filename, error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+        // Shown again, the tab tries once more
+        document_set_buffer(document, NULL);
+        if (is_current) update_document_actions(app_data);
+        return;
+    }
+    
+    g_free(document->saved_digest);
+    document->saved_digest = g_strdup(digest);
+    gchar *filepath = nginx_core_get_path(app_data->core, document->filename);
+    document_mark_saved(document, filepath);
+    g_free(filepath);
+    gchar *msg = g_strdup_printf("Loaded: %s", document->filename);
+    append_log(app_data, msg);
+    g_free(msg);
+    
+    // What is staged for the file replaces what is on disk
+    const Change *change = change_set_lookup(app_data->staged, document->filename);
+    if (change && change->delete) {
+        msg = g_strdup_printf("Warning: %s is staged for deletion", document->filename);
+        append_log(app_data, msg);
+        g_free(msg);
+    } else if (change) {
+        gtk_text_buffer_set_text(document->buffer, change->content, change->length);
+        msg = g_strdup_printf("Showing the staged content of %s", document->filename);
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    // Staged content is kept by the change set, so it counts as saved
+    gtk_text_buffer_set_modified(document->buffer, FALSE);
+    
+    if (!is_current) return;
+    update_document_actions(app_data);
+    // Its size is known now
+    document_cache_touch(app_data->documents, document);
+    if (document->goto_line) {
+        show_line(app_data, document->goto_line);
+        document->goto_line = 0;
+    }
+}
+
+// Reads the file into a new buffer; highlighting follows from the
+// buffer's change signals
+static void load_document(AppData *app_data, Document *document) {
+    GtkTextBuffer *buffer = new_document_buffer(document);
+    g_signal_connect(buffer, "modified-changed", G_CALLBACK(on_document_modified), document);
+    document_set_buffer(document, buffer);
+    g_object_unref(buffer);
+    
+    gchar *filepath = nginx_core_get_path(app_data->core, document->filename);
+    document->loader = buffer_loader_start(buffer, filepath, on_load_progress, on_load_done, document);
+    g_free(filepath);
+}
+
+// Shows a document in the editor. A buffer that is still there is shown
+// as it was left, unless another program changed the file meanwhile.
+static void activate_document(AppData *app_data, Document *document) {
+    // Diagnostics in flight are about the previous document
+    cancel_lint(app_data);
+    app_data->current = document;
+    app_data->current_file = document->filename;
+    app_data->editor = document->view;
+    document_cache_touch(app_data->documents, document);
+    
+    gchar *filepath = nginx_core_get_path(app_data->core, document->filename);
+    if (document->buffer && !document->loader && document_changed_on_disk(document, filepath)) {
+        gchar *msg;
+        if (document_is_dirty(document)) {
+            msg = g_strdup_printf("Warning: %s changed on disk, saving replaces those changes", document->filename);
+            // Saving the buffer is only a no-op when it matches the new contents
+            gchar *content = NULL;
+            gsize length = 0;
+            g_free(document->saved_digest);
+            document->saved_digest = g_file_get_contents(filepath, &content, &length, NULL)
+                ? g_compute_checksum_for_data(LOADER_CHECKSUM, (const guchar *)content, length) : NULL;
+            g_free(content);
+            document_mark_saved(document, filepath);
+        } else {
+            msg = g_strdup_printf("%s changed on disk, loading it again", document->filename);
+            document_set_buffer(document, NULL);
+        }
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    g_free(filepath);
+    
+    gtk_widget_set_visible(app_data->load_progress, FALSE);
+    if (!document->buffer) load_document(app_data, document);
+    app_data->source_buffer = document->buffer;
+    update_document_actions(app_data);
+    update_include_context(app_data);
+    conf_file_list_show_name(app_data->conf_files, document->filename);
+    
+    if (!document->loader) {
+        if (document->goto_line) {
+            show_line(app_data, document->goto_line);
+            document->goto_line = 0;
+        }
+        if (document->lint_stale) schedule_lint(app_data);
+    }
+}
+
+static void on_tab_switched(GtkNotebook *notebook, GtkWidget *page, guint page_num, AppData *app_data) {
+    (void)notebook; // Unused parameter
+    (void)page_num; // Unused parameter
+    Document *document = document_cache_lookup_page(app_data->documents, page);
+    if (document && document != app_data->current) {
+        activate_document(app_data, document);
+    }
+}
+
+void close_document(AppData *app_data, Document *document) {
+    if (document == app_data->current) {
+        cancel_lint(app_data);
+        app_data->current = NULL;
+        app_data->current_file = NULL;
+        app_data->source_buffer = NULL;
+        app_data->editor = NULL;
+    }
+    // Removing the active tab shows another one
+    gtk_notebook_remove_page(GTK_NOTEBOOK(app_data->tabs),
+                             gtk_notebook_page_num(GTK_NOTEBOOK(app_data->tabs), document->page));
+    document_cache_remove(app_data->documents, document);
+    
+    if (!app_data->current) {
+        gtk_widget_set_visible(app_data->load_progress, FALSE);
+        update_document_actions(app_data);
+        update_include_context(app_data);
+        conf_file_list_show_name(app_data->conf_files, NULL);
+    }
+}
+
+static void on_close_response(GtkDialog *dialog, gint response_id, Document *document) {
+    gtk_window_destroy(GTK_WINDOW(dialog));
+    if (response_id == GTK_RESPONSE_YES) {
+        close_document(document->user_data, document);
+    }
+}
+
+static void on_tab_close_clicked(GtkButton *button, Document *document) {
+    (void)button; // Unused parameter
+    AppData *app_data = document->user_data;
+    if (!document_is_dirty(document)) {
+        close_document(app_data, document);
+        return;
+    }
+    
+    GtkWidget *dialog = gtk_message_dialog_new(
+        GTK_WINDOW(app_data->window),
+        GTK_DIALOG_MODAL,
+        GTK_MESSAGE_QUESTION,
+        GTK_BUTTONS_YES_NO,
+        "%s has unsaved changes. Close it anyway?",
+        document->filename
+    );
+    g_signal_connect(dialog, "response", G_CALLBACK(on_close_response), document);
+    gtk_window_present(GTK_WINDOW(dialog));
+}
+
+// Shows filename in its tab, opening one if needed, and moves to line
+// when it is not 0
+void open_document(AppData *app_data, const gchar *filename, guint line) {
+    Document *document = document_cache_lookup(app_data->documents, filename);
+    if (!document) {
+        document = document_cache_add(app_data->documents, filename);
+        document->user_data = app_data;
+        document->goto_line = line;
+        
+        GtkWidget *tab = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+        document->label = gtk_label_new(filename);
+        gtk_box_append(GTK_BOX(tab), document->label);
+        GtkWidget *close_btn = gtk_button_new_from_icon_name("window-close-symbolic");
+        gtk_button_set_has_frame(GTK_BUTTON(close_btn), FALSE);
+        gtk_widget_set_tooltip_text(close_btn, "Close");
+        g_signal_connect(close_btn, "clicked", G_CALLBACK(on_tab_close_clicked), document);
+        gtk_box_append(GTK_BOX(tab), close_btn);
+        
+        document->view = new_document_view();
+        document->page = gtk_scrolled_window_new();
+        gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(document->page), document->view);
+        gtk_widget_set_vexpand(document->page, TRUE);
+        gtk_widget_set_hexpand(document->page, TRUE);
+        // The first tab becomes the active one right away
+        gtk_notebook_append_page(GTK_NOTEBOOK(app_data->tabs), document->page, tab);
+        gtk_notebook_set_tab_reorderable(GTK_NOTEBOOK(app_data->tabs), document->page, TRUE);
+    } else if (line) {
+        document->goto_line = line;
+    }
+    
+    if (document != app_data->current) {
+        gtk_notebook_set_current_page(GTK_NOTEBOOK(app_data->tabs),
+                                      gtk_notebook_page_num(GTK_NOTEBOOK(app_data->tabs), document->page));
+    } else if (document->goto_line && !document->loader) {
+        show_line(app_data, document->goto_line);
+        document->goto_line = 0;
+    }
+}
+
 void on_file_selected(GObject *object, GParamSpec *pspec, AppData *app_data) {
     (void)pspec; // Unused parameter
     GtkSingleSelection *selection = GTK_SINGLE_SELECTION(object);
@@ -52,198 +413,892 @@ void on_file_selected(GObject *object, GParamSpec *pspec, AppData *app_data) {
     if (!item) return;
     
     const gchar *filename = gtk_string_object_get_string(GTK_STRING_OBJECT(item));
-    if (!filename) {
-        g_object_unref(item);
+    if (filename) open_document(app_data, filename, 0);
+    g_object_unref(item);
+}
+
+// Re-reads /etc/nginx/conf.d/ and applies any differences to the list.
+// Changes made while nginxui runs normally arrive through the monitor.
+void refresh_file_list(AppData *app_data) {
+    if (conf_file_list_rescan(app_data->conf_files, NULL)) {
+        guint count = conf_file_list_get_count(app_data->conf_files);
+        gchar *msg = g_strdup_printf("Loaded %u config file(s) from %s", count, NGINX_CONF_DIR);
+        append_log(app_data, msg);
+        g_free(msg);
+    } else {
+        append_log(app_data, "Error: Cannot access /etc/nginx/conf.d/");
+    }
+}
+
+typedef struct {
+    IncludeGraph *graph;
+    const gchar *path;
+    GString *text;
+} BlockSourcesContext;
+
+static void describe_block_sources(const ConfDocument *doc, const ConfNode *node, gpointer user_data) {
+    BlockSourcesContext *ctx = user_data;
+    if (!node->is_block ||
+        !(conf_span_equal(doc, node->name, "http") || conf_span_equal(doc, node->name, "server"))) {
         return;
     }
     
-    g_free(app_data->current_file);
-    app_data->current_file = g_strdup(filename);
+    gchar **files = include_graph_get_files_in_block(ctx->graph, ctx->path, node->line);
+    if (files[0]) {
+        g_string_append_printf(ctx->text, "%s%.*s block on line %u includes:",
+                               ctx->text->len ? "\n" : "", (int)node->name.length,
+                               conf_span_data(doc, node->name), node->line);
+        for (gint i = 0; files[i]; i++) {
+            g_string_append_printf(ctx->text, "\n    %s", files[i]);
+        }
+    }
+    g_strfreev(files);
+}
+
+// Shows where the current file sits in the effective configuration,
+// bringing the include graph up to date first when update is set
+static void describe_include_context(AppData *app_data, gboolean update) {
+    GtkWidget *label = app_data->context_label;
+    gtk_widget_set_tooltip_text(label, NULL);
+    if (!app_data->current_file) {
+        gtk_label_set_text(GTK_LABEL(label), "");
+        return;
+    }
+    // Building the graph here would read every config; the refresh brings one
+    if (app_data->metadata_refreshing && include_graph_get_n_files(app_data->core->includes) == 0) {
+        gtk_label_set_text(GTK_LABEL(label), "Context: reading the include tree...");
+        return;
+    }
     
-    // Load file content
-    gchar *filepath = g_strdup_printf("%s/%s", NGINX_CONF_DIR, filename);
-    gchar *content = NULL;
     GError *error = NULL;
+    if (update && include_graph_update(app_data->core->includes, &error) < 0) {
+        gtk_label_set_text(GTK_LABEL(label), error->message);
+        g_error_free(error);
+        return;
+    }
     
-    if (g_file_get_contents(filepath, &content, NULL, &error)) {
-        gtk_text_buffer_set_text(GTK_TEXT_BUFFER(app_data->source_buffer), content, -1);
-        
-        // Apply syntax highlighting after loading (only if not using GtkSourceView)
-        // GtkSourceView handles highlighting automatically
-#ifndef HAVE_GTKSOURCEVIEW
-        apply_syntax_highlighting(GTK_TEXT_BUFFER(app_data->source_buffer));
-#endif
-        
-        g_free(content);
-        
-        gchar *msg = g_strdup_printf("Loaded: %s", filename);
-        append_log(app_data, msg);
-        g_free(msg);
+    gchar *filepath = g_strdup_printf("%s/%s", NGINX_CONF_DIR, app_data->current_file);
+    gchar *context = include_graph_describe_context(app_data->core->includes, filepath);
+    if (context) {
+        GPtrArray *sites = include_graph_get_include_sites(app_data->core->includes, filepath);
+        IncludeSite *site = g_ptr_array_index(sites, 0);
+        gchar *text = g_strdup_printf("Context: %s (included from %s:%u)", context, site->path, site->line);
+        gtk_label_set_text(GTK_LABEL(label), text);
+        g_free(text);
     } else {
-        append_log(app_data, error->message);
-        g_error_free(error);
+        gtk_label_set_text(GTK_LABEL(label), "Not included from " NGINX_MAIN_CONF);
+    }
+    app_data->lint_context = conf_lint_context_from_description(context);
+    
+    // The tooltip lists the files feeding into this file's http/server blocks
+    const ConfDocument *doc = include_graph_get_document(app_data->core->includes, filepath);
+    if (doc) {
+        BlockSourcesContext ctx = { app_data->core->includes, filepath, g_string_new(NULL) };
+        conf_document_foreach(doc, describe_block_sources, &ctx);
+        if (ctx.text->len) {
+            gtk_widget_set_tooltip_text(label, ctx.text->str);
+        }
+        g_string_free(ctx.text, TRUE);
     }
     
+    g_free(context);
     g_free(filepath);
-    g_object_unref(item);
+}
+
+// Only files whose inode, mtime or size changed since the last call are
+// parsed
+void update_include_context(AppData *app_data) {
+    describe_include_context(app_data, TRUE);
+}
+
+void show_include_context(AppData *app_data) {
+    describe_include_context(app_data, FALSE);
+}
+
+#ifndef HAVE_GTKSOURCEVIEW
+#define HIGHLIGHT_STATE_KEY "nginx-highlight-state"
+
+// Tag names indexed by HighlightTokenKind
+static const gchar *highlight_tags[] = { "keyword", "directive", "string", "comment" };
+
+typedef struct {
+    GtkTextBuffer *buffer;
+    gint line;
+} HighlightLineContext;
+
+static void apply_token_tag(HighlightTokenKind kind, gsize start, gsize end, gpointer user_data) {
+    HighlightLineContext *ctx = user_data;
+    GtkTextIter tag_start, tag_end;
+    gtk_text_buffer_get_iter_at_line_index(ctx->buffer, &tag_start, ctx->line, (gint)start);
+    gtk_text_buffer_get_iter_at_line_index(ctx->buffer, &tag_end, ctx->line, (gint)end);
+    gtk_text_buffer_apply_tag_by_name(ctx->buffer, highlight_tags[kind], &tag_start, &tag_end);
+}
+
+typedef struct {
+    GtkTextBuffer *buffer;
+    guint64 bytes;
+} HighlightRunContext;
+
+static guint8 highlight_buffer_line(guint line, guint8 state_in, gpointer user_data) {
+    HighlightRunContext *run = user_data;
+    GtkTextBuffer *buffer = run->buffer;
+    GtkTextIter line_start, line_end;
+    gtk_text_buffer_get_iter_at_line(buffer, &line_start, (gint)line);
+    line_end = line_start;
+    if (!gtk_text_iter_ends_line(&line_end)) {
+        gtk_text_iter_forward_to_line_end(&line_end);
+    }
+    
+    // Only this line's highlighting is replaced, other tags are left alone
+    for (gsize i = 0; i < G_N_ELEMENTS(highlight_tags); i++) {
+        gtk_text_buffer_remove_tag_by_name(buffer, highlight_tags[i], &line_start, &line_end);
+    }
     
-    // Enable save and delete buttons
-    gtk_widget_set_sensitive(app_data->save_btn, TRUE);
-    gtk_widget_set_sensitive(app_data->delete_btn, TRUE);
+    gchar *text = gtk_text_buffer_get_slice(buffer, &line_start, &line_end, TRUE);
+    HighlightLineContext ctx = { buffer, (gint)line };
+    gsize length = strlen(text);
+    run->bytes += length;
+    guint8 state_out = highlight_lex_line(text, length, state_in, apply_token_tag, &ctx);
+    g_free(text);
+    return state_out;
 }
 
-void refresh_file_list(AppData *app_data) {
-    // Read files from /etc/nginx/conf.d/
-    GDir *dir = g_dir_open(NGINX_CONF_DIR, 0, NULL);
-    if (dir) {
-        const gchar *filename;
-        GtkStringList *string_list = gtk_string_list_new(NULL);
-        
-        while ((filename = g_dir_read_name(dir)) != NULL) {
-            if (g_str_has_suffix(filename, ".conf")) {
-                gtk_string_list_append(string_list, filename);
-            }
+static void on_highlight_insert_text(GtkTextBuffer *buffer, GtkTextIter *location,
+                                     gchar *text, gint len, HighlightState *state) {
+    (void)buffer; // Unused parameter
+    guint added = 0;
+    for (gint i = 0; i < len; i++) {
+        if (text[i] == '\n' || (text[i] == '\r' && (i + 1 >= len || text[i + 1] != '\n'))) {
+            added++;
         }
-        
-        GtkSingleSelection *selection = gtk_single_selection_new(G_LIST_MODEL(string_list));
-        g_signal_connect(selection, "notify::selected", G_CALLBACK(on_file_selected), app_data);
-        gtk_list_view_set_model(GTK_LIST_VIEW(app_data->file_list), GTK_SELECTION_MODEL(selection));
-        g_dir_close(dir);
-        
-        guint count = g_list_model_get_n_items(G_LIST_MODEL(string_list));
-        gchar *msg = g_strdup_printf("Loaded %u config file(s) from %s", count, NGINX_CONF_DIR);
-        append_log(app_data, msg);
-        g_free(msg);
-    } else {
-        append_log(app_data, "Error: Cannot access /etc/nginx/conf.d/");
     }
+    highlight_state_insert_lines(state, gtk_text_iter_get_line(location), added);
 }
 
+static void on_highlight_delete_range(GtkTextBuffer *buffer, GtkTextIter *start,
+                                      GtkTextIter *end, HighlightState *state) {
+    (void)buffer; // Unused parameter
+    gint first = MIN(gtk_text_iter_get_line(start), gtk_text_iter_get_line(end));
+    gint last = MAX(gtk_text_iter_get_line(start), gtk_text_iter_get_line(end));
+    highlight_state_remove_lines(state, first, last - first);
+}
+#endif
+
+// Re-highlights only the lines touched since the last call. The first call
+// on a buffer attaches the line-state tracker and highlights everything.
 void apply_syntax_highlighting(GtkTextBuffer *buffer) {
 #ifdef HAVE_GTKSOURCEVIEW
     (void)buffer; // Unused when GtkSourceView handles highlighting
 #else
-    // Nginx keywords and directives
-    const gchar *keywords[] = {
-        "server", "listen", "server_name", "location", "root", "index", 
-        "proxy_pass", "proxy_set_header", "access_log", "error_log",
-        "return", "rewrite", "try_files", "include", "if", "set",
-        "upstream", "worker_processes", "events", "http", "gzip",
-        "ssl_certificate", "ssl_certificate_key", "ssl_protocols",
-        "client_max_body_size", "keepalive_timeout", "types",
-        NULL
-    };
+    HighlightState *state = g_object_get_data(G_OBJECT(buffer), HIGHLIGHT_STATE_KEY);
+    if (!state) {
+        state = highlight_state_new();
+        g_object_set_data_full(G_OBJECT(buffer), HIGHLIGHT_STATE_KEY, state,
+                               (GDestroyNotify)highlight_state_free);
+        g_signal_connect(buffer, "insert-text", G_CALLBACK(on_highlight_insert_text), state);
+        g_signal_connect(buffer, "delete-range", G_CALLBACK(on_highlight_delete_range), state);
+        highlight_state_reset(state, gtk_text_buffer_get_line_count(buffer));
+    }
     
-    GtkTextIter start, end;
-    gtk_text_buffer_get_bounds(buffer, &start, &end);
-    gchar *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_HIGHLIGHT);
+    HighlightRunContext run = { buffer, 0 };
+    highlight_state_relex(state, gtk_text_buffer_get_line_count(buffer),
+                          highlight_buffer_line, &run);
+    trace_end(&span, run.bytes);
+#endif
+}
+
+typedef struct {
+    AppData *app_data;
+    Document *document;         // only compared, it may be closed meanwhile
+    gchar *text;
+    LintContext context;
+    guint generation;
+} LintJob;
+
+// What a lint run sends back through the event queue
+typedef struct {
+    guint generation;
+    GPtrArray *diagnostics;
+} LintResult;
+
+static void lint_job_free(gpointer data) {
+    LintJob *job = data;
+    g_free(job->text);
+    g_free(job);
+}
+
+static void lint_result_free(gpointer data) {
+    LintResult *result = data;
+    g_ptr_array_unref(result->diagnostics);
+    g_free(result);
+}
+
+static void lint_thread(gpointer data, GCancellable *cancellable) {
+    LintJob *job = data;
+    TraceSpan span;
+    trace_begin(&span, TRACE_OP_LINT);
+    gsize length = strlen(job->text);
+    ConfDocument *doc = conf_document_parse(job->text, length);
+    GPtrArray *diagnostics = conf_lint_document(doc, job->context, cancellable);
+    conf_document_free(doc);
+    // Cancelled runs did not finish the work they would be timed for
+    if (!diagnostics) return;
+    trace_end(&span, length);
+    
+    LintResult *result = g_new0(LintResult, 1);
+    result->generation = job->generation;
+    result->diagnostics = diagnostics;
+    ui_event_queue_push_diagnostics(job->app_data->events, job->document, result, lint_result_free);
+}
+
+static void get_diagnostic_bounds(GtkTextBuffer *buffer, const LintDiagnostic *diagnostic,
+                                  GtkTextIter *start, GtkTextIter *end) {
+    gtk_text_buffer_get_iter_at_line_index(buffer, start, diagnostic->line - 1, diagnostic->column);
+    gtk_text_buffer_get_iter_at_line_index(buffer, end, diagnostic->line - 1,
+                                           diagnostic->column + diagnostic->length);
+    // Positions between tokens (a missing ";") mark the character before
+    if (gtk_text_iter_equal(start, end)) {
+        gtk_text_iter_backward_char(start);
+    }
+}
+
+// Runs when the event queue is drained; of several runs on a document
+// only the newest one's result arrives
+static void apply_lint_result(AppData *app_data, const Document *document, const LintResult *result) {
+    GPtrArray *diagnostics = result->diagnostics;
     
-    if (!text || !*text) {
-        g_free(text);
+    // Another tab is shown, or the buffer changed again while this run was going
+    if (document != app_data->current || result->generation != app_data->lint_generation) {
         return;
     }
+    g_clear_object(&app_data->lint_cancellable);
     
-    // Remove all existing tags first
-    gtk_text_buffer_remove_all_tags(buffer, &start, &end);
-    
-    // Apply comment highlighting
-    gchar *line_start = text;
-    gchar *line_end;
-    gint line_num = 0;
-    while ((line_end = strchr(line_start, '\n')) != NULL || *line_start != '\0') {
-        gint line_len = line_end ? (gint)(line_end - line_start) : (gint)strlen(line_start);
-        gchar *line = g_strndup(line_start, line_len);
-        gchar *trimmed = g_strstrip(line);
-        
-        // Check for comments
-        if (*trimmed == '#') {
-            GtkTextIter comment_start, comment_end;
-            gtk_text_buffer_get_iter_at_line(buffer, &comment_start, line_num);
-            gtk_text_buffer_get_iter_at_line(buffer, &comment_end, line_num);
-            gtk_text_iter_forward_to_line_end(&comment_end);
-            gtk_text_buffer_apply_tag_by_name(buffer, "comment", &comment_start, &comment_end);
-        } else {
-            // Check for strings (simple: text between quotes)
-            gchar *quote_start = strchr(line_start, '"');
-            if (quote_start && quote_start < (line_end ? line_end : line_start + strlen(line_start))) {
-                gchar *quote_end = strchr(quote_start + 1, '"');
-                if (quote_end && quote_end < (line_end ? line_end : line_start + strlen(line_start))) {
-                    GtkTextIter str_start, str_end;
-                    gint str_start_offset = quote_start - text;
-                    gint str_end_offset = quote_end - text + 1;
-                    gtk_text_buffer_get_iter_at_offset(buffer, &str_start, str_start_offset);
-                    gtk_text_buffer_get_iter_at_offset(buffer, &str_end, str_end_offset);
-                    gtk_text_buffer_apply_tag_by_name(buffer, "string", &str_start, &str_end);
-                }
-            }
-            
-            // Check for keywords
-            for (gint i = 0; keywords[i] != NULL; i++) {
-                gchar *keyword_pos = line_start;
-                gsize keyword_len = strlen(keywords[i]);
-                while ((keyword_pos = strstr(keyword_pos, keywords[i])) != NULL) {
-                    // Check if it's a whole word
-                    gboolean is_word = TRUE;
-                    if (keyword_pos > text && 
-                        (g_ascii_isalnum(keyword_pos[-1]) || keyword_pos[-1] == '_')) {
-                        is_word = FALSE;
-                    }
-                    if (keyword_pos + keyword_len < text + strlen(text) &&
-                        (g_ascii_isalnum(keyword_pos[keyword_len]) || keyword_pos[keyword_len] == '_')) {
-                        is_word = FALSE;
-                    }
-                    
-                    if (is_word) {
-                        GtkTextIter kw_start, kw_end;
-                        gint kw_offset = keyword_pos - text;
-                        gtk_text_buffer_get_iter_at_offset(buffer, &kw_start, kw_offset);
-                        gtk_text_buffer_get_iter_at_offset(buffer, &kw_end, kw_offset + keyword_len);
-                        
-                        // Use directive tag for common nginx directives
-                        if (strcmp(keywords[i], "server") == 0 || 
-                            strcmp(keywords[i], "location") == 0 ||
-                            strcmp(keywords[i], "upstream") == 0 ||
-                            strcmp(keywords[i], "http") == 0 ||
-                            strcmp(keywords[i], "events") == 0) {
-                            gtk_text_buffer_apply_tag_by_name(buffer, "directive", &kw_start, &kw_end);
-                        } else {
-                            gtk_text_buffer_apply_tag_by_name(buffer, "keyword", &kw_start, &kw_end);
-                        }
-                    }
-                    keyword_pos += keyword_len;
-                }
-            }
-        }
+    GtkTextBuffer *buffer = app_data->source_buffer;
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    gtk_text_buffer_remove_tag_by_name(buffer, "lint-error", &start, &end);
+    gtk_text_buffer_remove_tag_by_name(buffer, "lint-warning", &start, &end);
+    
+    // Only diagnostics that were not there on the previous run reach the log
+    GHashTable *logged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (guint i = 0; i < diagnostics->len; i++) {
+        const LintDiagnostic *diagnostic = g_ptr_array_index(diagnostics, i);
+        gboolean is_error = diagnostic->severity == LINT_SEVERITY_ERROR;
+        get_diagnostic_bounds(buffer, diagnostic, &start, &end);
+        gtk_text_buffer_apply_tag_by_name(buffer, is_error ? "lint-error" : "lint-warning", &start, &end);
         
-        g_free(line);
-        if (line_end) {
-            line_start = line_end + 1;
-            line_num++;
-        } else {
-            break;
+        gchar *msg = g_strdup_printf("%s: %s:%u: %s", is_error ? "Error" : "Warning",
+                                     app_data->current_file, diagnostic->line, diagnostic->message);
+        if (!g_hash_table_contains(app_data->current->lint_logged, msg)) {
+            append_log(app_data, msg);
         }
+        g_hash_table_add(logged, msg);
     }
-    
-    g_free(text);
-#endif
+    g_hash_table_unref(app_data->current->lint_logged);
+    app_data->current->lint_logged = logged;
+    app_data->current->lint_stale = FALSE;
 }
 
-static void on_text_changed(GtkTextBuffer *buffer, AppData *app_data) {
-    (void)app_data; // Unused parameter
+static gboolean start_lint(gpointer user_data) {
+    AppData *app_data = user_data;
+    app_data->lint_timeout_id = 0;
+    if (!app_data->current) return G_SOURCE_REMOVE;
+    
+    if (app_data->lint_cancellable) {
+        g_cancellable_cancel(app_data->lint_cancellable);
+        g_object_unref(app_data->lint_cancellable);
+    }
+    app_data->lint_cancellable = g_cancellable_new();
+    
+    LintJob *job = g_new0(LintJob, 1);
+    job->app_data = app_data;
+    job->document = app_data->current;
+    job->context = app_data->lint_context;
+    job->generation = app_data->lint_generation;
     GtkTextIter start, end;
-    gtk_text_buffer_get_bounds(buffer, &start, &end);
-    gchar *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
-    (void)strlen(text); // Character count available if needed
-    g_free(text);
+    gtk_text_buffer_get_bounds(app_data->source_buffer, &start, &end);
+    job->text = gtk_text_buffer_get_text(app_data->source_buffer, &start, &end, FALSE);
+    
+    work_pool_push(work_pool_get_default(), WORK_PRIORITY_INTERACTIVE, lint_thread, NULL,
+                   job, lint_job_free, app_data->lint_cancellable);
+    return G_SOURCE_REMOVE;
+}
+
+// Drops the pending run and the one in flight, whose results are stale
+static void cancel_lint(AppData *app_data) {
+    app_data->lint_generation++;
+    if (app_data->lint_cancellable) {
+        g_cancellable_cancel(app_data->lint_cancellable);
+        g_clear_object(&app_data->lint_cancellable);
+    }
+    if (app_data->lint_timeout_id) {
+        g_source_remove(app_data->lint_timeout_id);
+        app_data->lint_timeout_id = 0;
+    }
+}
+
+// Lints the buffer once typing pauses. An edit makes any run in flight
+// stale, so it is cancelled right away rather than left to finish.
+static void schedule_lint(AppData *app_data) {
+    cancel_lint(app_data);
+    app_data->lint_timeout_id = g_timeout_add(LINT_DEBOUNCE_MS, start_lint, app_data);
+}
+
+// Only the active document is linted; the others are when shown again
+static void on_text_changed(GtkTextBuffer *buffer, Document *document) {
+    AppData *app_data = document->user_data;
+    document->lint_stale = TRUE;
+    if (document == app_data->current) schedule_lint(app_data);
     
     // Apply syntax highlighting (only if not using GtkSourceView)
     // GtkSourceView handles highlighting automatically
 #ifndef HAVE_GTKSOURCEVIEW
     apply_syntax_highlighting(buffer);
+#else
+    (void)buffer; // Unused parameter
 #endif
 }
 
+// Entries of the severity drop-down, indexed by LogSeverity
+static const gchar *log_severity_filters[] = { "All messages", "Successes and problems",
+                                               "Warnings and errors", "Errors only", NULL };
+static const gchar *log_severity_classes[] = { "info", "success", "warning", "error" };
+
+static void setup_log_item(GtkListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+    (void)factory; (void)user_data; // Unused parameters
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_wrap(GTK_LABEL(label), TRUE);
+    gtk_label_set_selectable(GTK_LABEL(label), TRUE);
+    gtk_list_item_set_child(item, label);
+}
+
+static void bind_log_item(GtkListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+    (void)factory; (void)user_data; // Unused parameters
+    GtkWidget *label = gtk_list_item_get_child(item);
+    LogItem *log_item = LOG_ITEM(gtk_list_item_get_item(item));
+    
+    GDateTime *time = g_date_time_new_from_unix_local(log_item_get_timestamp(log_item) / G_USEC_PER_SEC);
+    gchar *timestamp = g_date_time_format(time, "[%H:%M:%S]");
+    gchar *text = g_strdup_printf("%s %s", timestamp, log_item_get_message(log_item));
+    gtk_label_set_text(GTK_LABEL(label), text);
+    g_free(text);
+    g_free(timestamp);
+    g_date_time_unref(time);
+    
+    // Rows are recycled, so the previous record's class has to go
+    for (gsize i = 0; i < G_N_ELEMENTS(log_severity_classes); i++) {
+        gtk_widget_remove_css_class(label, log_severity_classes[i]);
+    }
+    gtk_widget_add_css_class(label, log_severity_classes[log_item_get_severity(log_item)]);
+}
+
+static void on_log_filter_changed(GObject *object, GParamSpec *pspec, AppData *app_data) {
+    (void)object; (void)pspec; // Unused parameters
+    guint selected = gtk_drop_down_get_selected(GTK_DROP_DOWN(app_data->log_severity));
+    const gchar *search = gtk_editable_get_text(GTK_EDITABLE(app_data->log_search));
+    log_model_set_filter(app_data->log_model, (LogSeverity)selected, search);
+}
+
+static void on_file_filter_changed(GtkSearchEntry *entry, AppData *app_data) {
+    conf_file_list_set_filter(app_data->conf_files, gtk_editable_get_text(GTK_EDITABLE(entry)));
+}
+
+// Enter opens the best match
+static void on_file_filter_activate(GtkSearchEntry *entry, AppData *app_data) {
+    (void)entry; // Unused parameter
+    conf_file_list_select_first(app_data->conf_files);
+}
+
+typedef struct {
+    AppData *app_data;
+    SearchIndex *index;
+    gchar **paths;
+    gchar *cache_path;
+    gboolean load;              // the first pass of a session starts from the cache
+    guint n_indexed;
+    guint n_dropped;
+    GError *save_error;
+} SearchIndexJob;
+
+static void search_index_job_free(gpointer data) {
+    SearchIndexJob *job = data;
+    g_strfreev(job->paths);
+    g_free(job->cache_path);
+    g_clear_error(&job->save_error);
+    g_free(job);
+}
+
+// Only files whose mtime or size changed since the cache was written are read
+static void search_index_thread(gpointer data, GCancellable *cancellable) {
+    (void)cancellable; // Unused parameter
+    SearchIndexJob *job = data;
+    // A missing or outdated cache only means indexing everything
+    if (job->load) {
+        search_index_load(job->index, job->cache_path, NULL);
+    }
+    guint n_paths = g_strv_length(job->paths);
+    UiEventQueue *events = job->app_data->events;
+    for (guint i = 0; i < n_paths; i++) {
+        if (search_index_refresh_file(job->index, job->paths[i])) job->n_indexed++;
+        // One per file; the drain keeps the newest per frame
+        ui_event_queue_push_progress(events, job->index, (gdouble)(i + 1) / n_paths);
+    }
+    ui_event_queue_push_progress(events, job->index, 1.0);
+    job->n_dropped = search_index_retain(job->index, (const gchar * const *)job->paths);
+    if (search_index_is_dirty(job->index)) {
+        search_index_save(job->index, job->cache_path, &job->save_error);
+    }
+}
+
+static void on_search_changed(GtkSearchEntry *entry, AppData *app_data);
+
+static void on_search_index_done(gpointer data, gboolean cancelled) {
+    (void)cancelled; // Unused parameter
+    SearchIndexJob *job = data;
+    AppData *app_data = job->app_data;
+    app_data->search_indexing = FALSE;
+    
+    if (job->n_indexed || job->n_dropped) {
+        gchar *msg = g_strdup_printf("Search index: %u file(s), %u re-indexed, %u removed",
+                                     search_index_get_n_files(job->index), job->n_indexed, job->n_dropped);
+        append_log(app_data, msg);
+        g_free(msg);
+        on_search_changed(GTK_SEARCH_ENTRY(app_data->search_entry), app_data);
+    }
+    if (job->save_error) {
+        gchar *msg = g_strdup_printf("Warning: Cannot save the search index: %s", job->save_error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    if (app_data->search_reindex) {
+        app_data->search_reindex = FALSE;
+        update_search_index(app_data);
+    }
+}
+
+// Brings the full-text index up to date with the disk on a worker thread.
+// Saves made in the meantime update the index directly.
+void update_search_index(AppData *app_data) {
+    if (app_data->search_indexing) {
+        app_data->search_reindex = TRUE;
+        return;
+    }
+    app_data->search_indexing = TRUE;
+    SearchIndexJob *job = g_new0(SearchIndexJob, 1);
+    job->app_data = app_data;
+    job->index = app_data->core->search;
+    job->paths = nginx_core_list_search_files(app_data->core);
+    job->cache_path = search_index_get_cache_path();
+    job->load = !app_data->search_loaded;
+    app_data->search_loaded = TRUE;
+    
+    work_pool_push(work_pool_get_default(), WORK_PRIORITY_BULK, search_index_thread, on_search_index_done,
+                   job, search_index_job_free, NULL);
+}
+
+typedef struct {
+    AppData *app_data;
+    MetadataRefresh *refresh;
+} MetadataJob;
+
+static void metadata_job_free(gpointer data) {
+    MetadataJob *job = data;
+    metadata_refresh_free(job->refresh);
+    g_free(job);
+}
+
+static void metadata_thread(gpointer data, GCancellable *cancellable) {
+    (void)cancellable; // Unused parameter
+    MetadataJob *job = data;
+    job->refresh = nginx_core_refresh_metadata(job->app_data->core);
+}
+
+static void on_metadata_done(gpointer data, gboolean cancelled) {
+    (void)cancelled; // Unused parameter
+    MetadataJob *job = data;
+    AppData *app_data = job->app_data;
+    app_data->metadata_refreshing = FALSE;
+    MetadataRefresh *refresh = job->refresh;
+    nginx_core_apply_metadata(app_data->core, refresh);
+    if (!refresh->error && refresh->n_touched) {
+        gchar *msg = g_strdup_printf("Metadata: %u file(s) had a new timestamp but the same contents",
+                                     refresh->n_touched);
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    
+    // Both walk the include graph, which is there now
+    update_include_context(app_data);
+    update_search_index(app_data);
+}
+
+// Checks the summaries the conflict index was built from against the
+// disk on a worker thread; the first frame shows the cached state
+static void refresh_metadata(AppData *app_data) {
+    if (app_data->metadata_refreshing) return;
+    app_data->metadata_refreshing = TRUE;
+    MetadataJob *job = g_new0(MetadataJob, 1);
+    job->app_data = app_data;
+    work_pool_push(work_pool_get_default(), WORK_PRIORITY_BULK, metadata_thread, on_metadata_done,
+                   job, metadata_job_free, NULL);
+}
+
+// The index answers from posting lists, so every keystroke queries it
+static void on_search_changed(GtkSearchEntry *entry, AppData *app_data) {
+    const gchar *query = gtk_editable_get_text(GTK_EDITABLE(entry));
+    GPtrArray *hits = search_index_query(app_data->core->search, query, SEARCH_MAX_HITS);
+    
+    const gchar *conf_dir = app_data->core->conf_dir;
+    gsize conf_dir_length = strlen(conf_dir);
+    gchar **rows = g_new0(gchar *, hits->len + 1);
+    for (guint i = 0; i < hits->len; i++) {
+        const SearchHit *hit = g_ptr_array_index(hits, i);
+        // Files in the config directory are shown by name, like in the file list
+        const gchar *name = hit->path;
+        if (g_str_has_prefix(name, conf_dir) && name[conf_dir_length] == '/') {
+            name += conf_dir_length + 1;
+        }
+        rows[i] = g_strdup_printf("%s:%u: %s", name, hit->line, hit->text);
+    }
+    
+    if (app_data->search_hits) g_ptr_array_unref(app_data->search_hits);
+    app_data->search_hits = hits;
+    gtk_string_list_splice(app_data->search_rows, 0,
+                           g_list_model_get_n_items(G_LIST_MODEL(app_data->search_rows)),
+                           (const gchar * const *)rows);
+    g_strfreev(rows);
+}
+
+// Opens the file of a hit at its line. Only files in the config directory
+// can be edited; hits elsewhere are just shown.
+static void on_search_hit_activated(GtkListView *view, guint position, AppData *app_data) {
+    (void)view; // Unused parameter
+    if (!app_data->search_hits || position >= app_data->search_hits->len) return;
+    const SearchHit *hit = g_ptr_array_index(app_data->search_hits, position);
+    
+    gchar *dir = g_path_get_dirname(hit->path);
+    gboolean editable = strcmp(dir, app_data->core->conf_dir) == 0;
+    g_free(dir);
+    if (!editable) {
+        gchar *msg = g_strdup_printf("%s:%u is outside %s and cannot be opened here",
+                                     hit->path, hit->line, app_data->core->conf_dir);
+        append_log(app_data, msg);
+        g_free(msg);
+        return;
+    }
+    
+    gchar *name = g_path_get_basename(hit->path);
+    open_document(app_data, name, hit->line);
+    g_free(name);
+}
+
+// Histograms, then what the worker pool is doing right now, how long its
+// work waited being in the wait-* rows, and how much the event queue merged
+static void update_stats_panel(AppData *app_data) {
+    gchar *histograms = trace_format_stats();
+    WorkPoolStats pool;
+    work_pool_get_stats(work_pool_get_default(), &pool);
+    gchar *text = g_strdup_printf("%s\nworkers: %u, %u running, queued %u interactive + %u bulk, "
+                                  "%" G_GUINT64_FORMAT " done (%" G_GUINT64_FORMAT " cancelled, "
+                                  "%" G_GUINT64_FORMAT " stolen) in %" G_GUINT64_FORMAT " batch(es)",
+                                  histograms, pool.n_threads, pool.running,
+                                  pool.queued[WORK_PRIORITY_INTERACTIVE], pool.queued[WORK_PRIORITY_BULK],
+                                  pool.finished, pool.skipped, pool.stolen, pool.batches);
+    UiEventStats events;
+    ui_event_queue_get_stats(app_data->events, &events);
+    gchar *full = g_strdup_printf("%s\nevents: %" G_GUINT64_FORMAT " applied of %" G_GUINT64_FORMAT
+                                  " (%" G_GUINT64_FORMAT " merged, %" G_GUINT64_FORMAT " log lines dropped) "
+                                  "in %" G_GUINT64_FORMAT " frame(s)",
+                                  text, events.taken - events.merged - events.dropped, events.taken,
+                                  events.merged, events.dropped, events.drains);
+    gtk_label_set_text(GTK_LABEL(app_data->stats_label), full);
+    g_free(full);
+    g_free(text);
+    g_free(histograms);
+}
+
+static gboolean on_stats_timeout(gpointer user_data) {
+    update_stats_panel(user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+// The panel is only redrawn while somebody can see it
+static void on_stats_expanded(GObject *object, GParamSpec *pspec, AppData *app_data) {
+    (void)pspec; // Unused parameter
+    if (gtk_expander_get_expanded(GTK_EXPANDER(object))) {
+        update_stats_panel(app_data);
+        app_data->stats_timeout_id = g_timeout_add(STATS_REFRESH_MS, on_stats_timeout, app_data);
+    } else if (app_data->stats_timeout_id) {
+        g_source_remove(app_data->stats_timeout_id);
+        app_data->stats_timeout_id = 0;
+    }
+}
+
+static void on_stats_reset_clicked(GtkButton *button, AppData *app_data) {
+    (void)button; // Unused parameter
+    trace_reset_stats();
+    update_stats_panel(app_data);
+}
+
+typedef struct _RouteJob RouteJob;
+typedef void (*RouteJobFunc)(RouteJob *job);
+
+// Routes of the configs on disk, and of the same configs with the open
+// file replaced by the editor buffer when a file is open
+struct _RouteJob {
+    AppData *app_data;
+    RouteSnapshot *snapshot;
+    gchar *filename;            // the open file when the job started, NULL when none was
+    gchar *path;                // its path
+    gchar *text;                // its editor buffer
+    RouteTable *buffer;         // the routes with text standing in for the file
+    RouteJobFunc done;          // on the main thread once the tables are built
+    gchar *query;               // the host a lookup asks for
+    gchar *uri;
+    gchar *log_path;            // the access log a replay reads
+    RouteReplay replay;
+};
+
+static void route_job_free(gpointer data) {
+    RouteJob *job = data;
+    route_replay_clear(&job->replay);
+    route_table_free(job->buffer);
+    route_snapshot_unref(job->snapshot);
+    g_free(job->log_path);
+    g_free(job->uri);
+    g_free(job->query);
+    g_free(job->text);
+    g_free(job->path);
+    g_free(job->filename);
+    g_free(job);
+}
+
+static void route_tables_thread(gpointer data, GCancellable *cancellable) {
+    (void)cancellable; // Unused parameter
+    RouteJob *job = data;
+    // Only a snapshot taken for this job still needs its table
+    route_snapshot_build(job->snapshot);
+    if (!job->filename) return;
+    ConfDocument *doc = conf_document_parse(job->text, strlen(job->text));
+    job->buffer = route_snapshot_build_with(job->snapshot, job->path, doc);
+    conf_document_free(doc);
+}
+
+static void on_route_tables_done(gpointer data, gboolean cancelled) {
+    (void)cancelled; // Unused parameter
+    RouteJob *job = data;
+    AppData *app_data = job->app_data;
+    // Kept for the next job until the include graph changes
+    if (job->snapshot != app_data->routes && nginx_core_routes_current(app_data->core, job->snapshot)) {
+        route_snapshot_unref(app_data->routes);
+        app_data->routes = route_snapshot_ref(job->snapshot);
+    }
+    job->done(job);
+}
+
+// The disk table is reused while the include graph is unchanged; the
+// editor's table and a new disk table are built on the worker pool
+static void start_route_job(AppData *app_data, RouteJob *job) {
+    job->app_data = app_data;
+    if (app_data->routes && !nginx_core_routes_current(app_data->core, app_data->routes)) {
+        route_snapshot_unref(app_data->routes);
+        app_data->routes = NULL;
+    }
+    job->snapshot = app_data->routes ? route_snapshot_ref(app_data->routes)
+                                     : nginx_core_snapshot_routes(app_data->core);
+    if (app_data->current_file) {
+        job->filename = g_strdup(app_data->current_file);
+        job->path = nginx_core_get_path(app_data->core, app_data->current_file);
+        GtkTextIter start, end;
+        gtk_text_buffer_get_bounds(app_data->source_buffer, &start, &end);
+        job->text = gtk_text_buffer_get_text(app_data->source_buffer, &start, &end, FALSE);
+    }
+    work_pool_push(work_pool_get_default(), WORK_PRIORITY_INTERACTIVE, route_tables_thread, on_route_tables_done,
+                   job, NULL, NULL);
+}
+
+static void on_route_lookup_done(RouteJob *job) {
+    AppData *app_data = job->app_data;
+    RouteResult result;
+    route_table_lookup(route_snapshot_get_table(job->snapshot), job->query, ROUTE_DEFAULT_PORT, job->uri, &result);
+    gchar *route = route_result_describe(&result);
+    gchar *msg = g_strdup_printf("Route %s %s: %s", job->query, job->uri, route);
+    append_log(app_data, msg);
+    g_free(msg);
+    g_free(route);
+    
+    if (job->buffer) {
+        RouteResult edited;
+        route_table_lookup(job->buffer, job->query, ROUTE_DEFAULT_PORT, job->uri, &edited);
+        if (strcmp(route_result_get_key(&result), route_result_get_key(&edited)) != 0) {
+            route = route_result_describe(&edited);
+            msg = g_strdup_printf("Warning: With the editor's %s: %s", job->filename, route);
+            append_log(app_data, msg);
+            g_free(msg);
+            g_free(route);
+        }
+    }
+    route_job_free(job);
+}
+
+static void on_route_lookup_activate(GtkWidget *widget, AppData *app_data) {
+    (void)widget; // Unused parameter
+    gchar *query = g_strstrip(g_strdup(gtk_editable_get_text(GTK_EDITABLE(app_data->route_entry))));
+    if (!*query) {
+        g_free(query);
+        return;
+    }
+    // "host[:port] /uri", the URI defaults to /
+    gchar *uri = strpbrk(query, " \t");
+    if (uri) {
+        *uri++ = '\0';
+        g_strchug(uri);
+    }
+    
+    RouteJob *job = g_new0(RouteJob, 1);
+    job->query = query;
+    job->uri = g_strdup(uri && *uri ? uri : "/");
+    job->done = on_route_lookup_done;
+    start_route_job(app_data, job);
+}
+
+static void on_route_replay_done(RouteReplay *replay, const GError *error, gpointer data) {
+    RouteJob *job = data;
+    AppData *app_data = job->app_data;
+    gtk_widget_set_sensitive(app_data->route_replay_btn, TRUE);
+    
+    if (error) {
+        gchar *msg = g_strdup_printf("Error: Cannot replay %s: %s", job->log_path, error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+        route_job_free(job);
+        return;
+    }
+    gchar *text = route_replay_describe(replay, ROUTE_REPLAY_ROWS);
+    gchar **lines = g_strsplit(g_strchomp(text), "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+        append_log(app_data, lines[i]);
+    }
+    g_strfreev(lines);
+    g_free(text);
+    if (job->buffer && replay->n_changed == 0) {
+        gchar *msg = g_strdup_printf("The editor's %s routes every request the same", job->filename);
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    route_job_free(job);
+}
+
+static void on_route_replay_tables_done(RouteJob *job) {
+    AppData *app_data = job->app_data;
+    const RouteTable *disk = route_snapshot_get_table(job->snapshot);
+    gchar *msg = g_strdup_printf("Replaying %s through %u server(s) and %u location(s)...", job->log_path,
+                                 route_table_get_n_servers(disk), route_table_get_n_locations(disk));
+    append_log(app_data, msg);
+    g_free(msg);
+    if (route_table_get_n_invalid(disk) > 0) {
+        msg = g_strdup_printf("Warning: %u regex(es) did not compile and are left out",
+                              route_table_get_n_invalid(disk));
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    
+    route_replay_init(&job->replay);
+    route_replay_file_async(work_pool_get_default(), disk, job->buffer, job->log_path, &job->replay,
+                            on_route_replay_done, job);
+}
+
+// Routes every line of an access log on the worker pool; the tables are
+// taken here, so the editor may change meanwhile
+static void on_route_replay_clicked(GtkWidget *widget, AppData *app_data) {
+    (void)widget; // Unused parameter
+    if (!gtk_widget_get_sensitive(app_data->route_replay_btn)) return;
+    const gchar *path = gtk_editable_get_text(GTK_EDITABLE(app_data->route_log_entry));
+    if (!*path) {
+        append_log(app_data, "Error: Enter an access log of \"host uri\" lines to replay");
+        return;
+    }
+    
+    RouteJob *job = g_new0(RouteJob, 1);
+    job->log_path = g_strdup(path);
+    job->done = on_route_replay_tables_done;
+    start_route_job(app_data, job);
+    gtk_widget_set_sensitive(app_data->route_replay_btn, FALSE);
+}
+
+// Numbers from the environment, for tuning without a settings dialog
+static guint get_env_uint(const gchar *name, guint default_value) {
+    const gchar *value = g_getenv(name);
+    guint64 number;
+    if (!value || !g_ascii_string_to_unsigned(value, 10, 0, G_MAXUINT, &number, NULL)) return default_value;
+    return (guint)number;
+}
+
+static void show_index_progress(AppData *app_data, gdouble fraction) {
+    gtk_widget_set_visible(app_data->index_progress, fraction < 1.0);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app_data->index_progress), fraction);
+}
+
+// Applies what workers pushed since the last frame, merged, in one go
+static gboolean drain_events(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+    (void)widget; (void)frame_clock; // Unused parameters
+    AppData *app_data = user_data;
+    app_data->events_tick_id = 0;
+    
+    guint n_dropped = 0;
+    GPtrArray *events = ui_event_queue_drain(app_data->events, LOG_CAPACITY, &n_dropped);
+    if (n_dropped > 0) {
+        gchar *msg = g_strdup_printf("Warning: %u log line(s) arrived faster than the log keeps them", n_dropped);
+        append_log(app_data, msg);
+        g_free(msg);
+    }
+    for (guint i = 0; i < events->len; i++) {
+        const UiEvent *event = g_ptr_array_index(events, i);
+        switch (event->type) {
+            case UI_EVENT_LOG:
+                append_log_full(app_data, event->severity, event->source, event->text);
+                break;
+            case UI_EVENT_FILE:
+                conf_file_list_queue_name(app_data->conf_files, event->text, event->exists);
+                break;
+            case UI_EVENT_DIAGNOSTICS:
+                apply_lint_result(app_data, event->key, event->payload);
+                break;
+            case UI_EVENT_PROGRESS:
+                if (event->key == app_data->core->search) show_index_progress(app_data, event->fraction);
+                break;
+            default:
+                break;
+        }
+    }
+    g_ptr_array_unref(events);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean schedule_drain(gpointer user_data) {
+    AppData *app_data = user_data;
+    if (!app_data->events_tick_id) {
+        app_data->events_tick_id = gtk_widget_add_tick_callback(app_data->window, drain_events, app_data, NULL);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Called by the push that finds the queue empty, from any thread
+static void on_events_pushed(gpointer user_data) {
+    g_main_context_invoke(NULL, schedule_drain, user_data);
+}
+
 void setup_ui(GtkApplication *app, AppData *app_data) {
+    app_data->events = ui_event_queue_new(on_events_pushed, app_data);
+    app_data->core = nginx_core_new(NGINX_MAIN_CONF, NGINX_CONF_DIR, HOSTS_FILE, on_core_log, app_data);
+    app_data->reloads = reload_scheduler_new(app_data->core,
+                                             get_env_uint("NGINXUI_RELOAD_WINDOW_MS", RELOAD_DEFAULT_WINDOW_MS),
+                                             get_env_uint("NGINXUI_RELOAD_INTERVAL_MS", RELOAD_DEFAULT_INTERVAL_MS),
+                                             on_reload_started, on_reload_done, app_data);
+    
     // Create main window
     app_data->window = gtk_application_window_new(app);
     gtk_window_set_title(GTK_WINDOW(app_data->window), "Nginx Config Editor");
@@ -282,11 +1337,32 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     g_signal_connect(app_data->reload_btn, "clicked", G_CALLBACK(on_reload_nginx_clicked), app_data);
     gtk_box_append(GTK_BOX(header_box), app_data->reload_btn);
     
+    app_data->cancel_btn = gtk_button_new_with_label("Cancel");
+    g_signal_connect(app_data->cancel_btn, "clicked", G_CALLBACK(on_cancel_command_clicked), app_data);
+    gtk_widget_set_sensitive(app_data->cancel_btn, FALSE);
+    gtk_box_append(GTK_BOX(header_box), app_data->cancel_btn);
+    
     app_data->refresh_btn = gtk_button_new_with_label("Refresh");
     gtk_widget_add_css_class(app_data->refresh_btn, "suggested-action");
     g_signal_connect(app_data->refresh_btn, "clicked", G_CALLBACK(on_refresh_clicked), app_data);
     gtk_box_append(GTK_BOX(header_box), app_data->refresh_btn);
     
+    // Staged edits to several files are tested and reloaded once, together
+    app_data->staged = change_set_new(app_data->core);
+    app_data->stage_btn = gtk_toggle_button_new_with_label("Stage Changes");
+    gtk_box_append(GTK_BOX(header_box), app_data->stage_btn);
+    
+    app_data->apply_btn = gtk_button_new_with_label("Apply");
+    gtk_widget_add_css_class(app_data->apply_btn, "suggested-action");
+    g_signal_connect(app_data->apply_btn, "clicked", G_CALLBACK(on_apply_staged_clicked), app_data);
+    gtk_widget_set_sensitive(app_data->apply_btn, FALSE);
+    gtk_box_append(GTK_BOX(header_box), app_data->apply_btn);
+    
+    app_data->discard_btn = gtk_button_new_with_label("Discard");
+    g_signal_connect(app_data->discard_btn, "clicked", G_CALLBACK(on_discard_staged_clicked), app_data);
+    gtk_widget_set_sensitive(app_data->discard_btn, FALSE);
+    gtk_box_append(GTK_BOX(header_box), app_data->discard_btn);
+    
     gtk_box_append(GTK_BOX(main_box), header_box);
     
     // Horizontal paned for three panels
@@ -320,29 +1396,36 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     gtk_widget_set_size_request(app_data->file_entry, 120, -1);
     gtk_box_append(GTK_BOX(new_file_box), app_data->file_entry);
     
-    GtkWidget *new_btn = gtk_button_new_with_label("New");
-    gtk_widget_add_css_class(new_btn, "suggested-action");
+    app_data->new_btn = gtk_button_new_with_label("New");
+    gtk_widget_add_css_class(app_data->new_btn, "suggested-action");
     // Button should not expand, keep its natural size
-    gtk_widget_set_hexpand(new_btn, FALSE);
-    gtk_widget_set_halign(new_btn, GTK_ALIGN_CENTER);
+    gtk_widget_set_hexpand(app_data->new_btn, FALSE);
+    gtk_widget_set_halign(app_data->new_btn, GTK_ALIGN_CENTER);
     // Set minimum width for button
-    gtk_widget_set_size_request(new_btn, 60, -1);
-    g_signal_connect(new_btn, "clicked", G_CALLBACK(on_new_file_clicked), app_data);
-    gtk_box_append(GTK_BOX(new_file_box), new_btn);
+    gtk_widget_set_size_request(app_data->new_btn, 60, -1);
+    g_signal_connect(app_data->new_btn, "clicked", G_CALLBACK(on_new_file_clicked), app_data);
+    gtk_box_append(GTK_BOX(new_file_box), app_data->new_btn);
     
     // Make the box itself handle shrinking gracefully
     gtk_widget_set_hexpand(new_file_box, TRUE);
     gtk_box_append(GTK_BOX(left_panel), new_file_box);
     
-    // File list with increased minimum height
-    GtkStringList *string_list = gtk_string_list_new(NULL);
-    GtkSingleSelection *selection_model = gtk_single_selection_new(G_LIST_MODEL(string_list));
+    // Fuzzy filter over the file names, applied on every keystroke
+    app_data->file_filter = gtk_search_entry_new();
+    gtk_search_entry_set_placeholder_text(GTK_SEARCH_ENTRY(app_data->file_filter), "Filter files");
+    gtk_search_entry_set_search_delay(GTK_SEARCH_ENTRY(app_data->file_filter), 0);
+    g_signal_connect(app_data->file_filter, "search-changed", G_CALLBACK(on_file_filter_changed), app_data);
+    g_signal_connect(app_data->file_filter, "activate", G_CALLBACK(on_file_filter_activate), app_data);
+    gtk_box_append(GTK_BOX(left_panel), app_data->file_filter);
     
+    // File list with increased minimum height
     GtkListItemFactory *factory = GTK_LIST_ITEM_FACTORY(gtk_signal_list_item_factory_new());
     g_signal_connect(factory, "setup", G_CALLBACK(setup_list_item), NULL);
     g_signal_connect(factory, "bind", G_CALLBACK(bind_list_item), NULL);
     
-    app_data->file_list = gtk_list_view_new(GTK_SELECTION_MODEL(selection_model), factory);
+    app_data->file_list = gtk_list_view_new(NULL, factory);
+    app_data->conf_files = conf_file_list_new(NGINX_CONF_DIR, app_data->file_list,
+                                              G_CALLBACK(on_file_selected), app_data);
     
     GtkWidget *scrolled_files = gtk_scrolled_window_new();
     gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_files), app_data->file_list);
@@ -354,6 +1437,33 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     gtk_widget_set_valign(scrolled_files, GTK_ALIGN_FILL);
     gtk_box_append(GTK_BOX(left_panel), scrolled_files);
     
+    // Full-text search across every config, answered from the trigram index
+    app_data->core->search = search_index_new();
+    app_data->search_entry = gtk_search_entry_new();
+    gtk_search_entry_set_placeholder_text(GTK_SEARCH_ENTRY(app_data->search_entry), "Search in configs");
+    gtk_search_entry_set_search_delay(GTK_SEARCH_ENTRY(app_data->search_entry), 0);
+    g_signal_connect(app_data->search_entry, "search-changed", G_CALLBACK(on_search_changed), app_data);
+    gtk_box_append(GTK_BOX(left_panel), app_data->search_entry);
+    app_data->index_progress = gtk_progress_bar_new();
+    gtk_widget_set_visible(app_data->index_progress, FALSE);
+    gtk_box_append(GTK_BOX(left_panel), app_data->index_progress);
+    
+    app_data->search_rows = gtk_string_list_new(NULL);
+    GtkListItemFactory *search_factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(search_factory, "setup", G_CALLBACK(setup_search_item), NULL);
+    g_signal_connect(search_factory, "bind", G_CALLBACK(bind_list_item), NULL);
+    GtkNoSelection *search_selection = gtk_no_selection_new(G_LIST_MODEL(g_object_ref(app_data->search_rows)));
+    GtkWidget *search_results = gtk_list_view_new(GTK_SELECTION_MODEL(search_selection), search_factory);
+    gtk_list_view_set_single_click_activate(GTK_LIST_VIEW(search_results), TRUE);
+    g_signal_connect(search_results, "activate", G_CALLBACK(on_search_hit_activated), app_data);
+    
+    GtkWidget *scrolled_search = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_search), search_results);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_search),
+                                   GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scrolled_search), 150);
+    gtk_box_append(GTK_BOX(left_panel), scrolled_search);
+    
     gtk_paned_set_start_child(GTK_PANED(hpaned), left_panel);
     
     // Right side: Editor and Logs
@@ -370,7 +1480,17 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     GtkWidget *editing_label = gtk_label_new("Editing:");
     gtk_widget_add_css_class(editing_label, "title");
     gtk_box_append(GTK_BOX(editor_header), editing_label);
-    gtk_box_append(GTK_BOX(editor_header), gtk_label_new("")); // Spacer
+    
+    app_data->context_label = gtk_label_new("");
+    gtk_label_set_ellipsize(GTK_LABEL(app_data->context_label), PANGO_ELLIPSIZE_MIDDLE);
+    gtk_widget_set_hexpand(app_data->context_label, TRUE);
+    gtk_label_set_xalign(GTK_LABEL(app_data->context_label), 0.0);
+    gtk_box_append(GTK_BOX(editor_header), app_data->context_label);
+    
+    app_data->load_progress = gtk_progress_bar_new();
+    gtk_widget_set_valign(app_data->load_progress, GTK_ALIGN_CENTER);
+    gtk_widget_set_visible(app_data->load_progress, FALSE);
+    gtk_box_append(GTK_BOX(editor_header), app_data->load_progress);
     
     app_data->save_btn = gtk_button_new_with_label("Save");
     gtk_widget_add_css_class(app_data->save_btn, "suggested-action");
@@ -378,6 +1498,26 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     gtk_widget_set_sensitive(app_data->save_btn, FALSE);
     gtk_box_append(GTK_BOX(editor_header), app_data->save_btn);
     
+    // Earlier revisions of the file; one is restored into the editor
+    app_data->history_list = gtk_list_box_new();
+    gtk_list_box_set_selection_mode(GTK_LIST_BOX(app_data->history_list), GTK_SELECTION_NONE);
+    gtk_list_box_set_placeholder(GTK_LIST_BOX(app_data->history_list), gtk_label_new("No revisions yet"));
+    g_signal_connect(app_data->history_list, "row-activated", G_CALLBACK(on_history_row_activated), app_data);
+    GtkWidget *scrolled_history = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_history), app_data->history_list);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_history),
+                                   GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_propagate_natural_height(GTK_SCROLLED_WINDOW(scrolled_history), TRUE);
+    gtk_scrolled_window_set_max_content_height(GTK_SCROLLED_WINDOW(scrolled_history), 400);
+    GtkWidget *history_popover = gtk_popover_new();
+    gtk_popover_set_child(GTK_POPOVER(history_popover), scrolled_history);
+    g_signal_connect(history_popover, "show", G_CALLBACK(on_history_shown), app_data);
+    app_data->history_btn = gtk_menu_button_new();
+    gtk_menu_button_set_label(GTK_MENU_BUTTON(app_data->history_btn), "History");
+    gtk_menu_button_set_popover(GTK_MENU_BUTTON(app_data->history_btn), history_popover);
+    gtk_widget_set_sensitive(app_data->history_btn, FALSE);
+    gtk_box_append(GTK_BOX(editor_header), app_data->history_btn);
+    
     app_data->delete_btn = gtk_button_new_with_label("Delete");
     gtk_widget_add_css_class(app_data->delete_btn, "destructive-action");
     g_signal_connect(app_data->delete_btn, "clicked", G_CALLBACK(on_delete_clicked), app_data);
@@ -386,80 +1526,17 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     
     gtk_box_append(GTK_BOX(editor_panel), editor_header);
     
-    // Source view for syntax highlighting (or plain text view if GtkSourceView not available)
-#ifdef HAVE_GTKSOURCEVIEW
-    app_data->source_buffer = GTK_TEXT_BUFFER(gtk_source_buffer_new(NULL));
-    GtkSourceLanguageManager *lm = gtk_source_language_manager_get_default();
-    
-    // Try to find nginx language definition
-    GtkSourceLanguage *lang = gtk_source_language_manager_get_language(lm, "nginx");
-    if (!lang) {
-        // Try alternative names
-        lang = gtk_source_language_manager_get_language(lm, "conf");
-        if (!lang) {
-            lang = gtk_source_language_manager_get_language(lm, "apache");
-        }
-    }
-    
-    if (lang) {
-        gtk_source_buffer_set_language(GTK_SOURCE_BUFFER(app_data->source_buffer), lang);
-    } else {
-        // Create a simple style scheme for basic highlighting
-        GtkSourceStyleSchemeManager *scheme_mgr = gtk_source_style_scheme_manager_get_default();
-        GtkSourceStyleScheme *scheme = gtk_source_style_scheme_manager_get_scheme(scheme_mgr, "classic");
-        if (scheme) {
-            gtk_source_buffer_set_style_scheme(GTK_SOURCE_BUFFER(app_data->source_buffer), scheme);
-        }
-    }
-    
-    app_data->editor = gtk_source_view_new_with_buffer(GTK_SOURCE_BUFFER(app_data->source_buffer));
-    gtk_source_view_set_show_line_numbers(GTK_SOURCE_VIEW(app_data->editor), TRUE);
-    gtk_source_view_set_auto_indent(GTK_SOURCE_VIEW(app_data->editor), TRUE);
-    gtk_source_view_set_tab_width(GTK_SOURCE_VIEW(app_data->editor), 4);
-    gtk_source_view_set_insert_spaces_instead_of_tabs(GTK_SOURCE_VIEW(app_data->editor), TRUE);
-    gtk_source_buffer_set_highlight_syntax(GTK_SOURCE_BUFFER(app_data->source_buffer), TRUE);
-    
-    // Enable word wrap
-    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(app_data->editor), GTK_WRAP_WORD);
-#else
-    app_data->source_buffer = gtk_text_buffer_new(NULL);
-    app_data->editor = gtk_text_view_new_with_buffer(app_data->source_buffer);
-    gtk_text_view_set_monospace(GTK_TEXT_VIEW(app_data->editor), TRUE);
-    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(app_data->editor), GTK_WRAP_WORD);
-    
-    // Add basic syntax highlighting using text tags
-    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(app_data->source_buffer);
-    
-    // Keywords tag (blue)
-    GtkTextTag *keyword_tag = gtk_text_tag_new("keyword");
-    g_object_set(keyword_tag, "foreground", "#0000FF", NULL);
-    gtk_text_tag_table_add(tag_table, keyword_tag);
-    
-    // Directives tag (dark blue/bold)
-    GtkTextTag *directive_tag = gtk_text_tag_new("directive");
-    g_object_set(directive_tag, "foreground", "#0066CC", "weight", PANGO_WEIGHT_BOLD, NULL);
-    gtk_text_tag_table_add(tag_table, directive_tag);
-    
-    // Strings tag (green)
-    GtkTextTag *string_tag = gtk_text_tag_new("string");
-    g_object_set(string_tag, "foreground", "#008000", NULL);
-    gtk_text_tag_table_add(tag_table, string_tag);
-    
-    // Comments tag (gray/italic)
-    GtkTextTag *comment_tag = gtk_text_tag_new("comment");
-    g_object_set(comment_tag, "foreground", "#808080", "style", PANGO_STYLE_ITALIC, NULL);
-    gtk_text_tag_table_add(tag_table, comment_tag);
-#endif
-    
-    GtkWidget *scrolled_editor = gtk_scrolled_window_new();
-    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_editor), app_data->editor);
+    // One tab per open document, each with its own buffer and view
+    app_data->documents = document_cache_new(
+        (gsize)get_env_uint("NGINXUI_DOCUMENT_BUDGET_MB", DOCUMENTS_DEFAULT_BUDGET / (1024 * 1024)) * 1024 * 1024);
+    app_data->tabs = gtk_notebook_new();
+    gtk_notebook_set_scrollable(GTK_NOTEBOOK(app_data->tabs), TRUE);
     // Make editor expand to fill available space
-    gtk_widget_set_vexpand(scrolled_editor, TRUE);
-    gtk_widget_set_hexpand(scrolled_editor, TRUE);
-    gtk_widget_set_valign(scrolled_editor, GTK_ALIGN_FILL);
-    gtk_box_append(GTK_BOX(editor_panel), scrolled_editor);
-    
-    g_signal_connect(app_data->source_buffer, "changed", G_CALLBACK(on_text_changed), app_data);
+    gtk_widget_set_vexpand(app_data->tabs, TRUE);
+    gtk_widget_set_hexpand(app_data->tabs, TRUE);
+    gtk_widget_set_valign(app_data->tabs, GTK_ALIGN_FILL);
+    g_signal_connect(app_data->tabs, "switch-page", G_CALLBACK(on_tab_switched), app_data);
+    gtk_box_append(GTK_BOX(editor_panel), app_data->tabs);
     
     gtk_paned_set_start_child(GTK_PANED(right_vpaned), editor_panel);
     
@@ -474,42 +1551,42 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     gtk_widget_add_css_class(logs_label, "title");
     gtk_box_append(GTK_BOX(logs_panel), logs_label);
     
-    app_data->logs_text = gtk_text_view_new();
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(app_data->logs_text), FALSE);
-    gtk_text_view_set_monospace(GTK_TEXT_VIEW(app_data->logs_text), TRUE);
-    
-    // Add text tags for log formatting
-    GtkTextBuffer *log_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app_data->logs_text));
-    GtkTextTagTable *log_tag_table = gtk_text_buffer_get_tag_table(log_buffer);
-    
-    // Error tag (red)
-    GtkTextTag *error_tag = gtk_text_tag_new("error");
-    g_object_set(error_tag, "foreground", "#CC0000", "weight", PANGO_WEIGHT_BOLD, NULL);
-    gtk_text_tag_table_add(log_tag_table, error_tag);
-    
-    // Success tag (green)
-    GtkTextTag *success_tag = gtk_text_tag_new("success");
-    g_object_set(success_tag, "foreground", "#008000", NULL);
-    gtk_text_tag_table_add(log_tag_table, success_tag);
-    
-    // Info tag (blue)
-    GtkTextTag *info_tag = gtk_text_tag_new("info");
-    g_object_set(info_tag, "foreground", "#0066CC", NULL);
-    gtk_text_tag_table_add(log_tag_table, info_tag);
+    // Only the visible rows of the log get widgets
+    app_data->log_model = log_model_new(LOG_CAPACITY);
+    GtkListItemFactory *log_factory = gtk_signal_list_item_factory_new();
+    g_signal_connect(log_factory, "setup", G_CALLBACK(setup_log_item), NULL);
+    g_signal_connect(log_factory, "bind", G_CALLBACK(bind_log_item), NULL);
+    GtkNoSelection *log_selection = gtk_no_selection_new(G_LIST_MODEL(g_object_ref(app_data->log_model)));
+    app_data->logs_view = gtk_list_view_new(GTK_SELECTION_MODEL(log_selection), log_factory);
+    gtk_widget_add_css_class(app_data->logs_view, "log-text");
     
     // Set better font size for readability using CSS
-    gtk_widget_add_css_class(app_data->logs_text, "log-text");
-    // Create a CSS provider for log text styling
     GtkCssProvider *css_provider = gtk_css_provider_new();
     gtk_css_provider_load_from_string(css_provider,
-        "textview.log-text { font-family: monospace; font-size: 10pt; }");
+        ".log-text label { font-family: monospace; font-size: 10pt; }"
+        ".log-text label.error { color: #CC0000; font-weight: bold; }"
+        ".log-text label.warning { color: #B07A00; }"
+        ".log-text label.success { color: #008000; }"
+        ".stats-text { font-family: monospace; font-size: 9pt; }"
+        ".search-hit { font-family: monospace; font-size: 9pt; }");
     gtk_style_context_add_provider_for_display(
-        gtk_widget_get_display(app_data->logs_text),
+        gtk_widget_get_display(app_data->logs_view),
         GTK_STYLE_PROVIDER(css_provider),
         GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
     
+    // Filter bar: minimum severity and text search over the whole ring
+    GtkWidget *log_filter_bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    app_data->log_severity = gtk_drop_down_new_from_strings(log_severity_filters);
+    g_signal_connect(app_data->log_severity, "notify::selected", G_CALLBACK(on_log_filter_changed), app_data);
+    gtk_box_append(GTK_BOX(log_filter_bar), app_data->log_severity);
+    app_data->log_search = gtk_search_entry_new();
+    gtk_widget_set_hexpand(app_data->log_search, TRUE);
+    g_signal_connect(app_data->log_search, "search-changed", G_CALLBACK(on_log_filter_changed), app_data);
+    gtk_box_append(GTK_BOX(log_filter_bar), app_data->log_search);
+    gtk_box_append(GTK_BOX(logs_panel), log_filter_bar);
+    
     GtkWidget *scrolled_logs = gtk_scrolled_window_new();
-    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_logs), app_data->logs_text);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_logs), app_data->logs_view);
     // Increase logs height - set minimum but allow expansion
     gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scrolled_logs), 300);
     gtk_widget_set_vexpand(scrolled_logs, TRUE);
@@ -517,6 +1594,47 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     gtk_widget_set_valign(scrolled_logs, GTK_ALIGN_FILL);
     gtk_box_append(GTK_BOX(logs_panel), scrolled_logs);
     
+    // Performance: per-operation timings, collapsed until needed
+    GtkWidget *stats_expander = gtk_expander_new("Performance");
+    GtkWidget *stats_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+    app_data->stats_label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(app_data->stats_label), 0.0);
+    gtk_label_set_selectable(GTK_LABEL(app_data->stats_label), TRUE);
+    gtk_widget_add_css_class(app_data->stats_label, "stats-text");
+    gtk_box_append(GTK_BOX(stats_box), app_data->stats_label);
+    GtkWidget *stats_reset_btn = gtk_button_new_with_label("Reset");
+    gtk_widget_set_halign(stats_reset_btn, GTK_ALIGN_START);
+    g_signal_connect(stats_reset_btn, "clicked", G_CALLBACK(on_stats_reset_clicked), app_data);
+    gtk_box_append(GTK_BOX(stats_box), stats_reset_btn);
+    gtk_expander_set_child(GTK_EXPANDER(stats_expander), stats_box);
+    g_signal_connect(stats_expander, "notify::expanded", G_CALLBACK(on_stats_expanded), app_data);
+    gtk_box_append(GTK_BOX(logs_panel), stats_expander);
+    
+    // Route simulator: which server and location answer a request, on
+    // disk and with the editor's changes
+    GtkWidget *route_expander = gtk_expander_new("Route Simulator");
+    GtkWidget *route_grid = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(route_grid), 4);
+    gtk_grid_set_column_spacing(GTK_GRID(route_grid), 8);
+    app_data->route_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(app_data->route_entry), "example.com /path");
+    gtk_widget_set_hexpand(app_data->route_entry, TRUE);
+    g_signal_connect(app_data->route_entry, "activate", G_CALLBACK(on_route_lookup_activate), app_data);
+    gtk_grid_attach(GTK_GRID(route_grid), app_data->route_entry, 0, 0, 1, 1);
+    GtkWidget *route_lookup_btn = gtk_button_new_with_label("Look Up");
+    g_signal_connect(route_lookup_btn, "clicked", G_CALLBACK(on_route_lookup_activate), app_data);
+    gtk_grid_attach(GTK_GRID(route_grid), route_lookup_btn, 1, 0, 1, 1);
+    app_data->route_log_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(app_data->route_log_entry), "/var/log/nginx/routes.log");
+    gtk_widget_set_hexpand(app_data->route_log_entry, TRUE);
+    g_signal_connect(app_data->route_log_entry, "activate", G_CALLBACK(on_route_replay_clicked), app_data);
+    gtk_grid_attach(GTK_GRID(route_grid), app_data->route_log_entry, 0, 1, 1, 1);
+    app_data->route_replay_btn = gtk_button_new_with_label("Replay");
+    g_signal_connect(app_data->route_replay_btn, "clicked", G_CALLBACK(on_route_replay_clicked), app_data);
+    gtk_grid_attach(GTK_GRID(route_grid), app_data->route_replay_btn, 1, 1, 1, 1);
+    gtk_expander_set_child(GTK_EXPANDER(route_expander), route_grid);
+    gtk_box_append(GTK_BOX(logs_panel), route_expander);
+    
     gtk_paned_set_end_child(GTK_PANED(right_vpaned), logs_panel);
     // Adjust paned position - give more space to both editor and logs
     // For 900px window: editor ~550px, logs ~300px (with margins)
@@ -530,8 +1648,45 @@ void setup_ui(GtkApplication *app, AppData *app_data) {
     gtk_paned_set_shrink_start_child(GTK_PANED(hpaned), FALSE);
     gtk_paned_set_shrink_end_child(GTK_PANED(hpaned), TRUE);
     
-    // Initial file list refresh
+    // Every save and delete from here on is kept in the revision history
+    gchar *history_dir = history_store_get_default_dir();
+    GError *history_error = NULL;
+    app_data->core->history = history_store_open(history_dir, &history_error);
+    if (app_data->core->history) {
+        HistoryStats stats;
+        history_store_get_stats(app_data->core->history, &stats);
+        gchar *stored = g_format_size(stats.stored_bytes);
+        gchar *content = g_format_size(stats.content_bytes);
+        gchar *msg = g_strdup_printf("History: %u revision(s) of %u file(s), %s stored for %s of content",
+                                     stats.n_revisions, stats.n_files, stored, content);
+        append_log(app_data, msg);
+        g_free(msg);
+        g_free(content);
+        g_free(stored);
+    } else {
+        gchar *msg = g_strdup_printf("Warning: Saves are not kept in the history: %s", history_error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+        g_error_free(history_error);
+    }
+    g_free(history_dir);
+    
+    // Initial file list refresh, then follow changes made by other programs.
+    // Server names and conflicts come from the metadata cache, and the
+    // search index follows once the refresh has checked it.
     refresh_file_list(app_data);
+    gchar *metadata_path = meta_cache_get_default_path();
+    nginx_core_load_metadata(app_data->core, metadata_path);
+    g_free(metadata_path);
+    refresh_metadata(app_data);
+    GError *error = NULL;
+    if (!conf_file_list_watch(app_data->conf_files, &error)) {
+        gchar *msg = g_strdup_printf("Error: Cannot watch %s, use Refresh to see external changes (%s)",
+                                     NGINX_CONF_DIR, error->message);
+        append_log(app_data, msg);
+        g_free(msg);
+        g_error_free(error);
+    }
     
     gtk_window_present(GTK_WINDOW(app_data->window));
 }
@@ -5,47 +5,114 @@
 #ifdef HAVE_GTKSOURCEVIEW
 #include <gtksourceview/gtksource.h>
 #endif
+#include "nginx_core.h"
+#include "nginx_changes.h"
+#include "nginx_documents.h"
+#include "nginx_events.h"
+#include "nginx_reload.h"
+#include "nginx_filelist.h"
+#include "nginx_lint.h"
+#include "nginx_loader.h"
+#include "nginx_pool.h"
 
-#define NGINX_CONF_DIR "/etc/nginx/conf.d"
-#define HOSTS_FILE "/etc/hosts"
 #define MAX_LINE_LENGTH 4096
+// Log records kept in memory, the oldest are dropped first
+#define LOG_CAPACITY 10000
+// Quiet time after an edit before the buffer is linted
+#define LINT_DEBOUNCE_MS 300
+// How often the open performance panel is redrawn
+#define STATS_REFRESH_MS 1000
+// Busiest routes and route changes logged after a replay
+#define ROUTE_REPLAY_ROWS 20
 
 typedef struct {
     GtkWidget *window;
     GtkWidget *file_list;
+    ConfFileList *conf_files;       // model behind file_list
+    GtkWidget *file_filter;
+    GtkWidget *search_entry;        // full-text search over every config
+    GtkStringList *search_rows;     // one row per hit, behind the results view
+    GPtrArray *search_hits;         // SearchHit* of search_rows
+    gboolean search_loaded;         // the saved index was read this session
+    gboolean search_indexing;       // the index is being brought up to date
+    gboolean search_reindex;        // another pass was asked for meanwhile
+    gboolean metadata_refreshing;   // the include tree is checked against the cache
+    GtkWidget *index_progress;      // shown while the search index is updated
     GtkWidget *file_entry;
-    GtkWidget *editor;
-    GtkWidget *logs_text;
+    GtkWidget *tabs;                // one page per open document
+    DocumentCache *documents;       // buffers of the tabs, under a memory budget
+    Document *current;              // the active tab, NULL when none is open
+    GtkWidget *editor;              // view of current
+    GtkWidget *logs_view;
+    LogModel *log_model;            // ring of log records behind logs_view
+    guint log_tick_id;              // frame callback publishing pending records
+    UiEventQueue *events;           // updates from worker threads
+    guint events_tick_id;           // frame callback draining events
+    GtkWidget *log_severity;
+    GtkWidget *log_search;
+    GtkWidget *stats_label;         // operation histograms, in a collapsed expander
+    guint stats_timeout_id;         // redraws stats_label while it is expanded
+    GtkWidget *route_entry;         // "host[:port] /uri" for the route simulator
+    GtkWidget *route_log_entry;     // access log of "host uri" lines to replay
+    GtkWidget *route_replay_btn;    // insensitive while a replay runs
+    RouteSnapshot *routes;          // configs on disk with their routes, while the include graph has them
+    GtkWidget *new_btn;
     GtkWidget *save_btn;
     GtkWidget *delete_btn;
+    GtkWidget *history_btn;         // revisions of the current file, in a popover
+    GtkWidget *history_list;        // GtkListBox in that popover, filled when it opens
     GtkWidget *test_btn;
     GtkWidget *reload_btn;
     GtkWidget *refresh_btn;
-    GtkTextBuffer *source_buffer;
-    gchar *current_file;
+    GtkWidget *cancel_btn;
+    GtkWidget *stage_btn;           // toggled on, Save and Delete go to staged
+    GtkWidget *apply_btn;
+    GtkWidget *discard_btn;
+    ChangeSet *staged;              // edits applied together by Apply
+    GtkWidget *context_label;
+    GtkWidget *load_progress;
+    GtkTextBuffer *source_buffer;   // buffer of current
+    const gchar *current_file;      // filename of current
+    NginxCore *core;                // config, hosts and nginx operations
+    gboolean nginx_command_running; // nginx -t / reload in the helper
+    ReloadScheduler *reloads;       // coalesces Reload clicks
+    guint lint_timeout_id;          // pending debounced lint
+    guint lint_generation;          // bumped on every edit, stale results are dropped
+    GCancellable *lint_cancellable; // lint running on a worker thread
+    LintContext lint_context;       // block the current file is included into
 } AppData;
 
 // UI functions
 void append_log(AppData *app_data, const gchar *message);
+void append_log_full(AppData *app_data, LogSeverity severity, const gchar *source, const gchar *message);
 void refresh_file_list(AppData *app_data);
+void update_include_context(AppData *app_data);
+// Shows the include context as the graph stands, without stat'ing the
+// tree, when a save already brought the saved files up to date
+void show_include_context(AppData *app_data);
+void update_document_actions(AppData *app_data);
+void update_search_index(AppData *app_data);
+void open_document(AppData *app_data, const gchar *filename, guint line);
+void close_document(AppData *app_data, Document *document);
 void setup_ui(GtkApplication *app, AppData *app_data);
 
 // File operations
-gchar* execute_command(const gchar *command);
 void on_new_file_clicked(GtkButton *button, AppData *app_data);
 void on_save_clicked(GtkButton *button, AppData *app_data);
 void on_delete_clicked(GtkButton *button, AppData *app_data);
 void on_file_selected(GObject *object, GParamSpec *pspec, AppData *app_data);
+void on_history_shown(GtkWidget *popover, AppData *app_data);
+void on_history_row_activated(GtkListBox *box, GtkListBoxRow *row, AppData *app_data);
 
 // Nginx operations
 void on_test_config_clicked(GtkButton *button, AppData *app_data);
 void on_reload_nginx_clicked(GtkButton *button, AppData *app_data);
+void on_reload_started(guint n_requests, gpointer user_data);
+void on_reload_done(gboolean reloaded, guint n_requests, const GError *error, gpointer user_data);
+void on_cancel_command_clicked(GtkButton *button, AppData *app_data);
 void on_refresh_clicked(GtkButton *button, AppData *app_data);
-
-// Hosts file operations
-gchar** extract_domains_from_config(const gchar *config_content);
-gboolean domain_exists_in_hosts(const gchar *domain);
-void add_domain_to_hosts(const gchar *domain);
+void on_apply_staged_clicked(GtkButton *button, AppData *app_data);
+void on_discard_staged_clicked(GtkButton *button, AppData *app_data);
 
 // Syntax highlighting (when GtkSourceView not available)
 void apply_syntax_highlighting(GtkTextBuffer *buffer);
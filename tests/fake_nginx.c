@@ -0,0 +1,191 @@
+// A stand-in for the nginx binary, for the reload tests. The helper runs
+// it through NGINXUI_HELPER_NGINX; its pid file and the mode file that
+// says how it takes the next reload live in NGINXUI_FAKE_NGINX_DIR.
+//
+// Without arguments it starts a master in the background, as nginx does,
+// and exits once the master wrote its pid file. The master serves signals,
+// SIGHUP starting a new generation of workers before stopping the old
+// one. `-t` passes, after a minute when the file test-mode says "hang".
+// `-s reload` does what the file reload-mode says:
+//   accept   signals the master, which starts new workers
+//   reject   does nothing and exits 0, as nginx when the master keeps
+//            the old configuration
+//   replace  starts another master and stops this one
+//   exit     stops the master
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FAKE_NGINX_WORKERS 2
+#define FAKE_NGINX_START_TIMEOUT_MS 5000
+// How long a hanging -t takes, longer than any test waits for it
+#define FAKE_NGINX_HANG_S 60
+
+static gchar* state_path(const gchar *name) {
+    const gchar *dir = g_getenv("NGINXUI_FAKE_NGINX_DIR");
+    if (!dir) {
+        g_printerr("fake_nginx: NGINXUI_FAKE_NGINX_DIR is not set\n");
+        exit(1);
+    }
+    return g_build_filename(dir, name, NULL);
+}
+
+static gint read_pid_file(void) {
+    gchar *path = state_path("nginx.pid");
+    gchar *content = NULL;
+    gint pid = g_file_get_contents(path, &content, NULL, NULL) ? atoi(content) : 0;
+    g_free(content);
+    g_free(path);
+    return pid;
+}
+
+static void start_workers(GArray *workers) {
+    for (guint i = 0; i < FAKE_NGINX_WORKERS; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            sigset_t none;
+            sigemptyset(&none);
+            sigprocmask(SIG_SETMASK, &none, NULL);
+            for (;;) pause();
+        }
+        if (pid > 0) g_array_append_val(workers, pid);
+    }
+}
+
+static void stop_workers(GArray *workers) {
+    for (guint i = 0; i < workers->len; i++) {
+        kill(g_array_index(workers, pid_t, i), SIGTERM);
+    }
+    for (guint i = 0; i < workers->len; i++) {
+        waitpid(g_array_index(workers, pid_t, i), NULL, 0);
+    }
+    g_array_set_size(workers, 0);
+}
+
+static int run_master(void) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    GArray *workers = g_array_new(FALSE, FALSE, sizeof(pid_t));
+    start_workers(workers);
+
+    // Written whole, so a reader never sees half a pid
+    gchar *pid_file = state_path("nginx.pid");
+    gchar *pid = g_strdup_printf("%d\n", (gint)getpid());
+    g_file_set_contents(pid_file, pid, -1, NULL);
+    g_free(pid);
+
+    for (;;) {
+        gint sig = 0;
+        if (sigwait(&signals, &sig) != 0) continue;
+        if (sig != SIGHUP) break;
+        GArray *old = workers;
+        workers = g_array_new(FALSE, FALSE, sizeof(pid_t));
+        start_workers(workers);
+        stop_workers(old);
+        g_array_unref(old);
+    }
+
+    stop_workers(workers);
+    g_array_unref(workers);
+    // A master started in our place owns the pid file by now
+    if (read_pid_file() == getpid()) g_unlink(pid_file);
+    g_free(pid_file);
+    return 0;
+}
+
+// Starts a master that is nobody's child, so neither the test nor the
+// helper waits on its output or its exit
+static void start_detached_master(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setsid();
+        if (fork() != 0) _exit(0);
+        gint null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+        _exit(run_master());
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+static gboolean wait_for_master(gint old_master) {
+    for (guint waited = 0; waited < FAKE_NGINX_START_TIMEOUT_MS; waited += 10) {
+        gint master = read_pid_file();
+        if (master > 0 && master != old_master) return TRUE;
+        g_usleep(10 * 1000);
+    }
+    return FALSE;
+}
+
+static int run_test(void) {
+    gchar *mode_file = state_path("test-mode");
+    gchar *mode = NULL;
+    if (g_file_get_contents(mode_file, &mode, NULL, NULL) && strcmp(g_strstrip(mode), "hang") == 0) {
+        g_printerr("nginx: testing the configuration...\n");
+        g_usleep(FAKE_NGINX_HANG_S * G_USEC_PER_SEC);
+    }
+    g_free(mode);
+    g_free(mode_file);
+    g_printerr("nginx: configuration file test is successful\n");
+    return 0;
+}
+
+static int run_reload(void) {
+    gint master = read_pid_file();
+    if (master <= 0 || kill(master, 0) != 0) {
+        g_printerr("nginx: [error] invalid PID number \"\" in the pid file\n");
+        return 1;
+    }
+
+    gchar *mode_file = state_path("reload-mode");
+    gchar *mode = NULL;
+    if (!g_file_get_contents(mode_file, &mode, NULL, NULL)) mode = g_strdup("accept");
+    g_strstrip(mode);
+    g_free(mode_file);
+
+    gint status = 0;
+    if (strcmp(mode, "accept") == 0) {
+        kill(master, SIGHUP);
+    } else if (strcmp(mode, "replace") == 0) {
+        start_detached_master();
+        if (!wait_for_master(master)) {
+            g_printerr("fake_nginx: the new master did not start\n");
+            status = 1;
+        }
+        kill(master, SIGTERM);
+    } else if (strcmp(mode, "exit") == 0) {
+        kill(master, SIGTERM);
+    } else if (strcmp(mode, "reject") != 0) {
+        g_printerr("fake_nginx: unknown reload mode \"%s\"\n", mode);
+        status = 1;
+    }
+    g_free(mode);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 1) {
+        gint old_master = read_pid_file();
+        start_detached_master();
+        return wait_for_master(old_master) ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "-t") == 0) return run_test();
+    if (argc == 3 && strcmp(argv[1], "-s") == 0 && strcmp(argv[2], "reload") == 0) {
+        return run_reload();
+    }
+    g_printerr("fake_nginx: unexpected arguments\n");
+    return 1;
+}
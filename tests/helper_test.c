@@ -0,0 +1,288 @@
+// Tests of the privileged helper's file requests, run against an
+// unprivileged nginxui-helper (NGINXUI_HELPER_LAUNCHER=none) that may only
+// modify a scratch directory given in NGINXUI_HELPER_ALLOW. Cancelling
+// runs fake_nginx (NGINXUI_HELPER_NGINX) with a -t that hangs.
+
+#include "nginx_helper.h"
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ctest reports the test as skipped
+#define SKIP_EXIT_CODE 77
+#define CANCEL_AFTER_MS 200
+// Well below the minute a hanging fake_nginx -t takes
+#define CANCEL_TIMEOUT_MS 10000
+
+static gchar *scratch_dir;
+static gchar *nginx_dir;        // fake_nginx state, apart from the files counted
+
+static gchar* scratch_path(const gchar *name) {
+    return g_build_filename(scratch_dir, name, NULL);
+}
+
+static guint file_mode(const gchar *path) {
+    GStatBuf st;
+    g_assert_cmpint(g_stat(path, &st), ==, 0);
+    return st.st_mode & 07777;
+}
+
+static void assert_contents(const gchar *path, const gchar *expected) {
+    gchar *contents = NULL;
+    g_assert_true(g_file_get_contents(path, &contents, NULL, NULL));
+    g_assert_cmpstr(contents, ==, expected);
+    g_free(contents);
+}
+
+// Only the files the test made, no temporaries left behind by a write
+static guint count_entries(void) {
+    GDir *dir = g_dir_open(scratch_dir, 0, NULL);
+    g_assert_nonnull(dir);
+    guint n = 0;
+    while (g_dir_read_name(dir)) n++;
+    g_dir_close(dir);
+    return n;
+}
+
+static void test_write_file(void) {
+    gchar *path = scratch_path("write.conf");
+    GError *error = NULL;
+
+    g_assert_true(helper_write_file(path, "a", 1, 0640, &error));
+    g_assert_no_error(error);
+    assert_contents(path, "a");
+    g_assert_cmpuint(file_mode(path), ==, 0640);
+
+    // Replacing takes the new mode as well
+    g_assert_true(helper_write_file(path, "server {}\n", 10, 0600, &error));
+    g_assert_no_error(error);
+    assert_contents(path, "server {}\n");
+    g_assert_cmpuint(file_mode(path), ==, 0600);
+    g_assert_cmpuint(count_entries(), ==, 1);
+
+    g_assert_true(helper_unlink(path, &error));
+    g_free(path);
+}
+
+static void test_chmod(void) {
+    gchar *path = scratch_path("chmod.conf");
+    GError *error = NULL;
+    g_assert_true(helper_write_file(path, "", 0, 0644, &error));
+
+    HelperBatch *batch = helper_batch_new();
+    helper_batch_chmod(batch, path, 0600);
+    HelperClient *client = helper_client_get_default(&error);
+    g_assert_no_error(error);
+    g_assert_true(helper_batch_run(client, batch, &error));
+    g_assert_no_error(error);
+    helper_batch_free(batch);
+    g_assert_cmpuint(file_mode(path), ==, 0600);
+
+    g_assert_true(helper_unlink(path, &error));
+    g_free(path);
+}
+
+static void test_unlink(void) {
+    gchar *path = scratch_path("unlink.conf");
+    GError *error = NULL;
+    g_assert_true(helper_write_file(path, "x", 1, 0644, &error));
+
+    g_assert_true(helper_unlink(path, &error));
+    g_assert_no_error(error);
+    g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+
+    // A second unlink reports the errno of the helper
+    g_assert_false(helper_unlink(path, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+    g_clear_error(&error);
+    g_free(path);
+}
+
+// Requests after a failed one are still served, each with its own answer
+static void test_batch_errors(void) {
+    gchar *first = scratch_path("first.conf");
+    gchar *missing = scratch_path("missing.conf");
+    gchar *last = scratch_path("last.conf");
+    gchar *in_missing_dir = scratch_path("no-such-dir/a.conf");
+
+    HelperBatch *batch = helper_batch_new();
+    helper_batch_write_file(batch, first, "1", 1, 0644);
+    helper_batch_unlink(batch, missing);
+    helper_batch_write_file(batch, in_missing_dir, "2", 1, 0644);
+    helper_batch_chmod(batch, first, 0600);
+    helper_batch_write_file(batch, last, "3", 1, 0644);
+
+    GError *error = NULL;
+    HelperClient *client = helper_client_get_default(&error);
+    g_assert_no_error(error);
+    g_assert_false(helper_batch_run(client, batch, &error));
+    // The first failure is the one reported
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+    g_assert_nonnull(strstr(error->message, missing));
+    g_clear_error(&error);
+
+    g_assert_cmpuint(helper_batch_get_length(batch), ==, 5);
+    g_assert_null(helper_batch_get_error(batch, 0));
+    g_assert_nonnull(helper_batch_get_error(batch, 1));
+    g_assert_nonnull(helper_batch_get_error(batch, 2));
+    g_assert_null(helper_batch_get_error(batch, 3));
+    g_assert_null(helper_batch_get_error(batch, 4));
+    helper_batch_free(batch);
+
+    assert_contents(first, "1");
+    g_assert_cmpuint(file_mode(first), ==, 0600);
+    assert_contents(last, "3");
+
+    // The helper is still in step for the next request
+    g_assert_true(helper_unlink(first, &error));
+    g_assert_true(helper_unlink(last, &error));
+    g_assert_no_error(error);
+
+    g_free(in_missing_dir);
+    g_free(last);
+    g_free(missing);
+    g_free(first);
+}
+
+static void test_rejected_paths(void) {
+    gchar *parent = g_path_get_dirname(scratch_dir);
+    gchar *base = g_path_get_basename(scratch_dir);
+    gchar *outside = g_build_filename(parent, "nginxui-helper-test-outside.conf", NULL);
+    const gchar *rejected[] = {
+        outside,
+        g_strdup_printf("%s/../%s/a.conf", scratch_dir, base),
+        g_strdup_printf("%s//a.conf", scratch_dir),
+        g_strdup_printf("%s/./a.conf", scratch_dir),
+        g_strdup_printf("%s/", scratch_dir),
+        g_strdup(scratch_dir),
+        "a.conf",
+        "/etc/nginx-other/a.conf",
+    };
+    guint n_rejected = G_N_ELEMENTS(rejected);
+
+    HelperBatch *batch = helper_batch_new();
+    for (guint i = 0; i < n_rejected; i++) {
+        helper_batch_write_file(batch, rejected[i], "x", 1, 0644);
+    }
+    GError *error = NULL;
+    HelperClient *client = helper_client_get_default(&error);
+    g_assert_false(helper_batch_run(client, batch, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED);
+    g_clear_error(&error);
+    for (guint i = 0; i < n_rejected; i++) {
+        const gchar *message = helper_batch_get_error(batch, i);
+        g_assert_nonnull(message);
+        g_assert_nonnull(strstr(message, "not a path nginxui may modify"));
+    }
+    helper_batch_free(batch);
+
+    g_assert_false(g_file_test(outside, G_FILE_TEST_EXISTS));
+    g_assert_false(helper_unlink(outside, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED);
+    g_clear_error(&error);
+    g_assert_cmpuint(count_entries(), ==, 0);
+
+    for (guint i = 1; i <= 5; i++) {
+        g_free((gchar *)rejected[i]);
+    }
+    g_free(outside);
+    g_free(base);
+    g_free(parent);
+}
+
+static gpointer cancel_thread(gpointer data) {
+    (void)data; // Unused parameter
+    g_usleep(CANCEL_AFTER_MS * 1000);
+    helper_cancel_command();
+    return NULL;
+}
+
+static void on_command_output(const gchar *line, gpointer user_data) {
+    guint *n_lines = user_data;
+    (void)line; // Unused parameter
+    (*n_lines)++;
+}
+
+// A cancel frame stops the command while another thread waits on it, and
+// the helper is in step for the next request afterwards
+static void test_cancel(void) {
+    if (!g_getenv("NGINXUI_HELPER_NGINX")) {
+        g_test_skip("NGINXUI_HELPER_NGINX does not name fake_nginx");
+        return;
+    }
+    gchar *mode_file = g_build_filename(nginx_dir, "test-mode", NULL);
+    g_assert_true(g_file_set_contents(mode_file, "hang", -1, NULL));
+    GError *error = NULL;
+    HelperClient *client = helper_client_get_default(&error);
+    g_assert_no_error(error);
+
+    // Nothing runs yet, so this must not reach the helper
+    helper_cancel_command();
+
+    gint64 started = g_get_monotonic_time();
+    GThread *thread = g_thread_new("cancel", cancel_thread, NULL);
+    guint n_lines = 0;
+    gint exit_status = 0;
+    g_assert_false(helper_client_run_nginx(client, HELPER_OP_NGINX_TEST, on_command_output, &n_lines,
+                                           &exit_status, &error));
+    g_thread_join(thread);
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED);
+    g_assert_nonnull(strstr(error->message, "cancel"));
+    g_clear_error(&error);
+    g_assert_cmpint(g_get_monotonic_time() - started, <, CANCEL_TIMEOUT_MS * (gint64)1000);
+    g_assert_cmpuint(n_lines, ==, 1);
+
+    gchar *path = scratch_path("after-cancel.conf");
+    g_assert_true(helper_write_file(path, "x", 1, 0644, &error));
+    g_assert_no_error(error);
+    assert_contents(path, "x");
+    g_assert_true(helper_unlink(path, &error));
+
+    // And it still runs commands
+    g_assert_cmpint(g_unlink(mode_file), ==, 0);
+    g_assert_true(helper_client_run_nginx(client, HELPER_OP_NGINX_TEST, NULL, NULL, &exit_status, &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(exit_status, ==, 0);
+    g_free(path);
+    g_free(mode_file);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    // As root the helper ignores NGINXUI_HELPER_ALLOW and would write to
+    // the real /etc/nginx
+    if (geteuid() == 0) {
+        g_printerr("helper_test: the helper ignores the environment as root, skipping\n");
+        return SKIP_EXIT_CODE;
+    }
+
+    GError *error = NULL;
+    gchar *dir = g_dir_make_tmp("nginxui-helper-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    // The helper compares canonical paths
+    scratch_dir = g_canonicalize_filename(dir, "/");
+    g_free(dir);
+    gchar *allow = g_strconcat(scratch_dir, "/", NULL);
+    g_setenv("NGINXUI_HELPER_ALLOW", allow, TRUE);
+    g_setenv("NGINXUI_HELPER_LAUNCHER", "none", TRUE);
+    g_free(allow);
+    nginx_dir = g_dir_make_tmp("nginxui-helper-test-nginx-XXXXXX", &error);
+    g_assert_no_error(error);
+    g_setenv("NGINXUI_FAKE_NGINX_DIR", nginx_dir, TRUE);
+
+    g_test_add_func("/helper/write-file", test_write_file);
+    g_test_add_func("/helper/chmod", test_chmod);
+    g_test_add_func("/helper/unlink", test_unlink);
+    g_test_add_func("/helper/batch-errors", test_batch_errors);
+    g_test_add_func("/helper/rejected-paths", test_rejected_paths);
+    g_test_add_func("/helper/cancel", test_cancel);
+    gint status = g_test_run();
+
+    g_rmdir(nginx_dir);
+    g_free(nginx_dir);
+    g_rmdir(scratch_dir);
+    g_free(scratch_dir);
+    return status;
+}
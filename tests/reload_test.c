@@ -0,0 +1,321 @@
+// Tests of confirmed and scheduled reloads against fake_nginx, which the
+// unprivileged helper runs in place of nginx (NGINXUI_HELPER_NGINX). Each
+// test sets how the fake master takes the next reload.
+
+#include "nginx_changes.h"
+#include "nginx_reload.h"
+#include <glib/gstdio.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+// ctest reports the test as skipped
+#define SKIP_EXIT_CODE 77
+#define SCHEDULER_WINDOW_MS 200
+#define SCHEDULER_INTERVAL_MS 1000
+#define SCHEDULER_TIMEOUT_MS 30000
+
+static gchar *scratch_dir;
+static gchar *pid_file;
+static NginxCore *core;
+static GString *log_text;
+static GMutex log_lock;
+
+// Reloads log from worker threads
+static void on_log(LogSeverity severity, const gchar *source, const gchar *message, gpointer user_data) {
+    (void)severity; // Unused parameter
+    (void)source; // Unused parameter
+    (void)user_data; // Unused parameter
+    g_mutex_lock(&log_lock);
+    g_string_append_printf(log_text, "%s\n", message);
+    g_mutex_unlock(&log_lock);
+}
+
+static gboolean log_contains(const gchar *text) {
+    g_mutex_lock(&log_lock);
+    gboolean found = strstr(log_text->str, text) != NULL;
+    g_mutex_unlock(&log_lock);
+    return found;
+}
+
+static void set_reload_mode(const gchar *mode) {
+    gchar *path = g_build_filename(scratch_dir, "reload-mode", NULL);
+    g_assert_true(g_file_set_contents(path, mode, -1, NULL));
+    g_free(path);
+    g_mutex_lock(&log_lock);
+    g_string_truncate(log_text, 0);
+    g_mutex_unlock(&log_lock);
+}
+
+// fake_nginx returns once its master wrote the pid file
+static void ensure_master(void) {
+    NginxProcesses processes;
+    nginx_processes_read(pid_file, &processes);
+    gint master = processes.master;
+    nginx_processes_clear(&processes);
+    if (master) return;
+
+    gchar *argv[] = { (gchar *)g_getenv("NGINXUI_HELPER_NGINX"), NULL };
+    gint status = -1;
+    GError *error = NULL;
+    g_assert_true(g_spawn_sync(NULL, argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, NULL, NULL, &status, &error));
+    g_assert_no_error(error);
+    // A wait status of 0 is exit status 0
+    g_assert_cmpint(status, ==, 0);
+}
+
+static void stop_master(void) {
+    NginxProcesses processes;
+    nginx_processes_read(pid_file, &processes);
+    if (processes.master) kill(processes.master, SIGTERM);
+    nginx_processes_clear(&processes);
+    // The master removes its pid file last
+    for (guint i = 0; i < 500 && g_file_test(pid_file, G_FILE_TEST_EXISTS); i++) {
+        g_usleep(10 * 1000);
+    }
+}
+
+static void read_running(NginxProcesses *processes) {
+    nginx_processes_read(pid_file, processes);
+    g_assert_cmpint(processes->master, >, 0);
+    g_assert_cmpuint(processes->workers->len, >, 0);
+}
+
+static void test_confirmed(void) {
+    ensure_master();
+    set_reload_mode("accept");
+    NginxProcesses before;
+    read_running(&before);
+
+    GError *error = NULL;
+    g_assert_true(nginx_reload_run(core, &error));
+    g_assert_no_error(error);
+    g_assert_true(log_contains("new of"));
+
+    // Same master with new workers; the old ones may still be stopping
+    NginxProcesses after;
+    read_running(&after);
+    g_assert_cmpint(after.master, ==, before.master);
+    guint n_new = 0;
+    for (guint i = 0; i < after.workers->len; i++) {
+        gboolean known = FALSE;
+        for (guint j = 0; j < before.workers->len; j++) {
+            known = known || g_array_index(after.workers, gint, i) == g_array_index(before.workers, gint, j);
+        }
+        if (!known) n_new++;
+    }
+    g_assert_cmpuint(n_new, >, 0);
+    nginx_processes_clear(&after);
+    nginx_processes_clear(&before);
+}
+
+// The master keeps its workers, so the reload times out and the change
+// set puts the file back, leaving the hosts file alone
+static void test_rejected(void) {
+    ensure_master();
+    gchar *path = nginx_core_get_path(core, "site.conf");
+    const gchar *original = "server {\n    listen 80;\n    server_name old.test;\n}\n";
+    const gchar *staged = "server {\n    listen 80;\n    server_name new.test;\n}\n";
+    g_assert_true(g_file_set_contents(path, original, -1, NULL));
+    g_assert_cmpint(g_chmod(path, 0640), ==, 0);
+    set_reload_mode("reject");
+
+    ChangeSet *set = change_set_new(core);
+    GError *error = NULL;
+    g_assert_true(change_set_write(set, "site.conf", staged, strlen(staged), &error));
+    g_assert_no_error(error);
+    g_assert_cmpint(change_set_apply(set, CHANGE_SET_TEST | CHANGE_SET_RELOAD | CHANGE_SET_HOSTS), ==,
+                    CHANGE_SET_ROLLED_BACK);
+    change_set_free(set);
+    g_assert_true(log_contains("Configuration test passed"));
+    g_assert_true(log_contains("started no new workers"));
+
+    gchar *content = NULL;
+    g_assert_true(g_file_get_contents(path, &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, original);
+    GStatBuf st;
+    g_assert_cmpint(g_stat(path, &st), ==, 0);
+    g_assert_cmpuint(st.st_mode & 07777, ==, 0640);
+    g_free(content);
+    g_assert_true(g_file_get_contents(core->hosts_file, &content, NULL, NULL));
+    g_assert_null(strstr(content, "new.test"));
+    g_free(content);
+
+    g_unlink(path);
+    g_free(path);
+}
+
+static void test_replaced(void) {
+    ensure_master();
+    set_reload_mode("replace");
+    NginxProcesses before;
+    read_running(&before);
+
+    GError *error = NULL;
+    g_assert_false(nginx_reload_run(core, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED);
+    g_assert_nonnull(strstr(error->message, "was replaced"));
+    g_clear_error(&error);
+
+    NginxProcesses after;
+    read_running(&after);
+    g_assert_cmpint(after.master, !=, before.master);
+    nginx_processes_clear(&after);
+    nginx_processes_clear(&before);
+}
+
+static void test_exited(void) {
+    ensure_master();
+    set_reload_mode("exit");
+
+    GError *error = NULL;
+    g_assert_false(nginx_reload_run(core, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED);
+    g_assert_nonnull(strstr(error->message, "exited"));
+    g_clear_error(&error);
+
+    NginxProcesses after;
+    nginx_processes_read(pid_file, &after);
+    g_assert_cmpint(after.master, ==, 0);
+    nginx_processes_clear(&after);
+}
+
+typedef struct {
+    ReloadScheduler *scheduler;
+    GMainLoop *loop;
+    guint n_started;
+    guint n_done;
+    guint n_requests[2];
+    gboolean reloaded[2];
+    gint64 done_at[2];
+} SchedulerRun;
+
+static void on_scheduled_reload_started(guint n_requests, gpointer user_data) {
+    SchedulerRun *run = user_data;
+    g_assert_cmpuint(n_requests, >, 0);
+    // One reload at a time
+    g_assert_cmpuint(run->n_started, ==, run->n_done);
+    run->n_started++;
+}
+
+static void on_scheduled_reload(gboolean reloaded, guint n_requests, const GError *error, gpointer user_data) {
+    SchedulerRun *run = user_data;
+    g_assert_no_error(error);
+    g_assert_cmpuint(run->n_done, <, 2);
+    run->reloaded[run->n_done] = reloaded;
+    run->n_requests[run->n_done] = n_requests;
+    run->done_at[run->n_done] = g_get_monotonic_time();
+    if (++run->n_done == 1) {
+        // Right after a reload these wait out the minimum interval
+        reload_scheduler_request(run->scheduler);
+        reload_scheduler_request(run->scheduler);
+    } else {
+        g_main_loop_quit(run->loop);
+    }
+}
+
+static gboolean on_scheduler_timeout(gpointer user_data) {
+    SchedulerRun *run = user_data;
+    g_main_loop_quit(run->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void test_scheduler(void) {
+    ensure_master();
+    set_reload_mode("accept");
+
+    SchedulerRun run = { 0 };
+    run.loop = g_main_loop_new(NULL, FALSE);
+    run.scheduler = reload_scheduler_new(core, SCHEDULER_WINDOW_MS, SCHEDULER_INTERVAL_MS,
+                                         on_scheduled_reload_started, on_scheduled_reload, &run);
+    guint timeout_id = g_timeout_add(SCHEDULER_TIMEOUT_MS, on_scheduler_timeout, &run);
+
+    // Three requests within the window make one reload
+    gint64 started = g_get_monotonic_time();
+    reload_scheduler_request(run.scheduler);
+    reload_scheduler_request(run.scheduler);
+    reload_scheduler_request(run.scheduler);
+    g_main_loop_run(run.loop);
+    g_source_remove(timeout_id);
+
+    g_assert_cmpuint(run.n_started, ==, 2);
+    g_assert_cmpuint(run.n_done, ==, 2);
+    g_assert_true(run.reloaded[0]);
+    g_assert_true(run.reloaded[1]);
+    g_assert_cmpuint(run.n_requests[0], ==, 3);
+    g_assert_cmpuint(run.n_requests[1], ==, 2);
+    g_assert_cmpint(run.done_at[0] - started, >=, SCHEDULER_WINDOW_MS * (gint64)1000);
+    // The first reload started after the window, the second no sooner
+    // than the interval after it
+    g_assert_cmpint(run.done_at[1] - started, >=, (SCHEDULER_WINDOW_MS + SCHEDULER_INTERVAL_MS) * (gint64)1000);
+
+    reload_scheduler_free(run.scheduler);
+    g_main_loop_unref(run.loop);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    // As root the helper ignores NGINXUI_HELPER_NGINX and would reload
+    // the real nginx
+    if (geteuid() == 0) {
+        g_printerr("reload_test: the helper ignores the environment as root, skipping\n");
+        return SKIP_EXIT_CODE;
+    }
+    if (!g_getenv("NGINXUI_HELPER_NGINX")) {
+        g_printerr("reload_test: NGINXUI_HELPER_NGINX must name fake_nginx\n");
+        return 1;
+    }
+
+    GError *error = NULL;
+    gchar *dir = g_dir_make_tmp("nginxui-reload-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    // The helper compares canonical paths
+    scratch_dir = g_canonicalize_filename(dir, "/");
+    g_free(dir);
+    gchar *allow = g_strconcat(scratch_dir, "/", NULL);
+    g_setenv("NGINXUI_HELPER_ALLOW", allow, TRUE);
+    g_setenv("NGINXUI_HELPER_LAUNCHER", "none", TRUE);
+    g_setenv("NGINXUI_FAKE_NGINX_DIR", scratch_dir, TRUE);
+    g_free(allow);
+
+    // The pid directive is relative to the main config, as nginx reads it
+    gchar *main_conf = g_build_filename(scratch_dir, "nginx.conf", NULL);
+    gchar *conf_dir = g_build_filename(scratch_dir, "conf.d", NULL);
+    gchar *hosts_file = g_build_filename(scratch_dir, "hosts", NULL);
+    g_assert_true(g_file_set_contents(main_conf, "pid nginx.pid;\nevents {}\nhttp {\n    include conf.d/*.conf;\n}\n",
+                                      -1, NULL));
+    g_assert_cmpint(g_mkdir(conf_dir, 0755), ==, 0);
+    g_assert_true(g_file_set_contents(hosts_file, "127.0.0.1 localhost\n", -1, NULL));
+    pid_file = nginx_reload_find_pid_file(main_conf);
+    gchar *expected_pid_file = g_build_filename(scratch_dir, "nginx.pid", NULL);
+    g_assert_cmpstr(pid_file, ==, expected_pid_file);
+    g_free(expected_pid_file);
+
+    log_text = g_string_new(NULL);
+    core = nginx_core_new(main_conf, conf_dir, hosts_file, on_log, NULL);
+
+    g_test_add_func("/reload/confirmed", test_confirmed);
+    g_test_add_func("/reload/rejected", test_rejected);
+    g_test_add_func("/reload/replaced", test_replaced);
+    g_test_add_func("/reload/exited", test_exited);
+    g_test_add_func("/reload/scheduler", test_scheduler);
+    gint status = g_test_run();
+
+    stop_master();
+    nginx_core_free(core);
+    g_string_free(log_text, TRUE);
+    gchar *mode_file = g_build_filename(scratch_dir, "reload-mode", NULL);
+    g_unlink(mode_file);
+    g_free(mode_file);
+    g_unlink(main_conf);
+    g_unlink(hosts_file);
+    g_rmdir(conf_dir);
+    g_rmdir(scratch_dir);
+    g_free(hosts_file);
+    g_free(conf_dir);
+    g_free(main_conf);
+    g_free(pid_file);
+    g_free(scratch_dir);
+    return status;
+}